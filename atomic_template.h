@@ -0,0 +1,237 @@
+/*
+ * Atomic read-modify-write helpers on guest memory
+ *
+ * Generate the helpers behind tcg_gen_atomic_*, for one access size and
+ * one endianness of the guest memory (big endian if ATOMIC_BE is defined).
+ *
+ * Included from user-exec.c and cputlb.c.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define DATA_SIZE (1 << SHIFT)
+
+#if DATA_SIZE == 8
+#define SUFFIX     q
+#define USUFFIX    q
+#define DATA_TYPE  uint64_t
+#define BSWAP      bswap64
+#elif DATA_SIZE == 4
+#define SUFFIX     l
+#define USUFFIX    ul
+#define DATA_TYPE  uint32_t
+#define BSWAP      bswap32
+#elif DATA_SIZE == 2
+#define SUFFIX     w
+#define USUFFIX    uw
+#define DATA_TYPE  uint16_t
+#define BSWAP      bswap16
+#elif DATA_SIZE == 1
+#define SUFFIX     b
+#define USUFFIX    ub
+#define DATA_TYPE  uint8_t
+#define BSWAP
+#else
+#error unsupported data size
+#endif
+
+#if DATA_SIZE == 8
+#define ABI_TYPE   uint64_t
+#else
+#define ABI_TYPE   uint32_t
+#endif
+
+#if DATA_SIZE == 1
+#define END
+#elif defined(ATOMIC_BE)
+#define END        _be
+#else
+#define END        _le
+#endif
+
+/* Build the name in this order, so that no partial name is one of the
+   atomic_* macros of qemu/atomic.h.  */
+#define ATOMIC_NAME(X) \
+    HELPER(glue(glue(atomic_, glue(X, SUFFIX)), END))
+
+#ifdef CONFIG_USER_ONLY
+
+/* The guest memory is host memory: use the host atomic instructions, so
+   that vCPU threads only contend where the guest itself does.  A fault
+   is reported against the guest instruction through helper_retaddr.  */
+
+#if DATA_SIZE > 1 && defined(ATOMIC_BE) != defined(HOST_WORDS_BIGENDIAN)
+#define ATOMIC_SWAP(x) BSWAP(x)
+#else
+#define ATOMIC_SWAP(x) (x)
+#endif
+
+ABI_TYPE ATOMIC_NAME(cmpxchg)(CPUArchState *env, target_ulong addr,
+                              ABI_TYPE cmpv, ABI_TYPE newv, uint32_t mmu_idx)
+{
+    DATA_TYPE *haddr = atomic_mmu_lookup(env, addr, GETPC());
+    DATA_TYPE ret;
+
+    ret = atomic_cmpxchg(haddr, (DATA_TYPE)ATOMIC_SWAP((DATA_TYPE)cmpv),
+                         (DATA_TYPE)ATOMIC_SWAP((DATA_TYPE)newv));
+    tls_var(helper_retaddr) = 0;
+    return ATOMIC_SWAP(ret);
+}
+
+ABI_TYPE ATOMIC_NAME(xchg)(CPUArchState *env, target_ulong addr,
+                           ABI_TYPE val, uint32_t mmu_idx)
+{
+    DATA_TYPE *haddr = atomic_mmu_lookup(env, addr, GETPC());
+    DATA_TYPE ret;
+
+    ret = atomic_xchg(haddr, (DATA_TYPE)ATOMIC_SWAP((DATA_TYPE)val));
+    tls_var(helper_retaddr) = 0;
+    return ATOMIC_SWAP(ret);
+}
+
+/* Bitwise operations do not care about the byte order.  */
+#define GEN_ATOMIC_HELPER(X)                                            \
+ABI_TYPE ATOMIC_NAME(X)(CPUArchState *env, target_ulong addr,           \
+                        ABI_TYPE val, uint32_t mmu_idx)                 \
+{                                                                       \
+    DATA_TYPE *haddr = atomic_mmu_lookup(env, addr, GETPC());           \
+    DATA_TYPE ret;                                                      \
+                                                                        \
+    ret = atomic_##X(haddr, (DATA_TYPE)ATOMIC_SWAP((DATA_TYPE)val));    \
+    tls_var(helper_retaddr) = 0;                                        \
+    return ATOMIC_SWAP(ret);                                            \
+}
+
+GEN_ATOMIC_HELPER(fetch_and)
+GEN_ATOMIC_HELPER(fetch_or)
+GEN_ATOMIC_HELPER(fetch_xor)
+GEN_ATOMIC_HELPER(and_fetch)
+GEN_ATOMIC_HELPER(or_fetch)
+GEN_ATOMIC_HELPER(xor_fetch)
+
+#undef GEN_ATOMIC_HELPER
+
+/* Additions carry across bytes: with the other byte order, loop on a
+   compare-and-swap of the byte-swapped values.  */
+#if DATA_SIZE > 1 && defined(ATOMIC_BE) != defined(HOST_WORDS_BIGENDIAN)
+#define GEN_ATOMIC_HELPER(X, RET)                                       \
+ABI_TYPE ATOMIC_NAME(X)(CPUArchState *env, target_ulong addr,           \
+                        ABI_TYPE val, uint32_t mmu_idx)                 \
+{                                                                       \
+    DATA_TYPE *haddr = atomic_mmu_lookup(env, addr, GETPC());           \
+    DATA_TYPE ldo, ldn, old, new;                                       \
+                                                                        \
+    ldn = atomic_read(haddr);                                           \
+    do {                                                                \
+        ldo = ldn;                                                      \
+        old = BSWAP(ldo);                                               \
+        new = old + val;                                                \
+        ldn = atomic_cmpxchg(haddr, ldo, (DATA_TYPE)BSWAP(new));        \
+    } while (ldn != ldo);                                               \
+    tls_var(helper_retaddr) = 0;                                        \
+    return RET;                                                         \
+}
+#else
+#define GEN_ATOMIC_HELPER(X, RET)                                       \
+ABI_TYPE ATOMIC_NAME(X)(CPUArchState *env, target_ulong addr,           \
+                        ABI_TYPE val, uint32_t mmu_idx)                 \
+{                                                                       \
+    DATA_TYPE *haddr = atomic_mmu_lookup(env, addr, GETPC());           \
+    DATA_TYPE ret;                                                      \
+                                                                        \
+    ret = atomic_##X(haddr, (DATA_TYPE)val);                            \
+    tls_var(helper_retaddr) = 0;                                        \
+    return ret;                                                         \
+}
+#endif
+
+GEN_ATOMIC_HELPER(fetch_add, old)
+GEN_ATOMIC_HELPER(add_fetch, new)
+
+#undef GEN_ATOMIC_HELPER
+#undef ATOMIC_SWAP
+
+#else /* !CONFIG_USER_ONLY */
+
+/* Go through the softmmu helpers under cpu_atomic_lock, so that the
+   atomic sequences of the vCPUs are serialized against each other, as
+   the LOCK prefix and store-exclusive were before.  */
+
+#if DATA_SIZE == 1
+#define ATOMIC_LD  helper_ret_ldub_mmu
+#define ATOMIC_ST  helper_ret_stb_mmu
+#elif defined(ATOMIC_BE)
+#define ATOMIC_LD  glue(glue(helper_be_ld, USUFFIX), _mmu)
+#define ATOMIC_ST  glue(glue(helper_be_st, SUFFIX), _mmu)
+#else
+#define ATOMIC_LD  glue(glue(helper_le_ld, USUFFIX), _mmu)
+#define ATOMIC_ST  glue(glue(helper_le_st, SUFFIX), _mmu)
+#endif
+
+ABI_TYPE ATOMIC_NAME(cmpxchg)(CPUArchState *env, target_ulong addr,
+                              ABI_TYPE cmpv, ABI_TYPE newv, uint32_t mmu_idx)
+{
+    uintptr_t retaddr = GETRA();
+    DATA_TYPE ret;
+
+    cpu_atomic_lock();
+    ret = ATOMIC_LD(env, addr, mmu_idx, retaddr);
+    /* always do the store, so that a read-only page faults either way */
+    ATOMIC_ST(env, addr, ret == (DATA_TYPE)cmpv ? newv : ret,
+              mmu_idx, retaddr);
+    cpu_atomic_unlock();
+    return ret;
+}
+
+#define GEN_ATOMIC_HELPER(X, NEW, RET)                                  \
+ABI_TYPE ATOMIC_NAME(X)(CPUArchState *env, target_ulong addr,           \
+                        ABI_TYPE val, uint32_t mmu_idx)                 \
+{                                                                       \
+    uintptr_t retaddr = GETRA();                                        \
+    DATA_TYPE old, new;                                                 \
+                                                                        \
+    cpu_atomic_lock();                                                  \
+    old = ATOMIC_LD(env, addr, mmu_idx, retaddr);                       \
+    new = NEW;                                                          \
+    ATOMIC_ST(env, addr, new, mmu_idx, retaddr);                        \
+    cpu_atomic_unlock();                                                \
+    return RET;                                                         \
+}
+
+GEN_ATOMIC_HELPER(xchg, val, old)
+GEN_ATOMIC_HELPER(fetch_add, old + val, old)
+GEN_ATOMIC_HELPER(fetch_and, old & val, old)
+GEN_ATOMIC_HELPER(fetch_or, old | val, old)
+GEN_ATOMIC_HELPER(fetch_xor, old ^ val, old)
+GEN_ATOMIC_HELPER(add_fetch, old + val, new)
+GEN_ATOMIC_HELPER(and_fetch, old & val, new)
+GEN_ATOMIC_HELPER(or_fetch, old | val, new)
+GEN_ATOMIC_HELPER(xor_fetch, old ^ val, new)
+
+#undef GEN_ATOMIC_HELPER
+#undef ATOMIC_LD
+#undef ATOMIC_ST
+
+#endif /* CONFIG_USER_ONLY */
+
+#undef ATOMIC_NAME
+#undef END
+#undef ABI_TYPE
+#undef BSWAP
+#undef DATA_TYPE
+#undef USUFFIX
+#undef SUFFIX
+#undef DATA_SIZE
+#undef SHIFT
+#undef ATOMIC_BE
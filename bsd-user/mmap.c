@@ -48,6 +48,14 @@ void mmap_unlock(void)
     }
 }
 
+void mmap_lock_reset(void)
+{
+    if (mmap_lock_count) {
+        mmap_lock_count = 0;
+        pthread_mutex_unlock(&mmap_mutex);
+    }
+}
+
 /* Grab lock to make sure things are in a consistent state after fork().  */
 void mmap_fork_start(void)
 {
@@ -72,6 +80,10 @@ void mmap_lock(void)
 void mmap_unlock(void)
 {
 }
+
+void mmap_lock_reset(void)
+{
+}
 #endif
 
 /* NOTE: all the constants are the HOST ones, but addresses are target. */
@@ -217,8 +229,7 @@ unsigned long last_brk;
    to use them. */
 static abi_ulong mmap_find_vma(abi_ulong start, abi_ulong size)
 {
-    abi_ulong addr, addr1, addr_start;
-    int prot;
+    abi_ulong addr, addr_start;
     unsigned long new_brk;
 
     new_brk = (unsigned long)sbrk(0);
@@ -240,17 +251,16 @@ static abi_ulong mmap_find_vma(abi_ulong start, abi_ulong size)
     if (addr == 0)
         addr = mmap_next_start;
     addr_start = addr;
-    for(;;) {
-        prot = 0;
-        for(addr1 = addr; addr1 < (addr + size); addr1 += TARGET_PAGE_SIZE) {
-            prot |= page_get_flags(addr1);
-        }
-        if (prot == 0)
-            break;
-        addr += qemu_host_page_size;
+    addr = page_find_range_empty(addr_start, (abi_ulong)-1, size,
+                                 qemu_host_page_size);
+    if (addr == (abi_ulong)-1 && addr_start != 0) {
+        /* wrap around to the bottom of the address space */
+        addr = page_find_range_empty(0, (abi_ulong)-1, size,
+                                     qemu_host_page_size);
+    }
+    if (addr == (abi_ulong)-1) {
         /* we found nothing */
-        if (addr == addr_start)
-            return (abi_ulong)-1;
+        return (abi_ulong)-1;
     }
     if (start == 0)
         mmap_next_start = addr + size;
@@ -24,6 +24,8 @@
 #include "qemu/atomic.h"
 #include "sysemu/qtest.h"
 #include "qemu/timer.h"
+#include "qemu/main-loop.h"
+#include "exec/helper-proto.h"
 
 /* -icount align implementation. */
 
@@ -219,58 +221,92 @@ static void cpu_exec_nocache(CPUArchState *env, int max_cycles,
     tb_free(tb);
 }
 
+struct tb_desc {
+    CPUArchState *env;
+    target_ulong pc;
+    target_ulong cs_base;
+    uint64_t flags;
+    tb_page_addr_t phys_page1;
+};
+
+static bool tb_cmp(const void *p, const void *d)
+{
+    const TranslationBlock *tb = p;
+    const struct tb_desc *desc = d;
+
+    if (tb->pc == desc->pc &&
+        tb->page_addr[0] == desc->phys_page1 &&
+        tb->cs_base == desc->cs_base &&
+        tb->flags == desc->flags) {
+        /* check next page if needed */
+        if (tb->page_addr[1] == -1) {
+            return true;
+        } else {
+            tb_page_addr_t phys_page2;
+            target_ulong virt_page2;
+
+            virt_page2 = (desc->pc & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
+            phys_page2 = get_page_addr_code(desc->env, virt_page2);
+            if (tb->page_addr[1] == phys_page2) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* find translated block using physical mappings */
+static TranslationBlock *tb_htable_lookup(CPUArchState *env,
+                                          target_ulong pc,
+                                          target_ulong cs_base,
+                                          uint64_t flags)
+{
+    tb_page_addr_t phys_pc;
+    struct tb_desc desc;
+
+    phys_pc = get_page_addr_code(env, pc);
+    desc.env = env;
+    desc.pc = pc;
+    desc.cs_base = cs_base;
+    desc.flags = flags;
+    desc.phys_page1 = phys_pc & TARGET_PAGE_MASK;
+    return qht_lookup(&tb_ctx.htable, tb_cmp, &desc,
+                      tb_hash_func(phys_pc, pc, flags));
+}
+
 static TranslationBlock *tb_find_slow(CPUArchState *env,
                                       target_ulong pc,
                                       target_ulong cs_base,
                                       uint64_t flags)
 {
     CPUState *cpu = ENV_GET_CPU(env);
-    TranslationBlock *tb, **ptb1;
-    unsigned int h;
-    tb_page_addr_t phys_pc, phys_page1;
-    target_ulong virt_page2;
-
-    tcg_ctx.tb_ctx.tb_invalidated_flag = 0;
-
-    /* find translated block using physical mappings */
-    phys_pc = get_page_addr_code(env, pc);
-    phys_page1 = phys_pc & TARGET_PAGE_MASK;
-    h = tb_phys_hash_func(phys_pc);
-    ptb1 = &tcg_ctx.tb_ctx.tb_phys_hash[h];
-    for(;;) {
-        tb = *ptb1;
-        if (!tb)
-            goto not_found;
-        if (tb->pc == pc &&
-            tb->page_addr[0] == phys_page1 &&
-            tb->cs_base == cs_base &&
-            tb->flags == flags) {
-            /* check next page if needed */
-            if (tb->page_addr[1] != -1) {
-                tb_page_addr_t phys_page2;
-
-                virt_page2 = (pc & TARGET_PAGE_MASK) +
-                    TARGET_PAGE_SIZE;
-                phys_page2 = get_page_addr_code(env, virt_page2);
-                if (tb->page_addr[1] == phys_page2)
-                    goto found;
+    TranslationBlock *tb, *new_tb;
+
+    tb = tb_htable_lookup(env, pc, cs_base, flags);
+    if (!tb) {
+        /* if no translated code available, then translate it now,
+           outside of the locks if this thread has a code region of its
+           own.  Look again under the lock as another vCPU may have just
+           done so.  tb_gen_code needs the mmap lock too, and
+           page_unprotect takes it first.  */
+        new_tb = tb_gen_code_parallel(cpu, pc, cs_base, flags);
+        mmap_lock();
+        tb_lock();
+        tb = tb_htable_lookup(env, pc, cs_base, flags);
+        if (!tb) {
+            tb_ctx.tb_invalidated_flag = 0;
+            if (new_tb && tb_publish(cpu, new_tb)) {
+                tb = new_tb;
             } else {
-                goto found;
+                tb = tb_gen_code(cpu, pc, cs_base, flags, 0);
             }
+        } else if (new_tb) {
+            tb_ctx.tb_parallel_drop_count++;
         }
-        ptb1 = &tb->phys_hash_next;
-    }
- not_found:
-   /* if no translated code available, then translate it now */
-    tb = tb_gen_code(cpu, pc, cs_base, flags, 0);
-
- found:
-    /* Move the last found TB to the head of the list */
-    if (likely(*ptb1)) {
-        *ptb1 = tb->phys_hash_next;
-        tb->phys_hash_next = tcg_ctx.tb_ctx.tb_phys_hash[h];
-        tcg_ctx.tb_ctx.tb_phys_hash[h] = tb;
+        tb_unlock();
+        mmap_unlock();
     }
+
     /* we add the TB in the virtual pc hash table */
     cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)] = tb;
     return tb;
@@ -295,6 +331,38 @@ static inline TranslationBlock *tb_find_fast(CPUArchState *env)
     return tb;
 }
 
+/* Called by the code of tcg_gen_lookup_and_goto_ptr at the end of a TB:
+   return the host code of the TB that cpu_exec would run next, or the
+   epilogue if it is not translated yet.  Translation is left to cpu_exec,
+   so that code_gen_buffer never changes under the running TB.  */
+void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+{
+    CPUState *cpu = ENV_GET_CPU(env);
+    TranslationBlock *tb;
+    target_ulong cs_base, pc;
+    int flags;
+    unsigned int h;
+
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    h = tb_jmp_cache_hash_func(pc);
+    tb = cpu->tb_jmp_cache[h];
+    if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
+                 tb->flags != flags)) {
+        tb = tb_htable_lookup(env, pc, cs_base, flags);
+        if (!tb) {
+            cpu->tb_lookup_miss_count++;
+            return tcg_ctx.code_gen_epilogue;
+        }
+        cpu->tb_jmp_cache[h] = tb;
+    }
+    cpu->tb_lookup_hit_count++;
+    if (qemu_loglevel_mask(CPU_LOG_EXEC)) {
+        qemu_log("Trace %p [" TARGET_FMT_lx "] %s\n",
+                 tb->tc_ptr, tb->pc, lookup_symbol(tb->pc));
+    }
+    return tb->tc_ptr;
+}
+
 static void cpu_handle_debug_exception(CPUArchState *env)
 {
     CPUState *cpu = ENV_GET_CPU(env);
@@ -310,6 +378,72 @@ static void cpu_handle_debug_exception(CPUArchState *env)
     cc->debug_excp_handler(cpu);
 }
 
+/* Guest atomic sequences are only serialized against each other; plain
+   stores from other vCPUs are not excluded.  linux-user uses host atomic
+   instructions instead, and only needs this for what they cannot do
+   (e.g. cmpxchg16b).  */
+static spinlock_t cpu_atomic_spinlock = SPIN_LOCK_UNLOCKED;
+static DEFINE_TLS(bool, have_cpu_atomic_lock);
+
+void cpu_atomic_lock(void)
+{
+    spin_lock(&cpu_atomic_spinlock);
+    tls_var(have_cpu_atomic_lock) = true;
+}
+
+void cpu_atomic_unlock(void)
+{
+    tls_var(have_cpu_atomic_lock) = false;
+    spin_unlock(&cpu_atomic_spinlock);
+}
+
+/* An atomic sequence may fault half way (e.g. a page fault on the store
+   of a LOCK-prefixed instruction); drop the lock after the longjmp.  */
+void cpu_atomic_lock_reset(void)
+{
+    if (tls_var(have_cpu_atomic_lock)) {
+        cpu_atomic_unlock();
+    }
+}
+
+#if !defined(CONFIG_USER_ONLY)
+/* With one thread per vCPU, cpu_exec runs without the iothread lock;
+   interrupt processing touches device state (PIC, APIC, ...) and has to
+   take it.  In single-threaded mode the lock is already held.  */
+static inline void cpu_exec_lock_iothread(void)
+{
+    if (parallel_cpus) {
+        qemu_mutex_lock_iothread();
+    }
+}
+
+static inline void cpu_exec_unlock_iothread(void)
+{
+    if (parallel_cpus) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
+static inline void cpu_exec_reset_iothread(void)
+{
+    if (parallel_cpus && qemu_mutex_iothread_locked()) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+#else
+static inline void cpu_exec_lock_iothread(void)
+{
+}
+
+static inline void cpu_exec_unlock_iothread(void)
+{
+}
+
+static inline void cpu_exec_reset_iothread(void)
+{
+}
+#endif
+
 /* main execution loop */
 
 volatile sig_atomic_t exit_request;
@@ -327,9 +461,6 @@ int cpu_exec(CPUArchState *env)
     uintptr_t next_tb;
     SyncClocks sc;
 
-    /* This must be volatile so it is not trashed by longjmp() */
-    volatile bool have_tb_lock = false;
-
     if (cpu->halted) {
         if (!cpu_has_work(cpu)) {
             return EXCP_HALTED;
@@ -395,6 +526,8 @@ int cpu_exec(CPUArchState *env)
             for(;;) {
                 interrupt_request = cpu->interrupt_request;
                 if (unlikely(interrupt_request)) {
+                    cpu_exec_lock_iothread();
+                    interrupt_request = cpu->interrupt_request;
                     if (unlikely(cpu->singlestep_enabled & SSTEP_NOIRQ)) {
                         /* Mask out external interrupts for this step. */
                         interrupt_request &= ~CPU_INTERRUPT_SSTEP_MASK;
@@ -437,24 +570,21 @@ int cpu_exec(CPUArchState *env)
                            the program flow was changed */
                         next_tb = 0;
                     }
+                    cpu_exec_unlock_iothread();
                 }
                 if (unlikely(cpu->exit_request)) {
                     cpu->exit_request = 0;
+#if !defined(CONFIG_USER_ONLY)
+                    if (cpu->profile_request) {
+                        guest_profile_sample(cpu);
+                    }
+#endif
                     cpu->exception_index = EXCP_INTERRUPT;
                     cpu_loop_exit(cpu);
                 }
-                spin_lock(&tcg_ctx.tb_ctx.tb_lock);
-                have_tb_lock = true;
+                /* the lookup itself is lock-free; tb_lock is only taken
+                   to translate a missing TB or to patch a jump */
                 tb = tb_find_fast(env);
-                /* Note: we do it here to avoid a gcc bug on Mac OS X when
-                   doing it in tb_find_slow */
-                if (tcg_ctx.tb_ctx.tb_invalidated_flag) {
-                    /* as some TB could have been invalidated because
-                       of memory exceptions while generating the code, we
-                       must recompute the hash index here */
-                    next_tb = 0;
-                    tcg_ctx.tb_ctx.tb_invalidated_flag = 0;
-                }
                 if (qemu_loglevel_mask(CPU_LOG_EXEC)) {
                     qemu_log("Trace %p [" TARGET_FMT_lx "] %s\n",
                              tb->tc_ptr, tb->pc, lookup_symbol(tb->pc));
@@ -463,11 +593,29 @@ int cpu_exec(CPUArchState *env)
                    spans two pages, we cannot safely do a direct
                    jump. */
                 if (next_tb != 0 && tb->page_addr[1] == -1) {
-                    tb_add_jump((TranslationBlock *)(next_tb & ~TB_EXIT_MASK),
-                                next_tb & TB_EXIT_MASK, tb);
+                    mmap_lock();
+                    tb_lock();
+                    /* Note: we do it here to avoid a gcc bug on Mac OS X
+                       when doing it in tb_find_slow */
+                    if (tb_ctx.tb_invalidated_flag) {
+                        /* as some TB could have been invalidated because
+                           of memory exceptions while generating the code,
+                           we must recompute the hash index here */
+                        tb_ctx.tb_invalidated_flag = 0;
+                    } else if (tb_is_live((TranslationBlock *)
+                                          (next_tb & ~TB_EXIT_MASK)) &&
+                               tb_is_live(tb) &&
+                               !tb_trace_profile(cpu, (TranslationBlock *)
+                                                 (next_tb & ~TB_EXIT_MASK),
+                                                 next_tb & TB_EXIT_MASK,
+                                                 &tb)) {
+                        tb_add_jump((TranslationBlock *)
+                                    (next_tb & ~TB_EXIT_MASK),
+                                    next_tb & TB_EXIT_MASK, tb);
+                    }
+                    tb_unlock();
+                    mmap_unlock();
                 }
-                have_tb_lock = false;
-                spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
 
                 /* cpu_interrupt might be called while translating the
                    TB, but before it is linked into a potentially
@@ -540,10 +688,10 @@ int cpu_exec(CPUArchState *env)
 #ifdef TARGET_I386
             x86_cpu = X86_CPU(cpu);
 #endif
-            if (have_tb_lock) {
-                spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
-                have_tb_lock = false;
-            }
+            tb_lock_reset();
+            mmap_lock_reset();
+            cpu_atomic_lock_reset();
+            cpu_exec_reset_iothread();
         }
     } /* for(;;) */
 
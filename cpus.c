@@ -41,6 +41,8 @@
 #include "qemu/seqlock.h"
 #include "qapi-event.h"
 #include "hw/nmi.h"
+#include "tcg.h"
+#include "tcg/perf.h"
 
 #ifndef _WIN32
 #include "qemu/compatfd.h"
@@ -548,6 +550,44 @@ void configure_icount(QemuOpts *opts, Error **errp)
                    get_ticks_per_sec() / 10);
 }
 
+void configure_tcg(QemuOpts *opts, Error **errp)
+{
+    const char *thread = qemu_opt_get(opts, "thread");
+    const char *perf;
+
+    if (!thread || !strcmp(thread, "single")) {
+        parallel_cpus = false;
+    } else if (!strcmp(thread, "multi")) {
+#ifndef __linux__
+        /* current_cpu and friends are only thread-local on Linux hosts */
+        error_setg(errp, "tcg: thread=multi is not supported on this host");
+        return;
+#endif
+        if (use_icount) {
+            error_setg(errp, "tcg: thread=multi is incompatible with icount");
+            return;
+        }
+        parallel_cpus = true;
+    } else {
+        error_setg(errp, "tcg: Invalid thread value '%s'", thread);
+        return;
+    }
+
+    hot_trace_threshold = qemu_opt_get_number(opts, "hot-trace", 0);
+    if (hot_trace_threshold > UINT16_MAX) {
+        error_setg(errp, "tcg: hot-trace must be at most %d", UINT16_MAX);
+        return;
+    } else if (hot_trace_threshold && use_icount) {
+        error_setg(errp, "tcg: hot-trace is incompatible with icount");
+        return;
+    }
+
+    perf = qemu_opt_get(opts, "perf");
+    if (perf && !perf_enable(perf)) {
+        error_setg(errp, "tcg: Invalid perf value '%s'", perf);
+    }
+}
+
 /***********************************************************/
 void hw_error(const char *fmt, ...)
 {
@@ -643,7 +683,9 @@ static void cpu_signal(int sig)
     if (current_cpu) {
         cpu_exit(current_cpu);
     }
-    exit_request = 1;
+    if (!parallel_cpus) {
+        exit_request = 1;
+    }
 }
 
 #ifdef CONFIG_LINUX
@@ -786,6 +828,18 @@ static void qemu_tcg_init_cpu_signals(void)
 static QemuMutex qemu_global_mutex;
 static QemuCond qemu_io_proceeded_cond;
 static bool iothread_requesting_mutex;
+static DEFINE_TLS(bool, iothread_locked);
+/* vCPU whose "running" state was suspended while it holds the iothread
+   lock from within cpu_exec, see qemu_mutex_lock_iothread */
+static DEFINE_TLS(CPUState *, iothread_paused_cpu);
+
+/* Exclusive sections for multi-threaded TCG.  Everything is protected by
+   qemu_global_mutex: a vCPU counts as running only while it executes guest
+   code without holding the lock.  */
+static QemuCond qemu_exclusive_cond;
+static QemuCond qemu_exclusive_resume;
+static int pending_exclusive;
+static int tcg_running_cpus;
 
 static QemuThread io_thread;
 
@@ -805,11 +859,63 @@ void qemu_init_cpu_loop(void)
     qemu_cond_init(&qemu_pause_cond);
     qemu_cond_init(&qemu_work_cond);
     qemu_cond_init(&qemu_io_proceeded_cond);
+    qemu_cond_init(&qemu_exclusive_cond);
+    qemu_cond_init(&qemu_exclusive_resume);
     qemu_mutex_init(&qemu_global_mutex);
 
     qemu_thread_get_self(&io_thread);
 }
 
+/* Wait for exclusive sections to finish, and mark @cpu as executing
+   guest code.  */
+static void tcg_cpu_exec_start(CPUState *cpu)
+{
+    while (pending_exclusive) {
+        qemu_cond_wait(&qemu_exclusive_resume, &qemu_global_mutex);
+    }
+    cpu->running = true;
+    tcg_running_cpus++;
+}
+
+/* Mark @cpu as not executing guest code, and release a pending exclusive
+   section if it was the last one.  */
+static void tcg_cpu_exec_end(CPUState *cpu)
+{
+    cpu->running = false;
+    if (--tcg_running_cpus == 0 && pending_exclusive) {
+        qemu_cond_broadcast(&qemu_exclusive_cond);
+    }
+}
+
+void start_exclusive(void)
+{
+    CPUState *cpu;
+
+    pending_exclusive++;
+    CPU_FOREACH(cpu) {
+        if (cpu->running) {
+            cpu_exit(cpu);
+        }
+    }
+    while (tcg_running_cpus) {
+        qemu_cond_wait(&qemu_exclusive_cond, &qemu_global_mutex);
+    }
+}
+
+bool cpu_in_exclusive_section(void)
+{
+    return pending_exclusive && !tcg_running_cpus &&
+           qemu_mutex_iothread_locked();
+}
+
+void end_exclusive(void)
+{
+    assert(pending_exclusive);
+    if (--pending_exclusive == 0) {
+        qemu_cond_broadcast(&qemu_exclusive_resume);
+    }
+}
+
 void run_on_cpu(CPUState *cpu, void (*func)(void *data), void *data)
 {
     struct qemu_work_item wi;
@@ -932,6 +1038,7 @@ static void *qemu_kvm_cpu_thread_fn(void *arg)
     int r;
 
     qemu_mutex_lock(&qemu_global_mutex);
+    tls_var(iothread_locked) = true;
     qemu_thread_get_self(cpu->thread);
     cpu->thread_id = qemu_get_thread_id();
     current_cpu = cpu;
@@ -1004,6 +1111,7 @@ static void *qemu_dummy_cpu_thread_fn(void *arg)
 }
 
 static void tcg_exec_all(void);
+static int tcg_cpu_exec(CPUArchState *env);
 
 static void *qemu_tcg_cpu_thread_fn(void *arg)
 {
@@ -1013,6 +1121,7 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
     qemu_thread_get_self(cpu->thread);
 
     qemu_mutex_lock(&qemu_global_mutex);
+    tls_var(iothread_locked) = true;
     CPU_FOREACH(cpu) {
         cpu->thread_id = qemu_get_thread_id();
         cpu->created = true;
@@ -1045,6 +1154,58 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
     return NULL;
 }
 
+static void qemu_tcg_mt_wait_io_event(CPUState *cpu)
+{
+    while (cpu_thread_is_idle(cpu)) {
+        qemu_cond_wait(cpu->halt_cond, &qemu_global_mutex);
+    }
+
+    qemu_wait_io_event_common(cpu);
+}
+
+/* With "-tcg thread=multi" every vCPU gets one of these.  Guest code runs
+   without the iothread lock, which is only taken back for device access,
+   interrupt processing and between calls to cpu_exec.  */
+static void *qemu_tcg_mt_cpu_thread_fn(void *arg)
+{
+    CPUState *cpu = arg;
+    CPUArchState *env = cpu->env_ptr;
+    int r;
+
+    qemu_tcg_init_cpu_signals();
+    qemu_thread_get_self(cpu->thread);
+
+    qemu_mutex_lock(&qemu_global_mutex);
+    tls_var(iothread_locked) = true;
+    cpu->thread_id = qemu_get_thread_id();
+    cpu->created = true;
+    qemu_cond_signal(&qemu_cpu_cond);
+
+    while (1) {
+        if (cpu_can_run(cpu)) {
+            tcg_cpu_exec_start(cpu);
+            tls_var(iothread_locked) = false;
+            qemu_mutex_unlock(&qemu_global_mutex);
+
+            r = tcg_cpu_exec(env);
+
+            qemu_mutex_lock(&qemu_global_mutex);
+            tls_var(iothread_locked) = true;
+            tcg_cpu_exec_end(cpu);
+
+            if (tb_ctx.tb_flush_pending) {
+                tb_flush_pending_work(env);
+            }
+            if (r == EXCP_DEBUG) {
+                cpu_handle_guest_debug(cpu);
+            }
+        }
+        qemu_tcg_mt_wait_io_event(cpu);
+    }
+
+    return NULL;
+}
+
 static void qemu_cpu_kick_thread(CPUState *cpu)
 {
 #ifndef _WIN32
@@ -1087,6 +1248,12 @@ static void qemu_cpu_kick_thread(CPUState *cpu)
 void qemu_cpu_kick(CPUState *cpu)
 {
     qemu_cond_broadcast(cpu->halt_cond);
+    if (tcg_enabled() && parallel_cpus) {
+        /* the vCPU has its own thread, no signal needed to get it out of
+           the generated code */
+        cpu_exit(cpu);
+        return;
+    }
     if (!tcg_enabled() && !cpu->thread_kicked) {
         qemu_cpu_kick_thread(cpu);
         cpu->thread_kicked = true;
@@ -1119,7 +1286,7 @@ static bool qemu_in_vcpu_thread(void)
 
 void qemu_mutex_lock_iothread(void)
 {
-    if (!tcg_enabled()) {
+    if (!tcg_enabled() || parallel_cpus) {
         qemu_mutex_lock(&qemu_global_mutex);
     } else {
         iothread_requesting_mutex = true;
@@ -1130,13 +1297,35 @@ void qemu_mutex_lock_iothread(void)
         iothread_requesting_mutex = false;
         qemu_cond_broadcast(&qemu_io_proceeded_cond);
     }
+    tls_var(iothread_locked) = true;
+
+    /* A vCPU thread taking the lock from guest context (MMIO, interrupts)
+       does not touch TCG state until it drops it again, so it need not
+       hold up exclusive sections meanwhile.  */
+    if (parallel_cpus && current_cpu && current_cpu->running &&
+        qemu_cpu_is_self(current_cpu)) {
+        tls_var(iothread_paused_cpu) = current_cpu;
+        tcg_cpu_exec_end(current_cpu);
+    }
 }
 
 void qemu_mutex_unlock_iothread(void)
 {
+    CPUState *cpu = tls_var(iothread_paused_cpu);
+
+    if (cpu) {
+        tls_var(iothread_paused_cpu) = NULL;
+        tcg_cpu_exec_start(cpu);
+    }
+    tls_var(iothread_locked) = false;
     qemu_mutex_unlock(&qemu_global_mutex);
 }
 
+bool qemu_mutex_iothread_locked(void)
+{
+    return tls_var(iothread_locked);
+}
+
 static int all_vcpus_paused(void)
 {
     CPUState *cpu;
@@ -1162,7 +1351,7 @@ void pause_all_vcpus(void)
 
     if (qemu_in_vcpu_thread()) {
         cpu_stop_current();
-        if (!kvm_enabled()) {
+        if (!kvm_enabled() && !parallel_cpus) {
             CPU_FOREACH(cpu) {
                 cpu->stop = false;
                 cpu->stopped = true;
@@ -1205,6 +1394,24 @@ static void qemu_tcg_init_vcpu(CPUState *cpu)
 
     tcg_cpu_address_space_init(cpu, cpu->as);
 
+    if (parallel_cpus) {
+        cpu->thread = g_malloc0(sizeof(QemuThread));
+        cpu->halt_cond = g_malloc0(sizeof(QemuCond));
+        qemu_cond_init(cpu->halt_cond);
+        snprintf(thread_name, VCPU_THREAD_NAME_SIZE, "CPU %d/TCG",
+                 cpu->cpu_index);
+        qemu_thread_create(cpu->thread, thread_name,
+                           qemu_tcg_mt_cpu_thread_fn,
+                           cpu, QEMU_THREAD_JOINABLE);
+#ifdef _WIN32
+        cpu->hThread = qemu_thread_get_handle(cpu->thread);
+#endif
+        while (!cpu->created) {
+            qemu_cond_wait(&qemu_cpu_cond, &qemu_global_mutex);
+        }
+        return;
+    }
+
     /* share a single thread for all cpus with TCG */
     if (!tcg_cpu_thread) {
         cpu->thread = g_malloc0(sizeof(QemuThread));
@@ -29,6 +29,8 @@
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
 #include "tcg/tcg.h"
+#include "qemu/timer.h"
+#include "exec/helper-proto.h"
 
 //#define DEBUG_TLB
 //#define DEBUG_TLB_CHECK
@@ -36,40 +38,177 @@
 /* statistics */
 int tlb_flush_count;
 
-/* NOTE:
- * If flush_global is true (the usual case), flush all tlb entries.
- * If flush_global is false, flush (at least) all tlb entries not
- * marked global.
- *
- * Since QEMU doesn't currently implement a global/not-global flag
- * for tlb entries, at the moment tlb_flush() will also flush all
- * tlb entries in the flush_global == false case. This is OK because
- * CPU architectures generally permit an implementation to drop
- * entries from the TLB at any time, so flushing more entries than
- * required is only an efficiency issue, not a correctness issue.
- */
-void tlb_flush(CPUState *cpu, int flush_global)
+/* The TLB of each MMU mode is resized on flush according to the largest
+   number of entries it held during the last TLB_WINDOW_NS: it doubles
+   when more than 70% of it was used, and shrinks when less than 30% was
+   used for a whole window, so that guests that flush often do not pay
+   for clearing a big table.  Independently of flushes, tlb_set_page grows
+   a table in place once refills have evicted as many live entries as the
+   table holds, for guests that rarely flush at all.  */
+#define TLB_WINDOW_NS (100 * 1000 * 1000)
+
+/* With -tcg thread=multi, another vCPU may flush our TLB concurrently.
+   Replacing a table is done under tb_lock, which is also taken by the
+   flushes of other vCPUs' TLBs and by cpu_tlb_reset_dirty_all, so that
+   none of them can see a freed table.  */
+static bool tlb_lock_remote(CPUState *cpu)
+{
+    if (parallel_cpus && cpu != current_cpu) {
+        tb_lock();
+        return true;
+    }
+    return false;
+}
+
+static bool tlb_desc_alloc(CPUTLBDesc *desc, size_t n_entries)
+{
+    CPUTLBEntry *table = g_try_new(CPUTLBEntry, n_entries);
+    hwaddr *iotlb = g_try_new(hwaddr, n_entries);
+
+    if (!table || !iotlb) {
+        g_free(table);
+        g_free(iotlb);
+        return false;
+    }
+    g_free(desc->table);
+    g_free(desc->iotlb);
+    desc->table = table;
+    desc->iotlb = iotlb;
+    desc->n_entries = n_entries;
+    return true;
+}
+
+/* Reset the bookkeeping of @desc once its table has been emptied.  */
+static void tlb_desc_clear(CPUTLBDesc *desc)
+{
+    desc->n_used_entries = 0;
+    desc->n_evicted_entries = 0;
+    desc->large_page_addr = -1;
+    desc->large_page_mask = 0;
+    desc->nonglobal_lo = -1;
+    desc->nonglobal_hi = 0;
+}
+
+/* Point the TLB fields of @env used by the fast path at @desc.  */
+static void tlb_desc_load(CPUArchState *env, int mmu_idx, CPUTLBDesc *desc)
+{
+    env->tlb_mask[mmu_idx] = (desc->n_entries - 1) << CPU_TLB_ENTRY_BITS;
+    env->tlb_table[mmu_idx] = desc->table;
+    env->iotlb[mmu_idx] = desc->iotlb;
+}
+
+void tlb_init(CPUState *cpu)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int64_t now = get_clock();
+    int mmu_idx;
+
+    cpu->tlb_d = g_new0(CPUTLBDesc, NB_MMU_MODES);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBDesc *desc = &cpu->tlb_d[mmu_idx];
+
+        if (!tlb_desc_alloc(desc, 1 << CPU_TLB_DYN_DEFAULT_BITS)) {
+            fprintf(stderr, "Could not allocate the softmmu TLB\n");
+            abort();
+        }
+        desc->window_begin_ns = now;
+        tlb_desc_load(env, mmu_idx, desc);
+        memset(desc->table, -1, desc->n_entries * sizeof(CPUTLBEntry));
+        tlb_desc_clear(desc);
+    }
+}
+
+/* Pick the size of the TLB of @desc after a flush.  The old contents
+   are about to be discarded, so the table is simply reallocated.  */
+static void tlb_mmu_resize(CPUTLBDesc *desc, int64_t now)
+{
+    size_t old_size = desc->n_entries;
+    size_t new_size = old_size;
+    bool window_expired = now > desc->window_begin_ns + TLB_WINDOW_NS;
+    size_t rate;
+
+    if (desc->n_used_entries > desc->window_max_entries) {
+        desc->window_max_entries = desc->n_used_entries;
+    }
+    rate = desc->window_max_entries * 100 / old_size;
+
+    if (rate > 70) {
+        new_size = MIN(old_size << 1, (size_t)1 << CPU_TLB_DYN_MAX_BITS);
+    } else if (rate < 30 && window_expired) {
+        /* Shrink to the smallest size that would have been under 70%
+           full, without going below the minimum.  */
+        new_size = old_size;
+        while (new_size > (1 << CPU_TLB_DYN_MIN_BITS)
+               && desc->window_max_entries * 100 / (new_size >> 1) <= 70) {
+            new_size >>= 1;
+        }
+    }
+
+    if (new_size == old_size) {
+        if (window_expired) {
+            desc->window_begin_ns = now;
+            desc->window_max_entries = desc->n_used_entries;
+        }
+        return;
+    }
+
+    if (parallel_cpus) {
+        tb_lock();
+    }
+    /* On allocation failure, keep the old table.  */
+    if (tlb_desc_alloc(desc, new_size)) {
+        desc->window_begin_ns = now;
+        desc->window_max_entries = 0;
+    }
+    if (parallel_cpus) {
+        tb_unlock();
+    }
+}
+
+void tlb_flush_by_mmuidx(CPUState *cpu, uint16_t idxmap)
 {
     CPUArchState *env = cpu->env_ptr;
+    bool remote;
+    int64_t now;
+    int mmu_idx;
 
 #if defined(DEBUG_TLB)
-    printf("tlb_flush:\n");
+    printf("tlb_flush_by_mmuidx: %x\n", idxmap);
 #endif
     /* must reset current TB so that interrupts cannot modify the
        links while we are modifying them */
     cpu->current_tb = NULL;
 
-    memset(env->tlb_table, -1, sizeof(env->tlb_table));
-    memset(env->tlb_v_table, -1, sizeof(env->tlb_v_table));
+    /* Only the vCPU itself resizes its TLB; this also reloads the fields
+       of env that a CPU reset cleared.  */
+    remote = tlb_lock_remote(cpu);
+    now = remote ? 0 : get_clock();
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBDesc *desc = &cpu->tlb_d[mmu_idx];
+
+        if (!(idxmap & (1 << mmu_idx))) {
+            continue;
+        }
+        if (!remote) {
+            tlb_mmu_resize(desc, now);
+        }
+        tlb_desc_load(env, mmu_idx, desc);
+        memset(desc->table, -1, desc->n_entries * sizeof(CPUTLBEntry));
+        memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
+        tlb_desc_clear(desc);
+    }
+    if (remote) {
+        tb_unlock();
+    }
     memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
 
-    env->vtlb_index = 0;
-    env->tlb_flush_addr = -1;
-    env->tlb_flush_mask = 0;
+    if (idxmap == ALL_MMUIDX_BITS) {
+        env->vtlb_index = 0;
+    }
     tlb_flush_count++;
 }
 
-static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
+static inline bool tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
 {
     if (addr == (tlb_entry->addr_read &
                  (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
@@ -78,47 +217,329 @@ static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
         addr == (tlb_entry->addr_code &
                  (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
         memset(tlb_entry, -1, sizeof(*tlb_entry));
+        return true;
     }
+    return false;
 }
 
-void tlb_flush_page(CPUState *cpu, target_ulong addr)
+/* Return the virtual page mapped by @te, or -1 if it is empty.  */
+static inline target_ulong tlb_entry_page(const CPUTLBEntry *te)
+{
+    target_ulong addr = te->addr_read;
+
+    if (addr == -1) {
+        addr = te->addr_write;
+    }
+    if (addr == -1) {
+        addr = te->addr_code;
+    }
+    return addr == -1 ? -1 : addr & TARGET_PAGE_MASK;
+}
+
+/* Double the TLB of @mmu_idx while keeping its contents.  Growing only
+   adds high bits to the index, so no two live entries can collide.  */
+static void tlb_mmu_grow(CPUState *cpu, int mmu_idx)
 {
     CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *desc = &cpu->tlb_d[mmu_idx];
+    CPUTLBEntry *old_table = desc->table;
+    hwaddr *old_iotlb = desc->iotlb;
+    size_t old_size = desc->n_entries;
+    size_t new_size = old_size << 1;
+    CPUTLBEntry *table = g_try_new(CPUTLBEntry, new_size);
+    hwaddr *iotlb = g_try_new(hwaddr, new_size);
+    size_t i;
+
+    desc->n_evicted_entries = 0;
+    if (!table || !iotlb) {
+        g_free(table);
+        g_free(iotlb);
+        return;
+    }
+
+    memset(table, -1, new_size * sizeof(CPUTLBEntry));
+    if (parallel_cpus) {
+        tb_lock();
+    }
+    for (i = 0; i < old_size; i++) {
+        target_ulong page = tlb_entry_page(&old_table[i]);
+        size_t index;
+
+        if (page != -1) {
+            index = (page >> TARGET_PAGE_BITS) & (new_size - 1);
+            table[index] = old_table[i];
+            iotlb[index] = old_iotlb[i];
+        }
+    }
+    desc->table = table;
+    desc->iotlb = iotlb;
+    desc->n_entries = new_size;
+    tlb_desc_load(env, mmu_idx, desc);
+    if (parallel_cpus) {
+        tb_unlock();
+    }
+    g_free(old_table);
+    g_free(old_iotlb);
+}
+
+/* Drop the jump cache entries of the TBs that may overlap the pages
+   from @start to @last included.  */
+static void tlb_flush_jmp_cache_range(CPUState *cpu, target_ulong start,
+                                      target_ulong last)
+{
+    target_ulong span = last - start;
     int i;
-    int mmu_idx;
 
+    if ((span >> TARGET_PAGE_BITS) < TB_JMP_PAGE_SIZE) {
+        target_ulong addr = start;
+
+        do {
+            tb_flush_jmp_cache(cpu, addr);
+            addr += TARGET_PAGE_SIZE;
+        } while (addr - start <= span);
+        return;
+    }
+    for (i = 0; i < TB_JMP_CACHE_SIZE; i++) {
+        TranslationBlock *tb = cpu->tb_jmp_cache[i];
+
+        /* a TB spans at most two pages */
+        if (tb && ((tb->pc & TARGET_PAGE_MASK) - start <= span ||
+                   ((tb->pc & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE) - start
+                   <= span)) {
+            cpu->tb_jmp_cache[i] = NULL;
+        }
+    }
+}
+
+/* Drop the entries of @mmu_idx that map a page from @start to @last
+   included, visiting whichever of the pages or the table is smaller.
+   Does not handle large pages, see tlb_flush_range_mmuidx.  */
+static void tlb_flush_range_entries(CPUState *cpu, int mmu_idx,
+                                    target_ulong start, target_ulong last)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *desc = &cpu->tlb_d[mmu_idx];
+    target_ulong span = last - start;
+    target_ulong page;
+    size_t i;
+
+    if ((span >> TARGET_PAGE_BITS) < desc->n_entries) {
+        page = start;
+        do {
+            if (tlb_flush_entry(tlb_entry(env, mmu_idx, page), page)
+                && desc->n_used_entries) {
+                desc->n_used_entries--;
+            }
+            page += TARGET_PAGE_SIZE;
+        } while (page - start <= span);
+    } else {
+        for (i = 0; i < desc->n_entries; i++) {
+            page = tlb_entry_page(&desc->table[i]);
+            if (page != -1 && page - start <= span) {
+                memset(&desc->table[i], -1, sizeof(CPUTLBEntry));
+                if (desc->n_used_entries) {
+                    desc->n_used_entries--;
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        page = tlb_entry_page(&env->tlb_v_table[mmu_idx][i]);
+        if (page != -1 && page - start <= span) {
+            memset(&env->tlb_v_table[mmu_idx][i], -1, sizeof(CPUTLBEntry));
+        }
+    }
+}
+
+/* Flush the pages of @mmu_idx from @start to @last included.  A large
+   page must go as a whole, and we only know the region that covers all
+   of them: if the range touches it, flush that region too.  Returns the
+   last page flushed, and widens *@start accordingly.  */
+static target_ulong tlb_flush_range_mmuidx(CPUState *cpu, int mmu_idx,
+                                           target_ulong *start,
+                                           target_ulong last)
+{
+    CPUTLBDesc *desc = &cpu->tlb_d[mmu_idx];
+    target_ulong lp_first = desc->large_page_addr;
+    target_ulong lp_last = (lp_first | ~desc->large_page_mask)
+                           & TARGET_PAGE_MASK;
+
+    tlb_flush_range_entries(cpu, mmu_idx, *start, last);
+    if (lp_first != -1 && lp_first <= last && *start <= lp_last) {
 #if defined(DEBUG_TLB)
-    printf("tlb_flush_page: " TARGET_FMT_lx "\n", addr);
+        printf("tlb_flush_range: flushing large pages ("
+               TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
+               desc->large_page_addr, desc->large_page_mask);
 #endif
-    /* Check if we need to flush due to large pages.  */
-    if ((addr & env->tlb_flush_mask) == env->tlb_flush_addr) {
+        tlb_flush_range_entries(cpu, mmu_idx, lp_first, lp_last);
+        desc->large_page_addr = -1;
+        desc->large_page_mask = 0;
+        *start = MIN(*start, lp_first);
+        last = MAX(last, lp_last);
+    }
+    return last;
+}
+
+void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                               target_ulong len, uint16_t idxmap)
+{
+    target_ulong start, last, jmp_start, jmp_last;
+    bool remote;
+    int mmu_idx;
+
 #if defined(DEBUG_TLB)
-        printf("tlb_flush_page: forced full flush ("
-               TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-               env->tlb_flush_addr, env->tlb_flush_mask);
+    printf("tlb_flush_range: " TARGET_FMT_lx "+" TARGET_FMT_lx " (%x)\n",
+           addr, len, idxmap);
 #endif
-        tlb_flush(cpu, 1);
+    if (len == 0) {
         return;
     }
+    start = addr & TARGET_PAGE_MASK;
+    last = (addr + len - 1) & TARGET_PAGE_MASK;
+    if (last < start) {
+        /* the range wraps around: stop at the top of the address space */
+        last = TARGET_PAGE_MASK;
+    }
+
     /* must reset current TB so that interrupts cannot modify the
        links while we are modifying them */
     cpu->current_tb = NULL;
 
-    addr &= TARGET_PAGE_MASK;
-    i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    jmp_start = start;
+    jmp_last = last;
+    remote = tlb_lock_remote(cpu);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
+        if (idxmap & (1 << mmu_idx)) {
+            target_ulong s = start;
+
+            jmp_last = MAX(jmp_last, tlb_flush_range_mmuidx(cpu, mmu_idx,
+                                                            &s, last));
+            jmp_start = MIN(jmp_start, s);
+        }
+    }
+    if (remote) {
+        tb_unlock();
     }
 
-    /* check whether there are entries that need to be flushed in the vtlb */
+    tlb_flush_jmp_cache_range(cpu, jmp_start, jmp_last);
+}
+
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len)
+{
+    tlb_flush_range_by_mmuidx(cpu, addr, len, ALL_MMUIDX_BITS);
+}
+
+void tlb_flush_page(CPUState *cpu, target_ulong addr)
+{
+    tlb_flush_range_by_mmuidx(cpu, addr & TARGET_PAGE_MASK, TARGET_PAGE_SIZE,
+                              ALL_MMUIDX_BITS);
+}
+
+/* NOTE:
+ * If flush_global is true (the usual case), flush all tlb entries.
+ * If flush_global is false, flush (at least) all tlb entries not
+ * entered with tlb_set_global_page.  Those are only tracked as a range
+ * per MMU mode, which is enough to keep the kernel half of the address
+ * space across the context switches of the usual operating systems.
+ */
+void tlb_flush(CPUState *cpu, int flush_global)
+{
+    target_ulong jmp_start = -1, jmp_last = 0;
+    bool remote;
+    int mmu_idx;
+
+    if (flush_global) {
+        tlb_flush_by_mmuidx(cpu, ALL_MMUIDX_BITS);
+        return;
+    }
+
+#if defined(DEBUG_TLB)
+    printf("tlb_flush: non-global\n");
+#endif
+    /* must reset current TB so that interrupts cannot modify the
+       links while we are modifying them */
+    cpu->current_tb = NULL;
+
+    remote = tlb_lock_remote(cpu);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        int k;
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
-            tlb_flush_entry(&env->tlb_v_table[mmu_idx][k], addr);
+        CPUTLBDesc *desc = &cpu->tlb_d[mmu_idx];
+        target_ulong start = desc->nonglobal_lo;
+        target_ulong last;
+
+        if (start > desc->nonglobal_hi) {
+            continue;
+        }
+        last = tlb_flush_range_mmuidx(cpu, mmu_idx, &start,
+                                      desc->nonglobal_hi);
+        jmp_start = MIN(jmp_start, start);
+        jmp_last = MAX(jmp_last, last);
+        desc->nonglobal_lo = -1;
+        desc->nonglobal_hi = 0;
+    }
+    if (remote) {
+        tb_unlock();
+    }
+
+    if (jmp_start <= jmp_last) {
+        tlb_flush_jmp_cache_range(cpu, jmp_start, jmp_last);
+    }
+    tlb_flush_count++;
+}
+
+void tlb_flush_page_masked(CPUState *cpu, target_ulong addr,
+                           target_ulong mask)
+{
+    CPUArchState *env = cpu->env_ptr;
+    bool remote;
+    int mmu_idx;
+
+#if defined(DEBUG_TLB)
+    printf("tlb_flush_page_masked: " TARGET_FMT_lx "/" TARGET_FMT_lx "\n",
+           addr, mask);
+#endif
+    mask &= TARGET_PAGE_MASK;
+    addr &= mask;
+
+    /* must reset current TB so that interrupts cannot modify the
+       links while we are modifying them */
+    cpu->current_tb = NULL;
+
+    remote = tlb_lock_remote(cpu);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBDesc *desc = &cpu->tlb_d[mmu_idx];
+        target_ulong page;
+        size_t i;
+
+        for (i = 0; i < desc->n_entries; i++) {
+            page = tlb_entry_page(&desc->table[i]);
+            if (page != -1 && (page & mask) == addr) {
+                memset(&desc->table[i], -1, sizeof(CPUTLBEntry));
+                if (desc->n_used_entries) {
+                    desc->n_used_entries--;
+                }
+            }
+        }
+        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+            page = tlb_entry_page(&env->tlb_v_table[mmu_idx][i]);
+            if (page != -1 && (page & mask) == addr) {
+                memset(&env->tlb_v_table[mmu_idx][i], -1, sizeof(CPUTLBEntry));
+            }
+        }
+
+        /* We cannot tell which large page is meant, flush them all.  */
+        if (desc->large_page_addr != -1) {
+            page = desc->large_page_addr;
+            tlb_flush_range_mmuidx(cpu, mmu_idx, &page,
+                                   (page | ~desc->large_page_mask)
+                                   & TARGET_PAGE_MASK);
         }
     }
+    if (remote) {
+        tb_unlock();
+    }
 
-    tb_flush_jmp_cache(cpu, addr);
+    memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
 }
 
 /* update the TLBs so that writes to code in the virtual page 'addr'
@@ -171,14 +592,18 @@ void cpu_tlb_reset_dirty_all(ram_addr_t start1, ram_addr_t length)
     CPUState *cpu;
     CPUArchState *env;
 
+    /* keep the vCPUs from replacing their tables under our feet */
+    if (parallel_cpus) {
+        tb_lock();
+    }
     CPU_FOREACH(cpu) {
         int mmu_idx;
 
         env = cpu->env_ptr;
         for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-            unsigned int i;
+            size_t i;
 
-            for (i = 0; i < CPU_TLB_SIZE; i++) {
+            for (i = 0; i < cpu->tlb_d[mmu_idx].n_entries; i++) {
                 tlb_reset_dirty_range(&env->tlb_table[mmu_idx][i],
                                       start1, length);
             }
@@ -189,6 +614,9 @@ void cpu_tlb_reset_dirty_all(ram_addr_t start1, ram_addr_t length)
             }
         }
     }
+    if (parallel_cpus) {
+        tb_unlock();
+    }
 }
 
 static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
@@ -202,13 +630,11 @@ static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
    so that it is no longer dirty */
 void tlb_set_dirty(CPUArchState *env, target_ulong vaddr)
 {
-    int i;
     int mmu_idx;
 
     vaddr &= TARGET_PAGE_MASK;
-    i = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_set_dirty1(&env->tlb_table[mmu_idx][i], vaddr);
+        tlb_set_dirty1(tlb_entry(env, mmu_idx, vaddr), vaddr);
     }
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
@@ -220,38 +646,41 @@ void tlb_set_dirty(CPUArchState *env, target_ulong vaddr)
 }
 
 /* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
-static void tlb_add_large_page(CPUArchState *env, target_ulong vaddr,
+   large pages and flush it as a whole if any of them is invalidated.  */
+static void tlb_add_large_page(CPUTLBDesc *desc, target_ulong vaddr,
                                target_ulong size)
 {
     target_ulong mask = ~(size - 1);
 
-    if (env->tlb_flush_addr == (target_ulong)-1) {
-        env->tlb_flush_addr = vaddr & mask;
-        env->tlb_flush_mask = mask;
+    if (desc->large_page_addr == (target_ulong)-1) {
+        desc->large_page_addr = vaddr & mask;
+        desc->large_page_mask = mask;
         return;
     }
     /* Extend the existing region to include the new page.
        This is a compromise between unnecessary flushes and the cost
        of maintaining a full variable size TLB.  */
-    mask &= env->tlb_flush_mask;
-    while (((env->tlb_flush_addr ^ vaddr) & mask) != 0) {
+    mask &= desc->large_page_mask;
+    while (((desc->large_page_addr ^ vaddr) & mask) != 0) {
         mask <<= 1;
     }
-    env->tlb_flush_addr &= mask;
-    env->tlb_flush_mask = mask;
+    desc->large_page_addr &= mask;
+    desc->large_page_mask = mask;
 }
 
 /* Add a new TLB entry. At most one entry for a given virtual address
    is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
-   supplied size is only used by tlb_flush_page.  */
-void tlb_set_page(CPUState *cpu, target_ulong vaddr,
-                  hwaddr paddr, int prot,
-                  int mmu_idx, target_ulong size)
+   supplied size is only used by tlb_flush_page.  Unless @global, the
+   entry is dropped by tlb_flush(cpu, 0).  */
+static void tlb_set_page_common(CPUState *cpu, target_ulong vaddr,
+                                hwaddr paddr, int prot,
+                                int mmu_idx, target_ulong size, bool global)
 {
     CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *desc = &cpu->tlb_d[mmu_idx];
     MemoryRegionSection *section;
     unsigned int index;
+    target_ulong old_page;
     target_ulong address;
     target_ulong code_address;
     uintptr_t addend;
@@ -261,7 +690,11 @@ void tlb_set_page(CPUState *cpu, target_ulong vaddr,
 
     assert(size >= TARGET_PAGE_SIZE);
     if (size != TARGET_PAGE_SIZE) {
-        tlb_add_large_page(env, vaddr, size);
+        tlb_add_large_page(desc, vaddr, size);
+    }
+    if (!global) {
+        desc->nonglobal_lo = MIN(desc->nonglobal_lo, vaddr & TARGET_PAGE_MASK);
+        desc->nonglobal_hi = MAX(desc->nonglobal_hi, vaddr & TARGET_PAGE_MASK);
     }
 
     sz = size;
@@ -289,8 +722,21 @@ void tlb_set_page(CPUState *cpu, target_ulong vaddr,
     iotlb = memory_region_section_get_iotlb(cpu, section, vaddr, paddr, xlat,
                                             prot, &address);
 
-    index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    index = tlb_index(env, mmu_idx, vaddr);
     te = &env->tlb_table[mmu_idx][index];
+    old_page = tlb_entry_page(te);
+    if (old_page == -1) {
+        desc->n_used_entries++;
+    } else if (old_page != (vaddr & TARGET_PAGE_MASK)
+               && ++desc->n_evicted_entries >= desc->n_entries
+               && desc->n_entries < (1 << CPU_TLB_DYN_MAX_BITS)) {
+        tlb_mmu_grow(cpu, mmu_idx);
+        index = tlb_index(env, mmu_idx, vaddr);
+        te = &env->tlb_table[mmu_idx][index];
+        if (tlb_entry_page(te) == -1) {
+            desc->n_used_entries++;
+        }
+    }
 
     /* do not discard the translation in te, evict it into a victim tlb */
     env->tlb_v_table[mmu_idx][vidx] = *te;
@@ -327,6 +773,22 @@ void tlb_set_page(CPUState *cpu, target_ulong vaddr,
     }
 }
 
+void tlb_set_page(CPUState *cpu, target_ulong vaddr,
+                  hwaddr paddr, int prot,
+                  int mmu_idx, target_ulong size)
+{
+    tlb_set_page_common(cpu, vaddr, paddr, prot, mmu_idx, size, false);
+}
+
+/* Like tlb_set_page, for a translation that the guest shares between
+   all address spaces and that survives tlb_flush(cpu, 0).  */
+void tlb_set_global_page(CPUState *cpu, target_ulong vaddr,
+                         hwaddr paddr, int prot,
+                         int mmu_idx, target_ulong size)
+{
+    tlb_set_page_common(cpu, vaddr, paddr, prot, mmu_idx, size, true);
+}
+
 /* NOTE: this function can trigger an exception */
 /* NOTE2: the returned address is not exactly the physical address: it
  * is actually a ram_addr_t (in system mode; the user mode emulation
@@ -339,11 +801,12 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
     MemoryRegion *mr;
     CPUState *cpu = ENV_GET_CPU(env1);
 
-    page_index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     mmu_idx = cpu_mmu_index(env1);
+    page_index = tlb_index(env1, mmu_idx, addr);
     if (unlikely(env1->tlb_table[mmu_idx][page_index].addr_code !=
                  (addr & TARGET_PAGE_MASK))) {
         cpu_ldub_code(env1, addr);
+        page_index = tlb_index(env1, mmu_idx, addr);
     }
     pd = env1->iotlb[mmu_idx][page_index] & ~TARGET_PAGE_MASK;
     mr = iotlb_to_region(cpu->as, pd);
@@ -361,6 +824,106 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
     return qemu_ram_addr_from_host_nofail(p);
 }
 
+/* We are about to do a page table walk for the page at ADDR.  Our last
+   hope is the victim tlb: if the entry is there, swap it with entry INDEX
+   of the main tlb.  ELT_OFS selects the field of CPUTLBEntry to compare,
+   for the type of access.  */
+static bool victim_tlb_hit(CPUArchState *env, int mmu_idx, int index,
+                           size_t elt_ofs, target_ulong addr)
+{
+    target_ulong page = addr & TARGET_PAGE_MASK;
+    int vidx;
+
+    for (vidx = CPU_VTLB_SIZE - 1; vidx >= 0; --vidx) {
+        CPUTLBEntry *vtlb = &env->tlb_v_table[mmu_idx][vidx];
+        target_ulong cmp = *(target_ulong *)((uintptr_t)vtlb + elt_ofs);
+
+        if (cmp == page) {
+            CPUTLBEntry tmptlb = env->tlb_table[mmu_idx][index];
+            hwaddr tmpiotlb = env->iotlb[mmu_idx][index];
+
+            env->tlb_table[mmu_idx][index] = *vtlb;
+            *vtlb = tmptlb;
+            env->iotlb[mmu_idx][index] = env->iotlb_v[mmu_idx][vidx];
+            env->iotlb_v[mmu_idx][vidx] = tmpiotlb;
+            ENV_GET_CPU(env)->tlb_slow_stats.victim++;
+            return true;
+        }
+    }
+    ENV_GET_CPU(env)->tlb_slow_stats.fill++;
+    return false;
+}
+
+#ifndef ALIGNED_ONLY
+/* Return the host address of ADDR for an access of type ACCESS_TYPE,
+   refilling the tlb of MMU_IDX first if it does not map the page.
+   Return NULL if the page is not plain RAM for this access: I/O, a
+   clean page being written, a watchpoint.  Like tlb_fill, this does not
+   return if the access faults.  */
+static void *tlb_fill_host(CPUArchState *env, target_ulong addr,
+                           int access_type, int mmu_idx, uintptr_t retaddr)
+{
+    int index = tlb_index(env, mmu_idx, addr);
+    CPUTLBEntry *entry = &env->tlb_table[mmu_idx][index];
+    size_t elt_ofs;
+    target_ulong tlb_addr;
+
+    switch (access_type) {
+    case 0:
+        elt_ofs = offsetof(CPUTLBEntry, addr_read);
+        break;
+    case 1:
+        elt_ofs = offsetof(CPUTLBEntry, addr_write);
+        break;
+    default:
+        elt_ofs = offsetof(CPUTLBEntry, addr_code);
+        break;
+    }
+    tlb_addr = *(target_ulong *)((uintptr_t)entry + elt_ofs);
+    if ((addr & TARGET_PAGE_MASK)
+        != (tlb_addr & (TARGET_PAGE_MASK | TLB_INVALID_MASK))
+        && !victim_tlb_hit(env, mmu_idx, index, elt_ofs, addr)) {
+        tlb_fill(ENV_GET_CPU(env), addr, access_type, mmu_idx, retaddr);
+    }
+    return tlb_vaddr_to_host(env, addr, access_type, mmu_idx);
+}
+
+/* An access of SIZE bytes at ADDR spans two pages.  If both are plain
+   RAM for ACCESS_TYPE, do it directly in host memory, reading the bytes
+   into BUF or writing them from BUF, and return true.  Otherwise return
+   false without having accessed either page, and the caller splits the
+   access up.  The second page is looked up, and faults, first.  */
+static inline bool tlb_cross_page_access(CPUArchState *env, target_ulong addr,
+                                         uint8_t *buf, int size,
+                                         int access_type, int mmu_idx,
+                                         uintptr_t retaddr)
+{
+    target_ulong addr2 = (addr + size - 1) & TARGET_PAGE_MASK;
+    int size1 = addr2 - addr;
+    uint8_t *haddr1, *haddr2;
+
+    haddr2 = tlb_vaddr_to_host(env, addr2, access_type, mmu_idx);
+    if (!haddr2) {
+        haddr2 = tlb_fill_host(env, addr2, access_type, mmu_idx, retaddr);
+    }
+    /* the refill may have evicted the first page, or resized the tlb */
+    haddr1 = tlb_vaddr_to_host(env, addr, access_type, mmu_idx);
+    if (!haddr1 || !haddr2) {
+        ENV_GET_CPU(env)->tlb_slow_stats.cross_page_split++;
+        return false;
+    }
+    if (access_type == 1) {
+        memcpy(haddr1, buf, size1);
+        memcpy(haddr2, buf + size1, size - size1);
+    } else {
+        memcpy(buf, haddr1, size1);
+        memcpy(buf + size1, haddr2, size - size1);
+    }
+    ENV_GET_CPU(env)->tlb_slow_stats.cross_page++;
+    return true;
+}
+#endif
+
 #define MMUSUFFIX _mmu
 
 #define SHIFT 0
@@ -376,6 +939,32 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
 #include "softmmu_template.h"
 #undef MMUSUFFIX
 
+/* Atomic read-modify-write helpers; they use the load and store helpers
+   above.  */
+#define SHIFT 0
+#include "atomic_template.h"
+
+#define SHIFT 1
+#include "atomic_template.h"
+
+#define SHIFT 1
+#define ATOMIC_BE
+#include "atomic_template.h"
+
+#define SHIFT 2
+#include "atomic_template.h"
+
+#define SHIFT 2
+#define ATOMIC_BE
+#include "atomic_template.h"
+
+#define SHIFT 3
+#include "atomic_template.h"
+
+#define SHIFT 3
+#define ATOMIC_BE
+#include "atomic_template.h"
+
 #define MMUSUFFIX _cmmu
 #undef GETPC_ADJ
 #define GETPC_ADJ 0
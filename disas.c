@@ -334,36 +334,33 @@ void target_disas(FILE *out, CPUArchState *env, target_ulong code,
     }
 }
 
-/* Disassemble this for me please... (debugging). */
-void disas(FILE *out, void *code, unsigned long size)
+/* Point @info at host code, and return the function that disassembles it.  */
+static disassembler_ftype host_disas_init(disassemble_info *info,
+                                          void *code, unsigned long size)
 {
-    uintptr_t pc;
-    int count;
-    CPUDebug s;
-    int (*print_insn)(bfd_vma pc, disassemble_info *info) = NULL;
+    disassembler_ftype print_insn = NULL;
 
-    INIT_DISASSEMBLE_INFO(s.info, out, fprintf);
-    s.info.print_address_func = generic_print_host_address;
+    info->print_address_func = generic_print_host_address;
 
-    s.info.buffer = code;
-    s.info.buffer_vma = (uintptr_t)code;
-    s.info.buffer_length = size;
+    info->buffer = code;
+    info->buffer_vma = (uintptr_t)code;
+    info->buffer_length = size;
 
 #ifdef HOST_WORDS_BIGENDIAN
-    s.info.endian = BFD_ENDIAN_BIG;
+    info->endian = BFD_ENDIAN_BIG;
 #else
-    s.info.endian = BFD_ENDIAN_LITTLE;
+    info->endian = BFD_ENDIAN_LITTLE;
 #endif
 #if defined(CONFIG_TCG_INTERPRETER)
     print_insn = print_insn_tci;
 #elif defined(__i386__)
-    s.info.mach = bfd_mach_i386_i386;
+    info->mach = bfd_mach_i386_i386;
     print_insn = print_insn_i386;
 #elif defined(__x86_64__)
-    s.info.mach = bfd_mach_x86_64;
+    info->mach = bfd_mach_x86_64;
     print_insn = print_insn_i386;
 #elif defined(_ARCH_PPC)
-    s.info.disassembler_options = (char *)"any";
+    info->disassembler_options = (char *)"any";
     print_insn = print_insn_ppc;
 #elif defined(__aarch64__) && defined(CONFIG_ARM_A64_DIS)
     print_insn = print_insn_arm_a64;
@@ -371,7 +368,7 @@ void disas(FILE *out, void *code, unsigned long size)
     print_insn = print_insn_alpha;
 #elif defined(__sparc__)
     print_insn = print_insn_sparc;
-    s.info.mach = bfd_mach_sparc_v9b;
+    info->mach = bfd_mach_sparc_v9b;
 #elif defined(__arm__)
     print_insn = print_insn_arm;
 #elif defined(__MIPSEB__)
@@ -387,6 +384,19 @@ void disas(FILE *out, void *code, unsigned long size)
 #elif defined(__ia64__)
     print_insn = print_insn_ia64;
 #endif
+    return print_insn;
+}
+
+/* Disassemble this for me please... (debugging). */
+void disas(FILE *out, void *code, unsigned long size)
+{
+    uintptr_t pc;
+    int count;
+    CPUDebug s;
+    int (*print_insn)(bfd_vma pc, disassemble_info *info);
+
+    INIT_DISASSEMBLE_INFO(s.info, out, fprintf);
+    print_insn = host_disas_init(&s.info, code, size);
     if (print_insn == NULL) {
         print_insn = print_insn_od_host;
     }
@@ -399,6 +409,35 @@ void disas(FILE *out, void *code, unsigned long size)
     }
 }
 
+static int GCC_FMT_ATTR(2, 3) fprintf_null(FILE *stream, const char *fmt, ...)
+{
+    return 0;
+}
+
+/* Return the number of host instructions in @size bytes at @code, or -1
+   if there is no disassembler for the host.  */
+int disas_host_insn_count(void *code, unsigned long size)
+{
+    uintptr_t pc;
+    int count, n = 0;
+    CPUDebug s;
+    int (*print_insn)(bfd_vma pc, disassemble_info *info);
+
+    INIT_DISASSEMBLE_INFO(s.info, NULL, fprintf_null);
+    print_insn = host_disas_init(&s.info, code, size);
+    if (print_insn == NULL) {
+        return -1;
+    }
+    for (pc = (uintptr_t)code; size > 0; pc += count, size -= count) {
+        count = print_insn(pc, &s.info);
+        if (count <= 0) {
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
 /* Look up symbol for debugging purpose.  Returns "" if unknown. */
 const char *lookup_symbol(target_ulong orig_addr)
 {
@@ -20,40 +20,65 @@
 #include "disas/bfd.h"
 #include "tcg/tcg.h"
 
-/* Disassemble TCI bytecode. */
+static const char *const tci_op_names[TCI_NB_OPS] = {
+#define DEF(name, nconst) #name,
+#define FUSE(a, b) #a "+" #b,
+#include "tci-opc.h"
+};
+
+/* Disassemble TCI bytecode.  A fused instruction is shown with the
+   length of its first part, the second one follows it.  */
 int print_insn_tci(bfd_vma addr, disassemble_info *info)
 {
-    int length;
-    uint8_t byte;
-    int status;
-    TCGOpcode op;
+    tcg_target_ulong word;
+    uint8_t r[TCI_REG_BYTES];
+    int status, op, i, n, nconst;
 
-    status = info->read_memory_func(addr, &byte, 1, info);
+    status = info->read_memory_func(addr, (bfd_byte *)&word, sizeof(word),
+                                    info);
     if (status != 0) {
         info->memory_error_func(status, addr, info);
         return -1;
     }
-    op = byte;
+    for (op = 0; op < TCI_NB_OPS; op++) {
+        if (tci_handlers[op] == (const void *)word) {
+            break;
+        }
+    }
+    if (op == TCI_NB_OPS) {
+        info->fprintf_func(info->stream, "illegal handler 0x%" PRIxPTR,
+                           (uintptr_t)word);
+        return sizeof(word);
+    }
+    addr += sizeof(word);
 
-    addr++;
-    status = info->read_memory_func(addr, &byte, 1, info);
+    status = info->read_memory_func(addr, r, sizeof(r), info);
     if (status != 0) {
         info->memory_error_func(status, addr, info);
         return -1;
     }
-    length = byte;
-
-    if (op >= tcg_op_defs_max) {
-        info->fprintf_func(info->stream, "illegal opcode %d", op);
-    } else {
-        const TCGOpDef *def = &tcg_op_defs[op];
-        int nb_oargs = def->nb_oargs;
-        int nb_iargs = def->nb_iargs;
-        int nb_cargs = def->nb_cargs;
-        /* TODO: Improve disassembler output. */
-        info->fprintf_func(info->stream, "%s\to=%d i=%d c=%d",
-                           def->name, nb_oargs, nb_iargs, nb_cargs);
+    addr += sizeof(r);
+
+    /* the register bytes, without trailing zeros */
+    info->fprintf_func(info->stream, "%s", tci_op_names[op]);
+    for (n = TCI_REG_BYTES; n > 1 && !r[n - 1]; n--) {
+        continue;
+    }
+    for (i = 0; i < n; i++) {
+        info->fprintf_func(info->stream, "%s%d", i ? "," : "\t", r[i]);
+    }
+
+    nconst = tci_op_nconst[op];
+    for (i = 0; i < nconst; i++) {
+        status = info->read_memory_func(addr, (bfd_byte *)&word,
+                                        sizeof(word), info);
+        if (status != 0) {
+            info->memory_error_func(status, addr, info);
+            return -1;
+        }
+        addr += sizeof(word);
+        info->fprintf_func(info->stream, ",0x%" PRIxPTR, (uintptr_t)word);
     }
 
-    return length;
+    return TCI_INSN_WORDS(nconst) * sizeof(word);
 }
@@ -44,6 +44,9 @@ these four paragraphs for those parts of this code that are retained.
 
 /* We only need stdlib for abort() */
 #include <stdlib.h>
+/* float.h and math.h are for the host FPU fast path */
+#include <float.h>
+#include <math.h>
 
 /*----------------------------------------------------------------------------
 | Primitive arithmetic functions, including multi-word arithmetic, and
@@ -1862,6 +1865,214 @@ float32 float32_round_to_int( float32 a STATUS_PARAM)
 
 }
 
+/*----------------------------------------------------------------------------
+| Host FPU fast path for the basic operations on single- and double-precision
+| values.  When rounding to nearest-even, and the operands are zero or
+| normal, the host FPU computes the same result as the routines below.  If
+| that result is also zero or normal (and, for double precision, far enough
+| from the subnormal range that the error terms below are exact), the only
+| exception that may have occurred is inexact, which is found by computing
+| the rounding error exactly: with 2Sum for additions, in double precision
+| for single-precision products and quotients, and with a fused multiply-add
+| otherwise.  The check is skipped if the inexact flag is already set.  In
+| any other case, the functions return 0 and the caller falls back to the
+| software implementation.
+|
+| This needs a host that evaluates float and double expressions in their own
+| precision, so that each host operation is correctly rounded.
+*----------------------------------------------------------------------------*/
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+#define HOST_FPU_FAST_PATH 1
+#else
+#define HOST_FPU_FAST_PATH 0
+#endif
+
+/* Smallest magnitude of a double-precision operand or result for which
+   the rounding error of a product or the remainder of a quotient is
+   representable: 2 ** (-1074 + 2 * 53).  */
+#define HOST_FPU_FLOAT64_TINY 0x1p-968
+
+typedef union {
+    float32 s;
+    float h;
+} HostFloat32;
+
+typedef union {
+    float64 s;
+    double h;
+} HostFloat64;
+
+enum {
+    host_fpu_add,
+    host_fpu_sub,
+    host_fpu_mul,
+    host_fpu_div,
+};
+
+static inline flag hostFPUUsable(float_status *status)
+{
+    return HOST_FPU_FAST_PATH
+        && STATUS(float_rounding_mode) == float_round_nearest_even;
+}
+
+static inline flag float32IsZeroOrNormal(float32 a)
+{
+    return (uint32_t)(extractFloat32Exp(a) - 1) < 0xFE
+        || (float32_val(a) & 0x7FFFFFFF) == 0;
+}
+
+static inline flag float64IsZeroOrNormal(float64 a)
+{
+    return (uint32_t)(extractFloat64Exp(a) - 1) < 0x7FE
+        || (float64_val(a) & LIT64(0x7FFFFFFFFFFFFFFF)) == 0;
+}
+
+static flag float32HostOp(int op, float32 a, float32 b, float32 *zPtr
+                          STATUS_PARAM)
+{
+    HostFloat32 ua, ub, uz;
+    double exact;
+    float z, err;
+    flag inexact;
+
+    if (!hostFPUUsable(status)
+        || !float32IsZeroOrNormal(a) || !float32IsZeroOrNormal(b)) {
+        return 0;
+    }
+    ua.s = a;
+    ub.s = b;
+    inexact = 0;
+    switch (op) {
+    case host_fpu_add:
+    case host_fpu_sub:
+        if (op == host_fpu_sub) {
+            ub.h = -ub.h;
+        }
+        z = ua.h + ub.h;
+        if (z == 0) {
+            /* only an exact cancellation can round to zero */
+            break;
+        }
+        if (!(fabsf(z) > FLT_MIN && fabsf(z) <= FLT_MAX)) {
+            return 0;
+        }
+        if (!(STATUS(float_exception_flags) & float_flag_inexact)) {
+            err = z - ua.h;
+            err = (ua.h - (z - err)) + (ub.h - err);
+            inexact = err != 0;
+        }
+        break;
+    case host_fpu_mul:
+        /* a double holds the exact product of two floats */
+        exact = (double)ua.h * ub.h;
+        z = exact;
+        if (ua.h == 0 || ub.h == 0) {
+            break;
+        }
+        if (!(fabsf(z) > FLT_MIN && fabsf(z) <= FLT_MAX)) {
+            return 0;
+        }
+        inexact = z != exact;
+        break;
+    case host_fpu_div:
+        if (ub.h == 0) {
+            return 0;
+        }
+        /* rounding the double quotient again to float is innocuous */
+        z = (double)ua.h / ub.h;
+        if (ua.h == 0) {
+            break;
+        }
+        if (!(fabsf(z) > FLT_MIN && fabsf(z) <= FLT_MAX)) {
+            return 0;
+        }
+        inexact = (double)z * ub.h != ua.h;
+        break;
+    default:
+        abort();
+    }
+    if (inexact) {
+        float_raise(float_flag_inexact STATUS_VAR);
+    }
+    uz.h = z;
+    *zPtr = uz.s;
+    return 1;
+}
+
+static flag float64HostOp(int op, float64 a, float64 b, float64 *zPtr
+                          STATUS_PARAM)
+{
+    HostFloat64 ua, ub, uz;
+    double z, err;
+    flag inexact;
+
+    if (!hostFPUUsable(status)
+        || !float64IsZeroOrNormal(a) || !float64IsZeroOrNormal(b)) {
+        return 0;
+    }
+    ua.s = a;
+    ub.s = b;
+    inexact = 0;
+    switch (op) {
+    case host_fpu_add:
+    case host_fpu_sub:
+        if (op == host_fpu_sub) {
+            ub.h = -ub.h;
+        }
+        z = ua.h + ub.h;
+        if (z == 0) {
+            /* only an exact cancellation can round to zero */
+            break;
+        }
+        if (!(fabs(z) > DBL_MIN && fabs(z) <= DBL_MAX)) {
+            return 0;
+        }
+        if (!(STATUS(float_exception_flags) & float_flag_inexact)) {
+            err = z - ua.h;
+            err = (ua.h - (z - err)) + (ub.h - err);
+            inexact = err != 0;
+        }
+        break;
+    case host_fpu_mul:
+        z = ua.h * ub.h;
+        if (ua.h == 0 || ub.h == 0) {
+            break;
+        }
+        if (!(fabs(z) >= HOST_FPU_FLOAT64_TINY && fabs(z) <= DBL_MAX)) {
+            return 0;
+        }
+        if (!(STATUS(float_exception_flags) & float_flag_inexact)) {
+            inexact = fma(ua.h, ub.h, -z) != 0;
+        }
+        break;
+    case host_fpu_div:
+        if (ub.h == 0) {
+            return 0;
+        }
+        z = ua.h / ub.h;
+        if (ua.h == 0) {
+            break;
+        }
+        if (!(fabs(ua.h) >= HOST_FPU_FLOAT64_TINY
+              && fabs(z) > DBL_MIN && fabs(z) <= DBL_MAX)) {
+            return 0;
+        }
+        if (!(STATUS(float_exception_flags) & float_flag_inexact)) {
+            inexact = fma(z, ub.h, -ua.h) != 0;
+        }
+        break;
+    default:
+        abort();
+    }
+    if (inexact) {
+        float_raise(float_flag_inexact STATUS_VAR);
+    }
+    uz.h = z;
+    *zPtr = uz.s;
+    return 1;
+}
+
 /*----------------------------------------------------------------------------
 | Returns the result of adding the absolute values of the single-precision
 | floating-point values `a' and `b'.  If `zSign' is 1, the sum is negated
@@ -2025,6 +2236,11 @@ static float32 subFloat32Sigs( float32 a, float32 b, flag zSign STATUS_PARAM)
 float32 float32_add( float32 a, float32 b STATUS_PARAM )
 {
     flag aSign, bSign;
+    float32 z;
+
+    if (float32HostOp(host_fpu_add, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -2048,6 +2264,11 @@ float32 float32_add( float32 a, float32 b STATUS_PARAM )
 float32 float32_sub( float32 a, float32 b STATUS_PARAM )
 {
     flag aSign, bSign;
+    float32 z;
+
+    if (float32HostOp(host_fpu_sub, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -2075,7 +2296,11 @@ float32 float32_mul( float32 a, float32 b STATUS_PARAM )
     uint32_t aSig, bSig;
     uint64_t zSig64;
     uint32_t zSig;
+    float32 z;
 
+    if (float32HostOp(host_fpu_mul, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -2136,6 +2361,11 @@ float32 float32_div( float32 a, float32 b STATUS_PARAM )
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
     uint32_t aSig, bSig, zSig;
+    float32 z;
+
+    if (float32HostOp(host_fpu_div, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float32_squash_input_denormal(a STATUS_VAR);
     b = float32_squash_input_denormal(b STATUS_VAR);
 
@@ -3769,6 +3999,11 @@ static float64 subFloat64Sigs( float64 a, float64 b, flag zSign STATUS_PARAM )
 float64 float64_add( float64 a, float64 b STATUS_PARAM )
 {
     flag aSign, bSign;
+    float64 z;
+
+    if (float64HostOp(host_fpu_add, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3792,6 +4027,11 @@ float64 float64_add( float64 a, float64 b STATUS_PARAM )
 float64 float64_sub( float64 a, float64 b STATUS_PARAM )
 {
     flag aSign, bSign;
+    float64 z;
+
+    if (float64HostOp(host_fpu_sub, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3817,7 +4057,11 @@ float64 float64_mul( float64 a, float64 b STATUS_PARAM )
     flag aSign, bSign, zSign;
     int_fast16_t aExp, bExp, zExp;
     uint64_t aSig, bSig, zSig0, zSig1;
+    float64 z;
 
+    if (float64HostOp(host_fpu_mul, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
@@ -3880,6 +4124,11 @@ float64 float64_div( float64 a, float64 b STATUS_PARAM )
     uint64_t aSig, bSig, zSig;
     uint64_t rem0, rem1;
     uint64_t term0, term1;
+    float64 z;
+
+    if (float64HostOp(host_fpu_div, a, b, &z STATUS_VAR)) {
+        return z;
+    }
     a = float64_squash_input_denormal(a STATUS_VAR);
     b = float64_squash_input_denormal(b STATUS_VAR);
 
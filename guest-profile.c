@@ -0,0 +1,347 @@
+/*
+ * Guest sampling profiler
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu-common.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "disas/disas.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "sysemu/sysemu.h"
+#include "qapi/error.h"
+#include "qmp-commands.h"
+
+/* A host timer asks every running vCPU for a sample: the vCPU leaves
+   its chain of TBs and, back in cpu_exec, records its guest pc and, if
+   the target can walk the guest stack (CPUClass::guest_backtrace), the
+   return addresses above it.  Samples are therefore taken at TB
+   boundaries, and a TB that runs for a long time without leaving is
+   credited to the TB that follows it.
+
+   Identical stacks of the same vCPU share one entry.  The flat profile
+   adds up the entries by their innermost pc, the folded stacks list
+   them from the outermost caller down, as read by flamegraph.pl.  */
+
+#define GUEST_PROFILE_MAX_DEPTH 32
+/* more distinct stacks than this are counted as dropped */
+#define GUEST_PROFILE_MAX_STACKS (64 * 1024)
+/* in microseconds */
+#define GUEST_PROFILE_DEFAULT_INTERVAL 1000
+#define GUEST_PROFILE_MIN_INTERVAL 100
+/* entries in the hot list of query-guest-profile */
+#define GUEST_PROFILE_HOT 10
+
+typedef struct GuestProfileStack {
+    uint64_t samples;
+    int cpu_index;
+    int depth;
+    /* innermost first */
+    target_ulong pc[GUEST_PROFILE_MAX_DEPTH];
+} GuestProfileStack;
+
+typedef struct GuestProfileAddr {
+    uint64_t pc;
+    uint64_t samples;
+} GuestProfileAddr;
+
+static struct {
+    QemuMutex lock;
+    QEMUTimer *timer;
+    bool active;
+    /* in microseconds */
+    int64_t interval;
+    GHashTable *stacks;
+    uint64_t samples;
+    uint64_t dropped;
+} prof;
+
+static size_t guest_profile_stack_size(int depth)
+{
+    return offsetof(GuestProfileStack, pc) + depth * sizeof(target_ulong);
+}
+
+static guint guest_profile_stack_hash(gconstpointer key)
+{
+    const GuestProfileStack *s = key;
+    uint64_t h = s->cpu_index;
+    int i;
+
+    for (i = 0; i < s->depth; i++) {
+        h = (h ^ s->pc[i]) * 0x100000001b3ULL;
+    }
+    return h ^ (h >> 32);
+}
+
+static gboolean guest_profile_stack_equal(gconstpointer a, gconstpointer b)
+{
+    const GuestProfileStack *x = a, *y = b;
+
+    return x->cpu_index == y->cpu_index && x->depth == y->depth &&
+           !memcmp(x->pc, y->pc, x->depth * sizeof(target_ulong));
+}
+
+static void guest_profile_tick(void *opaque)
+{
+    CPUState *cpu;
+
+    if (runstate_is_running()) {
+        CPU_FOREACH(cpu) {
+            if (!cpu->halted) {
+                cpu->profile_request = 1;
+                cpu_exit(cpu);
+            }
+        }
+    }
+    timer_mod(prof.timer, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+              prof.interval * SCALE_US);
+}
+
+/* Called by the vCPU thread from cpu_exec, between two TBs.  */
+void guest_profile_sample(CPUState *cpu)
+{
+    CPUClass *cc = CPU_GET_CLASS(cpu);
+    CPUArchState *env = cpu->env_ptr;
+    GuestProfileStack s, *e;
+    target_ulong cs_base;
+    int flags;
+
+    cpu->profile_request = 0;
+
+    cpu_get_tb_cpu_state(env, &s.pc[0], &cs_base, &flags);
+    s.depth = 1;
+    if (cc->guest_backtrace) {
+        vaddr frames[GUEST_PROFILE_MAX_DEPTH - 1];
+        int i, n;
+
+        n = cc->guest_backtrace(cpu, frames, ARRAY_SIZE(frames));
+        for (i = 0; i < n; i++) {
+            s.pc[s.depth++] = frames[i];
+        }
+    }
+    s.cpu_index = cpu->cpu_index;
+    s.samples = 0;
+
+    qemu_mutex_lock(&prof.lock);
+    if (prof.active) {
+        e = g_hash_table_lookup(prof.stacks, &s);
+        if (!e && g_hash_table_size(prof.stacks) < GUEST_PROFILE_MAX_STACKS) {
+            e = g_memdup(&s, guest_profile_stack_size(s.depth));
+            g_hash_table_insert(prof.stacks, e, e);
+        }
+        if (e) {
+            e->samples++;
+            prof.samples++;
+        } else {
+            prof.dropped++;
+        }
+    }
+    qemu_mutex_unlock(&prof.lock);
+}
+
+void qmp_guest_profile_start(bool has_interval, int64_t interval,
+                             Error **errp)
+{
+    if (!tcg_enabled()) {
+        error_setg(errp, "guest profiling requires TCG");
+        return;
+    }
+    if (!has_interval) {
+        interval = GUEST_PROFILE_DEFAULT_INTERVAL;
+    } else if (interval < GUEST_PROFILE_MIN_INTERVAL) {
+        error_setg(errp, "interval must be at least %d microseconds",
+                   GUEST_PROFILE_MIN_INTERVAL);
+        return;
+    }
+
+    if (!prof.timer) {
+        qemu_mutex_init(&prof.lock);
+        prof.timer = timer_new_ns(QEMU_CLOCK_REALTIME, guest_profile_tick,
+                                  NULL);
+    }
+
+    qemu_mutex_lock(&prof.lock);
+    if (prof.stacks) {
+        g_hash_table_destroy(prof.stacks);
+    }
+    prof.stacks = g_hash_table_new_full(guest_profile_stack_hash,
+                                        guest_profile_stack_equal,
+                                        g_free, NULL);
+    prof.samples = 0;
+    prof.dropped = 0;
+    prof.interval = interval;
+    prof.active = true;
+    qemu_mutex_unlock(&prof.lock);
+
+    timer_mod(prof.timer, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) +
+              interval * SCALE_US);
+}
+
+void qmp_guest_profile_stop(Error **errp)
+{
+    if (!prof.active) {
+        error_setg(errp, "the guest profiler is not running");
+        return;
+    }
+    timer_del(prof.timer);
+    qemu_mutex_lock(&prof.lock);
+    prof.active = false;
+    qemu_mutex_unlock(&prof.lock);
+}
+
+static gint guest_profile_addr_cmp(gconstpointer a, gconstpointer b)
+{
+    const GuestProfileAddr *x = *(GuestProfileAddr **)a;
+    const GuestProfileAddr *y = *(GuestProfileAddr **)b;
+
+    if (x->samples != y->samples) {
+        return x->samples > y->samples ? -1 : 1;
+    }
+    return x->pc < y->pc ? -1 : x->pc > y->pc;
+}
+
+/* Add up the samples by innermost pc, hottest first.  Called with
+   prof.lock held; free the result with guest_profile_flat_free().  */
+static GPtrArray *guest_profile_flat(void)
+{
+    GHashTable *addrs = g_hash_table_new(g_int64_hash, g_int64_equal);
+    GPtrArray *flat = g_ptr_array_new();
+    GHashTableIter iter;
+    GuestProfileStack *s;
+    GuestProfileAddr *a;
+
+    g_hash_table_iter_init(&iter, prof.stacks);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&s, NULL)) {
+        uint64_t pc = s->pc[0];
+
+        a = g_hash_table_lookup(addrs, &pc);
+        if (!a) {
+            a = g_new0(GuestProfileAddr, 1);
+            a->pc = pc;
+            g_hash_table_insert(addrs, &a->pc, a);
+            g_ptr_array_add(flat, a);
+        }
+        a->samples += s->samples;
+    }
+    g_hash_table_destroy(addrs);
+    g_ptr_array_sort(flat, guest_profile_addr_cmp);
+    return flat;
+}
+
+static void guest_profile_flat_free(GPtrArray *flat)
+{
+    g_ptr_array_foreach(flat, (GFunc)g_free, NULL);
+    g_ptr_array_free(flat, true);
+}
+
+static void guest_profile_dump_flat(FILE *f)
+{
+    GPtrArray *flat = guest_profile_flat();
+    guint i;
+
+    fprintf(f, "# %" PRIu64 " samples, %" PRIu64 " dropped\n",
+            prof.samples, prof.dropped);
+    fprintf(f, "# %10s %7s %18s  %s\n", "samples", "%", "guest pc", "symbol");
+    for (i = 0; i < flat->len; i++) {
+        GuestProfileAddr *a = g_ptr_array_index(flat, i);
+
+        fprintf(f, "%12" PRIu64 " %6.2f%% 0x" TARGET_FMT_lx "  %s\n",
+                a->samples, 100.0 * a->samples / prof.samples,
+                (target_ulong)a->pc, lookup_symbol(a->pc));
+    }
+    guest_profile_flat_free(flat);
+}
+
+static void guest_profile_dump_folded(FILE *f)
+{
+    GHashTableIter iter;
+    GuestProfileStack *s;
+    int i;
+
+    g_hash_table_iter_init(&iter, prof.stacks);
+    while (g_hash_table_iter_next(&iter, (gpointer *)&s, NULL)) {
+        fprintf(f, "cpu%d", s->cpu_index);
+        for (i = s->depth - 1; i >= 0; i--) {
+            const char *sym = lookup_symbol(s->pc[i]);
+
+            if (*sym) {
+                fprintf(f, ";%s", sym);
+            } else {
+                fprintf(f, ";0x" TARGET_FMT_lx, s->pc[i]);
+            }
+        }
+        fprintf(f, " %" PRIu64 "\n", s->samples);
+    }
+}
+
+void qmp_guest_profile_dump(const char *filename, bool has_format,
+                            GuestProfileFormat format, Error **errp)
+{
+    FILE *f;
+
+    if (!prof.stacks) {
+        error_setg(errp, "the guest profiler was never started");
+        return;
+    }
+    f = fopen(filename, "w");
+    if (!f) {
+        error_setg_file_open(errp, errno, filename);
+        return;
+    }
+
+    qemu_mutex_lock(&prof.lock);
+    if (has_format && format == GUEST_PROFILE_FORMAT_FOLDED) {
+        guest_profile_dump_folded(f);
+    } else {
+        guest_profile_dump_flat(f);
+    }
+    qemu_mutex_unlock(&prof.lock);
+
+    if (fclose(f)) {
+        error_setg_errno(errp, errno, "cannot write '%s'", filename);
+    }
+}
+
+GuestProfileInfo *qmp_query_guest_profile(Error **errp)
+{
+    GuestProfileInfo *info = g_new0(GuestProfileInfo, 1);
+    GuestProfileEntryList **tail = &info->hot;
+
+    if (!prof.stacks) {
+        return info;
+    }
+
+    qemu_mutex_lock(&prof.lock);
+    info->active = prof.active;
+    info->interval = prof.interval;
+    info->samples = prof.samples;
+    info->dropped = prof.dropped;
+    info->stacks = g_hash_table_size(prof.stacks);
+    if (prof.samples) {
+        GPtrArray *flat = guest_profile_flat();
+        guint i;
+
+        for (i = 0; i < flat->len && i < GUEST_PROFILE_HOT; i++) {
+            GuestProfileAddr *a = g_ptr_array_index(flat, i);
+            GuestProfileEntryList *e = g_new0(GuestProfileEntryList, 1);
+            const char *sym = lookup_symbol(a->pc);
+
+            e->value = g_new0(GuestProfileEntry, 1);
+            e->value->pc = a->pc;
+            e->value->samples = a->samples;
+            if (*sym) {
+                e->value->has_symbol = true;
+                e->value->symbol = g_strdup(sym);
+            }
+            *tail = e;
+            tail = &e->next;
+        }
+        info->has_hot = true;
+        guest_profile_flat_free(flat);
+    }
+    qemu_mutex_unlock(&prof.lock);
+    return info;
+}
@@ -1034,6 +1034,54 @@ gdb. Without -z|-l|-s, the dump format is ELF.
             together with begin.
 ETEXI
 
+    {
+        .name       = "guest-profile-start",
+        .args_type  = "interval:i?",
+        .params     = "[interval]",
+        .help       = "start sampling the guest pc of the running vCPUs,\n\t\t\t"
+                      "every 'interval' microseconds (default 1000)",
+        .mhandler.cmd = hmp_guest_profile_start,
+    },
+
+STEXI
+@item guest-profile-start [@var{interval}]
+@findex guest-profile-start
+Start sampling the guest pc of every running vCPU, and its guest call stack
+when the target can walk it, every @var{interval} microseconds.  Earlier
+samples are discarded.  Only available with TCG.
+ETEXI
+
+    {
+        .name       = "guest-profile-stop",
+        .args_type  = "",
+        .params     = "",
+        .help       = "stop sampling the guest pc",
+        .mhandler.cmd = hmp_guest_profile_stop,
+    },
+
+STEXI
+@item guest-profile-stop
+@findex guest-profile-stop
+Stop sampling.  The samples taken so far are kept.
+ETEXI
+
+    {
+        .name       = "guest-profile-dump",
+        .args_type  = "folded:-f,filename:F",
+        .params     = "[-f] filename",
+        .help       = "write the guest profile to 'filename'.\n\t\t\t"
+                      "-f: one line per call stack, for flamegraph.pl",
+        .mhandler.cmd = hmp_guest_profile_dump,
+    },
+
+STEXI
+@item guest-profile-dump [-f] @var{filename}
+@findex guest-profile-dump
+Write the samples of the guest profiler to @var{filename}: the number of
+samples of each guest pc, hottest first, or with @option{-f} the number of
+samples of each guest call stack, in the folded format of flamegraph.pl.
+ETEXI
+
     {
         .name       = "snapshot_blkdev",
         .args_type  = "reuse:-n,device:B,snapshot-file:s?,format:s?",
@@ -1732,6 +1780,8 @@ show virtual to physical memory mappings (i386, SH4, SPARC, PPC, and Xtensa only
 show the active virtual memory mappings (i386 only)
 @item info jit
 show dynamic compiler info
+@item info guest-profile
+show the state of the guest profiler and the hottest guest code
 @item info numa
 show NUMA information
 @item info kvm
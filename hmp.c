@@ -1368,6 +1368,62 @@ void hmp_dump_guest_memory(Monitor *mon, const QDict *qdict)
     g_free(prot);
 }
 
+void hmp_guest_profile_start(Monitor *mon, const QDict *qdict)
+{
+    Error *err = NULL;
+    bool has_interval = qdict_haskey(qdict, "interval");
+    int64_t interval = qdict_get_try_int(qdict, "interval", 0);
+
+    qmp_guest_profile_start(has_interval, interval, &err);
+    hmp_handle_error(mon, &err);
+}
+
+void hmp_guest_profile_stop(Monitor *mon, const QDict *qdict)
+{
+    Error *err = NULL;
+
+    qmp_guest_profile_stop(&err);
+    hmp_handle_error(mon, &err);
+}
+
+void hmp_guest_profile_dump(Monitor *mon, const QDict *qdict)
+{
+    Error *err = NULL;
+    int folded = qdict_get_try_bool(qdict, "folded", 0);
+    const char *filename = qdict_get_str(qdict, "filename");
+
+    qmp_guest_profile_dump(filename, true,
+                           folded ? GUEST_PROFILE_FORMAT_FOLDED
+                                  : GUEST_PROFILE_FORMAT_FLAT, &err);
+    hmp_handle_error(mon, &err);
+}
+
+void hmp_info_guest_profile(Monitor *mon, const QDict *qdict)
+{
+    GuestProfileInfo *info;
+    GuestProfileEntryList *e;
+    Error *err = NULL;
+
+    info = qmp_query_guest_profile(&err);
+    if (err) {
+        hmp_handle_error(mon, &err);
+        return;
+    }
+    monitor_printf(mon, "guest profiler: %s, interval %" PRId64 " us\n",
+                   info->active ? "active" : "stopped", info->interval);
+    monitor_printf(mon, "samples: %" PRId64 ", dropped: %" PRId64
+                   ", stacks: %" PRId64 "\n",
+                   info->samples, info->dropped, info->stacks);
+    for (e = info->hot; e; e = e->next) {
+        monitor_printf(mon, "%10" PRId64 " %6.2f%%  0x%016" PRIx64 "  %s\n",
+                       e->value->samples,
+                       100.0 * e->value->samples / info->samples,
+                       e->value->pc,
+                       e->value->has_symbol ? e->value->symbol : "");
+    }
+    qapi_free_GuestProfileInfo(info);
+}
+
 void hmp_netdev_add(Monitor *mon, const QDict *qdict)
 {
     Error *err = NULL;
@@ -78,6 +78,10 @@ void hmp_block_job_complete(Monitor *mon, const QDict *qdict);
 void hmp_migrate(Monitor *mon, const QDict *qdict);
 void hmp_device_del(Monitor *mon, const QDict *qdict);
 void hmp_dump_guest_memory(Monitor *mon, const QDict *qdict);
+void hmp_guest_profile_start(Monitor *mon, const QDict *qdict);
+void hmp_guest_profile_stop(Monitor *mon, const QDict *qdict);
+void hmp_guest_profile_dump(Monitor *mon, const QDict *qdict);
+void hmp_info_guest_profile(Monitor *mon, const QDict *qdict);
 void hmp_netdev_add(Monitor *mon, const QDict *qdict);
 void hmp_netdev_del(Monitor *mon, const QDict *qdict);
 void hmp_getfd(Monitor *mon, const QDict *qdict);
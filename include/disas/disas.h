@@ -6,6 +6,7 @@
 #ifdef NEED_CPU_H
 /* Disassemble this for me please... (debugging). */
 void disas(FILE *out, void *code, unsigned long size);
+int disas_host_insn_count(void *code, unsigned long size);
 void target_disas(FILE *out, CPUArchState *env, target_ulong code,
                   target_ulong size, int flags);
 
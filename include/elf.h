@@ -1465,6 +1465,9 @@ typedef struct elf64_shdr {
 #define NT_PPC_SPE       0x101          /* PowerPC SPE/EVR registers */
 #define NT_PPC_VSX       0x102          /* PowerPC VSX registers */
 
+/* Notes used in executables, with name "GNU" */
+#define NT_GNU_BUILD_ID  3
+
 
 /* Note header in a PT_NOTE section */
 typedef struct elf32_note {
@@ -239,6 +239,10 @@ int walk_memory_regions(void *, walk_memory_regions_fn);
 int page_get_flags(target_ulong address);
 void page_set_flags(target_ulong start, target_ulong end, int flags);
 int page_check_range(target_ulong start, target_ulong len, int flags);
+target_ulong page_find_range_empty(target_ulong min, target_ulong max,
+                                   target_ulong len, target_ulong align);
+target_ulong page_find_range_empty_top(target_ulong min, target_ulong max,
+                                       target_ulong len, target_ulong align);
 #endif
 
 CPUArchState *cpu_copy(CPUArchState *env);
@@ -69,8 +69,16 @@ typedef uint64_t target_ulong;
 #define TB_JMP_PAGE_MASK (TB_JMP_CACHE_SIZE - TB_JMP_PAGE_SIZE)
 
 #if !defined(CONFIG_USER_ONLY)
-#define CPU_TLB_BITS 8
-#define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
+/* The direct-mapped TLB of each MMU mode is resized on flush, depending
+   on how many of its entries were in use; see tlb_mmu_resize in cputlb.c. */
+#define CPU_TLB_DYN_MIN_BITS 6
+#define CPU_TLB_DYN_DEFAULT_BITS 8
+#if HOST_LONG_BITS == 32
+/* The index must come from the low word of the guest address.  */
+#define CPU_TLB_DYN_MAX_BITS (32 - TARGET_PAGE_BITS)
+#else
+#define CPU_TLB_DYN_MAX_BITS 20
+#endif
 /* use a fully associative victim tlb of 8 entries */
 #define CPU_VTLB_SIZE 8
 
@@ -102,14 +110,40 @@ typedef struct CPUTLBEntry {
 
 QEMU_BUILD_BUG_ON(sizeof(CPUTLBEntry) != (1 << CPU_TLB_ENTRY_BITS));
 
+/* Per MMU mode TLB storage and usage statistics, hanging off CPUState
+   because CPU reset clears CPU_COMMON.  */
+typedef struct CPUTLBDesc {
+    CPUTLBEntry *table;
+    hwaddr *iotlb;
+    size_t n_entries;
+    /* entries filled since the last flush of this MMU mode */
+    size_t n_used_entries;
+    /* live entries replaced by a different page since the last flush */
+    size_t n_evicted_entries;
+    /* largest n_used_entries seen since window_begin_ns */
+    size_t window_max_entries;
+    int64_t window_begin_ns;
+    /* Our TLB does not support large pages, so this region covers every
+       large page entered in this MMU mode (-1 if there is none).  */
+    target_ulong large_page_addr;
+    target_ulong large_page_mask;
+    /* range of the pages that were not entered with tlb_set_global_page,
+       i.e. those that tlb_flush(cpu, 0) must drop (empty if lo > hi) */
+    target_ulong nonglobal_lo;
+    target_ulong nonglobal_hi;
+} CPUTLBDesc;
+
+/* tlb_mask and tlb_table come first so that the TCG backends can reach
+   them with short offsets from AREG0.  tlb_flush() reloads them, as well
+   as iotlb, from the CPUTLBDesc array.  */
 #define CPU_COMMON_TLB \
     /* The meaning of the MMU modes is defined in the target code. */   \
-    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
+    /* (n_entries - 1) << CPU_TLB_ENTRY_BITS */                         \
+    uintptr_t tlb_mask[NB_MMU_MODES];                                   \
+    CPUTLBEntry *tlb_table[NB_MMU_MODES];                               \
     CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
-    hwaddr iotlb[NB_MMU_MODES][CPU_TLB_SIZE];                           \
+    hwaddr *iotlb[NB_MMU_MODES];                                        \
     hwaddr iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];                        \
-    target_ulong tlb_flush_addr;                                        \
-    target_ulong tlb_flush_mask;                                        \
     target_ulong vtlb_index;                                            \
 
 #else
@@ -70,6 +70,13 @@ typedef struct TranslationBlock TranslationBlock;
 
 #define OPPARAM_BUF_SIZE (OPC_BUF_SIZE * MAX_OPC_PARAM)
 
+/* Target words of per-insn state, besides the pc, that the translator
+   records in tcg_ctx.gen_opc_data[] for restore_state_to_opc().  */
+#define TCG_MAX_INSN_DATA 3
+#ifndef TARGET_INSN_DATA_WORDS
+#define TARGET_INSN_DATA_WORDS 0
+#endif
+
 #include "qemu/log.h"
 
 void gen_intermediate_code(CPUArchState *env, struct TranslationBlock *tb);
@@ -81,6 +88,9 @@ void cpu_gen_init(void);
 int cpu_gen_code(CPUArchState *env, struct TranslationBlock *tb,
                  int *gen_code_size_ptr);
 bool cpu_restore_state(CPUState *cpu, uintptr_t searched_pc);
+/* Check that the search table of a TB, stored in the LEN bytes at TABLE,
+   can be decoded without reading past them.  */
+bool tb_search_table_check(const uint8_t *table, size_t len);
 void page_size_init(void);
 
 void QEMU_NORETURN cpu_resume_from_signal(CPUState *cpu, void *puc);
@@ -88,6 +98,9 @@ void QEMU_NORETURN cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base, int flags,
                               int cflags);
+TranslationBlock *tb_gen_code_parallel(CPUState *cpu, target_ulong pc,
+                                       target_ulong cs_base, int flags);
+bool tb_publish(CPUState *cpu, TranslationBlock *tb);
 void cpu_exec_init(CPUArchState *env);
 void QEMU_NORETURN cpu_loop_exit(CPUState *cpu);
 int page_unprotect(target_ulong address, uintptr_t pc, void *puc);
@@ -98,26 +111,60 @@ void tb_invalidate_phys_range(tb_page_addr_t start, tb_page_addr_t end,
 #if !defined(CONFIG_USER_ONLY)
 void tcg_cpu_address_space_init(CPUState *cpu, AddressSpace *as);
 /* cputlb.c */
+void tlb_init(CPUState *cpu);
 void tlb_flush_page(CPUState *cpu, target_ulong addr);
+void tlb_flush_page_masked(CPUState *cpu, target_ulong addr,
+                           target_ulong mask);
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len);
+void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                               target_ulong len, uint16_t idxmap);
 void tlb_flush(CPUState *cpu, int flush_global);
+void tlb_flush_by_mmuidx(CPUState *cpu, uint16_t idxmap);
 void tlb_set_page(CPUState *cpu, target_ulong vaddr,
                   hwaddr paddr, int prot,
                   int mmu_idx, target_ulong size);
+void tlb_set_global_page(CPUState *cpu, target_ulong vaddr,
+                         hwaddr paddr, int prot,
+                         int mmu_idx, target_ulong size);
 void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr);
 #else
 static inline void tlb_flush_page(CPUState *cpu, target_ulong addr)
 {
 }
 
+static inline void tlb_flush_page_masked(CPUState *cpu, target_ulong addr,
+                                         target_ulong mask)
+{
+}
+
+static inline void tlb_flush_range(CPUState *cpu, target_ulong addr,
+                                   target_ulong len)
+{
+}
+
+static inline void tlb_flush_range_by_mmuidx(CPUState *cpu, target_ulong addr,
+                                             target_ulong len, uint16_t idxmap)
+{
+}
+
 static inline void tlb_flush(CPUState *cpu, int flush_global)
 {
 }
+
+static inline void tlb_flush_by_mmuidx(CPUState *cpu, uint16_t idxmap)
+{
+}
 #endif
 
+/* idxmap argument of the tlb_flush_*_by_mmuidx functions: a bit per
+   MMU mode */
+#define ALL_MMUIDX_BITS ((1 << NB_MMU_MODES) - 1)
+
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
 
-#define CODE_GEN_PHYS_HASH_BITS     15
-#define CODE_GEN_PHYS_HASH_SIZE     (1 << CODE_GEN_PHYS_HASH_BITS)
+/* initial size of the physical TB hash table; it grows as needed */
+#define CODE_GEN_HTABLE_BITS     15
+#define CODE_GEN_HTABLE_SIZE     (1 << CODE_GEN_HTABLE_BITS)
 
 /* estimated block size for TB allocation */
 /* XXX: use a per code average code fragment size and modulate it
@@ -147,8 +194,6 @@ struct TranslationBlock {
 #define CF_LAST_IO     0x8000 /* Last insn may be an IO access.  */
 
     void *tc_ptr;    /* pointer to the translated code */
-    /* next matching tb for physical address. */
-    struct TranslationBlock *phys_hash_next;
     /* first and second physical page containing code. The lower bit
        of the pointer tells the index in page_next[] */
     struct TranslationBlock *page_next[2];
@@ -169,27 +214,123 @@ struct TranslationBlock {
     struct TranslationBlock *jmp_next[2];
     struct TranslationBlock *jmp_first;
     uint32_t icount;
+    /* compressed map from host code offsets to the guest insns, and
+       their state, following the code; NULL if the TB has none and
+       cpu_restore_state must translate it again.  See encode_search().  */
+    uint8_t *tc_search;
+
+    /* profile used to build hot traces: the guest pc reached through
+       each jump slot, and how many times the slot was taken before
+       the jump was patched */
+    target_ulong trace_pc[2];
+    uint16_t trace_count[2];
+    /* non-NULL if this TB is a trace */
+    struct TBTrace *trace;
 };
 
+/* A trace is a single TB made of the code of several TBs that follow
+   each other along a hot path, usually the body of a loop.  Each member
+   falls through into the next one instead of jumping to it, so that
+   guest registers can stay in host registers and the optimizer sees the
+   whole path.  */
+#define TB_TRACE_MAX_MEMBERS 8
+
+typedef struct TBTraceMember {
+    target_ulong pc;
+    uint64_t flags;
+    uint16_t size;
+    /* jump slot that leads to the next member */
+    uint8_t slot;
+    /* position of the ops of the member in the trace; those that follow
+       the exit to the next member are moved to the end (rem_*) */
+    uint16_t op_start;
+    uint16_t op_len;
+    uint16_t rem_start;
+    uint16_t rem_len;
+} TBTraceMember;
+
+typedef struct TBTrace {
+    int nb_members;
+    TBTraceMember members[TB_TRACE_MAX_MEMBERS];
+} TBTrace;
+
 #include "exec/spinlock.h"
+#include "qemu/qht.h"
+
+/* The code buffer is split in regions that are filled in turn.  When the
+   last free one fills up, the oldest region is evicted and reused instead
+   of flushing the whole buffer.  In linux-user, each guest thread also
+   takes a free region for itself, which it fills without tb_lock (see
+   tb_gen_code_parallel).  */
+#define CODE_GEN_MAX_REGIONS 16
+
+typedef struct TBRegion {
+    uint8_t *start;
+    /* a TB may not start past this point */
+    uint8_t *end;
+    /* end of the generated code */
+    uint8_t *ptr;
+    TranslationBlock *tbs;
+    int nb_tbs;
+    int max_tbs;
+    /* filled by the translation context of a thread, and thus not to be
+       evicted nor filled by anybody else */
+    bool owned;
+} TBRegion;
+
+/* values of tb_flush_pending */
+#define TB_FLUSH_EVICT  1
+#define TB_FLUSH_ALL    2
 
 typedef struct TBContext TBContext;
 
 struct TBContext {
 
     TranslationBlock *tbs;
-    TranslationBlock *tb_phys_hash[CODE_GEN_PHYS_HASH_SIZE];
+    /* TBs indexed by tb_hash_func(); lookups do not need tb_lock */
+    QHT htable;
     int nb_tbs;
+    TBRegion regions[CODE_GEN_MAX_REGIONS];
+    int nb_regions;
+    /* the region filled with tb_lock held */
+    int cur_region;
+    size_t region_size;
     /* any access to the tbs or the page table must use this lock */
     spinlock_t tb_lock;
+    /* incremented before TBs are invalidated because guest code may have
+       changed, to catch the TBs translated without tb_lock meanwhile */
+    unsigned int code_write_gen;
+    /* set when the code buffer filled up while other vCPU threads may
+       still be executing from it; see tb_flush() */
+    int tb_flush_pending;
 
     /* statistics */
     int tb_flush_count;
+    int tb_evict_count;
+    int tb_evict_tb_count;
     int tb_phys_invalidate_count;
+    /* TBs invalidated by cause */
+    int tb_invalidate_smc_count;
+    int tb_invalidate_write_count;
+    int tb_invalidate_io_count;
+    int tb_invalidate_watch_count;
+    /* stores to pages holding code, and those the code bitmap filtered */
+    int tb_smc_write_count;
+    int tb_smc_filtered_count;
+    int tb_trace_count;
+    int tb_trace_member_count;
+    /* contended acquisitions of tb_lock, and the time (ns) spent waiting */
+    int tb_lock_wait_count;
+    int64_t tb_lock_wait_time;
+    /* TBs translated without tb_lock, and those dropped at publication */
+    int tb_parallel_count;
+    int tb_parallel_drop_count;
 
     int tb_invalidated_flag;
 };
 
+extern TBContext tb_ctx;
+
 static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc)
 {
     target_ulong tmp;
@@ -205,15 +346,76 @@ static inline unsigned int tb_jmp_cache_hash_func(target_ulong pc)
 	    | (tmp & TB_JMP_ADDR_MASK));
 }
 
-static inline unsigned int tb_phys_hash_func(tb_page_addr_t pc)
+static inline uint32_t tb_hash_func(tb_page_addr_t phys_pc, target_ulong pc,
+                                    uint64_t flags)
 {
-    return (pc >> 2) & (CODE_GEN_PHYS_HASH_SIZE - 1);
+    uint64_t h = ((uint64_t)phys_pc * 31 + pc) ^ (flags * 0x9e3779b97f4a7c15ULL);
+
+    /* 64-bit finalizer of MurmurHash3 */
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
 }
 
 void tb_free(TranslationBlock *tb);
 void tb_flush(CPUArchState *env);
+void tb_flush_pending_work(CPUArchState *env);
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
 
+/* Once invalidated, a TB must not be jumped to from other TBs any more,
+   as its code goes away with its region.  Call with tb_lock held.  */
+static inline bool tb_is_live(TranslationBlock *tb)
+{
+    return tb->page_addr[0] != -1;
+}
+bool tb_trace_profile(CPUState *cpu, TranslationBlock *last, int n,
+                      TranslationBlock **ptb);
+
+/* Number of times a backward jump is taken before the loop it closes is
+   made into a trace; 0 disables traces.  */
+extern unsigned hot_trace_threshold;
+
+/* True when more than one host thread may execute guest code at a time:
+   linux-user once the guest created a thread, system mode with
+   "-tcg thread=multi".  */
+extern bool parallel_cpus;
+
+void tb_lock(void);
+void tb_unlock(void);
+void tb_lock_reset(void);
+void dump_tb_lock_info(FILE *f, fprintf_function cpu_fprintf);
+
+#if defined(CONFIG_USER_ONLY)
+/* Each guest thread of linux-user translates in a TCG context of its own,
+   copied from the one of its parent with tcg_context_clone.  */
+struct TCGContext;
+void tcg_register_thread(struct TCGContext *s);
+void tcg_unregister_thread(void);
+void tcg_fork_end_child(void);
+#endif
+
+/* Protects the guest mappings and the page flags in linux-user; when both
+   are needed, take it before tb_lock.  */
+#if defined(CONFIG_USER_ONLY)
+void mmap_lock(void);
+void mmap_unlock(void);
+void mmap_lock_reset(void);
+#else
+static inline void mmap_lock(void) {}
+static inline void mmap_unlock(void) {}
+static inline void mmap_lock_reset(void) {}
+#endif
+
+/* Serialize guest atomic sequences between vCPU threads: the
+   tcg_gen_atomic_* helpers and ARM store-exclusive in system mode, and
+   the operations that have no host atomic (x86 cmpxchg16b).  */
+void cpu_atomic_lock(void);
+void cpu_atomic_unlock(void);
+void cpu_atomic_lock_reset(void);
+
 #if defined(USE_DIRECT_JUMP)
 
 #if defined(CONFIG_TCG_INTERPRETER)
@@ -309,7 +511,7 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
 /* GETRA is the true target of the return instruction that we'll execute,
    defined here for simplicity of defining the follow-up macros.  */
 #if defined(CONFIG_TCG_INTERPRETER)
-extern uintptr_t tci_tb_ptr;
+extern __thread uintptr_t tci_tb_ptr;
 # define GETRA() tci_tb_ptr
 #else
 # define GETRA() \
@@ -344,6 +546,9 @@ bool io_mem_write(struct MemoryRegion *mr, hwaddr addr,
 void tlb_fill(CPUState *cpu, target_ulong addr, int is_write, int mmu_idx,
               uintptr_t retaddr);
 
+/* guest-profile.c */
+void guest_profile_sample(CPUState *cpu);
+
 #endif
 
 #if defined(CONFIG_USER_ONLY)
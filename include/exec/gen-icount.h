@@ -5,34 +5,36 @@
 
 /* Helpers for instruction counting code generation.  */
 
-static TCGArg *icount_arg;
-static int icount_label;
-static int exitreq_label;
-
 static inline void gen_tb_start(void)
 {
     TCGv_i32 count;
     TCGv_i32 flag;
 
-    exitreq_label = gen_new_label();
+    if (tcg_ctx.trace_member) {
+        /* the head of the trace did the check */
+        tcg_ctx.exitreq_label = -1;
+        return;
+    }
+
+    tcg_ctx.exitreq_label = gen_new_label();
     flag = tcg_temp_new_i32();
     tcg_gen_ld_i32(flag, cpu_env,
                    offsetof(CPUState, tcg_exit_req) - ENV_OFFSET);
-    tcg_gen_brcondi_i32(TCG_COND_NE, flag, 0, exitreq_label);
+    tcg_gen_brcondi_i32(TCG_COND_NE, flag, 0, tcg_ctx.exitreq_label);
     tcg_temp_free_i32(flag);
 
     if (!use_icount)
         return;
 
-    icount_label = gen_new_label();
+    tcg_ctx.icount_label = gen_new_label();
     count = tcg_temp_local_new_i32();
     tcg_gen_ld_i32(count, cpu_env,
                    -ENV_OFFSET + offsetof(CPUState, icount_decr.u32));
     /* This is a horrid hack to allow fixing up the value later.  */
-    icount_arg = tcg_ctx.gen_opparam_ptr + 1;
+    tcg_ctx.icount_arg = tcg_ctx.gen_opparam_ptr + 1;
     tcg_gen_subi_i32(count, count, 0xdeadbeef);
 
-    tcg_gen_brcondi_i32(TCG_COND_LT, count, 0, icount_label);
+    tcg_gen_brcondi_i32(TCG_COND_LT, count, 0, tcg_ctx.icount_label);
     tcg_gen_st16_i32(count, cpu_env,
                      -ENV_OFFSET + offsetof(CPUState, icount_decr.u16.low));
     tcg_temp_free_i32(count);
@@ -40,12 +42,14 @@ static inline void gen_tb_start(void)
 
 static void gen_tb_end(TranslationBlock *tb, int num_insns)
 {
-    gen_set_label(exitreq_label);
-    tcg_gen_exit_tb((uintptr_t)tb + TB_EXIT_REQUESTED);
+    if (tcg_ctx.exitreq_label >= 0) {
+        gen_set_label(tcg_ctx.exitreq_label);
+        tcg_gen_exit_tb((uintptr_t)tb + TB_EXIT_REQUESTED);
+    }
 
     if (use_icount) {
-        *icount_arg = num_insns;
-        gen_set_label(icount_label);
+        *tcg_ctx.icount_arg = num_insns;
+        gen_set_label(tcg_ctx.icount_label);
         tcg_gen_exit_tb((uintptr_t)tb + TB_EXIT_ICOUNT_EXPIRED);
     }
 }
@@ -23,27 +23,44 @@
 
 #include <pthread.h>
 #define spin_lock pthread_mutex_lock
+#define spin_trylock pthread_mutex_trylock
 #define spin_unlock pthread_mutex_unlock
 #define spinlock_t pthread_mutex_t
 #define SPIN_LOCK_UNLOCKED PTHREAD_MUTEX_INITIALIZER
 
 #else
 
-/* Empty implementations, on the theory that system mode emulation
- * is single-threaded. This means that these functions should only
- * be used from code run in the TCG cpu thread, and cannot protect
- * data structures which might also be accessed from the IO thread
- * or from signal handlers.
+#include "qemu/atomic.h"
+
+/* System mode used to run every vCPU from a single thread, but with
+ * "-tcg thread=multi" each vCPU has its own host thread, so these must
+ * be real locks.  They protect short critical sections only (TB lookup
+ * and generation, guest atomic sequences), so a test-and-set spinlock
+ * is enough; it is uncontended, and thus cheap, in single-threaded mode.
+ * As before, they cannot protect data accessed from signal handlers.
  */
 typedef int spinlock_t;
 #define SPIN_LOCK_UNLOCKED 0
 
 static inline void spin_lock(spinlock_t *lock)
 {
+    while (atomic_xchg(lock, 1)) {
+        while (atomic_read(lock)) {
+            /* spin without hammering the cache line */
+        }
+    }
+}
+
+/* Returns 0 if the lock was taken, like pthread_mutex_trylock.  */
+static inline int spin_trylock(spinlock_t *lock)
+{
+    return atomic_xchg(lock, 1);
 }
 
 static inline void spin_unlock(spinlock_t *lock)
 {
+    smp_mb();
+    atomic_set(lock, 0);
 }
 
 #endif
@@ -109,6 +109,7 @@ void cpu_ticks_init(void);
 
 /* icount */
 void configure_icount(QemuOpts *opts, Error **errp);
+void configure_tcg(QemuOpts *opts, Error **errp);
 extern int use_icount;
 extern int icount_align_option;
 /* drift information for info jit command */
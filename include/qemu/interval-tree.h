@@ -0,0 +1,59 @@
+/*
+ * Interval tree: a red-black tree of [start, last] intervals
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+#ifndef QEMU_INTERVAL_TREE_H
+#define QEMU_INTERVAL_TREE_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct IntervalTreeNode IntervalTreeNode;
+typedef struct IntervalTreeRoot IntervalTreeRoot;
+
+/* Embed this in the structure that describes an interval.  Both ends of
+ * the interval are inclusive, so that it can reach the top of the address
+ * space.  Intervals may overlap.  The tree does no allocation.
+ */
+struct IntervalTreeNode {
+    IntervalTreeNode *parent;
+    IntervalTreeNode *left;
+    IntervalTreeNode *right;
+    bool red;
+    uint64_t start;
+    uint64_t last;
+    /* highest 'last' in the subtree rooted here */
+    uint64_t subtree_last;
+};
+
+struct IntervalTreeRoot {
+    IntervalTreeNode *root;
+};
+
+/* Add NODE, whose start and last must be set, to the tree.  */
+void interval_tree_insert(IntervalTreeNode *node, IntervalTreeRoot *root);
+
+/* Remove NODE from the tree; the caller owns its memory again.  */
+void interval_tree_remove(IntervalTreeNode *node, IntervalTreeRoot *root);
+
+/* Return the node with the lowest start among those that overlap
+ * [start, last], or NULL if none does.
+ */
+IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
+                                           uint64_t start, uint64_t last);
+
+/* Return the node after NODE, in the order of their starts, that overlaps
+ * [start, last], or NULL.  The tree must not change between the calls.
+ */
+IntervalTreeNode *interval_tree_iter_next(IntervalTreeNode *node,
+                                          uint64_t start, uint64_t last);
+
+static inline bool interval_tree_is_empty(const IntervalTreeRoot *root)
+{
+    return root->root == NULL;
+}
+
+#endif /* QEMU_INTERVAL_TREE_H */
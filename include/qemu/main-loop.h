@@ -299,6 +299,19 @@ void qemu_mutex_lock_iothread(void);
  */
 void qemu_mutex_unlock_iothread(void);
 
+/**
+ * qemu_mutex_iothread_locked: Return lock status of the main loop mutex.
+ *
+ * The main loop mutex is the coarsest lock in QEMU, and as such it
+ * must always be taken outside other locks.  This function helps
+ * functions take different paths depending on whether the current
+ * thread is running within the main loop mutex.
+ *
+ * NOTE: tools currently are single-threaded and the main loop mutex
+ * is always reported as taken there.
+ */
+bool qemu_mutex_iothread_locked(void);
+
 /* internal interfaces */
 
 void qemu_fd_register(int fd);
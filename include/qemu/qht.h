@@ -0,0 +1,102 @@
+/*
+ * QHT: hash table with lock-free lookups
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+#ifndef QEMU_QHT_H
+#define QEMU_QHT_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "qemu/thread.h"
+
+typedef struct QHT QHT;
+typedef struct QHTMap QHTMap;
+typedef struct QHTStats QHTStats;
+
+/* Called on every candidate whose hash matches; return true on a match.  */
+typedef bool (*qht_lookup_func_t)(const void *obj, const void *userp);
+typedef void (*qht_iter_func_t)(void *obj, uint32_t hash, void *userp);
+
+struct QHT {
+    QHTMap *map;
+    /* serializes writers; lookups never take it */
+    QemuMutex lock;
+    /* maps replaced by a resize; readers may still be walking them */
+    QHTMap *retired;
+    size_t min_buckets;
+    unsigned resizes;
+};
+
+struct QHTStats {
+    size_t head_buckets;
+    size_t used_head_buckets;
+    size_t overflow_buckets;
+    size_t entries;
+    size_t max_chain;
+    unsigned resizes;
+};
+
+/**
+ * qht_init: Initialize a hash table.
+ * @ht: the table
+ * @n_elems: number of entries the table is sized for initially
+ *
+ * The table grows as needed when entries are added.
+ */
+void qht_init(QHT *ht, size_t n_elems);
+
+/**
+ * qht_destroy: Free all memory used by a hash table.
+ */
+void qht_destroy(QHT *ht);
+
+/**
+ * qht_insert: Add @p to the table.
+ *
+ * Returns false if @p already was in the table.  Pointers must be
+ * non-NULL.  Concurrent lookups are allowed.
+ */
+bool qht_insert(QHT *ht, void *p, uint32_t hash);
+
+/**
+ * qht_remove: Remove @p from the table.
+ *
+ * Returns false if @p was not in the table.  Concurrent lookups are
+ * allowed.
+ */
+bool qht_remove(QHT *ht, const void *p, uint32_t hash);
+
+/**
+ * qht_lookup: Find an entry with hash @hash for which @func returns true.
+ *
+ * Never blocks and can run concurrently with writers; entries that are
+ * being added or removed at the same time may or may not be found.
+ * Returns NULL if there is no match.
+ */
+void *qht_lookup(QHT *ht, qht_lookup_func_t func, const void *userp,
+                 uint32_t hash);
+
+/**
+ * qht_reset: Remove all the entries from the table.
+ *
+ * This also frees the maps left over by earlier resizes, so it must only
+ * be called when no lookup can be in progress.
+ */
+void qht_reset(QHT *ht);
+
+/**
+ * qht_iter: Call @func on every entry of the table.
+ *
+ * @func must not modify the table.
+ */
+void qht_iter(QHT *ht, qht_iter_func_t func, void *userp);
+
+/**
+ * qht_statistics: Fill in @stats with the current shape of the table.
+ */
+void qht_statistics(QHT *ht, QHTStats *stats);
+
+#endif
@@ -93,6 +93,8 @@ struct TranslationBlock;
  * #TranslationBlock.
  * @handle_mmu_fault: Callback for handling an MMU fault.
  * @get_phys_page_debug: Callback for obtaining a physical address.
+ * @guest_backtrace: Callback for finding the return addresses of the
+ * current guest call stack, innermost first.  Returns how many it found.
  * @gdb_read_register: Callback for letting GDB read a register.
  * @gdb_write_register: Callback for letting GDB write a register.
  * @debug_excp_handler: Callback for handling debug exceptions.
@@ -138,6 +140,7 @@ typedef struct CPUClass {
     int (*handle_mmu_fault)(CPUState *cpu, vaddr address, int rw,
                             int mmu_index);
     hwaddr (*get_phys_page_debug)(CPUState *cpu, vaddr addr);
+    int (*guest_backtrace)(CPUState *cpu, vaddr *frames, int max);
     int (*gdb_read_register)(CPUState *cpu, uint8_t *buf, int reg);
     int (*gdb_write_register)(CPUState *cpu, uint8_t *buf, int reg);
     void (*debug_excp_handler)(CPUState *cpu);
@@ -187,6 +190,16 @@ typedef struct CPUWatchpoint {
     QTAILQ_ENTRY(CPUWatchpoint) entry;
 } CPUWatchpoint;
 
+/* Why guest accesses left the inline TLB fast path, for "info jit" */
+typedef struct TLBSlowPathStats {
+    uint64_t fill;             /* missed the tlb, filled by tlb_fill */
+    uint64_t victim;           /* missed the tlb, found in the victim tlb */
+    uint64_t io;               /* I/O, or write to a clean RAM page */
+    uint64_t unaligned;        /* unaligned within a RAM page */
+    uint64_t cross_page;       /* spans two RAM pages, done in one go */
+    uint64_t cross_page_split; /* spans two pages, split up */
+} TLBSlowPathStats;
+
 struct KVMState;
 struct kvm_run;
 
@@ -201,6 +214,8 @@ struct kvm_run;
  * @numa_node: NUMA node this CPU is belonging to.
  * @host_tid: Host thread ID.
  * @running: #true if CPU is currently running (usermode).
+ * @has_waiter: #true if an exclusive operation waits for the CPU to stop
+ *   running (usermode).
  * @created: Indicates whether the CPU thread has been successfully created.
  * @interrupt_request: Indicates a pending interrupt request.
  * @halted: Nonzero if the CPU is in suspended state.
@@ -208,6 +223,8 @@ struct kvm_run;
  * @stopped: Indicates the CPU has been artificially stopped.
  * @tcg_exit_req: Set to force TCG to stop executing linked TBs for this
  *           CPU and return to its top level loop.
+ * @profile_request: Set by the guest profiler, together with an exit
+ *           request, to take a sample when the CPU next stops between TBs.
  * @singlestep_enabled: Flags for single-stepping.
  * @icount_extra: Instructions until next timer event.
  * @icount_decr: Number of cycles left, with interrupt flag in high bit.
@@ -216,6 +233,14 @@ struct kvm_run;
  * @can_do_io: Nonzero if memory-mapped IO is safe.
  * @env_ptr: Pointer to subclass-specific CPUArchState field.
  * @current_tb: Currently executing TB.
+ * @tb_lookup_hit_count: Lookups of the next TB from generated code that
+ * found it.
+ * @tb_lookup_miss_count: Lookups from generated code that went back to
+ * cpu_exec.
+ * @tlb_d: Softmmu TLB sizing state and tables, one per MMU mode.  Kept
+ * outside of CPUArchState so that it survives CPU reset.
+ * @tlb_slow_stats: Softmmu TLB slow path counters, only ever updated by
+ * this CPU's thread.
  * @gdb_regs: Additional GDB registers.
  * @gdb_num_regs: Number of total registers accessible to GDB.
  * @gdb_num_g_regs: Number of registers in GDB 'g' packets.
@@ -243,6 +268,7 @@ struct CPUState {
     int thread_id;
     uint32_t host_tid;
     bool running;
+    bool has_waiter;
     struct QemuCond *halt_cond;
     struct qemu_work_item *queued_work_first, *queued_work_last;
     bool thread_kicked;
@@ -250,6 +276,7 @@ struct CPUState {
     bool stop;
     bool stopped;
     volatile sig_atomic_t exit_request;
+    volatile sig_atomic_t profile_request;
     uint32_t interrupt_request;
     int singlestep_enabled;
     int64_t icount_extra;
@@ -261,6 +288,10 @@ struct CPUState {
     void *env_ptr; /* CPUArchState */
     struct TranslationBlock *current_tb;
     struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    uint64_t tb_lookup_hit_count;
+    uint64_t tb_lookup_miss_count;
+    struct CPUTLBDesc *tlb_d;
+    TLBSlowPathStats tlb_slow_stats;
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
     int gdb_num_g_regs;
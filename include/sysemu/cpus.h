@@ -14,6 +14,19 @@ void cpu_clean_all_dirty(void);
 
 void qtest_clock_warp(int64_t dest);
 
+#ifndef CONFIG_USER_ONLY
+/* Stop every vCPU thread that is executing guest code and keep them out
+ * of cpu_exec until end_exclusive.  Must be called with the iothread lock
+ * held.  Only has an effect with "-tcg thread=multi".
+ */
+void start_exclusive(void);
+void end_exclusive(void);
+/* True between start_exclusive and end_exclusive, in the thread that
+ * called them.
+ */
+bool cpu_in_exclusive_section(void);
+#endif
+
 #ifndef CONFIG_USER_ONLY
 /* vl.c */
 extern int smp_cores;
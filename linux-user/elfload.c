@@ -15,6 +15,8 @@
 
 #include "qemu.h"
 #include "disas/disas.h"
+#include "tcg/perf.h"
+#include "vdso.h"
 
 #ifdef _ARCH_PPC64
 #undef ARCH_DLINFO
@@ -1555,6 +1557,9 @@ static abi_ulong create_elf_tables(abi_ulong p, int argc, int envc,
     size = (DLINFO_ITEMS + 1) * 2;
     if (k_platform)
         size += 2;
+    if (info->vdso) {
+        size += 2;
+    }
 #ifdef DLINFO_ARCH_ITEMS
     size += DLINFO_ARCH_ITEMS * 2;
 #endif
@@ -1600,6 +1605,9 @@ static abi_ulong create_elf_tables(abi_ulong p, int argc, int envc,
 
     if (k_platform)
         NEW_AUX_ENT(AT_PLATFORM, u_platform);
+    if (info->vdso) {
+        NEW_AUX_ENT(AT_SYSINFO_EHDR, info->vdso);
+    }
 #ifdef ARCH_DLINFO
     /*
      * ARCH_DLINFO must come last so platform specific code can enforce
@@ -1767,6 +1775,49 @@ exit_errmsg:
 }
 
 
+/* Look for a GNU build-id in the PT_NOTE segment PHDR, and copy it
+   to INFO.  */
+
+static void load_elf_build_id(int image_fd, char bprm_buf[BPRM_BUF_SIZE],
+                              struct elf_phdr *phdr, struct image_info *info)
+{
+    uint8_t buf[1024];
+    abi_ulong len = MIN(phdr->p_filesz, sizeof(buf));
+    abi_ulong pos = 0;
+
+    if (phdr->p_offset + len <= BPRM_BUF_SIZE) {
+        memcpy(buf, bprm_buf + phdr->p_offset, len);
+    } else if (pread(image_fd, buf, len, phdr->p_offset) != len) {
+        return;
+    }
+
+    while (pos + 12 <= len) {
+        uint32_t namesz, descsz, type;
+        abi_ulong desc;
+
+        memcpy(&namesz, buf + pos, 4);
+        memcpy(&descsz, buf + pos + 4, 4);
+        memcpy(&type, buf + pos + 8, 4);
+#ifdef BSWAP_NEEDED
+        bswap32s(&namesz);
+        bswap32s(&descsz);
+        bswap32s(&type);
+#endif
+        pos += 12;
+        desc = pos + ((namesz + 3) & ~3);
+        if (desc > len || descsz > len - desc) {
+            return;
+        }
+        if (type == NT_GNU_BUILD_ID && namesz == 4
+            && memcmp(buf + pos, "GNU", 4) == 0) {
+            info->build_id_len = MIN(descsz, sizeof(info->build_id));
+            memcpy(info->build_id, buf + desc, info->build_id_len);
+            return;
+        }
+        pos = desc + ((descsz + 3) & ~3);
+    }
+}
+
 /* Load an ELF image into the address space.
 
    IMAGE_NAME is the filename of the image, to use in error messages.
@@ -1963,6 +2014,8 @@ static void load_elf_image(const char *image_name, int image_fd,
                 goto exit_errmsg;
             }
             *pinterp_name = interp_name;
+        } else if (eppnt->p_type == PT_NOTE) {
+            load_elf_build_id(image_fd, bprm_buf, eppnt, info);
         }
     }
 
@@ -1972,7 +2025,7 @@ static void load_elf_image(const char *image_name, int image_fd,
         info->brk = info->end_code;
     }
 
-    if (qemu_log_enabled()) {
+    if (qemu_log_enabled() || perf_enabled()) {
         load_symbols(ehdr, image_fd, load_bias);
     }
 
@@ -2210,6 +2263,8 @@ int load_elf_binary(struct linux_binprm *bprm, struct image_info *info)
         }
     }
 
+    info->vdso = vdso_map();
+
     bprm->p = create_elf_tables(bprm->p, bprm->argc, bprm->envc, &elf_ex,
                                 info, (elf_interpreter ? &interp_info : NULL));
     info->start_stack = bprm->p;
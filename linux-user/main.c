@@ -30,6 +30,7 @@
 #include "qemu-common.h"
 #include "cpu.h"
 #include "tcg.h"
+#include "tcg/perf.h"
 #include "qemu/timer.h"
 #include "qemu/envlist.h"
 #include "elf.h"
@@ -42,6 +43,7 @@ const char *argv0;
 int gdbstub_port;
 envlist_t *envlist;
 static const char *cpu_model;
+static const char *tb_cache_dir;
 unsigned long mmap_min_addr;
 #if defined(CONFIG_USE_GUEST_BASE)
 unsigned long guest_base;
@@ -107,7 +109,7 @@ static int pending_cpus;
 /* Make sure everything is in a consistent state for calling fork().  */
 void fork_start(void)
 {
-    pthread_mutex_lock(&tcg_ctx.tb_ctx.tb_lock);
+    pthread_mutex_lock(&tb_ctx.tb_lock);
     pthread_mutex_lock(&exclusive_lock);
     mmap_fork_start();
 }
@@ -129,11 +131,12 @@ void fork_end(int child)
         pthread_mutex_init(&cpu_list_mutex, NULL);
         pthread_cond_init(&exclusive_cond, NULL);
         pthread_cond_init(&exclusive_resume, NULL);
-        pthread_mutex_init(&tcg_ctx.tb_ctx.tb_lock, NULL);
+        pthread_mutex_init(&tb_ctx.tb_lock, NULL);
+        tcg_fork_end_child();
         gdbserver_fork((CPUArchState *)thread_cpu->env_ptr);
     } else {
         pthread_mutex_unlock(&exclusive_lock);
-        pthread_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
+        pthread_mutex_unlock(&tb_ctx.tb_lock);
     }
 }
 
@@ -148,56 +151,87 @@ static inline void exclusive_idle(void)
 
 /* Start an exclusive operation.
    Must only be called from outside cpu_arm_exec.   */
-static inline void start_exclusive(void)
+void start_exclusive(void)
 {
     CPUState *other_cpu;
+    int running_cpus;
 
     pthread_mutex_lock(&exclusive_lock);
     exclusive_idle();
 
-    pending_cpus = 1;
-    /* Make all other cpus stop executing.  */
+    /* Make all other cpus stop executing.  Set pending_cpus before
+       looking at cpu->running, which cpu_exec_start sets before looking
+       at pending_cpus: either we see the cpu running, or it sees us.  */
+    atomic_set(&pending_cpus, 1);
+    smp_mb();
+    running_cpus = 0;
     CPU_FOREACH(other_cpu) {
-        if (other_cpu->running) {
-            pending_cpus++;
+        if (atomic_read(&other_cpu->running)) {
+            other_cpu->has_waiter = true;
+            running_cpus++;
             cpu_exit(other_cpu);
         }
     }
-    if (pending_cpus > 1) {
+    atomic_set(&pending_cpus, running_cpus + 1);
+    while (pending_cpus > 1) {
         pthread_cond_wait(&exclusive_cond, &exclusive_lock);
     }
 }
 
+/* Only meaningful in the thread that called start_exclusive, which keeps
+   exclusive_lock until end_exclusive.  */
+bool cpu_in_exclusive_section(void)
+{
+    return pending_cpus == 1;
+}
+
 /* Finish an exclusive operation.  */
-static inline void end_exclusive(void)
+void end_exclusive(void)
 {
-    pending_cpus = 0;
+    atomic_set(&pending_cpus, 0);
     pthread_cond_broadcast(&exclusive_resume);
     pthread_mutex_unlock(&exclusive_lock);
 }
 
-/* Wait for exclusive ops to finish, and begin cpu execution.  */
+/* Wait for exclusive ops to finish, and begin cpu execution.  Every
+   system call passes here and through cpu_exec_end, so exclusive_lock
+   is only taken while an exclusive operation is pending.  */
 static inline void cpu_exec_start(CPUState *cpu)
 {
-    pthread_mutex_lock(&exclusive_lock);
-    exclusive_idle();
-    cpu->running = true;
-    pthread_mutex_unlock(&exclusive_lock);
+    atomic_set(&cpu->running, true);
+    smp_mb();
+    if (unlikely(atomic_read(&pending_cpus))) {
+        pthread_mutex_lock(&exclusive_lock);
+        if (!cpu->has_waiter) {
+            /* not counted by start_exclusive, let it run first */
+            atomic_set(&cpu->running, false);
+            exclusive_idle();
+            atomic_set(&cpu->running, true);
+        }
+        /* otherwise cpu_exec_end releases the waiter */
+        pthread_mutex_unlock(&exclusive_lock);
+    }
 }
 
 /* Mark cpu as not executing, and release pending exclusive ops.  */
 static inline void cpu_exec_end(CPUState *cpu)
 {
-    pthread_mutex_lock(&exclusive_lock);
-    cpu->running = false;
-    if (pending_cpus > 1) {
-        pending_cpus--;
-        if (pending_cpus == 1) {
-            pthread_cond_signal(&exclusive_cond);
+    atomic_set(&cpu->running, false);
+    smp_mb();
+    if (unlikely(atomic_read(&pending_cpus))) {
+        pthread_mutex_lock(&exclusive_lock);
+        if (cpu->has_waiter) {
+            cpu->has_waiter = false;
+            if (--pending_cpus == 1) {
+                pthread_cond_signal(&exclusive_cond);
+            }
         }
+        pthread_mutex_unlock(&exclusive_lock);
     }
-    exclusive_idle();
-    pthread_mutex_unlock(&exclusive_lock);
+
+    /* evict the code that tb_gen_code could not, as other threads were
+       running from it */
+    tb_flush_pending_work(cpu->env_ptr);
 }
 
 void cpu_list_lock(void)
@@ -283,7 +317,9 @@ void cpu_loop(CPUX86State *env)
     target_siginfo_t info;
 
     for(;;) {
+        cpu_exec_start(cs);
         trapnr = cpu_x86_exec(env);
+        cpu_exec_end(cs);
         switch(trapnr) {
         case 0x80:
             /* linux syscall from int $0x80 */
@@ -540,20 +576,20 @@ do_kernel_trap(CPUARMState *env)
         /* ??? No-op. Will need to do better for SMP.  */
         break;
     case 0xffff0fc0: /* __kernel_cmpxchg */
-         /* XXX: This only works between threads, not between processes.
-            It's probably possible to implement this with native host
-            operations. However things like ldrex/strex are much harder so
-            there's not much point trying.  */
-        start_exclusive();
+        /* A host compare-and-swap, like store-exclusive in the generated
+           code, so the other threads keep running.  */
         cpsr = cpsr_read(env);
         addr = env->regs[2];
         /* FIXME: This should SEGV if the access fails.  */
-        if (get_user_u32(val, addr))
+        if (access_ok(VERIFY_WRITE, addr, 4)) {
+            val = atomic_cmpxchg((uint32_t *)g2h(addr),
+                                 tswap32(env->regs[0]),
+                                 tswap32(env->regs[1]));
+            val = tswap32(val);
+        } else {
             val = ~env->regs[0];
+        }
         if (val == env->regs[0]) {
-            val = env->regs[1];
-            /* FIXME: Check for segfaults.  */
-            put_user_u32(val, addr);
             env->regs[0] = 0;
             cpsr |= CPSR_C;
         } else {
@@ -561,7 +597,6 @@ do_kernel_trap(CPUARMState *env)
             cpsr &= ~CPSR_C;
         }
         cpsr_write(env, cpsr, CPSR_C);
-        end_exclusive();
         break;
     case 0xffff0fe0: /* __kernel_get_tls */
         env->regs[0] = env->cp15.tpidrro_el0;
@@ -584,90 +619,6 @@ do_kernel_trap(CPUARMState *env)
     return 0;
 }
 
-/* Store exclusive handling for AArch32 */
-static int do_strex(CPUARMState *env)
-{
-    uint64_t val;
-    int size;
-    int rc = 1;
-    int segv = 0;
-    uint32_t addr;
-    start_exclusive();
-    if (env->exclusive_addr != env->exclusive_test) {
-        goto fail;
-    }
-    /* We know we're always AArch32 so the address is in uint32_t range
-     * unless it was the -1 exclusive-monitor-lost value (which won't
-     * match exclusive_test above).
-     */
-    assert(extract64(env->exclusive_addr, 32, 32) == 0);
-    addr = env->exclusive_addr;
-    size = env->exclusive_info & 0xf;
-    switch (size) {
-    case 0:
-        segv = get_user_u8(val, addr);
-        break;
-    case 1:
-        segv = get_user_u16(val, addr);
-        break;
-    case 2:
-    case 3:
-        segv = get_user_u32(val, addr);
-        break;
-    default:
-        abort();
-    }
-    if (segv) {
-        env->exception.vaddress = addr;
-        goto done;
-    }
-    if (size == 3) {
-        uint32_t valhi;
-        segv = get_user_u32(valhi, addr + 4);
-        if (segv) {
-            env->exception.vaddress = addr + 4;
-            goto done;
-        }
-        val = deposit64(val, 32, 32, valhi);
-    }
-    if (val != env->exclusive_val) {
-        goto fail;
-    }
-
-    val = env->regs[(env->exclusive_info >> 8) & 0xf];
-    switch (size) {
-    case 0:
-        segv = put_user_u8(val, addr);
-        break;
-    case 1:
-        segv = put_user_u16(val, addr);
-        break;
-    case 2:
-    case 3:
-        segv = put_user_u32(val, addr);
-        break;
-    }
-    if (segv) {
-        env->exception.vaddress = addr;
-        goto done;
-    }
-    if (size == 3) {
-        val = env->regs[(env->exclusive_info >> 12) & 0xf];
-        segv = put_user_u32(val, addr + 4);
-        if (segv) {
-            env->exception.vaddress = addr + 4;
-            goto done;
-        }
-    }
-    rc = 0;
-fail:
-    env->regs[15] += 4;
-    env->regs[(env->exclusive_info >> 4) & 0xf] = rc;
-done:
-    end_exclusive();
-    return segv;
-}
-
 void cpu_loop(CPUARMState *env)
 {
     CPUState *cs = CPU(arm_env_get_cpu(env));
@@ -833,11 +784,6 @@ void cpu_loop(CPUARMState *env)
         case EXCP_INTERRUPT:
             /* just indicate that signals should be handled asap */
             break;
-        case EXCP_STREX:
-            if (!do_strex(env)) {
-                break;
-            }
-            /* fall through for segv */
         case EXCP_PREFETCH_ABORT:
         case EXCP_DATA_ABORT:
             addr = env->exception.vaddress;
@@ -883,7 +829,8 @@ void cpu_loop(CPUARMState *env)
 #else
 
 /*
- * Handle AArch64 store-release exclusive
+ * Handle AArch64 store-release exclusive of a pair of X registers; the
+ * other forms are a compare-and-swap in the generated code.
  *
  * rs = gets the status result of store exclusive
  * rt = is the register that is stored
@@ -1290,7 +1237,9 @@ void cpu_loop (CPUSPARCState *env)
     target_siginfo_t info;
 
     while (1) {
+        cpu_exec_start(cs);
         trapnr = cpu_sparc_exec (env);
+        cpu_exec_end(cs);
 
         /* Compute PSR before exposing state.  */
         if (env->cc_op != CC_OP_FLAGS) {
@@ -2330,55 +2279,6 @@ static const uint8_t mips_syscall_args[] = {
 #  undef MIPS_SYS
 # endif /* O32 */
 
-static int do_store_exclusive(CPUMIPSState *env)
-{
-    target_ulong addr;
-    target_ulong page_addr;
-    target_ulong val;
-    int flags;
-    int segv = 0;
-    int reg;
-    int d;
-
-    addr = env->lladdr;
-    page_addr = addr & TARGET_PAGE_MASK;
-    start_exclusive();
-    mmap_lock();
-    flags = page_get_flags(page_addr);
-    if ((flags & PAGE_READ) == 0) {
-        segv = 1;
-    } else {
-        reg = env->llreg & 0x1f;
-        d = (env->llreg & 0x20) != 0;
-        if (d) {
-            segv = get_user_s64(val, addr);
-        } else {
-            segv = get_user_s32(val, addr);
-        }
-        if (!segv) {
-            if (val != env->llval) {
-                env->active_tc.gpr[reg] = 0;
-            } else {
-                if (d) {
-                    segv = put_user_u64(env->llnewval, addr);
-                } else {
-                    segv = put_user_u32(env->llnewval, addr);
-                }
-                if (!segv) {
-                    env->active_tc.gpr[reg] = 1;
-                }
-            }
-        }
-    }
-    env->lladdr = -1;
-    if (!segv) {
-        env->active_tc.PC += 4;
-    }
-    mmap_unlock();
-    end_exclusive();
-    return segv;
-}
-
 /* Break codes */
 enum {
     BRK_OVERFLOW = 6,
@@ -2522,15 +2422,6 @@ done_syscall:
                   }
             }
             break;
-        case EXCP_SC:
-            if (do_store_exclusive(env)) {
-                info.si_signo = TARGET_SIGSEGV;
-                info.si_errno = 0;
-                info.si_code = TARGET_SEGV_MAPERR;
-                info._sifields._sigfault._addr = env->active_tc.PC;
-                queue_signal(env, info.si_signo, &info);
-            }
-            break;
         case EXCP_DSPDIS:
             info.si_signo = TARGET_SIGILL;
             info.si_errno = 0;
@@ -2658,7 +2549,9 @@ void cpu_loop(CPUOpenRISCState *env)
     int trapnr, gdbsig;
 
     for (;;) {
+        cpu_exec_start(cs);
         trapnr = cpu_exec(env);
+        cpu_exec_end(cs);
         gdbsig = 0;
 
         switch (trapnr) {
@@ -2746,7 +2639,9 @@ void cpu_loop(CPUSH4State *env)
     target_siginfo_t info;
 
     while (1) {
+        cpu_exec_start(cs);
         trapnr = cpu_sh4_exec (env);
+        cpu_exec_end(cs);
 
         switch (trapnr) {
         case 0x160:
@@ -2806,7 +2701,9 @@ void cpu_loop(CPUCRISState *env)
     target_siginfo_t info;
     
     while (1) {
+        cpu_exec_start(cs);
         trapnr = cpu_cris_exec (env);
+        cpu_exec_end(cs);
         switch (trapnr) {
         case 0xaa:
             {
@@ -2865,7 +2762,9 @@ void cpu_loop(CPUMBState *env)
     target_siginfo_t info;
     
     while (1) {
+        cpu_exec_start(cs);
         trapnr = cpu_mb_exec (env);
+        cpu_exec_end(cs);
         switch (trapnr) {
         case 0xaa:
             {
@@ -2968,7 +2867,9 @@ void cpu_loop(CPUM68KState *env)
     TaskState *ts = cs->opaque;
 
     for(;;) {
+        cpu_exec_start(cs);
         trapnr = cpu_m68k_exec(env);
+        cpu_exec_end(cs);
         switch(trapnr) {
         case EXCP_ILLEGAL:
             {
@@ -3105,7 +3006,9 @@ void cpu_loop(CPUAlphaState *env)
     abi_long sysret;
 
     while (1) {
+        cpu_exec_start(cs);
         trapnr = cpu_alpha_exec (env);
+        cpu_exec_end(cs);
 
         /* All of the traps imply a transition through PALcode, which
            implies an REI instruction has been executed.  Which means
@@ -3291,7 +3194,9 @@ void cpu_loop(CPUS390XState *env)
     target_ulong addr;
 
     while (1) {
+        cpu_exec_start(cs);
         trapnr = cpu_s390x_exec(env);
+        cpu_exec_end(cs);
         switch (trapnr) {
         case EXCP_INTERRUPT:
             /* Just indicate that signals should be handled asap.  */
@@ -3617,6 +3522,28 @@ static void handle_arg_singlestep(const char *arg)
     singlestep = 1;
 }
 
+static void handle_arg_tb_cache(const char *arg)
+{
+    tb_cache_dir = arg;
+}
+
+static void handle_arg_hot_trace(const char *arg)
+{
+    hot_trace_threshold = atoi(arg);
+    if (hot_trace_threshold > UINT16_MAX) {
+        fprintf(stderr, "-hot-trace: count must be at most %d\n", UINT16_MAX);
+        exit(1);
+    }
+}
+
+static void handle_arg_perf(const char *arg)
+{
+    if (!perf_enable(arg)) {
+        fprintf(stderr, "-perf: mode must be 'map' or 'jitdump'\n");
+        exit(1);
+    }
+}
+
 static void handle_arg_strace(const char *arg)
 {
     do_strace = 1;
@@ -3672,6 +3599,12 @@ static const struct qemu_argument arg_table[] = {
      "pagesize",   "set the host page size to 'pagesize'"},
     {"singlestep", "QEMU_SINGLESTEP",  false, handle_arg_singlestep,
      "",           "run in singlestep mode"},
+    {"tb-cache",   "QEMU_TB_CACHE",    true,  handle_arg_tb_cache,
+     "dir",        "reuse translated code across runs, saved in 'dir'"},
+    {"hot-trace",  "QEMU_HOT_TRACE",   true,  handle_arg_hot_trace,
+     "count",      "translate loops taken 'count' times as a whole"},
+    {"perf",       "QEMU_PERF",        true,  handle_arg_perf,
+     "map|jitdump", "describe translated code to Linux perf"},
     {"strace",     "QEMU_STRACE",      false, handle_arg_strace,
      "",           "log system calls"},
     {"version",    "QEMU_VERSION",     false, handle_arg_version,
@@ -4054,6 +3987,12 @@ int main(int argc, char **argv, char **envp)
     tcg_prologue_init(&tcg_ctx);
 #endif
 
+    /* translated code is not kept for a debugged program, which may
+       insert breakpoints */
+    if (tb_cache_dir && !gdbstub_port) {
+        tb_cache_init(tb_cache_dir, cpu_model, filename, info);
+    }
+
 #if defined(TARGET_I386)
     env->cr[0] = CR0_PG_MASK | CR0_WP_MASK | CR0_PE_MASK;
     env->hflags |= HF_PE_MASK | HF_CPL_MASK;
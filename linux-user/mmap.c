@@ -50,6 +50,16 @@ void mmap_unlock(void)
     }
 }
 
+/* Drop the lock if this thread holds it, after a longjmp out of code that
+   was run with the lock held.  */
+void mmap_lock_reset(void)
+{
+    if (mmap_lock_count) {
+        mmap_lock_count = 0;
+        pthread_mutex_unlock(&mmap_mutex);
+    }
+}
+
 /* Grab lock to make sure things are in a consistent state after fork().  */
 void mmap_fork_start(void)
 {
@@ -212,38 +222,26 @@ static abi_ulong mmap_find_vma_reserved(abi_ulong start, abi_ulong size)
 {
     abi_ulong addr;
     abi_ulong end_addr;
-    int prot;
-    int looped = 0;
 
     if (size > RESERVED_VA) {
         return (abi_ulong)-1;
     }
 
+    /* Take the highest free range that ends below start + size, else
+       the highest one below the top of the reserved space.  */
     size = HOST_PAGE_ALIGN(size);
     end_addr = start + size;
-    if (end_addr > RESERVED_VA) {
+    if (end_addr > RESERVED_VA || end_addr < start) {
         end_addr = RESERVED_VA;
     }
-    addr = end_addr - qemu_host_page_size;
-
-    while (1) {
-        if (addr > end_addr) {
-            if (looped) {
-                return (abi_ulong)-1;
-            }
-            end_addr = RESERVED_VA;
-            addr = end_addr - qemu_host_page_size;
-            looped = 1;
-            continue;
-        }
-        prot = page_get_flags(addr);
-        if (prot) {
-            end_addr = addr;
-        }
-        if (addr + size == end_addr) {
-            break;
-        }
-        addr -= qemu_host_page_size;
+    addr = page_find_range_empty_top(0, end_addr - 1, size,
+                                     qemu_host_page_size);
+    if (addr == (abi_ulong)-1 && end_addr != RESERVED_VA) {
+        addr = page_find_range_empty_top(0, RESERVED_VA - 1, size,
+                                         qemu_host_page_size);
+    }
+    if (addr == (abi_ulong)-1) {
+        return (abi_ulong)-1;
     }
 
     if (start == mmap_next_start) {
@@ -263,7 +261,7 @@ static abi_ulong mmap_find_vma_reserved(abi_ulong start, abi_ulong size)
 abi_ulong mmap_find_vma(abi_ulong start, abi_ulong size)
 {
     void *ptr, *prev;
-    abi_ulong addr;
+    abi_ulong addr, free_addr;
     int wrapped, repeat;
 
     /* If 'start' == 0, then a default start address is used. */
@@ -286,6 +284,14 @@ abi_ulong mmap_find_vma(abi_ulong start, abi_ulong size)
     prev = 0;
 
     for (;; prev = ptr) {
+        /* The ranges that the guest has mapped are mapped in the host
+           too: skip them without asking the kernel.  */
+        free_addr = page_find_range_empty(addr, (abi_ulong)-1, size,
+                                          TARGET_PAGE_SIZE);
+        if (free_addr != (abi_ulong)-1) {
+            addr = free_addr;
+        }
+
         /*
          * Reserve needed memory area to avoid a race.
          * It should be discarded using:
@@ -49,6 +49,10 @@ struct image_info {
         abi_ulong       arg_end;
         uint32_t        elf_flags;
 	int		personality;
+        /* GNU build-id note of the image, if any */
+        uint8_t         build_id[32];
+        uint32_t        build_id_len;
+        abi_ulong       vdso;   /* address of the vDSO image, or 0 */
 #ifdef CONFIG_USE_FDPIC
         abi_ulong       loadmap_addr;
         uint16_t        nsegs;
@@ -87,9 +91,16 @@ struct sigqueue {
     target_siginfo_t info;
 };
 
+/* Signals are queued by the thread itself, from its host signal handler
+   or its CPU loop, and taken by process_pending_signals, which a signal
+   may interrupt.  The queues are therefore lock-free: queue_signal pushes
+   onto INCOMING and the free list with atomic operations, and
+   process_pending_signals takes INCOMING whole before delivering from
+   FIRST.  */
 struct emulated_sigtable {
-    int pending; /* true if signal is pending */
-    struct sigqueue *first;
+    int pending; /* true while INFO is queued */
+    struct sigqueue *incoming; /* newest first, pushed by queue_signal */
+    struct sigqueue *first; /* oldest first, only seen by the consumer */
     struct sigqueue info; /* in order to always have memory for the
                              first signal, we put it here */
 };
@@ -200,6 +211,9 @@ int get_osversion(void);
 void init_qemu_uname_release(void);
 void fork_start(void);
 void fork_end(int child);
+void start_exclusive(void);
+void end_exclusive(void);
+bool cpu_in_exclusive_section(void);
 
 /* Creates the initial guest address space in the host memory space using
  * the given host start address hint and size.  The guest_start parameter
@@ -261,8 +275,6 @@ abi_long target_mremap(abi_ulong old_addr, abi_ulong old_size,
 int target_msync(abi_ulong start, abi_ulong len, int flags);
 extern unsigned long last_brk;
 extern abi_ulong mmap_next_start;
-void mmap_lock(void);
-void mmap_unlock(void);
 abi_ulong mmap_find_vma(abi_ulong, abi_ulong);
 void cpu_list_lock(void);
 void cpu_list_unlock(void);
@@ -272,6 +284,13 @@ void mmap_fork_end(int child);
 /* main.c */
 extern unsigned long guest_stack_size;
 
+/* tbcache.c */
+void tb_cache_init(const char *dir, const char *cpu_model,
+                   const char *filename, const struct image_info *info);
+bool tb_cache_restore(TranslationBlock *tb, int *code_size);
+void tb_cache_record(TranslationBlock *tb, int code_size);
+void tb_cache_save(void);
+
 /* user access */
 
 #define VERIFY_READ 0
@@ -417,14 +417,21 @@ void signal_init(void)
 
 /* signal queue handling */
 
+/* The free list is only pushed to by process_pending_signals, never from
+   a signal handler, so a pop cannot see an entry come back and the
+   compare-and-swap is enough.  */
 static inline struct sigqueue *alloc_sigqueue(CPUArchState *env)
 {
     CPUState *cpu = ENV_GET_CPU(env);
     TaskState *ts = cpu->opaque;
-    struct sigqueue *q = ts->first_free;
-    if (!q)
-        return NULL;
-    ts->first_free = q->next;
+    struct sigqueue *q, *next;
+
+    do {
+        q = atomic_read(&ts->first_free);
+        if (!q)
+            return NULL;
+        next = q->next;
+    } while (atomic_cmpxchg(&ts->first_free, q, next) != q);
     return q;
 }
 
@@ -432,9 +439,56 @@ static inline void free_sigqueue(CPUArchState *env, struct sigqueue *q)
 {
     CPUState *cpu = ENV_GET_CPU(env);
     TaskState *ts = cpu->opaque;
+    struct sigqueue *next;
+
+    do {
+        next = atomic_read(&ts->first_free);
+        q->next = next;
+    } while (atomic_cmpxchg(&ts->first_free, next, q) != next);
+}
+
+static inline void push_sigqueue(struct emulated_sigtable *k,
+                                 struct sigqueue *q)
+{
+    struct sigqueue *next;
+
+    do {
+        next = atomic_read(&k->incoming);
+        q->next = next;
+    } while (atomic_cmpxchg(&k->incoming, next, q) != next);
+}
+
+/* Take the oldest signal queued in K and copy its information to INFO.
+   Returns false if there is none.  */
+static bool dequeue_signal(CPUArchState *env, struct emulated_sigtable *k,
+                           target_siginfo_t *info)
+{
+    struct sigqueue *q, *next, *first;
 
-    q->next = ts->first_free;
-    ts->first_free = q;
+    if (!k->first) {
+        /* everything in K->incoming is newer than K->first */
+        q = atomic_xchg(&k->incoming, NULL);
+        first = NULL;
+        while (q) {
+            next = q->next;
+            q->next = first;
+            first = q;
+            q = next;
+        }
+        k->first = first;
+    }
+    q = k->first;
+    if (!q)
+        return false;
+    k->first = q->next;
+    *info = q->info;
+    if (q == &k->info) {
+        smp_mb();
+        atomic_set(&k->pending, 0);
+    } else {
+        free_sigqueue(env, q);
+    }
+    return true;
 }
 
 /* abort execution with signal */
@@ -496,7 +550,7 @@ int queue_signal(CPUArchState *env, int sig, target_siginfo_t *info)
     CPUState *cpu = ENV_GET_CPU(env);
     TaskState *ts = cpu->opaque;
     struct emulated_sigtable *k;
-    struct sigqueue *q, **pq;
+    struct sigqueue *q;
     abi_ulong handler;
     int queue;
 
@@ -540,31 +594,21 @@ int queue_signal(CPUArchState *env, int sig, target_siginfo_t *info)
     } else if (!queue && handler == TARGET_SIG_ERR) {
         force_sig(sig);
     } else {
-        pq = &k->first;
-        if (sig < TARGET_SIGRTMIN) {
+        if (atomic_cmpxchg(&k->pending, 0, 1) == 0) {
+            /* first signal */
+            q = &k->info;
+        } else if (sig < TARGET_SIGRTMIN) {
             /* if non real time signal, we queue exactly one signal */
-            if (!k->pending)
-                q = &k->info;
-            else
-                return 0;
+            return 0;
         } else {
-            if (!k->pending) {
-                /* first signal */
-                q = &k->info;
-            } else {
-                q = alloc_sigqueue(env);
-                if (!q)
-                    return -EAGAIN;
-                while (*pq != NULL)
-                    pq = &(*pq)->next;
-            }
+            q = alloc_sigqueue(env);
+            if (!q)
+                return -EAGAIN;
         }
-        *pq = q;
         q->info = *info;
-        q->next = NULL;
-        k->pending = 1;
+        push_sigqueue(k, q);
         /* signal that a new signal is pending */
-        ts->signal_pending = 1;
+        atomic_set(&ts->signal_pending, 1);
         return 1; /* indicates that the signal was queued */
     }
 }
@@ -5607,32 +5651,31 @@ void process_pending_signals(CPUArchState *cpu_env)
     target_sigset_t target_old_set;
     struct emulated_sigtable *k;
     struct target_sigaction *sa;
-    struct sigqueue *q;
+    target_siginfo_t info;
     TaskState *ts = cpu->opaque;
 
-    if (!ts->signal_pending)
+    if (!atomic_read(&ts->signal_pending))
         return;
 
-    /* FIXME: This is not threadsafe.  */
+    /* clear the flag before looking, so that a signal queued meanwhile
+       brings us back */
+    atomic_set(&ts->signal_pending, 0);
+    smp_mb();
     k = ts->sigtab;
     for(sig = 1; sig <= TARGET_NSIG; sig++) {
-        if (k->pending)
+        if (dequeue_signal(cpu_env, k, &info))
             goto handle_signal;
         k++;
     }
     /* if no signal is pending, just return */
-    ts->signal_pending = 0;
     return;
 
  handle_signal:
 #ifdef DEBUG_SIGNAL
     fprintf(stderr, "qemu: process signal %d\n", sig);
 #endif
-    /* dequeue signal */
-    q = k->first;
-    k->first = q->next;
-    if (!k->first)
-        k->pending = 0;
+    /* more signals may be queued, look again next time */
+    atomic_set(&ts->signal_pending, 1);
 
     sig = gdb_handlesig(cpu, sig);
     if (!sig) {
@@ -5690,16 +5733,14 @@ void process_pending_signals(CPUArchState *cpu_env)
         /* prepare the stack frame of the virtual CPU */
 #if defined(TARGET_ABI_MIPSN32) || defined(TARGET_ABI_MIPSN64)
         /* These targets do not have traditional signals.  */
-        setup_rt_frame(sig, sa, &q->info, &target_old_set, cpu_env);
+        setup_rt_frame(sig, sa, &info, &target_old_set, cpu_env);
 #else
         if (sa->sa_flags & TARGET_SA_SIGINFO)
-            setup_rt_frame(sig, sa, &q->info, &target_old_set, cpu_env);
+            setup_rt_frame(sig, sa, &info, &target_old_set, cpu_env);
         else
             setup_frame(sig, sa, &target_old_set, cpu_env);
 #endif
 	if (sa->sa_flags & TARGET_SA_RESETHAND)
             sa->_sa_handler = TARGET_SIG_DFL;
     }
-    if (q != &k->info)
-        free_sigqueue(cpu_env, q);
 }
@@ -114,6 +114,8 @@ int __clone2(int (*fn)(void *), void *child_stack_base,
 #include "uname.h"
 
 #include "qemu.h"
+#include "tcg.h"
+#include "vdso.h"
 
 #define CLONE_NPTL_FLAGS2 (CLONE_SETTLS | \
     CLONE_PARENT_SETTID | CLONE_CHILD_SETTID | CLONE_CHILD_CLEARTID)
@@ -721,6 +723,17 @@ abi_long do_brk(abi_ulong new_brk)
     return target_brk;
 }
 
+/* Guest arguments that the host can use in place: they have the host
+ * layout and byte order, and any address they hold is a host address too.
+ * syscall_init decides which ones qualify; the syscalls that take them
+ * then only check the guest permissions, and pass the guest memory to the
+ * host without copying or converting it.
+ */
+static bool direct_fdset;
+static bool direct_pollfd;
+static bool direct_iovec;
+static bool direct_sockaddr;
+
 static inline abi_long copy_from_user_fdset(fd_set *fds,
                                             abi_ulong target_fds_addr,
                                             int n)
@@ -757,7 +770,17 @@ static inline abi_ulong copy_from_user_fdset_ptr(fd_set *fds, fd_set **fds_ptr,
                                                  abi_ulong target_fds_addr,
                                                  int n)
 {
-    if (target_fds_addr) {
+    if (target_fds_addr && direct_fdset) {
+        /* the host reads and updates the guest set in place */
+        if (n < 0) {
+            return -TARGET_EINVAL;
+        }
+        if (!access_ok(VERIFY_WRITE, target_fds_addr,
+                       DIV_ROUND_UP(n, TARGET_ABI_BITS) * sizeof(abi_ulong))) {
+            return -TARGET_EFAULT;
+        }
+        *fds_ptr = g2h(target_fds_addr);
+    } else if (target_fds_addr) {
         if (copy_from_user_fdset(fds, target_fds_addr, n))
             return -TARGET_EFAULT;
         *fds_ptr = fds;
@@ -775,6 +798,11 @@ static inline abi_long copy_to_user_fdset(abi_ulong target_fds_addr,
     abi_long v;
     abi_ulong *target_fds;
 
+    if (direct_fdset) {
+        /* copy_from_user_fdset_ptr gave the guest set to the host */
+        return 0;
+    }
+
     nw = (n + TARGET_ABI_BITS - 1) / TARGET_ABI_BITS;
     if (!(target_fds = lock_user(VERIFY_WRITE,
                                  target_fds_addr,
@@ -1880,6 +1908,42 @@ static struct iovec *lock_iovec(int type, abi_ulong target_addr,
     return NULL;
 }
 
+/* Return the guest iovec array at TARGET_ADDR for the host to use in
+ * place, or NULL if it needs lock_iovec: the array cannot be used
+ * directly, or lock_iovec would have to fail it, shorten it, or skip a
+ * bad buffer in it.
+ */
+static struct iovec *direct_iovec_array(int type, abi_ulong target_addr,
+                                        int count)
+{
+    struct iovec *vec;
+    abi_ulong total_len, max_len;
+    int i;
+
+    if (!direct_iovec || count <= 0 || count > IOV_MAX ||
+        !access_ok(VERIFY_READ, target_addr, count * sizeof(struct iovec))) {
+        return NULL;
+    }
+    vec = g2h(target_addr);
+
+    max_len = 0x7fffffff & TARGET_PAGE_MASK;
+    total_len = 0;
+    /* check all the buffers under one lock */
+    mmap_lock();
+    for (i = 0; i < count; i++) {
+        abi_long len = vec[i].iov_len;
+
+        if (len < 0 || len > max_len - total_len ||
+            (len && !access_ok(type, (uintptr_t)vec[i].iov_base, len))) {
+            vec = NULL;
+            break;
+        }
+        total_len += len;
+    }
+    mmap_unlock();
+    return vec;
+}
+
 static void unlock_iovec(struct iovec *vec, abi_ulong target_addr,
                          int count, int copy)
 {
@@ -1983,6 +2047,13 @@ static abi_long do_bind(int sockfd, abi_ulong target_addr,
         return -TARGET_EINVAL;
     }
 
+    if (direct_sockaddr) {
+        if (!access_ok(VERIFY_READ, target_addr, addrlen)) {
+            return -TARGET_EFAULT;
+        }
+        return get_errno(bind(sockfd, g2h(target_addr), addrlen));
+    }
+
     addr = alloca(addrlen+1);
 
     ret = target_to_host_sockaddr(addr, target_addr, addrlen);
@@ -2003,6 +2074,13 @@ static abi_long do_connect(int sockfd, abi_ulong target_addr,
         return -TARGET_EINVAL;
     }
 
+    if (direct_sockaddr) {
+        if (!access_ok(VERIFY_READ, target_addr, addrlen)) {
+            return -TARGET_EFAULT;
+        }
+        return get_errno(connect(sockfd, g2h(target_addr), addrlen));
+    }
+
     addr = alloca(addrlen+1);
 
     ret = target_to_host_sockaddr(addr, target_addr, addrlen);
@@ -2287,11 +2365,19 @@ static abi_long do_sendto(int fd, abi_ulong msg, size_t len, int flags,
     if (!host_msg)
         return -TARGET_EFAULT;
     if (target_addr) {
-        addr = alloca(addrlen+1);
-        ret = target_to_host_sockaddr(addr, target_addr, addrlen);
-        if (ret) {
-            unlock_user(host_msg, msg, 0);
-            return ret;
+        if (direct_sockaddr) {
+            if (!access_ok(VERIFY_READ, target_addr, addrlen)) {
+                unlock_user(host_msg, msg, 0);
+                return -TARGET_EFAULT;
+            }
+            addr = g2h(target_addr);
+        } else {
+            addr = alloca(addrlen+1);
+            ret = target_to_host_sockaddr(addr, target_addr, addrlen);
+            if (ret) {
+                unlock_user(host_msg, msg, 0);
+                return ret;
+            }
         }
         ret = get_errno(sendto(fd, host_msg, len, flags, addr, addrlen));
     } else {
@@ -2323,14 +2409,26 @@ static abi_long do_recvfrom(int fd, abi_ulong msg, size_t len, int flags,
             ret = -TARGET_EINVAL;
             goto fail;
         }
-        addr = alloca(addrlen);
-        ret = get_errno(recvfrom(fd, host_msg, len, flags, addr, &addrlen));
+        if (direct_sockaddr) {
+            if (!access_ok(VERIFY_WRITE, target_addr, addrlen) ||
+                !access_ok(VERIFY_WRITE, target_addrlen, sizeof(addrlen))) {
+                ret = -TARGET_EFAULT;
+                goto fail;
+            }
+            addr = g2h(target_addr);
+            ret = get_errno(recvfrom(fd, host_msg, len, flags,
+                                     addr, g2h(target_addrlen)));
+        } else {
+            addr = alloca(addrlen);
+            ret = get_errno(recvfrom(fd, host_msg, len, flags,
+                                     addr, &addrlen));
+        }
     } else {
         addr = NULL; /* To keep compiler quiet.  */
         ret = get_errno(qemu_recv(fd, host_msg, len, flags));
     }
     if (!is_error(ret)) {
-        if (target_addr) {
+        if (target_addr && !direct_sockaddr) {
             host_to_target_sockaddr(target_addr, addr, addrlen);
             if (put_user_u32(addrlen, target_addrlen)) {
                 ret = -TARGET_EFAULT;
@@ -4424,6 +4522,7 @@ abi_long do_arch_prctl(CPUX86State *env, int code, abi_ulong addr)
 static pthread_mutex_t clone_lock = PTHREAD_MUTEX_INITIALIZER;
 typedef struct {
     CPUArchState *env;
+    TCGContext *tcg_context;
     pthread_mutex_t mutex;
     pthread_cond_t cond;
     pthread_t thread;
@@ -4444,6 +4543,7 @@ static void *clone_func(void *arg)
     cpu = ENV_GET_CPU(env);
     thread_cpu = cpu;
     ts = (TaskState *)cpu->opaque;
+    tcg_register_thread(info->tcg_context);
     info->tid = gettid();
     cpu->host_tid = info->tid;
     task_settid(ts);
@@ -4508,6 +4608,9 @@ static int do_fork(CPUArchState *env, unsigned int flags, abi_ulong newsp,
         if (nptl_flags & CLONE_SETTLS)
             cpu_set_tls (new_env, newtls);
 
+        /* From now on guest code runs in more than one host thread.  */
+        parallel_cpus = true;
+
         /* Grab a mutex so that thread setup appears atomic.  */
         pthread_mutex_lock(&clone_lock);
 
@@ -4516,6 +4619,7 @@ static int do_fork(CPUArchState *env, unsigned int flags, abi_ulong newsp,
         pthread_mutex_lock(&info.mutex);
         pthread_cond_init(&info.cond, NULL);
         info.env = new_env;
+        info.tcg_context = tcg_context_clone(&tcg_ctx);
         if (nptl_flags & CLONE_CHILD_SETTID)
             info.child_tidptr = child_tidptr;
         if (nptl_flags & CLONE_PARENT_SETTID)
@@ -4541,6 +4645,7 @@ static int do_fork(CPUArchState *env, unsigned int flags, abi_ulong newsp,
             if (flags & CLONE_PARENT_SETTID)
                 put_user_u32(ret, parent_tidptr);
         } else {
+            tcg_context_free(info.tcg_context);
             ret = -1;
         }
         pthread_mutex_unlock(&info.mutex);
@@ -4873,6 +4978,16 @@ void syscall_init(void)
         target_to_host_errno_table[host_to_target_errno_table[i]] = i;
     }
 
+#if !defined(DEBUG_REMAP) && \
+    defined(HOST_WORDS_BIGENDIAN) == defined(TARGET_WORDS_BIGENDIAN)
+    direct_sockaddr = true;
+    direct_pollfd = sizeof(struct target_pollfd) == sizeof(struct pollfd);
+    /* fd_set words are longs */
+    direct_fdset = TARGET_ABI_BITS == HOST_LONG_BITS;
+    /* and iovecs also hold guest addresses */
+    direct_iovec = TARGET_ABI_BITS == HOST_LONG_BITS && GUEST_BASE == 0;
+#endif
+
     /* we patch the ioctl size if necessary. We rely on the fact that
        no ioctl has all the bits at '1' in the size field */
     ie = ioctl_entries;
@@ -5123,7 +5238,12 @@ static inline abi_long host_to_target_stat64(void *cpu_env,
    are not really atomic probably breaks things.  However implementing
    futexes locally would make futexes shared between multiple processes
    tricky.  However they're probably useless because guest atomic
-   operations won't work either.  */
+   operations won't work either.
+
+   The futex word is handed to the host directly at its g2h address, so
+   that waiters and wakers meet in the host kernel without qemu keeping
+   any state of its own.  Only the values the kernel compares with guest
+   memory need swapping.  */
 static int do_futex(target_ulong uaddr, int op, int val, target_ulong timeout,
                     target_ulong uaddr2, int val3)
 {
@@ -5149,7 +5269,9 @@ static int do_futex(target_ulong uaddr, int op, int val, target_ulong timeout,
         return get_errno(sys_futex(g2h(uaddr), op, tswap32(val),
                          pts, NULL, val3));
     case FUTEX_WAKE:
-        return get_errno(sys_futex(g2h(uaddr), op, val, NULL, NULL, 0));
+    case FUTEX_WAKE_BITSET:
+        /* VAL3 is the bitset of FUTEX_WAKE_BITSET, and ignored otherwise */
+        return get_errno(sys_futex(g2h(uaddr), op, val, NULL, NULL, val3));
     case FUTEX_FD:
         return get_errno(sys_futex(g2h(uaddr), op, val, NULL, NULL, 0));
     case FUTEX_REQUEUE:
@@ -5166,6 +5288,30 @@ static int do_futex(target_ulong uaddr, int op, int val, target_ulong timeout,
                                    (base_op == FUTEX_CMP_REQUEUE
                                     ? tswap32(val3)
                                     : val3)));
+#if defined(HOST_WORDS_BIGENDIAN) == defined(TARGET_WORDS_BIGENDIAN)
+    /* The kernel stores the TID of the owner in the word of a PI futex,
+       which the guest can only read if no swapping is needed.  Guest
+       TIDs are host TIDs.  */
+    case FUTEX_LOCK_PI:
+    case FUTEX_TRYLOCK_PI:
+    case FUTEX_WAIT_REQUEUE_PI:
+        /* the timeout is absolute, FUTEX_TRYLOCK_PI ignores it */
+        if (timeout && base_op != FUTEX_TRYLOCK_PI) {
+            pts = &ts;
+            target_to_host_timespec(pts, timeout);
+        } else {
+            pts = NULL;
+        }
+        return get_errno(sys_futex(g2h(uaddr), op, val, pts,
+                                   base_op == FUTEX_WAIT_REQUEUE_PI
+                                   ? g2h(uaddr2) : NULL, 0));
+    case FUTEX_UNLOCK_PI:
+        return get_errno(sys_futex(g2h(uaddr), op, 0, NULL, NULL, 0));
+    case FUTEX_CMP_REQUEUE_PI:
+        pts = (struct timespec *)(uintptr_t) timeout;
+        return get_errno(sys_futex(g2h(uaddr), op, val, pts,
+                                   g2h(uaddr2), val3));
+#endif
     default:
         return -TARGET_ENOSYS;
     }
@@ -5473,6 +5619,14 @@ static int do_openat(void *cpu_env, int dirfd, const char *pathname, int flags,
     return get_errno(sys_openat(dirfd, path(pathname), flags, mode));
 }
 
+/* -d jit: contention of the guest threads on tb_lock */
+static void log_tb_lock_info(void)
+{
+    if (qemu_loglevel_mask(CPU_LOG_JIT)) {
+        dump_tb_lock_info(qemu_logfile, fprintf);
+    }
+}
+
 /* do_syscall() should always have a single exit point at the end so
    that actions, such as logging of syscall results, can be performed.
    All errnos that do_syscall() returns must be -TARGET_<errcode>. */
@@ -5517,12 +5671,15 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
             thread_cpu = NULL;
             object_unref(OBJECT(cpu));
             g_free(ts);
+            tcg_unregister_thread();
             pthread_exit(NULL);
         }
 #ifdef TARGET_GPROF
         _mcleanup();
 #endif
         gdb_exit(cpu_env, arg1);
+        tb_cache_save();
+        log_tb_lock_info();
         _exit(arg1);
         ret = 0; /* avoid warning */
         break;
@@ -5710,6 +5867,7 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
             }
             if (!(p = lock_user_string(arg1)))
                 goto execve_efault;
+            tb_cache_save();
             ret = get_errno(execve(p, argp, envp));
             unlock_user(p, arg1, 0);
 
@@ -5745,7 +5903,14 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
     case TARGET_NR_time:
         {
             time_t host_time;
-            ret = get_errno(time(&host_time));
+            struct timespec ts;
+
+            if (vdso_clock_gettime(CLOCK_REALTIME, &ts)) {
+                host_time = ts.tv_sec;
+                ret = host_time;
+            } else {
+                ret = get_errno(time(&host_time));
+            }
             if (!is_error(ret)
                 && arg1
                 && put_user_sal(host_time, arg1))
@@ -6558,7 +6723,15 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
     case TARGET_NR_gettimeofday:
         {
             struct timeval tv;
-            ret = get_errno(gettimeofday(&tv, NULL));
+            struct timespec ts;
+
+            if (vdso_clock_gettime(CLOCK_REALTIME, &ts)) {
+                tv.tv_sec = ts.tv_sec;
+                tv.tv_usec = ts.tv_nsec / 1000;
+                ret = 0;
+            } else {
+                ret = get_errno(gettimeofday(&tv, NULL));
+            }
             if (!is_error(ret)) {
                 if (copy_to_user_timeval(arg1, &tv))
                     goto efault;
@@ -7384,6 +7557,8 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
         _mcleanup();
 #endif
         gdb_exit(cpu_env, arg1);
+        tb_cache_save();
+        log_tb_lock_info();
         ret = get_errno(exit_group(arg1));
         break;
 #endif
@@ -7659,10 +7834,14 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
             if (!target_pfd)
                 goto efault;
 
-            pfd = alloca(sizeof(struct pollfd) * nfds);
-            for(i = 0; i < nfds; i++) {
-                pfd[i].fd = tswap32(target_pfd[i].fd);
-                pfd[i].events = tswap16(target_pfd[i].events);
+            if (direct_pollfd) {
+                pfd = (struct pollfd *)target_pfd;
+            } else {
+                pfd = alloca(sizeof(struct pollfd) * nfds);
+                for (i = 0; i < nfds; i++) {
+                    pfd[i].fd = tswap32(target_pfd[i].fd);
+                    pfd[i].events = tswap16(target_pfd[i].events);
+                }
             }
 
 # ifdef TARGET_NR_ppoll
@@ -7703,7 +7882,7 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
 # endif
                 ret = get_errno(poll(pfd, nfds, timeout));
 
-            if (!is_error(ret)) {
+            if (!is_error(ret) && !direct_pollfd) {
                 for(i = 0; i < nfds; i++) {
                     target_pfd[i].revents = tswap16(pfd[i].revents);
                 }
@@ -7719,7 +7898,12 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
         break;
     case TARGET_NR_readv:
         {
-            struct iovec *vec = lock_iovec(VERIFY_WRITE, arg2, arg3, 0);
+            struct iovec *vec = direct_iovec_array(VERIFY_WRITE, arg2, arg3);
+            if (vec != NULL) {
+                ret = get_errno(readv(arg1, vec, arg3));
+                break;
+            }
+            vec = lock_iovec(VERIFY_WRITE, arg2, arg3, 0);
             if (vec != NULL) {
                 ret = get_errno(readv(arg1, vec, arg3));
                 unlock_iovec(vec, arg2, arg3, 1);
@@ -7730,7 +7914,12 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
         break;
     case TARGET_NR_writev:
         {
-            struct iovec *vec = lock_iovec(VERIFY_READ, arg2, arg3, 1);
+            struct iovec *vec = direct_iovec_array(VERIFY_READ, arg2, arg3);
+            if (vec != NULL) {
+                ret = get_errno(writev(arg1, vec, arg3));
+                break;
+            }
+            vec = lock_iovec(VERIFY_READ, arg2, arg3, 1);
             if (vec != NULL) {
                 ret = get_errno(writev(arg1, vec, arg3));
                 unlock_iovec(vec, arg2, arg3, 0);
@@ -9094,7 +9283,11 @@ abi_long do_syscall(void *cpu_env, int num, abi_long arg1,
     case TARGET_NR_clock_gettime:
     {
         struct timespec ts;
-        ret = get_errno(clock_gettime(arg1, &ts));
+        if (vdso_clock_gettime(arg1, &ts)) {
+            ret = 0;
+        } else {
+            ret = get_errno(clock_gettime(arg1, &ts));
+        }
         if (!is_error(ret)) {
             host_to_target_timespec(arg2, &ts);
         }
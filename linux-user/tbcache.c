@@ -0,0 +1,572 @@
+/*
+ * Persistent cache of translated code
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "qemu.h"
+#include "qemu-common.h"
+#include "qemu/qht.h"
+#include "tcg.h"
+
+/* The host code of the TBs translated by a run is saved when the program
+   exits, and reused by later runs of the same program instead of
+   translating the guest code again.
+
+   A cache file holds the TBs of one guest executable, for one build of
+   QEMU and one host and guest configuration; all of these go into the
+   file name.  Entries are looked up by guest virtual address, which is
+   what translated code embeds, and are only used if the guest code at
+   that address still is the one they were translated from.
+
+   Translated code is made of position-independent instructions, and of
+   a few instructions that point to the TB itself, to helpers in the QEMU
+   executable or to the epilogue, or that use pc-relative addressing.
+   The TCG backend logs the latter (see TCGCodeReloc); they are saved
+   relative to what they point to, and emitted again when the code is
+   loaded at its new address.  TBs that embed other host pointers are
+   not saved.  */
+
+//#define DEBUG_TB_CACHE
+
+#define TB_CACHE_MAGIC "QEMUTBC2"
+
+/* entries from earlier runs and from this one, together */
+#define TB_CACHE_MAX_SIZE (64 * 1024 * 1024)
+
+/* A relocation that is emitted again with a longer encoding than the
+   saved one writes this much at most before it is rejected; the host
+   code of an entry leaves room for it in the code buffer.  */
+#define TB_CACHE_RELOC_SLACK 32
+#define TB_CACHE_MAX_HOST_SIZE \
+    (TCG_MAX_OP_SIZE * OPC_BUF_SIZE - TB_CACHE_RELOC_SLACK)
+
+typedef struct TBCacheHeader {
+    char magic[8];
+    uint64_t key;
+    uint64_t nb_entries;
+    uint64_t len;
+    /* of the entries, to catch a file damaged in other ways */
+    uint64_t sum;
+} TBCacheHeader;
+
+/* An entry is followed by its relocations, the guest code and the host
+   code, and is padded to 8 bytes.  The host code includes the search
+   table of the TB, if any, at search_offset.  */
+typedef struct TBCacheEntry {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t flags;
+    uint32_t host_size;
+    uint32_t search_offset;
+    uint16_t size;
+    uint16_t nb_relocs;
+    uint16_t tb_next_offset[2];
+    uint16_t tb_jmp_offset[2];
+    uint8_t parallel;
+    /* the guest code changed, or the code could not be moved */
+    uint8_t dead;
+    uint8_t pad[2];
+} TBCacheEntry;
+
+QEMU_BUILD_BUG_ON(sizeof(TBCacheEntry) % 8 || sizeof(TCGCodeReloc) % 8);
+
+typedef struct TBCacheDesc {
+    target_ulong pc;
+    target_ulong cs_base;
+    uint64_t flags;
+    bool parallel;
+} TBCacheDesc;
+
+typedef struct TBCache {
+    char *path;
+    uint64_t key;
+
+    /* entries loaded from the file, indexed by ht */
+    uint8_t *loaded;
+    size_t loaded_len;
+    QHT ht;
+
+    /* entries translated by this run */
+    uint8_t *out;
+    size_t out_len;
+    size_t out_size;
+
+    unsigned hits;
+    unsigned rejected;
+    unsigned recorded;
+} TBCache;
+
+extern char __executable_start[];
+extern char etext[];
+
+static TBCache tb_cache;
+static bool tb_cache_enabled;
+static TCGCodeReloc tb_cache_relocs[TCG_MAX_CODE_RELOCS];
+
+static inline size_t tb_cache_entry_len(const TBCacheEntry *e)
+{
+    return ROUND_UP(sizeof(*e) + e->nb_relocs * sizeof(TCGCodeReloc)
+                    + e->size + e->host_size, 8);
+}
+
+static inline TCGCodeReloc *tb_cache_entry_relocs(TBCacheEntry *e)
+{
+    return (TCGCodeReloc *)(e + 1);
+}
+
+static inline uint8_t *tb_cache_entry_guest(TBCacheEntry *e)
+{
+    return (uint8_t *)(tb_cache_entry_relocs(e) + e->nb_relocs);
+}
+
+static inline uint8_t *tb_cache_entry_host(TBCacheEntry *e)
+{
+    return tb_cache_entry_guest(e) + e->size;
+}
+
+static inline uint32_t tb_cache_hash(target_ulong pc, uint64_t flags)
+{
+    return tb_hash_func(pc, pc, flags);
+}
+
+static bool tb_cache_cmp(const void *p, const void *d)
+{
+    const TBCacheEntry *e = p;
+    const TBCacheDesc *desc = d;
+
+    return e->pc == desc->pc &&
+        e->cs_base == desc->cs_base &&
+        e->flags == desc->flags &&
+        e->parallel == desc->parallel &&
+        !e->dead;
+}
+
+#define TB_CACHE_FNV_INIT 0xcbf29ce484222325ULL
+
+static uint64_t tb_cache_fnv(uint64_t h, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    while (len--) {
+        h = (h ^ *p++) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t tb_cache_fnv_stat(uint64_t h, const struct stat *st)
+{
+    uint64_t v[4] = { st->st_dev, st->st_ino, st->st_size, st->st_mtime };
+
+    return tb_cache_fnv(h, v, sizeof(v));
+}
+
+/* Everything the translated code depends on, besides the guest code
+   itself which is checked entry by entry.  */
+static bool tb_cache_compute_key(const char *cpu_model, const char *filename,
+                                 const struct image_info *info,
+                                 uint64_t *key)
+{
+    uint64_t h = TB_CACHE_FNV_INIT;
+    uint64_t v[3];
+    struct stat st;
+
+    if (stat("/proc/self/exe", &st) < 0) {
+        return false;
+    }
+    h = tb_cache_fnv_stat(h, &st);
+    h = tb_cache_fnv(h, QEMU_VERSION, sizeof(QEMU_VERSION));
+    h = tb_cache_fnv(h, TARGET_NAME, sizeof(TARGET_NAME));
+    if (cpu_model) {
+        h = tb_cache_fnv(h, cpu_model, strlen(cpu_model) + 1);
+    }
+    v[0] = singlestep;
+    v[1] = GUEST_BASE;
+#ifdef TCG_TARGET_CODE_RELOCS
+    v[2] = tcg_target_code_features();
+#else
+    /* the TCG backend cannot move translated code */
+    return false;
+#endif
+    h = tb_cache_fnv(h, v, sizeof(v));
+
+    if (info->build_id_len) {
+        h = tb_cache_fnv(h, info->build_id, info->build_id_len);
+    } else {
+        if (stat(filename, &st) < 0) {
+            return false;
+        }
+        h = tb_cache_fnv_stat(h, &st);
+    }
+    *key = h;
+    return true;
+}
+
+/* The cache holds host code that is run as is, so only trust files and
+   directories that nobody but the user could have written.  */
+static bool tb_cache_private(const struct stat *st)
+{
+    return st->st_uid == geteuid() && !(st->st_mode & (S_IWGRP | S_IWOTH));
+}
+
+/* Check that whatever E points to in its host code lies inside it, and
+   that its relocations can be emitted again.  */
+static bool tb_cache_entry_check(TBCacheEntry *e)
+{
+    TCGCodeReloc *r = tb_cache_entry_relocs(e);
+    int i;
+
+    if (e->host_size == 0 || e->host_size > TB_CACHE_MAX_HOST_SIZE ||
+        e->nb_relocs > TCG_MAX_CODE_RELOCS) {
+        return false;
+    }
+    for (i = 0; i < 2; i++) {
+        if (e->tb_next_offset[i] == 0xffff) {
+            continue;
+        }
+        if (e->tb_next_offset[i] >= e->host_size) {
+            return false;
+        }
+#ifdef USE_DIRECT_JUMP
+        /* tb_set_jmp_target patches a 32-bit displacement there */
+        if (e->tb_jmp_offset[i] > e->host_size - sizeof(uint32_t)) {
+            return false;
+        }
+#endif
+    }
+    if (e->search_offset &&
+        (e->search_offset >= e->host_size ||
+         !tb_search_table_check(tb_cache_entry_host(e) + e->search_offset,
+                                e->host_size - e->search_offset))) {
+        return false;
+    }
+    for (i = 0; i < e->nb_relocs; i++) {
+        if (r[i].len == 0 || r[i].offset > e->host_size ||
+            r[i].len > e->host_size - r[i].offset ||
+            r[i].kind > TCG_CODE_RELOC_EPILOGUE ||
+            r[i].type > TCG_TYPE_I64 || r[i].reg >= TCG_TARGET_NB_REGS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void tb_cache_load(void)
+{
+    TBCacheHeader hdr;
+    struct stat st;
+    size_t pos;
+    int fd;
+
+    fd = open(tb_cache.path, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+        !tb_cache_private(&st) || st.st_size < sizeof(hdr) ||
+        st.st_size > sizeof(hdr) + TB_CACHE_MAX_SIZE ||
+        read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        memcmp(hdr.magic, TB_CACHE_MAGIC, sizeof(hdr.magic)) ||
+        hdr.key != tb_cache.key ||
+        hdr.len != st.st_size - sizeof(hdr)) {
+        goto out;
+    }
+
+    tb_cache.loaded = g_malloc(hdr.len);
+    if (read(fd, tb_cache.loaded, hdr.len) != hdr.len ||
+        tb_cache_fnv(TB_CACHE_FNV_INIT, tb_cache.loaded, hdr.len) != hdr.sum) {
+        goto fail;
+    }
+    qht_init(&tb_cache.ht,
+             MIN(hdr.nb_entries, hdr.len / sizeof(TBCacheEntry)));
+    for (pos = 0; pos < hdr.len; ) {
+        TBCacheEntry *e = (TBCacheEntry *)(tb_cache.loaded + pos);
+
+        if (hdr.len - pos < sizeof(*e) ||
+            e->host_size > TB_CACHE_MAX_HOST_SIZE ||
+            e->nb_relocs > TCG_MAX_CODE_RELOCS ||
+            hdr.len - pos < tb_cache_entry_len(e) ||
+            !tb_cache_entry_check(e)) {
+            qht_destroy(&tb_cache.ht);
+            goto fail;
+        }
+        e->dead = 0;
+        qht_insert(&tb_cache.ht, e, tb_cache_hash(e->pc, e->flags));
+        pos += tb_cache_entry_len(e);
+    }
+    tb_cache.loaded_len = hdr.len;
+    close(fd);
+    return;
+
+ fail:
+    g_free(tb_cache.loaded);
+    tb_cache.loaded = NULL;
+ out:
+    close(fd);
+}
+
+void tb_cache_init(const char *dir, const char *cpu_model,
+                   const char *filename, const struct image_info *info)
+{
+    struct stat st;
+
+    if (!tb_cache_compute_key(cpu_model, filename, info, &tb_cache.key)) {
+        return;
+    }
+    if ((mkdir(dir, 0700) < 0 && errno != EEXIST) ||
+        lstat(dir, &st) < 0 || !S_ISDIR(st.st_mode) ||
+        !tb_cache_private(&st)) {
+        return;
+    }
+    tb_cache.path = g_strdup_printf("%s/%016" PRIx64 ".tbc",
+                                    dir, tb_cache.key);
+    tb_cache_load();
+
+    tcg_ctx.code_relocs = tb_cache_relocs;
+    tb_cache_enabled = true;
+}
+
+/* Return the value saved for R, or false if the instruction points
+   somewhere that cannot be found again in another process.  */
+static bool tb_cache_encode_reloc(TCGCodeReloc *r, TranslationBlock *tb)
+{
+    uintptr_t start = (uintptr_t)__executable_start;
+    uintptr_t end = (uintptr_t)etext;
+
+    switch (r->kind) {
+    case TCG_CODE_RELOC_MOVI:
+        return true;
+    case TCG_CODE_RELOC_EXIT_TB:
+        if (r->value == 0) {
+            r->kind = TCG_CODE_RELOC_MOVI;
+            return true;
+        }
+        r->value -= (uintptr_t)tb;
+        return r->value >= 0 && r->value <= TB_EXIT_MASK;
+    case TCG_CODE_RELOC_CALL:
+    case TCG_CODE_RELOC_JMP:
+        if (r->value < start || r->value >= end) {
+            return false;
+        }
+        r->value -= start;
+        return true;
+    case TCG_CODE_RELOC_EPILOGUE:
+        r->value = 0;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static intptr_t tb_cache_decode_reloc(const TCGCodeReloc *r,
+                                      TranslationBlock *tb)
+{
+    switch (r->kind) {
+    case TCG_CODE_RELOC_EXIT_TB:
+        return (uintptr_t)tb + r->value;
+    case TCG_CODE_RELOC_CALL:
+    case TCG_CODE_RELOC_JMP:
+        return (uintptr_t)__executable_start + r->value;
+    default:
+        return r->value;
+    }
+}
+
+/* Fill in TB with saved code, if there is any for the guest code at
+   tb->pc.  Called with tb_lock held.  */
+bool tb_cache_restore(TranslationBlock *tb, int *code_size)
+{
+    TBCacheDesc desc;
+    TBCacheEntry *e;
+    TCGCodeReloc *r;
+    int i;
+
+    if (!tb_cache.loaded) {
+        return false;
+    }
+    desc.pc = tb->pc;
+    desc.cs_base = tb->cs_base;
+    desc.flags = tb->flags;
+    desc.parallel = parallel_cpus;
+    e = qht_lookup(&tb_cache.ht, tb_cache_cmp, &desc,
+                   tb_cache_hash(tb->pc, tb->flags));
+    if (!e || tb->cflags) {
+        return false;
+    }
+
+    if (page_check_range(e->pc, e->size, PAGE_READ) < 0 ||
+        memcmp(g2h(e->pc), tb_cache_entry_guest(e), e->size)) {
+        goto reject;
+    }
+    memcpy(tb->tc_ptr, tb_cache_entry_host(e), e->host_size);
+    r = tb_cache_entry_relocs(e);
+    for (i = 0; i < e->nb_relocs; i++) {
+        if (!tcg_code_reloc_apply(&tcg_ctx, tb->tc_ptr, &r[i],
+                                  tb_cache_decode_reloc(&r[i], tb))) {
+            goto reject;
+        }
+    }
+    flush_icache_range((uintptr_t)tb->tc_ptr,
+                       (uintptr_t)tb->tc_ptr + e->host_size);
+
+    tb->size = e->size;
+    tb->tc_search = e->search_offset ? (uint8_t *)tb->tc_ptr + e->search_offset
+                                     : NULL;
+    tb->tb_next_offset[0] = e->tb_next_offset[0];
+    tb->tb_next_offset[1] = e->tb_next_offset[1];
+#ifdef USE_DIRECT_JUMP
+    tb->tb_jmp_offset[0] = e->tb_jmp_offset[0];
+    tb->tb_jmp_offset[1] = e->tb_jmp_offset[1];
+#endif
+    *code_size = e->host_size;
+    tb_cache.hits++;
+    return true;
+
+ reject:
+    e->dead = 1;
+    tb_cache.rejected++;
+    return false;
+}
+
+/* Save the code that was just generated for TB.  Called with tb_lock
+   held, before the TB is chained to others.  */
+void tb_cache_record(TranslationBlock *tb, int code_size)
+{
+    TBCacheEntry *e;
+    TCGCodeReloc *r;
+    size_t len;
+    int i;
+
+    if (!tb_cache_enabled || tb->cflags || tcg_ctx.code_uncacheable ||
+        code_size > TB_CACHE_MAX_HOST_SIZE) {
+        return;
+    }
+    len = ROUND_UP(sizeof(*e) + tcg_ctx.nb_code_relocs * sizeof(*r)
+                   + tb->size + code_size, 8);
+    if (tb_cache.loaded_len + tb_cache.out_len + len > TB_CACHE_MAX_SIZE) {
+        return;
+    }
+    if (tb_cache.out_len + len > tb_cache.out_size) {
+        tb_cache.out_size = MAX(tb_cache.out_size * 2, 1024 * 1024);
+        tb_cache.out = g_realloc(tb_cache.out, tb_cache.out_size);
+    }
+
+    e = (TBCacheEntry *)(tb_cache.out + tb_cache.out_len);
+    memset(e, 0, len);
+    e->pc = tb->pc;
+    e->cs_base = tb->cs_base;
+    e->flags = tb->flags;
+    e->host_size = code_size;
+    e->search_offset = tb->tc_search ? tb->tc_search - (uint8_t *)tb->tc_ptr
+                                     : 0;
+    e->size = tb->size;
+    e->nb_relocs = tcg_ctx.nb_code_relocs;
+    e->tb_next_offset[0] = tb->tb_next_offset[0];
+    e->tb_next_offset[1] = tb->tb_next_offset[1];
+#ifdef USE_DIRECT_JUMP
+    e->tb_jmp_offset[0] = tb->tb_jmp_offset[0];
+    e->tb_jmp_offset[1] = tb->tb_jmp_offset[1];
+#endif
+    e->parallel = parallel_cpus;
+
+    r = tb_cache_entry_relocs(e);
+    memcpy(r, tcg_ctx.code_relocs, e->nb_relocs * sizeof(*r));
+    for (i = 0; i < e->nb_relocs; i++) {
+        if (!tb_cache_encode_reloc(&r[i], tb)) {
+            return;
+        }
+    }
+    memcpy(tb_cache_entry_guest(e), g2h(tb->pc), tb->size);
+    memcpy(tb_cache_entry_host(e), tb->tc_ptr, code_size);
+
+    tb_cache.out_len += len;
+    tb_cache.recorded++;
+}
+
+static bool tb_cache_write(int fd, const void *buf, size_t len)
+{
+    return qemu_write_full(fd, buf, len) == len;
+}
+
+/* Write the loaded entries that are still good, and the new ones.  The
+   file is replaced atomically, so that concurrent runs of the program
+   only lose each other's additions.  */
+void tb_cache_save(void)
+{
+    TBCacheHeader hdr;
+    char *tmp;
+    size_t pos, run;
+    bool ok = true;
+    int fd;
+
+    if (!tb_cache_enabled) {
+        return;
+    }
+    tb_lock();
+    if (!tb_cache.recorded && !tb_cache.rejected) {
+        goto out;
+    }
+
+    memcpy(hdr.magic, TB_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.key = tb_cache.key;
+    hdr.nb_entries = tb_cache.recorded;
+    hdr.len = tb_cache.out_len;
+    hdr.sum = TB_CACHE_FNV_INIT;
+    for (pos = 0; pos < tb_cache.loaded_len; ) {
+        TBCacheEntry *e = (TBCacheEntry *)(tb_cache.loaded + pos);
+
+        if (!e->dead) {
+            hdr.nb_entries++;
+            hdr.len += tb_cache_entry_len(e);
+            hdr.sum = tb_cache_fnv(hdr.sum, e, tb_cache_entry_len(e));
+        }
+        pos += tb_cache_entry_len(e);
+    }
+    hdr.sum = tb_cache_fnv(hdr.sum, tb_cache.out, tb_cache.out_len);
+
+    /* a new file that nobody else can have created or linked */
+    tmp = g_strdup_printf("%s.XXXXXX", tb_cache.path);
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+        g_free(tmp);
+        goto out;
+    }
+    ok = tb_cache_write(fd, &hdr, sizeof(hdr));
+
+    /* write runs of live entries at once */
+    for (pos = run = 0; ok && pos < tb_cache.loaded_len; ) {
+        TBCacheEntry *e = (TBCacheEntry *)(tb_cache.loaded + pos);
+        size_t len = tb_cache_entry_len(e);
+
+        if (e->dead) {
+            ok = tb_cache_write(fd, tb_cache.loaded + run, pos - run);
+            run = pos + len;
+        }
+        pos += len;
+    }
+    ok = ok && tb_cache_write(fd, tb_cache.loaded + run, pos - run);
+    ok = ok && tb_cache_write(fd, tb_cache.out, tb_cache.out_len);
+
+    close(fd);
+    if (!ok || rename(tmp, tb_cache.path) < 0) {
+        unlink(tmp);
+    }
+    g_free(tmp);
+
+#ifdef DEBUG_TB_CACHE
+    fprintf(stderr, "tb-cache: %u hits, %u rejected, %u new entries\n",
+            tb_cache.hits, tb_cache.rejected, tb_cache.recorded);
+#endif
+
+ out:
+    tb_unlock();
+}
@@ -0,0 +1,201 @@
+/*
+ * Guest vDSO
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "qemu.h"
+#include "qemu-common.h"
+#include "qemu/host-utils.h"
+#include "qemu/timer.h"
+#include "vdso.h"
+
+/* The vDSO lets guest programs read the clocks without a system call.
+   Its image is built from linux-user/<arch>/vdso.S; the clock functions
+   compute the time from the cycle counter of the guest and the time page
+   (see vdso.h), and fall back to the system call when the page is not
+   usable.
+
+   qemu plays the part of the timekeeping code of the kernel: it updates
+   the page whenever the guest makes one of the clock system calls, which
+   the vDSO does at least once per second of cycles.  The page therefore
+   starts disabled, until the counter is calibrated against the host
+   clock.  The emulated system calls return the time of the page too,
+   so that the monotonic clock never goes back whichever way the guest
+   reads it.  */
+
+#if defined(TARGET_X86_64)
+/* rdtsc reads cpu_get_real_ticks() (see cpu_get_tsc) */
+#include "vdso-image.hex"
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+/* cpu_get_real_ticks() is a free running cycle counter */
+#define VDSO_HOST_COUNTER
+#endif
+
+#define VDSO_SHIFT 32
+/* calibrate the counter over at least 10 ms before using the page */
+#define VDSO_CALIBRATE_NS (10 * 1000 * 1000LL)
+/* the largest lead over the host clock that one update makes up for */
+#define VDSO_MAX_LEAD_NS (100 * 1000 * 1000LL)
+#define NS_PER_SEC 1000000000LL
+
+static pthread_mutex_t vdso_lock = PTHREAD_MUTEX_INITIALIZER;
+/* host address of the time page, NULL without a vDSO */
+static uint8_t *vdso_time;
+/* first sample of the counter and of the host monotonic clock */
+static int64_t vdso_calib_tick, vdso_calib_ns;
+
+static int64_t vdso_time_base(int clock)
+{
+    return (int64_t)ldq_p(vdso_time + clock) * NS_PER_SEC +
+        (ldq_p(vdso_time + clock + 8) >> VDSO_SHIFT);
+}
+
+#ifdef VDSO_HOST_COUNTER
+static int64_t host_clock_ns(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static void vdso_time_set_base(int clock, int64_t ns)
+{
+    stq_p(vdso_time + clock, ns / NS_PER_SEC);
+    stq_p(vdso_time + clock + 8, (uint64_t)(ns % NS_PER_SEC) << VDSO_SHIFT);
+}
+#endif
+
+/* Move the page to the current time.  Called with vdso_lock held.  */
+static void vdso_update(void)
+{
+#ifdef VDSO_HOST_COUNTER
+    int64_t tick = cpu_get_real_ticks();
+    int64_t mono = host_clock_ns(CLOCK_MONOTONIC);
+    int64_t rt = host_clock_ns(CLOCK_REALTIME);
+    uint64_t mult, max_delta, lo, hi;
+
+    if (!vdso_calib_ns) {
+        vdso_calib_tick = tick;
+        vdso_calib_ns = mono;
+        return;
+    }
+    if (mono - vdso_calib_ns < VDSO_CALIBRATE_NS ||
+        tick <= vdso_calib_tick) {
+        return;
+    }
+    /* nanoseconds per tick, from the first sample on */
+    lo = (uint64_t)(mono - vdso_calib_ns) << VDSO_SHIFT;
+    hi = (uint64_t)(mono - vdso_calib_ns) >> (64 - VDSO_SHIFT);
+    if (divu128(&lo, &hi, tick - vdso_calib_tick) || !lo) {
+        return;
+    }
+    mult = lo;
+    /* one second worth of ticks, so that the vDSO cannot overflow */
+    max_delta = ((uint64_t)NS_PER_SEC << VDSO_SHIFT) / mult;
+
+    if (ldq_p(vdso_time + VDSO_TIME_MAX_DELTA)) {
+        /* the most the guest may have read from the page */
+        uint64_t delta = tick - ldq_p(vdso_time + VDSO_TIME_TICK_BASE);
+        int64_t prev;
+
+        if ((int64_t)delta < 0) {
+            delta = 0;
+        }
+        delta = MIN(delta, ldq_p(vdso_time + VDSO_TIME_MAX_DELTA));
+        prev = vdso_time_base(VDSO_TIME_MONOTONIC) +
+            ((delta * ldq_p(vdso_time + VDSO_TIME_MULT)) >> VDSO_SHIFT);
+        if (prev > mono) {
+            /* don't go back, but slow down to catch up with the host
+               within max_delta */
+            int64_t lead = MIN(prev - mono, VDSO_MAX_LEAD_NS);
+
+            mult -= ((uint64_t)lead << VDSO_SHIFT) / max_delta;
+            rt += prev - mono;
+            mono = prev;
+        }
+    }
+
+    stl_p(vdso_time + VDSO_TIME_SEQ, ldl_p(vdso_time + VDSO_TIME_SEQ) + 1);
+    smp_wmb();
+    stl_p(vdso_time + VDSO_TIME_SHIFT, VDSO_SHIFT);
+    stq_p(vdso_time + VDSO_TIME_MULT, mult);
+    stq_p(vdso_time + VDSO_TIME_TICK_BASE, tick);
+    stq_p(vdso_time + VDSO_TIME_MAX_DELTA, max_delta);
+    vdso_time_set_base(VDSO_TIME_REALTIME, rt);
+    vdso_time_set_base(VDSO_TIME_MONOTONIC, mono);
+    smp_wmb();
+    stl_p(vdso_time + VDSO_TIME_SEQ, ldl_p(vdso_time + VDSO_TIME_SEQ) + 1);
+#endif
+}
+
+/* Map the vDSO of the guest, with its time page below it.  Returns its
+   address, or 0 if the guest has none.  */
+abi_ulong vdso_map(void)
+{
+#ifdef TARGET_X86_64
+    abi_ulong size = TARGET_PAGE_SIZE + TARGET_PAGE_ALIGN(sizeof(vdso_image));
+    abi_long base;
+
+    base = target_mmap(0, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == -1) {
+        return 0;
+    }
+    memcpy(g2h(base + TARGET_PAGE_SIZE), vdso_image, sizeof(vdso_image));
+    target_mprotect(base + TARGET_PAGE_SIZE, size - TARGET_PAGE_SIZE,
+                    PROT_READ | PROT_EXEC);
+    /* read-only for the guest, but qemu keeps writing to it */
+    page_set_flags(base, base + TARGET_PAGE_SIZE, PAGE_VALID | PAGE_READ);
+
+    vdso_time = g2h(base);
+    pthread_mutex_lock(&vdso_lock);
+    vdso_update();
+    pthread_mutex_unlock(&vdso_lock);
+    return base + TARGET_PAGE_SIZE;
+#else
+    return 0;
+#endif
+}
+
+/* Read CLK for a system call of the guest, consistently with the vDSO.
+   Returns false if the host must be asked instead.  */
+bool vdso_clock_gettime(clockid_t clk, struct timespec *ts)
+{
+    int64_t ns;
+
+    switch (clk) {
+    case CLOCK_REALTIME:
+    case CLOCK_REALTIME_COARSE:
+    case CLOCK_MONOTONIC:
+    case CLOCK_MONOTONIC_COARSE:
+        break;
+    default:
+        return false;
+    }
+    if (!vdso_time) {
+        return false;
+    }
+    pthread_mutex_lock(&vdso_lock);
+    vdso_update();
+    if (!ldq_p(vdso_time + VDSO_TIME_MAX_DELTA)) {
+        pthread_mutex_unlock(&vdso_lock);
+        return false;
+    }
+    ns = vdso_time_base(clk == CLOCK_REALTIME || clk == CLOCK_REALTIME_COARSE
+                        ? VDSO_TIME_REALTIME : VDSO_TIME_MONOTONIC);
+    pthread_mutex_unlock(&vdso_lock);
+    ts->tv_sec = ns / NS_PER_SEC;
+    ts->tv_nsec = ns % NS_PER_SEC;
+    return true;
+}
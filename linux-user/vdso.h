@@ -0,0 +1,43 @@
+/*
+ * Guest vDSO time page
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef LINUX_USER_VDSO_H
+#define LINUX_USER_VDSO_H
+
+/* The page just below the vDSO image holds the state of the guest clocks,
+   which qemu updates like the kernel does with its vvar page.  It is
+   included by the assembly of the images, hence the plain offsets.
+
+   A guest reads the cycle counter, subtracts TICK_BASE and, unless the
+   difference exceeds MAX_DELTA, gets the time as the seconds of a clock
+   plus ((delta * MULT + nsec of the clock) >> SHIFT) nanoseconds.  SEQ
+   is odd while qemu updates the page; MAX_DELTA is 0 when the page must
+   not be used at all.  */
+#define VDSO_TIME_SEQ           0       /* uint32_t */
+#define VDSO_TIME_SHIFT         4       /* uint32_t */
+#define VDSO_TIME_MULT          8       /* uint64_t */
+#define VDSO_TIME_TICK_BASE     16      /* uint64_t */
+#define VDSO_TIME_MAX_DELTA     24      /* uint64_t */
+/* int64_t seconds, then uint64_t nanoseconds << SHIFT */
+#define VDSO_TIME_REALTIME      32
+#define VDSO_TIME_MONOTONIC     48
+
+#ifndef __ASSEMBLER__
+abi_ulong vdso_map(void);
+bool vdso_clock_gettime(clockid_t clk, struct timespec *ts);
+#endif
+
+#endif
@@ -24,7 +24,10 @@
 
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
+#include "exec/exec-all.h"
 #include "sysemu/sysemu.h"
+#include "sysemu/cpus.h"
+#include "qemu/main-loop.h"
 
 //#define DEBUG_UNASSIGNED
 
@@ -802,6 +805,12 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
+            /* vCPU threads running guest code without the iothread lock
+               look up the dispatch tables and their own TLBs; keep them
+               out while both are rebuilt.  */
+            if (parallel_cpus) {
+                start_exclusive();
+            }
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
@@ -809,6 +818,9 @@ void memory_region_transaction_commit(void)
             }
 
             MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
+            if (parallel_cpus) {
+                end_exclusive();
+            }
         } else if (ioeventfd_update_pending) {
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
                 address_space_update_ioeventfds(as);
@@ -1947,15 +1959,38 @@ void address_space_destroy(AddressSpace *as)
     g_free(as->ioeventfds);
 }
 
+/* With "-tcg thread=multi" vCPU threads reach device emulation without
+ * the iothread lock.
+ */
 bool io_mem_read(MemoryRegion *mr, hwaddr addr, uint64_t *pval, unsigned size)
 {
-    return memory_region_dispatch_read(mr, addr, pval, size);
+    bool unlocked = parallel_cpus && !qemu_mutex_iothread_locked();
+    bool ret;
+
+    if (unlocked) {
+        qemu_mutex_lock_iothread();
+    }
+    ret = memory_region_dispatch_read(mr, addr, pval, size);
+    if (unlocked) {
+        qemu_mutex_unlock_iothread();
+    }
+    return ret;
 }
 
 bool io_mem_write(MemoryRegion *mr, hwaddr addr,
                   uint64_t val, unsigned size)
 {
-    return memory_region_dispatch_write(mr, addr, val, size);
+    bool unlocked = parallel_cpus && !qemu_mutex_iothread_locked();
+    bool ret;
+
+    if (unlocked) {
+        qemu_mutex_lock_iothread();
+    }
+    ret = memory_region_dispatch_write(mr, addr, val, size);
+    if (unlocked) {
+        qemu_mutex_unlock_iothread();
+    }
+    return ret;
 }
 
 typedef struct MemoryRegionList MemoryRegionList;
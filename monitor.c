@@ -2735,6 +2735,13 @@ static mon_cmd_t info_cmds[] = {
         .help       = "show dynamic compiler info",
         .mhandler.cmd = do_info_jit,
     },
+    {
+        .name       = "guest-profile",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the state of the guest profiler",
+        .mhandler.cmd = hmp_info_guest_profile,
+    },
     {
         .name       = "kvm",
         .args_type  = "",
@@ -3162,6 +3162,40 @@ STEXI
 Set TB size.
 ETEXI
 
+DEF("tcg", HAS_ARG, QEMU_OPTION_tcg, \
+    "-tcg [thread=single|multi][,hot-trace=n][,perf=map|jitdump]\n" \
+    "                run all TCG vCPUs from one host thread (default) or\n" \
+    "                give each vCPU its own host thread\n" \
+    "                hot-trace=n: translate loops taken n times as a whole\n" \
+    "                perf=map|jitdump: describe translated code to Linux perf\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tcg [thread=single|multi][,hot-trace=@var{n}][,perf=map|jitdump]
+@findex -tcg
+Select how the TCG accelerator maps guest vCPUs to host threads.  With
+@option{thread=single} (the default) every vCPU is run in turn by a single
+host thread.  With @option{thread=multi} each vCPU gets its own host thread,
+so an SMP guest can use as many host cores as it has vCPUs.  Device
+emulation is still serialized by the global iothread lock.
+
+@option{thread=multi} cannot be combined with @option{-icount}.
+
+With @option{hot-trace=@var{n}}, a loop whose closing jump was taken
+@var{n} times is translated again as a single block (a trace) made of the
+blocks along its hot path.  Guest registers then stay in host registers
+from one block of the trace to the next.  The default, 0, disables traces.
+@option{hot-trace} cannot be combined with @option{-icount}.
+
+@option{perf=map} writes @file{/tmp/perf-@var{pid}.map}, which names each
+block of translated code after the guest address it comes from and, when
+the guest symbols are known, the guest function.  @command{perf top} and
+@command{perf report} then show where the guest spends host CPU time.
+@option{perf=jitdump} writes @file{jit-@var{pid}.dump} in the temporary
+directory instead, which also holds the translated code: record with
+@command{perf record -k 1} and process the result with
+@command{perf inject --jit} to annotate the host instructions of each block.
+ETEXI
+
 DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming p     prepare for incoming migration, listen on port p\n",
     QEMU_ARCH_ALL)
@@ -845,6 +845,112 @@ Example:
 <- { "return": { "formats":
                     ["elf", "kdump-zlib", "kdump-lzo", "kdump-snappy"] }
 
+EQMP
+
+    {
+        .name       = "guest-profile-start",
+        .args_type  = "interval:i?",
+        .mhandler.cmd_new = qmp_marshal_input_guest_profile_start,
+    },
+
+SQMP
+guest-profile-start
+-------------------
+
+Start sampling the guest pc, and the guest call stack where the target
+can walk it, of every running vCPU.  Earlier samples are discarded.
+Only available with TCG.
+
+Arguments:
+
+- "interval": time between two samples, in microseconds; at least 100,
+              1000 by default (json-int, optional)
+
+Example:
+
+-> { "execute": "guest-profile-start", "arguments": { "interval": 500 } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "guest-profile-stop",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_guest_profile_stop,
+    },
+
+SQMP
+guest-profile-stop
+------------------
+
+Stop sampling; the samples taken so far are kept.
+
+Example:
+
+-> { "execute": "guest-profile-stop" }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "guest-profile-dump",
+        .args_type  = "filename:F,format:s?",
+        .mhandler.cmd_new = qmp_marshal_input_guest_profile_dump,
+    },
+
+SQMP
+guest-profile-dump
+------------------
+
+Write the samples to a file.
+
+Arguments:
+
+- "filename": the file to write (json-string)
+- "format": "flat" for one line per guest pc with its samples and symbol,
+            hottest first, or "folded" for one line per call stack in the
+            format of flamegraph.pl; "flat" by default (json-string, optional)
+
+Example:
+
+-> { "execute": "guest-profile-dump",
+     "arguments": { "filename": "/tmp/guest.folded", "format": "folded" } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "query-guest-profile",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_guest_profile,
+    },
+
+SQMP
+query-guest-profile
+-------------------
+
+Show the state of the guest profiler and the guest pcs with the most
+samples.
+
+Return a json-object with:
+
+- "active": whether the profiler is sampling (json-bool)
+- "interval": sampling interval in microseconds (json-int)
+- "samples": number of samples (json-int)
+- "dropped": samples lost because of too many distinct stacks (json-int)
+- "stacks": number of distinct call stacks (json-int)
+- "hot": json-array of up to 10 json-objects, hottest first, with
+         "pc" (json-int), "samples" (json-int) and, when known, the guest
+         "symbol" (json-string) (optional)
+
+Example:
+
+-> { "execute": "query-guest-profile" }
+<- { "return": { "active": true, "interval": 1000, "samples": 5123,
+                 "dropped": 0, "stacks": 87,
+                 "hot": [ { "pc": 1050128, "samples": 2210,
+                            "symbol": "memcpy" } ] } }
+
 EQMP
 
     {
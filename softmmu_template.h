@@ -118,28 +118,7 @@
 
 /* macro to check the victim tlb */
 #define VICTIM_TLB_HIT(ty)                                                    \
-({                                                                            \
-    /* we are about to do a page table walk. our last hope is the             \
-     * victim tlb. try to refill from the victim tlb before walking the       \
-     * page table. */                                                         \
-    int vidx;                                                                 \
-    hwaddr tmpiotlb;                                                          \
-    CPUTLBEntry tmptlb;                                                       \
-    for (vidx = CPU_VTLB_SIZE-1; vidx >= 0; --vidx) {                         \
-        if (env->tlb_v_table[mmu_idx][vidx].ty == (addr & TARGET_PAGE_MASK)) {\
-            /* found entry in victim tlb, swap tlb and iotlb */               \
-            tmptlb = env->tlb_table[mmu_idx][index];                          \
-            env->tlb_table[mmu_idx][index] = env->tlb_v_table[mmu_idx][vidx]; \
-            env->tlb_v_table[mmu_idx][vidx] = tmptlb;                         \
-            tmpiotlb = env->iotlb[mmu_idx][index];                            \
-            env->iotlb[mmu_idx][index] = env->iotlb_v[mmu_idx][vidx];         \
-            env->iotlb_v[mmu_idx][vidx] = tmpiotlb;                           \
-            break;                                                            \
-        }                                                                     \
-    }                                                                         \
-    /* return true when there is a vtlb hit, i.e. vidx >=0 */                 \
-    vidx >= 0;                                                                \
-})
+    victim_tlb_hit(env, mmu_idx, index, offsetof(CPUTLBEntry, ty), addr)
 
 #ifndef SOFTMMU_CODE_ACCESS
 static inline DATA_TYPE glue(io_read, SUFFIX)(CPUArchState *env,
@@ -169,7 +148,7 @@ static __attribute__((unused))
 WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
                             uintptr_t retaddr)
 {
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].ADDR_READ;
     uintptr_t haddr;
     DATA_TYPE res;
@@ -189,6 +168,8 @@ WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
         if (!VICTIM_TLB_HIT(ADDR_READ)) {
             tlb_fill(ENV_GET_CPU(env), addr, READ_ACCESS_TYPE,
                      mmu_idx, retaddr);
+            /* the fill may have resized the TLB */
+            index = tlb_index(env, mmu_idx, addr);
         }
         tlb_addr = env->tlb_table[mmu_idx][index].ADDR_READ;
     }
@@ -199,6 +180,7 @@ WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
         if ((addr & (DATA_SIZE - 1)) != 0) {
             goto do_unaligned_access;
         }
+        ENV_GET_CPU(env)->tlb_slow_stats.io++;
         ioaddr = env->iotlb[mmu_idx][index];
 
         /* ??? Note that the io helpers always read data in the target
@@ -215,6 +197,14 @@ WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
         target_ulong addr1, addr2;
         DATA_TYPE res1, res2;
         unsigned shift;
+#if DATA_SIZE > 1 && !defined(ALIGNED_ONLY)
+        uint8_t buf[DATA_SIZE];
+
+        if (tlb_cross_page_access(env, addr, buf, DATA_SIZE, READ_ACCESS_TYPE,
+                                  mmu_idx, retaddr)) {
+            return glue(glue(ld, LSUFFIX), _le_p)(buf);
+        }
+#endif
     do_unaligned_access:
 #ifdef ALIGNED_ONLY
         cpu_unaligned_access(ENV_GET_CPU(env), addr, READ_ACCESS_TYPE,
@@ -234,6 +224,9 @@ WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
     }
 
     /* Handle aligned access or unaligned access in the same page.  */
+    if ((addr & (DATA_SIZE - 1)) != 0) {
+        ENV_GET_CPU(env)->tlb_slow_stats.unaligned++;
+    }
 #ifdef ALIGNED_ONLY
     if ((addr & (DATA_SIZE - 1)) != 0) {
         cpu_unaligned_access(ENV_GET_CPU(env), addr, READ_ACCESS_TYPE,
@@ -257,7 +250,7 @@ static __attribute__((unused))
 WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
                             uintptr_t retaddr)
 {
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].ADDR_READ;
     uintptr_t haddr;
     DATA_TYPE res;
@@ -277,6 +270,8 @@ WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
         if (!VICTIM_TLB_HIT(ADDR_READ)) {
             tlb_fill(ENV_GET_CPU(env), addr, READ_ACCESS_TYPE,
                      mmu_idx, retaddr);
+            /* the fill may have resized the TLB */
+            index = tlb_index(env, mmu_idx, addr);
         }
         tlb_addr = env->tlb_table[mmu_idx][index].ADDR_READ;
     }
@@ -287,6 +282,7 @@ WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
         if ((addr & (DATA_SIZE - 1)) != 0) {
             goto do_unaligned_access;
         }
+        ENV_GET_CPU(env)->tlb_slow_stats.io++;
         ioaddr = env->iotlb[mmu_idx][index];
 
         /* ??? Note that the io helpers always read data in the target
@@ -303,6 +299,14 @@ WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
         target_ulong addr1, addr2;
         DATA_TYPE res1, res2;
         unsigned shift;
+#if DATA_SIZE > 1 && !defined(ALIGNED_ONLY)
+        uint8_t buf[DATA_SIZE];
+
+        if (tlb_cross_page_access(env, addr, buf, DATA_SIZE, READ_ACCESS_TYPE,
+                                  mmu_idx, retaddr)) {
+            return glue(glue(ld, LSUFFIX), _be_p)(buf);
+        }
+#endif
     do_unaligned_access:
 #ifdef ALIGNED_ONLY
         cpu_unaligned_access(ENV_GET_CPU(env), addr, READ_ACCESS_TYPE,
@@ -322,6 +326,9 @@ WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr, int mmu_idx,
     }
 
     /* Handle aligned access or unaligned access in the same page.  */
+    if ((addr & (DATA_SIZE - 1)) != 0) {
+        ENV_GET_CPU(env)->tlb_slow_stats.unaligned++;
+    }
 #ifdef ALIGNED_ONLY
     if ((addr & (DATA_SIZE - 1)) != 0) {
         cpu_unaligned_access(ENV_GET_CPU(env), addr, READ_ACCESS_TYPE,
@@ -384,7 +391,7 @@ static inline void glue(io_write, SUFFIX)(CPUArchState *env,
 void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
                        int mmu_idx, uintptr_t retaddr)
 {
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
     uintptr_t haddr;
 
@@ -401,6 +408,8 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
 #endif
         if (!VICTIM_TLB_HIT(addr_write)) {
             tlb_fill(ENV_GET_CPU(env), addr, 1, mmu_idx, retaddr);
+            /* the fill may have resized the TLB */
+            index = tlb_index(env, mmu_idx, addr);
         }
         tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
     }
@@ -411,6 +420,7 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
         if ((addr & (DATA_SIZE - 1)) != 0) {
             goto do_unaligned_access;
         }
+        ENV_GET_CPU(env)->tlb_slow_stats.io++;
         ioaddr = env->iotlb[mmu_idx][index];
 
         /* ??? Note that the io helpers always read data in the target
@@ -425,6 +435,15 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
         && unlikely((addr & ~TARGET_PAGE_MASK) + DATA_SIZE - 1
                      >= TARGET_PAGE_SIZE)) {
         int i;
+#if DATA_SIZE > 1 && !defined(ALIGNED_ONLY)
+        uint8_t buf[DATA_SIZE];
+
+        glue(glue(st, SUFFIX), _le_p)(buf, val);
+        if (tlb_cross_page_access(env, addr, buf, DATA_SIZE, 1,
+                                  mmu_idx, retaddr)) {
+            return;
+        }
+#endif
     do_unaligned_access:
 #ifdef ALIGNED_ONLY
         cpu_unaligned_access(ENV_GET_CPU(env), addr, 1, mmu_idx, retaddr);
@@ -444,6 +463,9 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
     }
 
     /* Handle aligned access or unaligned access in the same page.  */
+    if ((addr & (DATA_SIZE - 1)) != 0) {
+        ENV_GET_CPU(env)->tlb_slow_stats.unaligned++;
+    }
 #ifdef ALIGNED_ONLY
     if ((addr & (DATA_SIZE - 1)) != 0) {
         cpu_unaligned_access(ENV_GET_CPU(env), addr, 1, mmu_idx, retaddr);
@@ -462,7 +484,7 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
 void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
                        int mmu_idx, uintptr_t retaddr)
 {
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
     uintptr_t haddr;
 
@@ -479,6 +501,8 @@ void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
 #endif
         if (!VICTIM_TLB_HIT(addr_write)) {
             tlb_fill(ENV_GET_CPU(env), addr, 1, mmu_idx, retaddr);
+            /* the fill may have resized the TLB */
+            index = tlb_index(env, mmu_idx, addr);
         }
         tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
     }
@@ -489,6 +513,7 @@ void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
         if ((addr & (DATA_SIZE - 1)) != 0) {
             goto do_unaligned_access;
         }
+        ENV_GET_CPU(env)->tlb_slow_stats.io++;
         ioaddr = env->iotlb[mmu_idx][index];
 
         /* ??? Note that the io helpers always read data in the target
@@ -503,6 +528,15 @@ void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
         && unlikely((addr & ~TARGET_PAGE_MASK) + DATA_SIZE - 1
                      >= TARGET_PAGE_SIZE)) {
         int i;
+#if DATA_SIZE > 1 && !defined(ALIGNED_ONLY)
+        uint8_t buf[DATA_SIZE];
+
+        glue(glue(st, SUFFIX), _be_p)(buf, val);
+        if (tlb_cross_page_access(env, addr, buf, DATA_SIZE, 1,
+                                  mmu_idx, retaddr)) {
+            return;
+        }
+#endif
     do_unaligned_access:
 #ifdef ALIGNED_ONLY
         cpu_unaligned_access(ENV_GET_CPU(env), addr, 1, mmu_idx, retaddr);
@@ -522,6 +556,9 @@ void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
     }
 
     /* Handle aligned access or unaligned access in the same page.  */
+    if ((addr & (DATA_SIZE - 1)) != 0) {
+        ENV_GET_CPU(env)->tlb_slow_stats.unaligned++;
+    }
 #ifdef ALIGNED_ONLY
     if ((addr & (DATA_SIZE - 1)) != 0) {
         cpu_unaligned_access(ENV_GET_CPU(env), addr, 1, mmu_idx, retaddr);
@@ -2838,17 +2838,15 @@ static inline void gen_intermediate_code_internal(AlphaCPU *cpu,
                 }
             }
         }
-        if (search_pc) {
-            j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-            if (lj < j) {
-                lj++;
-                while (lj < j)
-                    tcg_ctx.gen_opc_instr_start[lj++] = 0;
-            }
-            tcg_ctx.gen_opc_pc[lj] = ctx.pc;
-            tcg_ctx.gen_opc_instr_start[lj] = 1;
-            tcg_ctx.gen_opc_icount[lj] = num_insns;
+        j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+        if (lj < j) {
+            lj++;
+            while (lj < j)
+                tcg_ctx.gen_opc_instr_start[lj++] = 0;
         }
+        tcg_ctx.gen_opc_pc[lj] = ctx.pc;
+        tcg_ctx.gen_opc_instr_start[lj] = 1;
+        tcg_ctx.gen_opc_icount[lj] = num_insns;
         if (num_insns + 1 == max_insns && (tb->cflags & CF_LAST_IO)) {
             gen_io_start();
         }
@@ -2913,12 +2911,11 @@ static inline void gen_intermediate_code_internal(AlphaCPU *cpu,
 
     gen_tb_end(tb, num_insns);
     *tcg_ctx.gen_opc_ptr = INDEX_op_end;
-    if (search_pc) {
-        j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-        lj++;
-        while (lj <= j)
-            tcg_ctx.gen_opc_instr_start[lj++] = 0;
-    } else {
+    j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+    lj++;
+    while (lj <= j)
+        tcg_ctx.gen_opc_instr_start[lj++] = 0;
+    if (!search_pc) {
         tb->size = ctx.pc - pc_start;
         tb->icount = num_insns;
     }
@@ -1113,6 +1113,7 @@ static void arm_cpu_class_init(ObjectClass *oc, void *data)
     cc->handle_mmu_fault = arm_cpu_handle_mmu_fault;
 #else
     cc->get_phys_page_debug = arm_cpu_get_phys_page_debug;
+    cc->guest_backtrace = arm_cpu_guest_backtrace;
     cc->vmsd = &vmstate_arm_cpu;
 #endif
     cc->gdb_num_core_regs = 26;
@@ -34,6 +34,9 @@
 
 #define CPUArchState struct CPUARMState
 
+/* per-insn state saved for restore_state_to_opc(): IT block state */
+#define TARGET_INSN_DATA_WORDS 1
+
 #include "qemu-common.h"
 #include "exec/cpu-defs.h"
 
@@ -165,6 +168,13 @@ typedef struct CPUARMState {
     uint32_t VF; /* V is the bit 31. All other bits are undefined */
     uint32_t NF; /* N is bit 31. All other bits are undefined.  */
     uint32_t ZF; /* Z set if zero.  */
+    /* C and V are evaluated lazily: unless cc_op is CC_OP_FLAGS, CF and VF
+     * are stale and follow from the operands of the last flag-setting
+     * subtraction, cc_a - cc_b.  Use arm_cf() and arm_vf() to read them.
+     */
+    uint32_t cc_op;
+    uint64_t cc_a;
+    uint64_t cc_b;
     uint32_t QF; /* 0 or 1 */
     uint32_t GE; /* cpsr[19:16] */
     uint32_t thumb; /* cpsr[5]. 0 = arm mode, 1 = thumb mode. */
@@ -515,6 +525,46 @@ static inline unsigned int aarch64_pstate_mode(unsigned int el, bool handler)
     return (el << 2) | handler;
 }
 
+/* Values of CPUARMState::cc_op.  */
+enum {
+    CC_OP_FLAGS, /* CF and VF are up to date */
+    CC_OP_SUB32, /* C and V as for (uint32_t)cc_a - (uint32_t)cc_b */
+    CC_OP_SUB64, /* C and V as for cc_a - cc_b */
+};
+
+/* Return the C flag, in the format of env->CF.  */
+static inline uint32_t arm_cf(CPUARMState *env)
+{
+    switch (env->cc_op) {
+    case CC_OP_SUB32:
+        return (uint32_t)env->cc_a >= (uint32_t)env->cc_b;
+    case CC_OP_SUB64:
+        return env->cc_a >= env->cc_b;
+    default:
+        return env->CF;
+    }
+}
+
+/* Return the V flag, in the format of env->VF.  */
+static inline uint32_t arm_vf(CPUARMState *env)
+{
+    uint32_t a32, b32;
+    uint64_t a64, b64;
+
+    switch (env->cc_op) {
+    case CC_OP_SUB32:
+        a32 = env->cc_a;
+        b32 = env->cc_b;
+        return ((a32 - b32) ^ a32) & (a32 ^ b32);
+    case CC_OP_SUB64:
+        a64 = env->cc_a;
+        b64 = env->cc_b;
+        return (((a64 - b64) ^ a64) & (a64 ^ b64)) >> 32;
+    default:
+        return env->VF;
+    }
+}
+
 /* Return the current PSTATE value. For the moment we don't support 32<->64 bit
  * interprocessing, so we don't attempt to sync with the cpsr state used by
  * the 32 bit decoder.
@@ -525,7 +575,7 @@ static inline uint32_t pstate_read(CPUARMState *env)
 
     ZF = (env->ZF == 0);
     return (env->NF & 0x80000000) | (ZF << 30)
-        | (env->CF << 29) | ((env->VF & 0x80000000) >> 3)
+        | (arm_cf(env) << 29) | ((arm_vf(env) & 0x80000000) >> 3)
         | env->pstate | env->daif;
 }
 
@@ -535,6 +585,7 @@ static inline void pstate_write(CPUARMState *env, uint32_t val)
     env->NF = val;
     env->CF = (val >> 29) & 1;
     env->VF = (val << 3) & 0x80000000;
+    env->cc_op = CC_OP_FLAGS;
     env->daif = val & PSTATE_DAIF;
     env->pstate = val & ~CACHED_PSTATE_BITS;
 }
@@ -550,8 +601,8 @@ static inline uint32_t xpsr_read(CPUARMState *env)
     int ZF;
     ZF = (env->ZF == 0);
     return (env->NF & 0x80000000) | (ZF << 30)
-        | (env->CF << 29) | ((env->VF & 0x80000000) >> 3) | (env->QF << 27)
-        | (env->thumb << 24) | ((env->condexec_bits & 3) << 25)
+        | (arm_cf(env) << 29) | ((arm_vf(env) & 0x80000000) >> 3)
+        | (env->QF << 27) | (env->thumb << 24) | ((env->condexec_bits & 3) << 25)
         | ((env->condexec_bits & 0xfc) << 8)
         | env->v7m.exception;
 }
@@ -564,6 +615,7 @@ static inline void xpsr_write(CPUARMState *env, uint32_t val, uint32_t mask)
         env->NF = val;
         env->CF = (val >> 29) & 1;
         env->VF = (val << 3) & 0x80000000;
+        env->cc_op = CC_OP_FLAGS;
     }
     if (mask & CPSR_Q)
         env->QF = ((val & CPSR_Q) != 0);
@@ -86,6 +86,16 @@ uint64_t HELPER(rbit64)(uint64_t x)
     return x;
 }
 
+/* Bring CF and VF up to date, for a condition test that does not know
+ * at translation time what env->cc_op will be.
+ */
+void HELPER(compute_cv)(CPUARMState *env)
+{
+    env->CF = arm_cf(env);
+    env->VF = arm_vf(env);
+    env->cc_op = CC_OP_FLAGS;
+}
+
 /* Convert a softfloat float_relation_ (as returned by
  * the float*_compare functions) to the correct ARM
  * NZCV flag state.
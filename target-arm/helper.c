@@ -15,7 +15,7 @@
 static inline int get_phys_addr(CPUARMState *env, target_ulong address,
                                 int access_type, int is_user,
                                 hwaddr *phys_ptr, int *prot,
-                                target_ulong *page_size);
+                                target_ulong *page_size, bool *global);
 
 /* Definitions for the PMCCNTR and PMCR registers */
 #define PMCRD   0x8
@@ -333,10 +333,11 @@ static void contextidr_write(CPUARMState *env, const ARMCPRegInfo *ri,
     if (raw_read(env, ri) != value && !arm_feature(env, ARM_FEATURE_MPU)
         && !extended_addresses_enabled(env)) {
         /* For VMSA (when not using the LPAE long descriptor page table
-         * format) this register includes the ASID, so do a TLB flush.
+         * format) this register includes the ASID, so flush the entries
+         * that are not global.
          * For PMSA it is purely a process ID and no action is needed.
          */
-        tlb_flush(CPU(cpu), 1);
+        tlb_flush(CPU(cpu), 0);
     }
     raw_write(env, ri, value);
 }
@@ -1389,11 +1390,12 @@ static void ats_write(CPUARMState *env, const ARMCPRegInfo *ri, uint64_t value)
     hwaddr phys_addr;
     target_ulong page_size;
     int prot;
+    bool global;
     int ret, is_user = ri->opc2 & 2;
     int access_type = ri->opc2 & 1;
 
     ret = get_phys_addr(env, value, access_type, is_user,
-                        &phys_addr, &prot, &page_size);
+                        &phys_addr, &prot, &page_size, &global);
     if (extended_addresses_enabled(env)) {
         /* ret is a DFSR/IFSR value for the long descriptor
          * translation table format, but with WnR always clear.
@@ -1618,12 +1620,12 @@ static void vmsa_ttbr_write(CPUARMState *env, const ARMCPRegInfo *ri,
                             uint64_t value)
 {
     /* 64 bit accesses to the TTBRs can change the ASID and so we
-     * must flush the TLB.
+     * must flush the entries that are not global.
      */
     if (cpreg_field_is_64bit(ri)) {
         ARMCPU *cpu = arm_env_get_cpu(env);
 
-        tlb_flush(CPU(cpu), 1);
+        tlb_flush(CPU(cpu), 0);
     }
     raw_write(env, ri, value);
 }
@@ -3541,7 +3543,8 @@ uint32_t cpsr_read(CPUARMState *env)
     int ZF;
     ZF = (env->ZF == 0);
     return env->uncached_cpsr | (env->NF & 0x80000000) | (ZF << 30) |
-        (env->CF << 29) | ((env->VF & 0x80000000) >> 3) | (env->QF << 27)
+        (arm_cf(env) << 29) | ((arm_vf(env) & 0x80000000) >> 3) |
+        (env->QF << 27)
         | (env->thumb << 5) | ((env->condexec_bits & 3) << 25)
         | ((env->condexec_bits & 0xfc) << 8)
         | (env->GE << 16) | (env->daif & CPSR_AIF);
@@ -3554,6 +3557,7 @@ void cpsr_write(CPUARMState *env, uint32_t val, uint32_t mask)
         env->NF = val;
         env->CF = (val >> 29) & 1;
         env->VF = (val << 3) & 0x80000000;
+        env->cc_op = CC_OP_FLAGS;
     }
     if (mask & CPSR_Q)
         env->QF = ((val & CPSR_Q) != 0);
@@ -4305,7 +4309,7 @@ do_fault:
 
 static int get_phys_addr_v6(CPUARMState *env, uint32_t address, int access_type,
                             int is_user, hwaddr *phys_ptr,
-                            int *prot, target_ulong *page_size)
+                            int *prot, target_ulong *page_size, bool *global)
 {
     CPUState *cs = CPU(arm_env_get_cpu(env));
     int code;
@@ -4361,6 +4365,7 @@ static int get_phys_addr_v6(CPUARMState *env, uint32_t address, int access_type,
         ap = ((desc >> 10) & 3) | ((desc >> 13) & 4);
         xn = desc & (1 << 4);
         pxn = desc & 1;
+        *global = !(desc & (1 << 17));
         code = 13;
     } else {
         if (arm_feature(env, ARM_FEATURE_PXN)) {
@@ -4370,6 +4375,7 @@ static int get_phys_addr_v6(CPUARMState *env, uint32_t address, int access_type,
         table = (desc & 0xfffffc00) | ((address >> 10) & 0x3fc);
         desc = ldl_phys(cs->as, table);
         ap = ((desc >> 4) & 3) | ((desc >> 7) & 4);
+        *global = !(desc & (1 << 11));
         switch (desc & 3) {
         case 0: /* Page translation fault.  */
             code = 7;
@@ -4432,7 +4438,7 @@ typedef enum {
 static int get_phys_addr_lpae(CPUARMState *env, target_ulong address,
                               int access_type, int is_user,
                               hwaddr *phys_ptr, int *prot,
-                              target_ulong *page_size_ptr)
+                              target_ulong *page_size_ptr, bool *global)
 {
     CPUState *cs = CPU(arm_env_get_cpu(env));
     /* Read an LPAE long-descriptor translation table. */
@@ -4635,6 +4641,7 @@ static int get_phys_addr_lpae(CPUARMState *env, target_ulong address,
 
     *phys_ptr = descaddr;
     *page_size_ptr = page_size;
+    *global = !(attrs & (1 << 9)); /* nG */
     return 0;
 
 do_fault:
@@ -4725,16 +4732,19 @@ static int get_phys_addr_mpu(CPUARMState *env, uint32_t address,
  * @phys_ptr: set to the physical address corresponding to the virtual address
  * @prot: set to the permissions for the page containing phys_ptr
  * @page_size: set to the size of the page containing phys_ptr
+ * @global: set if the translation does not depend on the ASID
  */
 static inline int get_phys_addr(CPUARMState *env, target_ulong address,
                                 int access_type, int is_user,
                                 hwaddr *phys_ptr, int *prot,
-                                target_ulong *page_size)
+                                target_ulong *page_size, bool *global)
 {
     /* Fast Context Switch Extension.  */
     if (address < 0x02000000)
         address += env->cp15.c13_fcse;
 
+    *global = false;
+
     if ((env->cp15.c1_sys & SCTLR_M) == 0) {
         /* MMU/MPU disabled.  */
         *phys_ptr = address;
@@ -4747,10 +4757,10 @@ static inline int get_phys_addr(CPUARMState *env, target_ulong address,
 				 prot);
     } else if (extended_addresses_enabled(env)) {
         return get_phys_addr_lpae(env, address, access_type, is_user, phys_ptr,
-                                  prot, page_size);
+                                  prot, page_size, global);
     } else if (env->cp15.c1_sys & SCTLR_XP) {
         return get_phys_addr_v6(env, address, access_type, is_user, phys_ptr,
-                                prot, page_size);
+                                prot, page_size, global);
     } else {
         return get_phys_addr_v5(env, address, access_type, is_user, phys_ptr,
                                 prot, page_size);
@@ -4768,15 +4778,21 @@ int arm_cpu_handle_mmu_fault(CPUState *cs, vaddr address,
     int ret, is_user;
     uint32_t syn;
     bool same_el = (arm_current_pl(env) != 0);
+    bool global;
 
     is_user = mmu_idx == MMU_USER_IDX;
     ret = get_phys_addr(env, address, access_type, is_user, &phys_addr, &prot,
-                        &page_size);
+                        &page_size, &global);
     if (ret == 0) {
         /* Map a single [sub]page.  */
         phys_addr &= TARGET_PAGE_MASK;
         address &= TARGET_PAGE_MASK;
-        tlb_set_page(cs, address, phys_addr, prot, mmu_idx, page_size);
+        if (global) {
+            tlb_set_global_page(cs, address, phys_addr, prot, mmu_idx,
+                                page_size);
+        } else {
+            tlb_set_page(cs, address, phys_addr, prot, mmu_idx, page_size);
+        }
         return 0;
     }
 
@@ -4809,9 +4825,11 @@ hwaddr arm_cpu_get_phys_page_debug(CPUState *cs, vaddr addr)
     hwaddr phys_addr;
     target_ulong page_size;
     int prot;
+    bool global;
     int ret;
 
-    ret = get_phys_addr(&cpu->env, addr, 0, 0, &phys_addr, &prot, &page_size);
+    ret = get_phys_addr(&cpu->env, addr, 0, 0, &phys_addr, &prot, &page_size,
+                        &global);
 
     if (ret != 0) {
         return -1;
@@ -4820,6 +4838,47 @@ hwaddr arm_cpu_get_phys_page_debug(CPUState *cs, vaddr addr)
     return phys_addr;
 }
 
+/* AArch64 code keeps a chain of frame records, each holding the
+   caller's frame pointer (x29) and return address.  The AArch32 frame
+   layout depends on the compiler and on Thumb, so only the link
+   register is reported there; it is the caller unless the current
+   function already made a call of its own.  */
+int arm_cpu_guest_backtrace(CPUState *cs, vaddr *frames, int max)
+{
+    ARMCPU *cpu = ARM_CPU(cs);
+    CPUARMState *env = &cpu->env;
+    uint64_t fp, next, ret;
+    uint8_t buf[16];
+    int n;
+
+    if (max <= 0) {
+        return 0;
+    }
+    if (!is_a64(env)) {
+        frames[0] = env->regs[14] & ~1;
+        return 1;
+    }
+
+    fp = env->xregs[29];
+    for (n = 0; n < max && fp; n++) {
+        if (cpu_memory_rw_debug(cs, fp, buf, sizeof(buf), 0) < 0) {
+            break;
+        }
+        next = ldq_p(buf);
+        ret = ldq_p(buf + 8);
+        if (!ret) {
+            break;
+        }
+        frames[n] = ret;
+        if (next <= fp) {
+            n++;
+            break;
+        }
+        fp = next;
+    }
+    return n;
+}
+
 void HELPER(set_r13_banked)(CPUARMState *env, uint32_t mode, uint32_t val)
 {
     if ((env->uncached_cpsr & CPSR_M) == mode) {
@@ -229,6 +229,19 @@ void HELPER(wfe)(CPUARMState *env)
     cpu_loop_exit(cs);
 }
 
+/* Store-exclusive in system mode: the compare and the store must not be
+ * interleaved with another vCPU thread doing the same.
+ */
+void HELPER(exclusive_lock)(void)
+{
+    cpu_atomic_lock();
+}
+
+void HELPER(exclusive_unlock)(void)
+{
+    cpu_atomic_unlock();
+}
+
 /* Raise an internal-to-QEMU exception. This is limited to only
  * those EXCP values which are special cases for QEMU to interrupt
  * execution and not to be used for exceptions which are passed to
@@ -39,16 +39,10 @@
 
 static TCGv_i64 cpu_X[32];
 static TCGv_i64 cpu_pc;
-static TCGv_i32 cpu_NF, cpu_ZF, cpu_CF, cpu_VF;
+static TCGv_i64 cpu_cc_a, cpu_cc_b;
 
 /* Load/store exclusive handling */
-static TCGv_i64 cpu_exclusive_addr;
-static TCGv_i64 cpu_exclusive_val;
 static TCGv_i64 cpu_exclusive_high;
-#ifdef CONFIG_USER_ONLY
-static TCGv_i64 cpu_exclusive_test;
-static TCGv_i32 cpu_exclusive_info;
-#endif
 
 static const char *regnames[] = {
     "x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7",
@@ -104,23 +98,12 @@ void a64_translate_init(void)
                                           regnames[i]);
     }
 
-    cpu_NF = tcg_global_mem_new_i32(TCG_AREG0, offsetof(CPUARMState, NF), "NF");
-    cpu_ZF = tcg_global_mem_new_i32(TCG_AREG0, offsetof(CPUARMState, ZF), "ZF");
-    cpu_CF = tcg_global_mem_new_i32(TCG_AREG0, offsetof(CPUARMState, CF), "CF");
-    cpu_VF = tcg_global_mem_new_i32(TCG_AREG0, offsetof(CPUARMState, VF), "VF");
-
-    cpu_exclusive_addr = tcg_global_mem_new_i64(TCG_AREG0,
-        offsetof(CPUARMState, exclusive_addr), "exclusive_addr");
-    cpu_exclusive_val = tcg_global_mem_new_i64(TCG_AREG0,
-        offsetof(CPUARMState, exclusive_val), "exclusive_val");
+    cpu_cc_a = tcg_global_mem_new_i64(TCG_AREG0,
+        offsetof(CPUARMState, cc_a), "cc_a");
+    cpu_cc_b = tcg_global_mem_new_i64(TCG_AREG0,
+        offsetof(CPUARMState, cc_b), "cc_b");
     cpu_exclusive_high = tcg_global_mem_new_i64(TCG_AREG0,
         offsetof(CPUARMState, exclusive_high), "exclusive_high");
-#ifdef CONFIG_USER_ONLY
-    cpu_exclusive_test = tcg_global_mem_new_i64(TCG_AREG0,
-        offsetof(CPUARMState, exclusive_test), "exclusive_test");
-    cpu_exclusive_info = tcg_global_mem_new_i32(TCG_AREG0,
-        offsetof(CPUARMState, exclusive_info), "exclusive_info");
-#endif
 }
 
 void aarch64_cpu_dump_state(CPUState *cs, FILE *f,
@@ -422,6 +405,16 @@ static inline int vec_reg_offset(DisasContext *s, int regno,
     return offs;
 }
 
+/* Return the offset into CPUARMState of the whole of vector register Qn,
+ * as used by the TCG vector ops.  Their lanes are all the same size, so
+ * the order of the two 64 bit halves on big endian hosts does not matter.
+ */
+static inline int vec_full_reg_offset(DisasContext *s, int regno)
+{
+    assert_fp_access_checked(s);
+    return offsetof(CPUARMState, vfp.regs[regno * 2]);
+}
+
 /* Return the offset into CPUARMState of a slice (from
  * the least significant end) of FP register Qn (ie
  * Dn, Sn, Hn or Bn).
@@ -498,6 +491,88 @@ static TCGv_ptr get_fpstatus_ptr(void)
     return statusptr;
 }
 
+static inline void set_cc_op(DisasContext *s, int op)
+{
+    if (s->cc_op != op) {
+        tcg_gen_movi_i32(cpu_cc_op, op);
+        s->cc_op = op;
+    }
+}
+
+/* Bring CF and VF up to date if they are still pending from a
+ * subtraction.
+ */
+static void gen_compute_cv(DisasContext *s)
+{
+    TCGv_i32 a32, b32;
+    TCGv_i64 flag, tmp;
+
+    switch (s->cc_op) {
+    case CC_OP_FLAGS:
+        return;
+    case CC_OP_SUB32:
+        /* NF still holds the 32 bit cc_a - cc_b */
+        a32 = tcg_temp_new_i32();
+        b32 = tcg_temp_new_i32();
+        tcg_gen_trunc_i64_i32(a32, cpu_cc_a);
+        tcg_gen_trunc_i64_i32(b32, cpu_cc_b);
+        tcg_gen_setcond_i32(TCG_COND_GEU, cpu_CF, a32, b32);
+        tcg_gen_xor_i32(cpu_VF, cpu_NF, a32);
+        tcg_gen_xor_i32(a32, a32, b32);
+        tcg_gen_and_i32(cpu_VF, cpu_VF, a32);
+        tcg_temp_free_i32(a32);
+        tcg_temp_free_i32(b32);
+        break;
+    case CC_OP_SUB64:
+        flag = tcg_temp_new_i64();
+        tmp = tcg_temp_new_i64();
+        tcg_gen_setcond_i64(TCG_COND_GEU, flag, cpu_cc_a, cpu_cc_b);
+        tcg_gen_trunc_i64_i32(cpu_CF, flag);
+        tcg_gen_sub_i64(flag, cpu_cc_a, cpu_cc_b);
+        tcg_gen_xor_i64(flag, flag, cpu_cc_a);
+        tcg_gen_xor_i64(tmp, cpu_cc_a, cpu_cc_b);
+        tcg_gen_and_i64(flag, flag, tmp);
+        tcg_gen_shri_i64(flag, flag, 32);
+        tcg_gen_trunc_i64_i32(cpu_VF, flag);
+        tcg_temp_free_i64(tmp);
+        tcg_temp_free_i64(flag);
+        break;
+    default:
+        gen_helper_compute_cv(cpu_env);
+        s->cc_op = CC_OP_FLAGS;
+        return;
+    }
+    set_cc_op(s, CC_OP_FLAGS);
+}
+
+/* Branch to LABEL if condition CC holds.  Conditions that follow a
+ * subtraction are tested on its operands, without computing C and V.
+ */
+static void gen_test_cc(DisasContext *s, int cc, int label)
+{
+    TCGCond cond = arm_cc_sub_cond[cc];
+    TCGv_i32 a32, b32;
+
+    if (s->cc_op == CC_OP_SUB64 && cond != TCG_COND_NEVER) {
+        tcg_gen_brcond_i64(cond, cpu_cc_a, cpu_cc_b, label);
+        return;
+    }
+    if (s->cc_op == CC_OP_SUB32 && cond != TCG_COND_NEVER) {
+        a32 = tcg_temp_new_i32();
+        b32 = tcg_temp_new_i32();
+        tcg_gen_trunc_i64_i32(a32, cpu_cc_a);
+        tcg_gen_trunc_i64_i32(b32, cpu_cc_b);
+        tcg_gen_brcond_i32(cond, a32, b32, label);
+        tcg_temp_free_i32(a32);
+        tcg_temp_free_i32(b32);
+        return;
+    }
+    if (arm_cc_uses_cv(cc)) {
+        gen_compute_cv(s);
+    }
+    arm_gen_test_cc(cc, label);
+}
+
 /* Set ZF and NF based on a 64 bit result. This is alas fiddlier
  * than the 32 bit equivalent.
  */
@@ -513,8 +588,9 @@ static inline void gen_set_NZ64(TCGv_i64 result)
 }
 
 /* Set NZCV as for a logical operation: NZ as per result, CV cleared. */
-static inline void gen_logic_CC(int sf, TCGv_i64 result)
+static inline void gen_logic_CC(DisasContext *s, int sf, TCGv_i64 result)
 {
+    set_cc_op(s, CC_OP_FLAGS);
     if (sf) {
         gen_set_NZ64(result);
     } else {
@@ -526,8 +602,10 @@ static inline void gen_logic_CC(int sf, TCGv_i64 result)
 }
 
 /* dest = T0 + T1; compute C, N, V and Z flags */
-static void gen_add_CC(int sf, TCGv_i64 dest, TCGv_i64 t0, TCGv_i64 t1)
+static void gen_add_CC(DisasContext *s, int sf, TCGv_i64 dest,
+                       TCGv_i64 t0, TCGv_i64 t1)
 {
+    set_cc_op(s, CC_OP_FLAGS);
     if (sf) {
         TCGv_i64 result, flag, tmp;
         result = tcg_temp_new_i64();
@@ -573,58 +651,43 @@ static void gen_add_CC(int sf, TCGv_i64 dest, TCGv_i64 t0, TCGv_i64 t1)
     }
 }
 
-/* dest = T0 - T1; compute C, N, V and Z flags */
-static void gen_sub_CC(int sf, TCGv_i64 dest, TCGv_i64 t0, TCGv_i64 t1)
+/* dest = T0 - T1; compute N and Z flags, and leave C and V pending */
+static void gen_sub_CC(DisasContext *s, int sf, TCGv_i64 dest,
+                       TCGv_i64 t0, TCGv_i64 t1)
 {
+    tcg_gen_mov_i64(cpu_cc_a, t0);
+    tcg_gen_mov_i64(cpu_cc_b, t1);
     if (sf) {
         /* 64 bit arithmetic */
-        TCGv_i64 result, flag, tmp;
+        TCGv_i64 result = tcg_temp_new_i64();
 
-        result = tcg_temp_new_i64();
-        flag = tcg_temp_new_i64();
         tcg_gen_sub_i64(result, t0, t1);
-
         gen_set_NZ64(result);
-
-        tcg_gen_setcond_i64(TCG_COND_GEU, flag, t0, t1);
-        tcg_gen_trunc_i64_i32(cpu_CF, flag);
-
-        tcg_gen_xor_i64(flag, result, t0);
-        tmp = tcg_temp_new_i64();
-        tcg_gen_xor_i64(tmp, t0, t1);
-        tcg_gen_and_i64(flag, flag, tmp);
-        tcg_temp_free_i64(tmp);
-        tcg_gen_shri_i64(flag, flag, 32);
-        tcg_gen_trunc_i64_i32(cpu_VF, flag);
+        set_cc_op(s, CC_OP_SUB64);
         tcg_gen_mov_i64(dest, result);
-        tcg_temp_free_i64(flag);
         tcg_temp_free_i64(result);
     } else {
         /* 32 bit arithmetic */
         TCGv_i32 t0_32 = tcg_temp_new_i32();
         TCGv_i32 t1_32 = tcg_temp_new_i32();
-        TCGv_i32 tmp;
 
         tcg_gen_trunc_i64_i32(t0_32, t0);
         tcg_gen_trunc_i64_i32(t1_32, t1);
         tcg_gen_sub_i32(cpu_NF, t0_32, t1_32);
         tcg_gen_mov_i32(cpu_ZF, cpu_NF);
-        tcg_gen_setcond_i32(TCG_COND_GEU, cpu_CF, t0_32, t1_32);
-        tcg_gen_xor_i32(cpu_VF, cpu_NF, t0_32);
-        tmp = tcg_temp_new_i32();
-        tcg_gen_xor_i32(tmp, t0_32, t1_32);
+        set_cc_op(s, CC_OP_SUB32);
         tcg_temp_free_i32(t0_32);
         tcg_temp_free_i32(t1_32);
-        tcg_gen_and_i32(cpu_VF, cpu_VF, tmp);
-        tcg_temp_free_i32(tmp);
         tcg_gen_extu_i32_i64(dest, cpu_NF);
     }
 }
 
 /* dest = T0 + T1 + CF; do not compute flags. */
-static void gen_adc(int sf, TCGv_i64 dest, TCGv_i64 t0, TCGv_i64 t1)
+static void gen_adc(DisasContext *s, int sf, TCGv_i64 dest,
+                    TCGv_i64 t0, TCGv_i64 t1)
 {
     TCGv_i64 flag = tcg_temp_new_i64();
+    gen_compute_cv(s);
     tcg_gen_extu_i32_i64(flag, cpu_CF);
     tcg_gen_add_i64(dest, t0, t1);
     tcg_gen_add_i64(dest, dest, flag);
@@ -636,8 +699,10 @@ static void gen_adc(int sf, TCGv_i64 dest, TCGv_i64 t0, TCGv_i64 t1)
 }
 
 /* dest = T0 + T1 + CF; compute C, N, V and Z flags. */
-static void gen_adc_CC(int sf, TCGv_i64 dest, TCGv_i64 t0, TCGv_i64 t1)
+static void gen_adc_CC(DisasContext *s, int sf, TCGv_i64 dest,
+                       TCGv_i64 t0, TCGv_i64 t1)
 {
+    gen_compute_cv(s);
     if (sf) {
         TCGv_i64 result, cf_64, vf_64, tmp;
         result = tcg_temp_new_i64();
@@ -1149,7 +1214,7 @@ static void disas_cond_b_imm(DisasContext *s, uint32_t insn)
     if (cond < 0x0e) {
         /* genuinely conditional branches */
         int label_match = gen_new_label();
-        arm_gen_test_cc(cond, label_match);
+        gen_test_cc(s, cond, label_match);
         gen_goto_tb(s, 0, s->pc);
         gen_set_label(label_match);
         gen_goto_tb(s, 1, addr);
@@ -1249,11 +1314,13 @@ static void handle_msr_i(DisasContext *s, uint32_t insn,
     }
 }
 
-static void gen_get_nzcv(TCGv_i64 tcg_rt)
+static void gen_get_nzcv(DisasContext *s, TCGv_i64 tcg_rt)
 {
     TCGv_i32 tmp = tcg_temp_new_i32();
     TCGv_i32 nzcv = tcg_temp_new_i32();
 
+    gen_compute_cv(s);
+
     /* build bit 31, N */
     tcg_gen_andi_i32(nzcv, cpu_NF, (1 << 31));
     /* build bit 30, Z */
@@ -1271,11 +1338,13 @@ static void gen_get_nzcv(TCGv_i64 tcg_rt)
     tcg_temp_free_i32(tmp);
 }
 
-static void gen_set_nzcv(TCGv_i64 tcg_rt)
+static void gen_set_nzcv(DisasContext *s, TCGv_i64 tcg_rt)
 
 {
     TCGv_i32 nzcv = tcg_temp_new_i32();
 
+    set_cc_op(s, CC_OP_FLAGS);
+
     /* take NZCV from R[t] */
     tcg_gen_trunc_i64_i32(nzcv, tcg_rt);
 
@@ -1352,9 +1421,9 @@ static void handle_sys(DisasContext *s, uint32_t insn, bool isread,
     case ARM_CP_NZCV:
         tcg_rt = cpu_reg(s, rt);
         if (isread) {
-            gen_get_nzcv(tcg_rt);
+            gen_get_nzcv(s, tcg_rt);
         } else {
-            gen_set_nzcv(tcg_rt);
+            gen_set_nzcv(s, tcg_rt);
         }
         return;
     case ARM_CP_CURRENTEL:
@@ -1580,7 +1649,7 @@ static void disas_uncond_b_reg(DisasContext *s, uint32_t insn)
             return;
         }
         gen_helper_exception_return(cpu_env);
-        s->is_jmp = DISAS_JUMP;
+        s->is_jmp = DISAS_EXIT;
         return;
     case 5: /* DRPS */
         if (rn != 0x1f) {
@@ -1637,8 +1706,9 @@ static void disas_b_exc_sys(DisasContext *s, uint32_t insn)
  * mandated semantics, but it works for typical guest code sequences
  * and avoids having to monitor regular stores.
  *
- * In system emulation mode only one CPU will be running at once, so
- * this sequence is effectively atomic.  In user emulation mode we
+ * In system emulation mode the store is done under a lock shared by all
+ * the vCPUs, so the sequence is atomic with respect to other exclusive
+ * stores even with one thread per vCPU.  In user emulation mode we
  * throw an exception and handle the atomic operation elsewhere.
  */
 static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
@@ -1671,13 +1741,63 @@ static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
 }
 
 #ifdef CONFIG_USER_ONLY
+/* As for AArch32, the store is a host compare-and-swap against the
+ * value(s) the load-exclusive saw.  There is no 128-bit one for a pair
+ * of X registers, which cpu_loop still does with the other threads
+ * stopped.
+ */
 static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
-                                TCGv_i64 addr, int size, int is_pair)
+                                TCGv_i64 inaddr, int size, int is_pair)
 {
-    tcg_gen_mov_i64(cpu_exclusive_test, addr);
-    tcg_gen_movi_i32(cpu_exclusive_info,
-                     size | is_pair << 2 | (rd << 4) | (rt << 9) | (rt2 << 14));
-    gen_exception_internal_insn(s, 4, EXCP_STREX);
+    int fail_label;
+    int done_label;
+    TCGv_i64 addr, old;
+
+    if (is_pair && size == 3) {
+        tcg_gen_mov_i64(cpu_exclusive_test, inaddr);
+        tcg_gen_movi_i32(cpu_exclusive_info,
+                         size | is_pair << 2 | (rd << 4) | (rt << 9) |
+                         (rt2 << 14));
+        gen_exception_internal_insn(s, 4, EXCP_STREX);
+        return;
+    }
+
+    fail_label = gen_new_label();
+    done_label = gen_new_label();
+    /* Copy input into a local temp so it is not trashed when the
+     * basic block ends at the branch insn.
+     */
+    addr = tcg_temp_local_new_i64();
+    tcg_gen_mov_i64(addr, inaddr);
+    tcg_gen_brcond_i64(TCG_COND_NE, addr, cpu_exclusive_addr, fail_label);
+
+    old = tcg_temp_new_i64();
+    if (is_pair) {
+        TCGv_i64 val = tcg_temp_new_i64();
+        TCGv_i64 cmp = tcg_temp_new_i64();
+
+        tcg_gen_concat32_i64(val, cpu_reg(s, rt), cpu_reg(s, rt2));
+        tcg_gen_concat32_i64(cmp, cpu_exclusive_val, cpu_exclusive_high);
+        tcg_gen_atomic_cmpxchg_i64(old, addr, cmp, val,
+                                   get_mem_index(s), MO_TEQ);
+        tcg_gen_setcond_i64(TCG_COND_NE, cpu_reg(s, rd), old, cmp);
+        tcg_temp_free_i64(cmp);
+        tcg_temp_free_i64(val);
+    } else {
+        tcg_gen_atomic_cmpxchg_i64(old, addr, cpu_exclusive_val,
+                                   cpu_reg(s, rt), get_mem_index(s),
+                                   MO_TE + size);
+        tcg_gen_setcond_i64(TCG_COND_NE, cpu_reg(s, rd), old,
+                            cpu_exclusive_val);
+    }
+    tcg_temp_free_i64(old);
+    tcg_temp_free_i64(addr);
+
+    tcg_gen_br(done_label);
+    gen_set_label(fail_label);
+    tcg_gen_movi_i64(cpu_reg(s, rd), 1);
+    gen_set_label(done_label);
+    tcg_gen_movi_i64(cpu_exclusive_addr, -1);
 }
 #else
 static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
@@ -1704,6 +1824,9 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
      * basic block ends at the branch insn.
      */
     tcg_gen_mov_i64(addr, inaddr);
+    if (parallel_cpus) {
+        gen_helper_exclusive_lock();
+    }
     tcg_gen_brcond_i64(TCG_COND_NE, addr, cpu_exclusive_addr, fail_label);
 
     tmp = tcg_temp_new_i64();
@@ -1742,7 +1865,9 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
     tcg_gen_movi_i64(cpu_reg(s, rd), 1);
     gen_set_label(done_label);
     tcg_gen_movi_i64(cpu_exclusive_addr, -1);
-
+    if (parallel_cpus) {
+        gen_helper_exclusive_unlock();
+    }
 }
 #endif
 
@@ -2711,9 +2836,9 @@ static void disas_add_sub_imm(DisasContext *s, uint32_t insn)
     } else {
         TCGv_i64 tcg_imm = tcg_const_i64(imm);
         if (sub_op) {
-            gen_sub_CC(is_64bit, tcg_result, tcg_rn, tcg_imm);
+            gen_sub_CC(s, is_64bit, tcg_result, tcg_rn, tcg_imm);
         } else {
-            gen_add_CC(is_64bit, tcg_result, tcg_rn, tcg_imm);
+            gen_add_CC(s, is_64bit, tcg_result, tcg_rn, tcg_imm);
         }
         tcg_temp_free_i64(tcg_imm);
     }
@@ -2879,7 +3004,7 @@ static void disas_logic_imm(DisasContext *s, uint32_t insn)
     }
 
     if (opc == 3) { /* ANDS */
-        gen_logic_CC(sf, tcg_rd);
+        gen_logic_CC(s, sf, tcg_rd);
     }
 }
 
@@ -3225,7 +3350,7 @@ static void disas_logic_reg(DisasContext *s, uint32_t insn)
     }
 
     if (opc == 3) {
-        gen_logic_CC(sf, tcg_rd);
+        gen_logic_CC(s, sf, tcg_rd);
     }
 }
 
@@ -3287,9 +3412,9 @@ static void disas_add_sub_ext_reg(DisasContext *s, uint32_t insn)
         }
     } else {
         if (sub_op) {
-            gen_sub_CC(sf, tcg_result, tcg_rn, tcg_rm);
+            gen_sub_CC(s, sf, tcg_result, tcg_rn, tcg_rm);
         } else {
-            gen_add_CC(sf, tcg_result, tcg_rn, tcg_rm);
+            gen_add_CC(s, sf, tcg_result, tcg_rn, tcg_rm);
         }
     }
 
@@ -3351,9 +3476,9 @@ static void disas_add_sub_reg(DisasContext *s, uint32_t insn)
         }
     } else {
         if (sub_op) {
-            gen_sub_CC(sf, tcg_result, tcg_rn, tcg_rm);
+            gen_sub_CC(s, sf, tcg_result, tcg_rn, tcg_rm);
         } else {
-            gen_add_CC(sf, tcg_result, tcg_rn, tcg_rm);
+            gen_add_CC(s, sf, tcg_result, tcg_rn, tcg_rm);
         }
     }
 
@@ -3501,9 +3626,9 @@ static void disas_adc_sbc(DisasContext *s, uint32_t insn)
     }
 
     if (setflags) {
-        gen_adc_CC(sf, tcg_rd, tcg_rn, tcg_y);
+        gen_adc_CC(s, sf, tcg_rd, tcg_rn, tcg_y);
     } else {
-        gen_adc(sf, tcg_rd, tcg_rn, tcg_y);
+        gen_adc(s, sf, tcg_rd, tcg_rn, tcg_y);
     }
 }
 
@@ -3518,6 +3643,7 @@ static void disas_cc(DisasContext *s, uint32_t insn)
 {
     unsigned int sf, op, y, cond, rn, nzcv, is_imm;
     int label_continue = -1;
+    int match_cc_op;
     TCGv_i64 tcg_tmp, tcg_y, tcg_rn;
 
     if (!extract32(insn, 29, 1)) {
@@ -3539,14 +3665,16 @@ static void disas_cc(DisasContext *s, uint32_t insn)
     if (cond < 0x0e) { /* not always */
         int label_match = gen_new_label();
         label_continue = gen_new_label();
-        arm_gen_test_cc(cond, label_match);
+        gen_test_cc(s, cond, label_match);
+        match_cc_op = s->cc_op;
         /* nomatch: */
         tcg_tmp = tcg_temp_new_i64();
         tcg_gen_movi_i64(tcg_tmp, nzcv << 28);
-        gen_set_nzcv(tcg_tmp);
+        gen_set_nzcv(s, tcg_tmp);
         tcg_temp_free_i64(tcg_tmp);
         tcg_gen_br(label_continue);
         gen_set_label(label_match);
+        s->cc_op = match_cc_op;
     }
     /* match, or condition is always */
     if (is_imm) {
@@ -3559,14 +3687,18 @@ static void disas_cc(DisasContext *s, uint32_t insn)
 
     tcg_tmp = tcg_temp_new_i64();
     if (op) {
-        gen_sub_CC(sf, tcg_tmp, tcg_rn, tcg_y);
+        gen_sub_CC(s, sf, tcg_tmp, tcg_rn, tcg_y);
     } else {
-        gen_add_CC(sf, tcg_tmp, tcg_rn, tcg_y);
+        gen_add_CC(s, sf, tcg_tmp, tcg_rn, tcg_y);
     }
     tcg_temp_free_i64(tcg_tmp);
 
     if (cond < 0x0e) { /* continue */
         gen_set_label(label_continue);
+        /* the nomatch path left the flags computed */
+        if (s->cc_op != CC_OP_FLAGS) {
+            s->cc_op = CC_OP_DYNAMIC;
+        }
     }
 }
 
@@ -3613,7 +3745,7 @@ static void disas_cond_select(DisasContext *s, uint32_t insn)
         int label_match = gen_new_label();
         int label_continue = gen_new_label();
 
-        arm_gen_test_cc(cond, label_match);
+        gen_test_cc(s, cond, label_match);
         /* nomatch: */
         tcg_src = cpu_reg(s, rm);
 
@@ -4039,7 +4171,7 @@ static void handle_fp_compare(DisasContext *s, bool is_double,
 
     tcg_temp_free_ptr(fpst);
 
-    gen_set_nzcv(tcg_flags);
+    gen_set_nzcv(s, tcg_flags);
 
     tcg_temp_free_i64(tcg_flags);
 }
@@ -4085,6 +4217,7 @@ static void disas_fp_ccomp(DisasContext *s, uint32_t insn)
     unsigned int mos, type, rm, cond, rn, op, nzcv;
     TCGv_i64 tcg_flags;
     int label_continue = -1;
+    int match_cc_op;
 
     mos = extract32(insn, 29, 3);
     type = extract32(insn, 22, 2); /* 0 = single, 1 = double */
@@ -4106,13 +4239,15 @@ static void disas_fp_ccomp(DisasContext *s, uint32_t insn)
     if (cond < 0x0e) { /* not always */
         int label_match = gen_new_label();
         label_continue = gen_new_label();
-        arm_gen_test_cc(cond, label_match);
+        gen_test_cc(s, cond, label_match);
+        match_cc_op = s->cc_op;
         /* nomatch: */
         tcg_flags = tcg_const_i64(nzcv << 28);
-        gen_set_nzcv(tcg_flags);
+        gen_set_nzcv(s, tcg_flags);
         tcg_temp_free_i64(tcg_flags);
         tcg_gen_br(label_continue);
         gen_set_label(label_match);
+        s->cc_op = match_cc_op;
     }
 
     handle_fp_compare(s, type, rn, rm, false, op);
@@ -4166,7 +4301,7 @@ static void disas_fp_csel(DisasContext *s, uint32_t insn)
     if (cond < 0x0e) { /* not always */
         int label_match = gen_new_label();
         label_continue = gen_new_label();
-        arm_gen_test_cc(cond, label_match);
+        gen_test_cc(s, cond, label_match);
         /* nomatch: */
         gen_mov_fp2fp(s, type, rd, rm);
         tcg_gen_br(label_continue);
@@ -8756,6 +8891,31 @@ static void disas_simd_3same_logic(DisasContext *s, uint32_t insn)
         return;
     }
 
+    if (is_u ? size == 0 : size != 3) {
+        /* AND, BIC, ORR and EOR map onto the TCG vector ops */
+        TCGType type = is_q ? TCG_TYPE_V128 : TCG_TYPE_V64;
+        int dofs = vec_full_reg_offset(s, rd);
+        int nofs = vec_full_reg_offset(s, rn);
+        int mofs = vec_full_reg_offset(s, rm);
+
+        if (is_u) {
+            tcg_gen_vec_xor(type, cpu_env, dofs, nofs, mofs);
+        } else if (size == 0) {
+            tcg_gen_vec_and(type, cpu_env, dofs, nofs, mofs);
+        } else if (size == 1) {
+            tcg_gen_vec_andc(type, cpu_env, dofs, nofs, mofs);
+        } else if (rn == rm) {
+            /* MOV */
+            tcg_gen_vec_mov(type, cpu_env, dofs, nofs);
+        } else {
+            tcg_gen_vec_or(type, cpu_env, dofs, nofs, mofs);
+        }
+        if (!is_q) {
+            clear_vec_high(s, rd);
+        }
+        return;
+    }
+
     tcg_op1 = tcg_temp_new_i64();
     tcg_op2 = tcg_temp_new_i64();
     tcg_res[0] = tcg_temp_new_i64();
@@ -9118,6 +9278,26 @@ static void disas_simd_3same_int(DisasContext *s, uint32_t insn)
         return;
     }
 
+    if (opcode == 0x10 || (opcode == 0x11 && u && size != 3)) {
+        /* ADD, SUB and CMEQ map onto the TCG vector ops */
+        TCGType type = is_q ? TCG_TYPE_V128 : TCG_TYPE_V64;
+        int dofs = vec_full_reg_offset(s, rd);
+        int nofs = vec_full_reg_offset(s, rn);
+        int mofs = vec_full_reg_offset(s, rm);
+
+        if (opcode == 0x11) {
+            tcg_gen_vec_cmpeq(type, size, cpu_env, dofs, nofs, mofs);
+        } else if (u) {
+            tcg_gen_vec_sub(type, size, cpu_env, dofs, nofs, mofs);
+        } else {
+            tcg_gen_vec_add(type, size, cpu_env, dofs, nofs, mofs);
+        }
+        if (!is_q) {
+            clear_vec_high(s, rd);
+        }
+        return;
+    }
+
     if (size == 3) {
         assert(is_q);
         for (pass = 0; pass < 2; pass++) {
@@ -10917,6 +11097,7 @@ void gen_intermediate_code_internal_a64(ARMCPU *cpu,
     dc->pc = pc_start;
     dc->singlestep_enabled = cs->singlestep_enabled;
     dc->condjmp = 0;
+    dc->cc_op = CC_OP_DYNAMIC;
 
     dc->aarch64 = 1;
     dc->thumb = 0;
@@ -10980,18 +11161,16 @@ void gen_intermediate_code_internal_a64(ARMCPU *cpu,
             }
         }
 
-        if (search_pc) {
-            j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-            if (lj < j) {
-                lj++;
-                while (lj < j) {
-                    tcg_ctx.gen_opc_instr_start[lj++] = 0;
-                }
+        j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+        if (lj < j) {
+            lj++;
+            while (lj < j) {
+                tcg_ctx.gen_opc_instr_start[lj++] = 0;
             }
-            tcg_ctx.gen_opc_pc[lj] = dc->pc;
-            tcg_ctx.gen_opc_instr_start[lj] = 1;
-            tcg_ctx.gen_opc_icount[lj] = num_insns;
         }
+        tcg_ctx.gen_opc_pc[lj] = dc->pc;
+        tcg_ctx.gen_opc_instr_start[lj] = 1;
+        tcg_ctx.gen_opc_icount[lj] = num_insns;
 
         if (num_insns + 1 == max_insns && (tb->cflags & CF_LAST_IO)) {
             gen_io_start();
@@ -11050,7 +11229,7 @@ void gen_intermediate_code_internal_a64(ARMCPU *cpu,
          * (and thus a tb-jump is not possible when singlestepping).
          */
         assert(dc->is_jmp != DISAS_TB_JUMP);
-        if (dc->is_jmp != DISAS_JUMP) {
+        if (dc->is_jmp != DISAS_JUMP && dc->is_jmp != DISAS_EXIT) {
             gen_a64_set_pc_im(dc->pc);
         }
         if (cs->singlestep_enabled) {
@@ -11067,10 +11246,14 @@ void gen_intermediate_code_internal_a64(ARMCPU *cpu,
         case DISAS_UPDATE:
             gen_a64_set_pc_im(dc->pc);
             /* fall through */
-        case DISAS_JUMP:
+        case DISAS_EXIT:
             /* indicate that the hash table must be used to find the next TB */
             tcg_gen_exit_tb(0);
             break;
+        case DISAS_JUMP:
+            /* find the next TB without returning to the main loop */
+            tcg_gen_lookup_and_goto_ptr(cpu_env);
+            break;
         case DISAS_TB_JUMP:
         case DISAS_EXC:
         case DISAS_SWI:
@@ -11102,13 +11285,12 @@ done_generating:
         qemu_log("\n");
     }
 #endif
-    if (search_pc) {
-        j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-        lj++;
-        while (lj <= j) {
-            tcg_ctx.gen_opc_instr_start[lj++] = 0;
-        }
-    } else {
+    j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+    lj++;
+    while (lj <= j) {
+        tcg_ctx.gen_opc_instr_start[lj++] = 0;
+    }
+    if (!search_pc) {
         tb->size = dc->pc - pc_start;
         tb->icount = num_insns;
     }
@@ -52,7 +52,7 @@
 #define ARCH(x) do { if (!ENABLE_ARCH_##x) goto illegal_op; } while(0)
 
 #include "translate.h"
-static uint32_t gen_opc_condexec_bits[OPC_BUF_SIZE];
+#define gen_opc_condexec_bits tcg_ctx.gen_opc_data[0]
 
 #if defined(CONFIG_USER_ONLY)
 #define IS_USER(s) 1
@@ -64,13 +64,19 @@ TCGv_ptr cpu_env;
 /* We reuse the same 64-bit temporaries for efficiency.  */
 static TCGv_i64 cpu_V0, cpu_V1, cpu_M0;
 static TCGv_i32 cpu_R[16];
-static TCGv_i32 cpu_CF, cpu_NF, cpu_VF, cpu_ZF;
-static TCGv_i64 cpu_exclusive_addr;
-static TCGv_i64 cpu_exclusive_val;
+/* Shared with the A64 translator, which must not create globals of
+ * its own over these fields: liveness would not see the two as one.
+ */
+TCGv_i32 cpu_CF, cpu_NF, cpu_VF, cpu_ZF;
+TCGv_i32 cpu_cc_op;
+TCGv_i64 cpu_exclusive_addr;
+TCGv_i64 cpu_exclusive_val;
 #ifdef CONFIG_USER_ONLY
-static TCGv_i64 cpu_exclusive_test;
-static TCGv_i32 cpu_exclusive_info;
+TCGv_i64 cpu_exclusive_test;
+TCGv_i32 cpu_exclusive_info;
 #endif
+/* Operands of the last subtraction, while C and V are pending */
+static TCGv_i32 cpu_cc_a, cpu_cc_b;
 
 /* FIXME:  These should be removed.  */
 static TCGv_i32 cpu_F0s, cpu_F1s;
@@ -88,6 +94,7 @@ void arm_translate_init(void)
     int i;
 
     cpu_env = tcg_global_reg_new_ptr(TCG_AREG0, "env");
+    tcg_ctx.tcg_env = cpu_env;
 
     for (i = 0; i < 16; i++) {
         cpu_R[i] = tcg_global_mem_new_i32(TCG_AREG0,
@@ -98,6 +105,12 @@ void arm_translate_init(void)
     cpu_NF = tcg_global_mem_new_i32(TCG_AREG0, offsetof(CPUARMState, NF), "NF");
     cpu_VF = tcg_global_mem_new_i32(TCG_AREG0, offsetof(CPUARMState, VF), "VF");
     cpu_ZF = tcg_global_mem_new_i32(TCG_AREG0, offsetof(CPUARMState, ZF), "ZF");
+    cpu_cc_op = tcg_global_mem_new_i32(TCG_AREG0,
+        offsetof(CPUARMState, cc_op), "cc_op");
+    cpu_cc_a = tcg_global_mem_new_i32(TCG_AREG0,
+        offsetoflow32(CPUARMState, cc_a), "cc_a");
+    cpu_cc_b = tcg_global_mem_new_i32(TCG_AREG0,
+        offsetoflow32(CPUARMState, cc_b), "cc_b");
 
     cpu_exclusive_addr = tcg_global_mem_new_i64(TCG_AREG0,
         offsetof(CPUARMState, exclusive_addr), "exclusive_addr");
@@ -177,14 +190,18 @@ static void store_reg(DisasContext *s, int reg, TCGv_i32 var)
 #define gen_uxtb16(var) gen_helper_uxtb16(var, var)
 
 
-static inline void gen_set_cpsr(TCGv_i32 var, uint32_t mask)
+static inline void gen_set_cpsr(DisasContext *s, TCGv_i32 var, uint32_t mask)
 {
     TCGv_i32 tmp_mask = tcg_const_i32(mask);
     gen_helper_cpsr_write(cpu_env, var, tmp_mask);
     tcg_temp_free_i32(tmp_mask);
+    if (mask & CPSR_NZCV) {
+        /* cpsr_write has reset env->cc_op */
+        s->cc_op = CC_OP_FLAGS;
+    }
 }
 /* Set NZCV flags from the high 4 bits of var.  */
-#define gen_set_nzcv(var) gen_set_cpsr(var, CPSR_NZCV)
+#define gen_set_nzcv(s, var) gen_set_cpsr(s, var, CPSR_NZCV)
 
 static void gen_exception_internal(int excp)
 {
@@ -385,45 +402,105 @@ static void gen_add16(TCGv_i32 t0, TCGv_i32 t1)
     tcg_temp_free_i32(t1);
 }
 
+static inline void set_cc_op(DisasContext *s, int op)
+{
+    if (s->cc_op != op) {
+        tcg_gen_movi_i32(cpu_cc_op, op);
+        s->cc_op = op;
+    }
+}
+
+/* Bring CF and VF up to date if they are still pending from a
+   subtraction.  */
+static void gen_compute_cv(DisasContext *s)
+{
+    TCGv_i32 tmp, cf, vf, zero;
+
+    switch (s->cc_op) {
+    case CC_OP_FLAGS:
+        return;
+    case CC_OP_SUB32:
+        /* NF still holds cc_a - cc_b */
+        tcg_gen_setcond_i32(TCG_COND_GEU, cpu_CF, cpu_cc_a, cpu_cc_b);
+        tmp = tcg_temp_new_i32();
+        tcg_gen_xor_i32(cpu_VF, cpu_NF, cpu_cc_a);
+        tcg_gen_xor_i32(tmp, cpu_cc_a, cpu_cc_b);
+        tcg_gen_and_i32(cpu_VF, cpu_VF, tmp);
+        tcg_temp_free_i32(tmp);
+        break;
+    default:
+        /* Not known at translation time; in AArch32 state the flags are
+           either up to date or pending as CC_OP_SUB32.  */
+        cf = tcg_temp_new_i32();
+        vf = tcg_temp_new_i32();
+        tmp = tcg_temp_new_i32();
+        tcg_gen_setcond_i32(TCG_COND_GEU, cf, cpu_cc_a, cpu_cc_b);
+        tcg_gen_sub_i32(vf, cpu_cc_a, cpu_cc_b);
+        tcg_gen_xor_i32(vf, vf, cpu_cc_a);
+        tcg_gen_xor_i32(tmp, cpu_cc_a, cpu_cc_b);
+        tcg_gen_and_i32(vf, vf, tmp);
+        zero = tcg_const_i32(CC_OP_FLAGS);
+        tcg_gen_movcond_i32(TCG_COND_NE, cpu_CF, cpu_cc_op, zero, cf, cpu_CF);
+        tcg_gen_movcond_i32(TCG_COND_NE, cpu_VF, cpu_cc_op, zero, vf, cpu_VF);
+        tcg_temp_free_i32(zero);
+        tcg_temp_free_i32(tmp);
+        tcg_temp_free_i32(vf);
+        tcg_temp_free_i32(cf);
+        break;
+    }
+    set_cc_op(s, CC_OP_FLAGS);
+}
+
 /* Set CF to the top bit of var.  */
-static void gen_set_CF_bit31(TCGv_i32 var)
+static void gen_set_CF_bit31(DisasContext *s, TCGv_i32 var)
 {
+    gen_compute_cv(s);
     tcg_gen_shri_i32(cpu_CF, var, 31);
 }
 
 /* Set N and Z flags from var.  */
-static inline void gen_logic_CC(TCGv_i32 var)
+static inline void gen_logic_CC(DisasContext *s, TCGv_i32 var)
 {
     tcg_gen_mov_i32(cpu_NF, var);
     tcg_gen_mov_i32(cpu_ZF, var);
+    if (s->cc_op != CC_OP_FLAGS) {
+        /* C and V remain pending, but no longer match N and Z */
+        s->cc_op = CC_OP_DYNAMIC;
+    }
 }
 
 /* T0 += T1 + CF.  */
-static void gen_adc(TCGv_i32 t0, TCGv_i32 t1)
+static void gen_adc(DisasContext *s, TCGv_i32 t0, TCGv_i32 t1)
 {
+    gen_compute_cv(s);
     tcg_gen_add_i32(t0, t0, t1);
     tcg_gen_add_i32(t0, t0, cpu_CF);
 }
 
 /* dest = T0 + T1 + CF. */
-static void gen_add_carry(TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
+static void gen_add_carry(DisasContext *s, TCGv_i32 dest,
+                          TCGv_i32 t0, TCGv_i32 t1)
 {
+    gen_compute_cv(s);
     tcg_gen_add_i32(dest, t0, t1);
     tcg_gen_add_i32(dest, dest, cpu_CF);
 }
 
 /* dest = T0 - T1 + CF - 1.  */
-static void gen_sub_carry(TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
+static void gen_sub_carry(DisasContext *s, TCGv_i32 dest,
+                          TCGv_i32 t0, TCGv_i32 t1)
 {
+    gen_compute_cv(s);
     tcg_gen_sub_i32(dest, t0, t1);
     tcg_gen_add_i32(dest, dest, cpu_CF);
     tcg_gen_subi_i32(dest, dest, 1);
 }
 
 /* dest = T0 + T1. Compute C, N, V and Z flags */
-static void gen_add_CC(TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
+static void gen_add_CC(DisasContext *s, TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
 {
     TCGv_i32 tmp = tcg_temp_new_i32();
+    set_cc_op(s, CC_OP_FLAGS);
     tcg_gen_movi_i32(tmp, 0);
     tcg_gen_add2_i32(cpu_NF, cpu_CF, t0, tmp, t1, tmp);
     tcg_gen_mov_i32(cpu_ZF, cpu_NF);
@@ -435,9 +512,10 @@ static void gen_add_CC(TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
 }
 
 /* dest = T0 + T1 + CF.  Compute C, N, V and Z flags */
-static void gen_adc_CC(TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
+static void gen_adc_CC(DisasContext *s, TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
 {
     TCGv_i32 tmp = tcg_temp_new_i32();
+    gen_compute_cv(s);
     if (TCG_TARGET_HAS_add2_i32) {
         tcg_gen_movi_i32(tmp, 0);
         tcg_gen_add2_i32(cpu_NF, cpu_CF, t0, tmp, cpu_CF, tmp);
@@ -462,27 +540,23 @@ static void gen_adc_CC(TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
     tcg_gen_mov_i32(dest, cpu_NF);
 }
 
-/* dest = T0 - T1. Compute C, N, V and Z flags */
-static void gen_sub_CC(TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
+/* dest = T0 - T1. Compute N and Z flags, and leave C and V pending */
+static void gen_sub_CC(DisasContext *s, TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
 {
-    TCGv_i32 tmp;
+    tcg_gen_mov_i32(cpu_cc_a, t0);
+    tcg_gen_mov_i32(cpu_cc_b, t1);
     tcg_gen_sub_i32(cpu_NF, t0, t1);
     tcg_gen_mov_i32(cpu_ZF, cpu_NF);
-    tcg_gen_setcond_i32(TCG_COND_GEU, cpu_CF, t0, t1);
-    tcg_gen_xor_i32(cpu_VF, cpu_NF, t0);
-    tmp = tcg_temp_new_i32();
-    tcg_gen_xor_i32(tmp, t0, t1);
-    tcg_gen_and_i32(cpu_VF, cpu_VF, tmp);
-    tcg_temp_free_i32(tmp);
+    set_cc_op(s, CC_OP_SUB32);
     tcg_gen_mov_i32(dest, cpu_NF);
 }
 
 /* dest = T0 + ~T1 + CF.  Compute C, N, V and Z flags */
-static void gen_sbc_CC(TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
+static void gen_sbc_CC(DisasContext *s, TCGv_i32 dest, TCGv_i32 t0, TCGv_i32 t1)
 {
     TCGv_i32 tmp = tcg_temp_new_i32();
     tcg_gen_not_i32(tmp, t1);
-    gen_adc_CC(dest, t0, tmp);
+    gen_adc_CC(s, dest, t0, tmp);
     tcg_temp_free_i32(tmp);
 }
 
@@ -527,8 +601,9 @@ static void tcg_gen_abs_i32(TCGv_i32 dest, TCGv_i32 src)
     tcg_temp_free_i32(tmp);
 }
 
-static void shifter_out_im(TCGv_i32 var, int shift)
+static void shifter_out_im(DisasContext *s, TCGv_i32 var, int shift)
 {
+    gen_compute_cv(s);
     if (shift == 0) {
         tcg_gen_andi_i32(cpu_CF, var, 1);
     } else {
@@ -540,26 +615,26 @@ static void shifter_out_im(TCGv_i32 var, int shift)
 }
 
 /* Shift by immediate.  Includes special handling for shift == 0.  */
-static inline void gen_arm_shift_im(TCGv_i32 var, int shiftop,
+static inline void gen_arm_shift_im(DisasContext *s, TCGv_i32 var, int shiftop,
                                     int shift, int flags)
 {
     switch (shiftop) {
     case 0: /* LSL */
         if (shift != 0) {
             if (flags)
-                shifter_out_im(var, 32 - shift);
+                shifter_out_im(s, var, 32 - shift);
             tcg_gen_shli_i32(var, var, shift);
         }
         break;
     case 1: /* LSR */
         if (shift == 0) {
             if (flags) {
-                tcg_gen_shri_i32(cpu_CF, var, 31);
+                gen_set_CF_bit31(s, var);
             }
             tcg_gen_movi_i32(var, 0);
         } else {
             if (flags)
-                shifter_out_im(var, shift - 1);
+                shifter_out_im(s, var, shift - 1);
             tcg_gen_shri_i32(var, var, shift);
         }
         break;
@@ -567,7 +642,7 @@ static inline void gen_arm_shift_im(TCGv_i32 var, int shiftop,
         if (shift == 0)
             shift = 32;
         if (flags)
-            shifter_out_im(var, shift - 1);
+            shifter_out_im(s, var, shift - 1);
         if (shift == 32)
           shift = 31;
         tcg_gen_sari_i32(var, var, shift);
@@ -575,13 +650,14 @@ static inline void gen_arm_shift_im(TCGv_i32 var, int shiftop,
     case 3: /* ROR/RRX */
         if (shift != 0) {
             if (flags)
-                shifter_out_im(var, shift - 1);
+                shifter_out_im(s, var, shift - 1);
             tcg_gen_rotri_i32(var, var, shift); break;
         } else {
             TCGv_i32 tmp = tcg_temp_new_i32();
+            gen_compute_cv(s);
             tcg_gen_shli_i32(tmp, cpu_CF, 31);
             if (flags)
-                shifter_out_im(var, 0);
+                shifter_out_im(s, var, 0);
             tcg_gen_shri_i32(var, var, 1);
             tcg_gen_or_i32(var, var, tmp);
             tcg_temp_free_i32(tmp);
@@ -589,10 +665,12 @@ static inline void gen_arm_shift_im(TCGv_i32 var, int shiftop,
     }
 };
 
-static inline void gen_arm_shift_reg(TCGv_i32 var, int shiftop,
+static inline void gen_arm_shift_reg(DisasContext *s, TCGv_i32 var, int shiftop,
                                      TCGv_i32 shift, int flags)
 {
     if (flags) {
+        /* the helpers update CF only */
+        gen_compute_cv(s);
         switch (shiftop) {
         case 0: gen_helper_shl_cc(var, cpu_env, var, shift); break;
         case 1: gen_helper_shr_cc(var, cpu_env, var, shift); break;
@@ -788,6 +866,50 @@ void arm_gen_test_cc(int cc, int label)
     }
 }
 
+/* For each condition code, the equivalent comparison of the operands of
+ * a subtraction that set the flags, if there is one that does not need
+ * the V flag.  */
+const TCGCond arm_cc_sub_cond[14] = {
+    [0] = TCG_COND_EQ,          /* eq */
+    [1] = TCG_COND_NE,          /* ne */
+    [2] = TCG_COND_GEU,         /* cs */
+    [3] = TCG_COND_LTU,         /* cc */
+    [4] = TCG_COND_NEVER,       /* mi */
+    [5] = TCG_COND_NEVER,       /* pl */
+    [6] = TCG_COND_NEVER,       /* vs */
+    [7] = TCG_COND_NEVER,       /* vc */
+    [8] = TCG_COND_GTU,         /* hi */
+    [9] = TCG_COND_LEU,         /* ls */
+    [10] = TCG_COND_GE,         /* ge */
+    [11] = TCG_COND_LT,         /* lt */
+    [12] = TCG_COND_GT,         /* gt */
+    [13] = TCG_COND_LE,         /* le */
+};
+
+/* Branch to LABEL if condition CC holds.  Conditions that follow a
+ * subtraction are tested on its operands, without computing C and V.
+ */
+static void gen_test_cc(DisasContext *s, int cc, int label)
+{
+    if (s->cc_op == CC_OP_SUB32 && arm_cc_sub_cond[cc] != TCG_COND_NEVER) {
+        tcg_gen_brcond_i32(arm_cc_sub_cond[cc], cpu_cc_a, cpu_cc_b, label);
+        return;
+    }
+    if (arm_cc_uses_cv(cc)) {
+        gen_compute_cv(s);
+    }
+    arm_gen_test_cc(cc, label);
+}
+
+/* Skip the current instruction unless condition CC holds.  */
+static void gen_cond_skip(DisasContext *s, int cc)
+{
+    s->condlabel = gen_new_label();
+    gen_test_cc(s, cc ^ 1, s->condlabel);
+    s->condjmp = 1;
+    s->condjmp_cc_op = s->cc_op;
+}
+
 static const uint8_t table_logic_cc[16] = {
     1, /* and */
     1, /* xor */
@@ -807,12 +929,13 @@ static const uint8_t table_logic_cc[16] = {
     1, /* mvn */
 };
 
-/* Set PC and Thumb state from an immediate address.  */
+/* Set PC and Thumb state from an immediate address.  The Thumb bit is
+   part of the TB flags, so for the next TB lookup this is a plain jump.  */
 static inline void gen_bx_im(DisasContext *s, uint32_t addr)
 {
     TCGv_i32 tmp;
 
-    s->is_jmp = DISAS_UPDATE;
+    s->is_jmp = DISAS_JUMP;
     if (s->thumb != (addr & 1)) {
         tmp = tcg_temp_new_i32();
         tcg_gen_movi_i32(tmp, addr & 1);
@@ -825,7 +948,7 @@ static inline void gen_bx_im(DisasContext *s, uint32_t addr)
 /* Set PC and Thumb state from var.  var is marked as dead.  */
 static inline void gen_bx(DisasContext *s, TCGv_i32 var)
 {
-    s->is_jmp = DISAS_UPDATE;
+    s->is_jmp = DISAS_JUMP;
     tcg_gen_andi_i32(cpu_R[15], var, ~1);
     tcg_gen_andi_i32(var, var, 1);
     store_cpu_field(var, thumb);
@@ -889,6 +1012,20 @@ static inline void gen_aa32_st64(TCGv_i64 val, TCGv_i32 addr, int index)
     tcg_gen_qemu_st_i64(val, addr, index, MO_TEQ);
 }
 
+static inline void gen_aa32_cmpxchg_i32(TCGv_i32 ret, TCGv_i32 addr,
+                                        TCGv_i32 cmpv, TCGv_i32 newv,
+                                        int index, TCGMemOp opc)
+{
+    tcg_gen_atomic_cmpxchg_i32(ret, addr, cmpv, newv, index, opc);
+}
+
+static inline void gen_aa32_cmpxchg_i64(TCGv_i64 ret, TCGv_i32 addr,
+                                        TCGv_i64 cmpv, TCGv_i64 newv,
+                                        int index, TCGMemOp opc)
+{
+    tcg_gen_atomic_cmpxchg_i64(ret, addr, cmpv, newv, index, opc);
+}
+
 #else
 
 #define DO_GEN_LD(SUFF, OPC)                                             \
@@ -925,6 +1062,26 @@ static inline void gen_aa32_st64(TCGv_i64 val, TCGv_i32 addr, int index)
     tcg_temp_free(addr64);
 }
 
+static inline void gen_aa32_cmpxchg_i32(TCGv_i32 ret, TCGv_i32 addr,
+                                        TCGv_i32 cmpv, TCGv_i32 newv,
+                                        int index, TCGMemOp opc)
+{
+    TCGv addr64 = tcg_temp_new();
+    tcg_gen_extu_i32_i64(addr64, addr);
+    tcg_gen_atomic_cmpxchg_i32(ret, addr64, cmpv, newv, index, opc);
+    tcg_temp_free(addr64);
+}
+
+static inline void gen_aa32_cmpxchg_i64(TCGv_i64 ret, TCGv_i32 addr,
+                                        TCGv_i64 cmpv, TCGv_i64 newv,
+                                        int index, TCGMemOp opc)
+{
+    TCGv addr64 = tcg_temp_new();
+    tcg_gen_extu_i32_i64(addr64, addr);
+    tcg_gen_atomic_cmpxchg_i64(ret, addr64, cmpv, newv, index, opc);
+    tcg_temp_free(addr64);
+}
+
 #endif
 
 DO_GEN_LD(8s, MO_SB)
@@ -994,7 +1151,7 @@ static inline void gen_add_data_offset(DisasContext *s, unsigned int insn,
         shift = (insn >> 7) & 0x1f;
         shiftop = (insn >> 5) & 3;
         offset = load_reg(s, rm);
-        gen_arm_shift_im(offset, shiftop, shift, 0);
+        gen_arm_shift_im(s, offset, shiftop, shift, 0);
         if (!(insn & (1 << 23)))
             tcg_gen_sub_i32(var, var, offset);
         else
@@ -1926,7 +2083,7 @@ static int disas_iwmmxt_insn(CPUARMState *env, DisasContext *s, uint32_t insn)
             break;
         }
         tcg_gen_shli_i32(tmp, tmp, 28);
-        gen_set_nzcv(tmp);
+        gen_set_nzcv(s, tmp);
         tcg_temp_free_i32(tmp);
         break;
     case 0x401: case 0x405: case 0x409: case 0x40d:	/* TBCST */
@@ -1974,7 +2131,7 @@ static int disas_iwmmxt_insn(CPUARMState *env, DisasContext *s, uint32_t insn)
             tcg_gen_and_i32(tmp, tmp, tmp2);
             break;
         }
-        gen_set_nzcv(tmp);
+        gen_set_nzcv(s, tmp);
         tcg_temp_free_i32(tmp2);
         tcg_temp_free_i32(tmp);
         break;
@@ -2022,7 +2179,7 @@ static int disas_iwmmxt_insn(CPUARMState *env, DisasContext *s, uint32_t insn)
             tcg_gen_or_i32(tmp, tmp, tmp2);
             break;
         }
-        gen_set_nzcv(tmp);
+        gen_set_nzcv(s, tmp);
         tcg_temp_free_i32(tmp2);
         tcg_temp_free_i32(tmp);
         break;
@@ -2669,11 +2826,13 @@ static TCGv_i32 gen_load_and_replicate(DisasContext *s, TCGv_i32 addr, int size)
     return tmp;
 }
 
-static int handle_vsel(uint32_t insn, uint32_t rd, uint32_t rn, uint32_t rm,
-                       uint32_t dp)
+static int handle_vsel(DisasContext *s, uint32_t insn, uint32_t rd,
+                       uint32_t rn, uint32_t rm, uint32_t dp)
 {
     uint32_t cc = extract32(insn, 20, 2);
 
+    gen_compute_cv(s);
+
     if (dp) {
         TCGv_i64 frn, frm, dest;
         TCGv_i64 tmp, zero, zf, nf, vf;
@@ -2952,7 +3111,7 @@ static int disas_vfp_v8_insn(CPUARMState *env, DisasContext *s, uint32_t insn)
     }
 
     if ((insn & 0x0f800e50) == 0x0e000a00) {
-        return handle_vsel(insn, rd, rn, rm, dp);
+        return handle_vsel(s, insn, rd, rn, rm, dp);
     } else if ((insn & 0x0fb00e10) == 0x0e800a00) {
         return handle_vminmaxnm(insn, rd, rn, rm, dp);
     } else if ((insn & 0x0fbc0ed0) == 0x0eb80a40) {
@@ -3165,7 +3324,7 @@ static int disas_vfp_insn(CPUARMState * env, DisasContext *s, uint32_t insn)
                     }
                     if (rd == 15) {
                         /* Set the 4 flag bits in the CPSR.  */
-                        gen_set_nzcv(tmp);
+                        gen_set_nzcv(s, tmp);
                         tcg_temp_free_i32(tmp);
                     } else {
                         store_reg(s, rd, tmp);
@@ -3960,7 +4119,7 @@ static int gen_set_psr(DisasContext *s, uint32_t mask, int spsr, TCGv_i32 t0)
         tcg_gen_or_i32(tmp, tmp, t0);
         store_cpu_field(tmp, spsr);
     } else {
-        gen_set_cpsr(t0, mask);
+        gen_set_cpsr(s, t0, mask);
     }
     tcg_temp_free_i32(t0);
     gen_lookup_tb(s);
@@ -3982,7 +4141,7 @@ static void gen_exception_return(DisasContext *s, TCGv_i32 pc)
     TCGv_i32 tmp;
     store_reg(s, 15, pc);
     tmp = load_cpu_field(spsr);
-    gen_set_cpsr(tmp, CPSR_ERET_MASK);
+    gen_set_cpsr(s, tmp, CPSR_ERET_MASK);
     tcg_temp_free_i32(tmp);
     s->is_jmp = DISAS_UPDATE;
 }
@@ -3990,7 +4149,7 @@ static void gen_exception_return(DisasContext *s, TCGv_i32 pc)
 /* Generate a v6 exception return.  Marks both values as dead.  */
 static void gen_rfe(DisasContext *s, TCGv_i32 pc, TCGv_i32 cpsr)
 {
-    gen_set_cpsr(cpsr, CPSR_ERET_MASK);
+    gen_set_cpsr(s, cpsr, CPSR_ERET_MASK);
     tcg_temp_free_i32(cpsr);
     store_reg(s, 15, pc);
     s->is_jmp = DISAS_UPDATE;
@@ -5000,6 +5159,59 @@ static const uint8_t neon_2rm_sizes[] = {
    We process data in a mixture of 32-bit and 64-bit chunks.
    Mostly we use 32-bit chunks so we can use normal scalar instructions.  */
 
+/* Emit the elementwise 3-reg-same insns that have a TCG vector op.
+   Return false if OP is not one of them.  */
+static bool gen_neon_3r_vec(int op, int u, int size, int q,
+                            int rd, int rn, int rm)
+{
+    TCGType type = q ? TCG_TYPE_V128 : TCG_TYPE_V64;
+    long dofs = vfp_reg_offset(1, rd);
+    long nofs = vfp_reg_offset(1, rn);
+    long mofs = vfp_reg_offset(1, rm);
+
+    switch (op) {
+    case NEON_3R_LOGIC:
+        switch ((u << 2) | size) {
+        case 0: /* VAND */
+            tcg_gen_vec_and(type, cpu_env, dofs, nofs, mofs);
+            break;
+        case 1: /* VBIC */
+            tcg_gen_vec_andc(type, cpu_env, dofs, nofs, mofs);
+            break;
+        case 2: /* VORR, VMOV */
+            if (rn == rm) {
+                tcg_gen_vec_mov(type, cpu_env, dofs, nofs);
+            } else {
+                tcg_gen_vec_or(type, cpu_env, dofs, nofs, mofs);
+            }
+            break;
+        case 4: /* VEOR */
+            tcg_gen_vec_xor(type, cpu_env, dofs, nofs, mofs);
+            break;
+        default:
+            return false;
+        }
+        break;
+    case NEON_3R_VADD_VSUB:
+        if (u) {
+            tcg_gen_vec_sub(type, size, cpu_env, dofs, nofs, mofs);
+        } else {
+            tcg_gen_vec_add(type, size, cpu_env, dofs, nofs, mofs);
+        }
+        break;
+    case NEON_3R_VTST_VCEQ:
+        if (!u) {
+            return false;
+        }
+        /* VCEQ */
+        tcg_gen_vec_cmpeq(type, size, cpu_env, dofs, nofs, mofs);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
 static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t insn)
 {
     int op;
@@ -5089,6 +5301,9 @@ static int disas_neon_data_insn(CPUARMState * env, DisasContext *s, uint32_t ins
             tcg_temp_free_i32(tmp3);
             return 0;
         }
+        if (gen_neon_3r_vec(op, u, size, q, rd, rn, rm)) {
+            return 0;
+        }
         if (size == 3 && op != NEON_3R_LOGIC) {
             /* 64-bit element instructions. */
             for (pass = 0; pass < (q ? 2 : 1); pass++) {
@@ -7163,7 +7378,7 @@ static int disas_coproc_insn(CPUARMState * env, DisasContext *s, uint32_t insn)
                     /* Destination register of r15 for 32 bit loads sets
                      * the condition codes from the high 4 bits of the value
                      */
-                    gen_set_nzcv(tmp);
+                    gen_set_nzcv(s, tmp);
                     tcg_temp_free_i32(tmp);
                 } else {
                     store_reg(s, rt, tmp);
@@ -7287,10 +7502,13 @@ static void gen_addq(DisasContext *s, TCGv_i64 val, int rlow, int rhigh)
 }
 
 /* Set N and Z flags from hi|lo.  */
-static void gen_logicq_cc(TCGv_i32 lo, TCGv_i32 hi)
+static void gen_logicq_cc(DisasContext *s, TCGv_i32 lo, TCGv_i32 hi)
 {
     tcg_gen_mov_i32(cpu_NF, hi);
     tcg_gen_or_i32(cpu_ZF, lo, hi);
+    if (s->cc_op != CC_OP_FLAGS) {
+        s->cc_op = CC_OP_DYNAMIC;
+    }
 }
 
 /* Load/Store exclusive instructions are implemented by remembering
@@ -7299,8 +7517,9 @@ static void gen_logicq_cc(TCGv_i32 lo, TCGv_i32 hi)
    the architecturally mandated semantics, and avoids having to monitor
    regular stores.
 
-   In system emulation mode only one CPU will be running at once, so
-   this sequence is effectively atomic.  In user emulation mode we
+   In system emulation mode the store is done under a lock shared by all
+   the vCPUs, so the sequence is atomic with respect to other exclusive
+   stores even with one thread per vCPU.  In user emulation mode we
    throw an exception and handle the atomic operation elsewhere.  */
 static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
                                TCGv_i32 addr, int size)
@@ -7347,13 +7566,75 @@ static void gen_clrex(DisasContext *s)
 }
 
 #ifdef CONFIG_USER_ONLY
+/* In user mode the store is a host compare-and-swap against the value
+ * the load-exclusive saw, so that guest threads running in parallel do
+ * not have to stop each other.  Unlike a real monitor, this misses a
+ * store of that same value by another thread in between.
+ */
 static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
                                 TCGv_i32 addr, int size)
 {
-    tcg_gen_extu_i32_i64(cpu_exclusive_test, addr);
-    tcg_gen_movi_i32(cpu_exclusive_info,
-                     size | (rd << 4) | (rt << 8) | (rt2 << 12));
-    gen_exception_internal_insn(s, 4, EXCP_STREX);
+    TCGv_i32 tmp;
+    TCGv_i64 extaddr;
+    int done_label;
+    int fail_label;
+
+    /* if (env->exclusive_addr == addr
+           && cmpxchg([addr], env->exclusive_val, {Rt}) succeeds) {
+         {Rd} = 0;
+       } else {
+         {Rd} = 1;
+       } */
+    fail_label = gen_new_label();
+    done_label = gen_new_label();
+    extaddr = tcg_temp_new_i64();
+    tcg_gen_extu_i32_i64(extaddr, addr);
+    tcg_gen_brcond_i64(TCG_COND_NE, extaddr, cpu_exclusive_addr, fail_label);
+    tcg_temp_free_i64(extaddr);
+
+    if (size == 3) {
+        TCGv_i32 tmp2 = load_reg(s, rt2);
+        TCGv_i64 val64 = tcg_temp_new_i64();
+        TCGv_i64 cmp64 = tcg_temp_new_i64();
+        TCGv_i64 old64 = tcg_temp_new_i64();
+
+        tmp = load_reg(s, rt);
+        /* exclusive_val has the word at the lower address in its low half;
+           a big endian doubleword access has it in the high half */
+#ifdef TARGET_WORDS_BIGENDIAN
+        tcg_gen_concat_i32_i64(val64, tmp2, tmp);
+        tcg_gen_rotri_i64(cmp64, cpu_exclusive_val, 32);
+#else
+        tcg_gen_concat_i32_i64(val64, tmp, tmp2);
+        tcg_gen_mov_i64(cmp64, cpu_exclusive_val);
+#endif
+        tcg_temp_free_i32(tmp);
+        tcg_temp_free_i32(tmp2);
+        gen_aa32_cmpxchg_i64(old64, addr, cmp64, val64,
+                             get_mem_index(s), MO_TEQ);
+        tcg_temp_free_i64(val64);
+        tcg_gen_setcond_i64(TCG_COND_NE, old64, old64, cmp64);
+        tcg_gen_trunc_i64_i32(cpu_R[rd], old64);
+        tcg_temp_free_i64(old64);
+        tcg_temp_free_i64(cmp64);
+    } else {
+        TCGv_i32 cmp = tcg_temp_new_i32();
+        TCGv_i32 old = tcg_temp_new_i32();
+
+        tcg_gen_trunc_i64_i32(cmp, cpu_exclusive_val);
+        tmp = load_reg(s, rt);
+        gen_aa32_cmpxchg_i32(old, addr, cmp, tmp, get_mem_index(s),
+                             size | MO_TE);
+        tcg_temp_free_i32(tmp);
+        tcg_gen_setcond_i32(TCG_COND_NE, cpu_R[rd], old, cmp);
+        tcg_temp_free_i32(old);
+        tcg_temp_free_i32(cmp);
+    }
+    tcg_gen_br(done_label);
+    gen_set_label(fail_label);
+    tcg_gen_movi_i32(cpu_R[rd], 1);
+    gen_set_label(done_label);
+    tcg_gen_movi_i64(cpu_exclusive_addr, -1);
 }
 #else
 static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
@@ -7372,6 +7653,9 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
        } */
     fail_label = gen_new_label();
     done_label = gen_new_label();
+    if (parallel_cpus) {
+        gen_helper_exclusive_lock();
+    }
     extaddr = tcg_temp_new_i64();
     tcg_gen_extu_i32_i64(extaddr, addr);
     tcg_gen_brcond_i64(TCG_COND_NE, extaddr, cpu_exclusive_addr, fail_label);
@@ -7438,6 +7722,9 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
     tcg_gen_movi_i32(cpu_R[rd], 1);
     gen_set_label(done_label);
     tcg_gen_movi_i64(cpu_exclusive_addr, -1);
+    if (parallel_cpus) {
+        gen_helper_exclusive_unlock();
+    }
 }
 #endif
 
@@ -7716,9 +8003,7 @@ static void disas_arm_insn(CPUARMState * env, DisasContext *s)
     if (cond != 0xe) {
         /* if not always execute, we generate a conditional jump to
            next instruction */
-        s->condlabel = gen_new_label();
-        arm_gen_test_cc(cond ^ 1, s->condlabel);
-        s->condjmp = 1;
+        gen_cond_skip(s, cond);
     }
     if ((insn & 0x0f900000) == 0x03000000) {
         if ((insn & (1 << 21)) == 0) {
@@ -7956,7 +8241,7 @@ static void disas_arm_insn(CPUARMState * env, DisasContext *s)
             tmp2 = tcg_temp_new_i32();
             tcg_gen_movi_i32(tmp2, val);
             if (logic_cc && shift) {
-                gen_set_CF_bit31(tmp2);
+                gen_set_CF_bit31(s, tmp2);
             }
         } else {
             /* register */
@@ -7965,11 +8250,11 @@ static void disas_arm_insn(CPUARMState * env, DisasContext *s)
             shiftop = (insn >> 5) & 3;
             if (!(insn & (1 << 4))) {
                 shift = (insn >> 7) & 0x1f;
-                gen_arm_shift_im(tmp2, shiftop, shift, logic_cc);
+                gen_arm_shift_im(s, tmp2, shiftop, shift, logic_cc);
             } else {
                 rs = (insn >> 8) & 0xf;
                 tmp = load_reg(s, rs);
-                gen_arm_shift_reg(tmp2, shiftop, tmp, logic_cc);
+                gen_arm_shift_reg(s, tmp2, shiftop, tmp, logic_cc);
             }
         }
         if (op1 != 0x0f && op1 != 0x0d) {
@@ -7983,14 +8268,14 @@ static void disas_arm_insn(CPUARMState * env, DisasContext *s)
         case 0x00:
             tcg_gen_and_i32(tmp, tmp, tmp2);
             if (logic_cc) {
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             }
             store_reg_bx(env, s, rd, tmp);
             break;
         case 0x01:
             tcg_gen_xor_i32(tmp, tmp, tmp2);
             if (logic_cc) {
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             }
             store_reg_bx(env, s, rd, tmp);
             break;
@@ -8000,11 +8285,11 @@ static void disas_arm_insn(CPUARMState * env, DisasContext *s)
                 if (IS_USER(s)) {
                     goto illegal_op;
                 }
-                gen_sub_CC(tmp, tmp, tmp2);
+                gen_sub_CC(s, tmp, tmp, tmp2);
                 gen_exception_return(s, tmp);
             } else {
                 if (set_cc) {
-                    gen_sub_CC(tmp, tmp, tmp2);
+                    gen_sub_CC(s, tmp, tmp, tmp2);
                 } else {
                     tcg_gen_sub_i32(tmp, tmp, tmp2);
                 }
@@ -8013,7 +8298,7 @@ static void disas_arm_insn(CPUARMState * env, DisasContext *s)
             break;
         case 0x03:
             if (set_cc) {
-                gen_sub_CC(tmp, tmp2, tmp);
+                gen_sub_CC(s, tmp, tmp2, tmp);
             } else {
                 tcg_gen_sub_i32(tmp, tmp2, tmp);
             }
@@ -8021,7 +8306,7 @@ static void disas_arm_insn(CPUARMState * env, DisasContext *s)
             break;
         case 0x04:
             if (set_cc) {
-                gen_add_CC(tmp, tmp, tmp2);
+                gen_add_CC(s, tmp, tmp, tmp2);
             } else {
                 tcg_gen_add_i32(tmp, tmp, tmp2);
             }
@@ -8029,58 +8314,58 @@ static void disas_arm_insn(CPUARMState * env, DisasContext *s)
             break;
         case 0x05:
             if (set_cc) {
-                gen_adc_CC(tmp, tmp, tmp2);
+                gen_adc_CC(s, tmp, tmp, tmp2);
             } else {
-                gen_add_carry(tmp, tmp, tmp2);
+                gen_add_carry(s, tmp, tmp, tmp2);
             }
             store_reg_bx(env, s, rd, tmp);
             break;
         case 0x06:
             if (set_cc) {
-                gen_sbc_CC(tmp, tmp, tmp2);
+                gen_sbc_CC(s, tmp, tmp, tmp2);
             } else {
-                gen_sub_carry(tmp, tmp, tmp2);
+                gen_sub_carry(s, tmp, tmp, tmp2);
             }
             store_reg_bx(env, s, rd, tmp);
             break;
         case 0x07:
             if (set_cc) {
-                gen_sbc_CC(tmp, tmp2, tmp);
+                gen_sbc_CC(s, tmp, tmp2, tmp);
             } else {
-                gen_sub_carry(tmp, tmp2, tmp);
+                gen_sub_carry(s, tmp, tmp2, tmp);
             }
             store_reg_bx(env, s, rd, tmp);
             break;
         case 0x08:
             if (set_cc) {
                 tcg_gen_and_i32(tmp, tmp, tmp2);
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             }
             tcg_temp_free_i32(tmp);
             break;
         case 0x09:
             if (set_cc) {
                 tcg_gen_xor_i32(tmp, tmp, tmp2);
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             }
             tcg_temp_free_i32(tmp);
             break;
         case 0x0a:
             if (set_cc) {
-                gen_sub_CC(tmp, tmp, tmp2);
+                gen_sub_CC(s, tmp, tmp, tmp2);
             }
             tcg_temp_free_i32(tmp);
             break;
         case 0x0b:
             if (set_cc) {
-                gen_add_CC(tmp, tmp, tmp2);
+                gen_add_CC(s, tmp, tmp, tmp2);
             }
             tcg_temp_free_i32(tmp);
             break;
         case 0x0c:
             tcg_gen_or_i32(tmp, tmp, tmp2);
             if (logic_cc) {
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             }
             store_reg_bx(env, s, rd, tmp);
             break;
@@ -8093,7 +8378,7 @@ static void disas_arm_insn(CPUARMState * env, DisasContext *s)
                 gen_exception_return(s, tmp2);
             } else {
                 if (logic_cc) {
-                    gen_logic_CC(tmp2);
+                    gen_logic_CC(s, tmp2);
                 }
                 store_reg_bx(env, s, rd, tmp2);
             }
@@ -8101,7 +8386,7 @@ static void disas_arm_insn(CPUARMState * env, DisasContext *s)
         case 0x0e:
             tcg_gen_andc_i32(tmp, tmp, tmp2);
             if (logic_cc) {
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             }
             store_reg_bx(env, s, rd, tmp);
             break;
@@ -8109,7 +8394,7 @@ static void disas_arm_insn(CPUARMState * env, DisasContext *s)
         case 0x0f:
             tcg_gen_not_i32(tmp2, tmp2);
             if (logic_cc) {
-                gen_logic_CC(tmp2);
+                gen_logic_CC(s, tmp2);
             }
             store_reg_bx(env, s, rd, tmp2);
             break;
@@ -8152,7 +8437,7 @@ static void disas_arm_insn(CPUARMState * env, DisasContext *s)
                             tcg_temp_free_i32(tmp2);
                         }
                         if (insn & (1 << 20))
-                            gen_logic_CC(tmp);
+                            gen_logic_CC(s, tmp);
                         store_reg(s, rd, tmp);
                         break;
                     case 4:
@@ -8184,7 +8469,7 @@ static void disas_arm_insn(CPUARMState * env, DisasContext *s)
                             tcg_temp_free_i32(ah);
                         }
                         if (insn & (1 << 20)) {
-                            gen_logicq_cc(tmp, tmp2);
+                            gen_logicq_cc(s, tmp, tmp2);
                         }
                         store_reg(s, rn, tmp);
                         store_reg(s, rd, tmp2);
@@ -8867,7 +9152,7 @@ static void disas_arm_insn(CPUARMState * env, DisasContext *s)
                 if ((insn & (1 << 22)) && !user) {
                     /* Restore CPSR from SPSR.  */
                     tmp = load_cpu_field(spsr);
-                    gen_set_cpsr(tmp, CPSR_ERET_MASK);
+                    gen_set_cpsr(s, tmp, CPSR_ERET_MASK);
                     tcg_temp_free_i32(tmp);
                     s->is_jmp = DISAS_UPDATE;
                 }
@@ -8960,32 +9245,32 @@ gen_thumb2_data_op(DisasContext *s, int op, int conds, uint32_t shifter_out,
         break;
     case 8: /* add */
         if (conds)
-            gen_add_CC(t0, t0, t1);
+            gen_add_CC(s, t0, t0, t1);
         else
             tcg_gen_add_i32(t0, t0, t1);
         break;
     case 10: /* adc */
         if (conds)
-            gen_adc_CC(t0, t0, t1);
+            gen_adc_CC(s, t0, t0, t1);
         else
-            gen_adc(t0, t1);
+            gen_adc(s, t0, t1);
         break;
     case 11: /* sbc */
         if (conds) {
-            gen_sbc_CC(t0, t0, t1);
+            gen_sbc_CC(s, t0, t0, t1);
         } else {
-            gen_sub_carry(t0, t0, t1);
+            gen_sub_carry(s, t0, t0, t1);
         }
         break;
     case 13: /* sub */
         if (conds)
-            gen_sub_CC(t0, t0, t1);
+            gen_sub_CC(s, t0, t0, t1);
         else
             tcg_gen_sub_i32(t0, t0, t1);
         break;
     case 14: /* rsb */
         if (conds)
-            gen_sub_CC(t0, t1, t0);
+            gen_sub_CC(s, t0, t1, t0);
         else
             tcg_gen_sub_i32(t0, t1, t0);
         break;
@@ -8993,9 +9278,9 @@ gen_thumb2_data_op(DisasContext *s, int op, int conds, uint32_t shifter_out,
         return 1;
     }
     if (logic_cc) {
-        gen_logic_CC(t0);
+        gen_logic_CC(s, t0);
         if (shifter_out)
-            gen_set_CF_bit31(t1);
+            gen_set_CF_bit31(s, t1);
     }
     return 0;
 }
@@ -9353,7 +9638,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
             shift = ((insn >> 6) & 3) | ((insn >> 10) & 0x1c);
             conds = (insn & (1 << 20)) != 0;
             logic_cc = (conds && thumb2_logic_op(op));
-            gen_arm_shift_im(tmp2, shiftop, shift, logic_cc);
+            gen_arm_shift_im(s, tmp2, shiftop, shift, logic_cc);
             if (gen_thumb2_data_op(s, op, conds, 0, tmp, tmp2))
                 goto illegal_op;
             tcg_temp_free_i32(tmp2);
@@ -9376,9 +9661,9 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                 goto illegal_op;
             op = (insn >> 21) & 3;
             logic_cc = (insn & (1 << 20)) != 0;
-            gen_arm_shift_reg(tmp, op, tmp2, logic_cc);
+            gen_arm_shift_reg(s, tmp, op, tmp2, logic_cc);
             if (logic_cc)
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             store_reg_bx(env, s, rd, tmp);
             break;
         case 1: /* Sign/zero extend.  */
@@ -9722,6 +10007,8 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                             tmp = load_reg(s, rn);
                             addr = tcg_const_i32(insn & 0xff);
                             gen_helper_v7m_msr(cpu_env, addr, tmp);
+                            /* which may have written the flags */
+                            s->cc_op = CC_OP_DYNAMIC;
                             tcg_temp_free_i32(addr);
                             tcg_temp_free_i32(tmp);
                             gen_lookup_tb(s);
@@ -9820,9 +10107,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                 /* Conditional branch.  */
                 op = (insn >> 22) & 0xf;
                 /* Generate a conditional jump to next instruction.  */
-                s->condlabel = gen_new_label();
-                arm_gen_test_cc(op ^ 1, s->condlabel);
-                s->condjmp = 1;
+                gen_cond_skip(s, op);
 
                 /* offset[11:1] = insn[10:0] */
                 offset = (insn & 0x7ff) << 1;
@@ -10177,9 +10462,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
     if (s->condexec_mask) {
         cond = s->condexec_cond;
         if (cond != 0x0e) {     /* Skip conditional when condition is AL. */
-          s->condlabel = gen_new_label();
-          arm_gen_test_cc(cond ^ 1, s->condlabel);
-          s->condjmp = 1;
+          gen_cond_skip(s, cond);
         }
     }
 
@@ -10208,12 +10491,12 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
                 if (s->condexec_mask)
                     tcg_gen_sub_i32(tmp, tmp, tmp2);
                 else
-                    gen_sub_CC(tmp, tmp, tmp2);
+                    gen_sub_CC(s, tmp, tmp, tmp2);
             } else {
                 if (s->condexec_mask)
                     tcg_gen_add_i32(tmp, tmp, tmp2);
                 else
-                    gen_add_CC(tmp, tmp, tmp2);
+                    gen_add_CC(s, tmp, tmp, tmp2);
             }
             tcg_temp_free_i32(tmp2);
             store_reg(s, rd, tmp);
@@ -10222,9 +10505,9 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             rm = (insn >> 3) & 7;
             shift = (insn >> 6) & 0x1f;
             tmp = load_reg(s, rm);
-            gen_arm_shift_im(tmp, op, shift, s->condexec_mask == 0);
+            gen_arm_shift_im(s, tmp, op, shift, s->condexec_mask == 0);
             if (!s->condexec_mask)
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             store_reg(s, rd, tmp);
         }
         break;
@@ -10236,7 +10519,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             tmp = tcg_temp_new_i32();
             tcg_gen_movi_i32(tmp, insn & 0xff);
             if (!s->condexec_mask)
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             store_reg(s, rd, tmp);
         } else {
             tmp = load_reg(s, rd);
@@ -10244,7 +10527,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             tcg_gen_movi_i32(tmp2, insn & 0xff);
             switch (op) {
             case 1: /* cmp */
-                gen_sub_CC(tmp, tmp, tmp2);
+                gen_sub_CC(s, tmp, tmp, tmp2);
                 tcg_temp_free_i32(tmp);
                 tcg_temp_free_i32(tmp2);
                 break;
@@ -10252,7 +10535,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
                 if (s->condexec_mask)
                     tcg_gen_add_i32(tmp, tmp, tmp2);
                 else
-                    gen_add_CC(tmp, tmp, tmp2);
+                    gen_add_CC(s, tmp, tmp, tmp2);
                 tcg_temp_free_i32(tmp2);
                 store_reg(s, rd, tmp);
                 break;
@@ -10260,7 +10543,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
                 if (s->condexec_mask)
                     tcg_gen_sub_i32(tmp, tmp, tmp2);
                 else
-                    gen_sub_CC(tmp, tmp, tmp2);
+                    gen_sub_CC(s, tmp, tmp, tmp2);
                 tcg_temp_free_i32(tmp2);
                 store_reg(s, rd, tmp);
                 break;
@@ -10297,7 +10580,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             case 1: /* cmp */
                 tmp = load_reg(s, rd);
                 tmp2 = load_reg(s, rm);
-                gen_sub_CC(tmp, tmp, tmp2);
+                gen_sub_CC(s, tmp, tmp, tmp2);
                 tcg_temp_free_i32(tmp2);
                 tcg_temp_free_i32(tmp);
                 break;
@@ -10349,49 +10632,52 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
         case 0x0: /* and */
             tcg_gen_and_i32(tmp, tmp, tmp2);
             if (!s->condexec_mask)
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             break;
         case 0x1: /* eor */
             tcg_gen_xor_i32(tmp, tmp, tmp2);
             if (!s->condexec_mask)
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             break;
         case 0x2: /* lsl */
             if (s->condexec_mask) {
                 gen_shl(tmp2, tmp2, tmp);
             } else {
+                gen_compute_cv(s);
                 gen_helper_shl_cc(tmp2, cpu_env, tmp2, tmp);
-                gen_logic_CC(tmp2);
+                gen_logic_CC(s, tmp2);
             }
             break;
         case 0x3: /* lsr */
             if (s->condexec_mask) {
                 gen_shr(tmp2, tmp2, tmp);
             } else {
+                gen_compute_cv(s);
                 gen_helper_shr_cc(tmp2, cpu_env, tmp2, tmp);
-                gen_logic_CC(tmp2);
+                gen_logic_CC(s, tmp2);
             }
             break;
         case 0x4: /* asr */
             if (s->condexec_mask) {
                 gen_sar(tmp2, tmp2, tmp);
             } else {
+                gen_compute_cv(s);
                 gen_helper_sar_cc(tmp2, cpu_env, tmp2, tmp);
-                gen_logic_CC(tmp2);
+                gen_logic_CC(s, tmp2);
             }
             break;
         case 0x5: /* adc */
             if (s->condexec_mask) {
-                gen_adc(tmp, tmp2);
+                gen_adc(s, tmp, tmp2);
             } else {
-                gen_adc_CC(tmp, tmp, tmp2);
+                gen_adc_CC(s, tmp, tmp, tmp2);
             }
             break;
         case 0x6: /* sbc */
             if (s->condexec_mask) {
-                gen_sub_carry(tmp, tmp, tmp2);
+                gen_sub_carry(s, tmp, tmp, tmp2);
             } else {
-                gen_sbc_CC(tmp, tmp, tmp2);
+                gen_sbc_CC(s, tmp, tmp, tmp2);
             }
             break;
         case 0x7: /* ror */
@@ -10399,48 +10685,49 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
                 tcg_gen_andi_i32(tmp, tmp, 0x1f);
                 tcg_gen_rotr_i32(tmp2, tmp2, tmp);
             } else {
+                gen_compute_cv(s);
                 gen_helper_ror_cc(tmp2, cpu_env, tmp2, tmp);
-                gen_logic_CC(tmp2);
+                gen_logic_CC(s, tmp2);
             }
             break;
         case 0x8: /* tst */
             tcg_gen_and_i32(tmp, tmp, tmp2);
-            gen_logic_CC(tmp);
+            gen_logic_CC(s, tmp);
             rd = 16;
             break;
         case 0x9: /* neg */
             if (s->condexec_mask)
                 tcg_gen_neg_i32(tmp, tmp2);
             else
-                gen_sub_CC(tmp, tmp, tmp2);
+                gen_sub_CC(s, tmp, tmp, tmp2);
             break;
         case 0xa: /* cmp */
-            gen_sub_CC(tmp, tmp, tmp2);
+            gen_sub_CC(s, tmp, tmp, tmp2);
             rd = 16;
             break;
         case 0xb: /* cmn */
-            gen_add_CC(tmp, tmp, tmp2);
+            gen_add_CC(s, tmp, tmp, tmp2);
             rd = 16;
             break;
         case 0xc: /* orr */
             tcg_gen_or_i32(tmp, tmp, tmp2);
             if (!s->condexec_mask)
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             break;
         case 0xd: /* mul */
             tcg_gen_mul_i32(tmp, tmp, tmp2);
             if (!s->condexec_mask)
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             break;
         case 0xe: /* bic */
             tcg_gen_andc_i32(tmp, tmp, tmp2);
             if (!s->condexec_mask)
-                gen_logic_CC(tmp);
+                gen_logic_CC(s, tmp);
             break;
         case 0xf: /* mvn */
             tcg_gen_not_i32(tmp2, tmp2);
             if (!s->condexec_mask)
-                gen_logic_CC(tmp2);
+                gen_logic_CC(s, tmp2);
             val = 1;
             rm = rd;
             break;
@@ -10704,6 +10991,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             tmp = load_reg(s, rm);
             s->condlabel = gen_new_label();
             s->condjmp = 1;
+            s->condjmp_cc_op = s->cc_op;
             if (insn & (1 << 11))
                 tcg_gen_brcondi_i32(TCG_COND_EQ, tmp, 0, s->condlabel);
             else
@@ -10854,9 +11142,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             break;
         }
         /* generate a conditional jump to next instruction */
-        s->condlabel = gen_new_label();
-        arm_gen_test_cc(cond ^ 1, s->condlabel);
-        s->condjmp = 1;
+        gen_cond_skip(s, cond);
 
         /* jump to the offset */
         val = (uint32_t)s->pc + 2;
@@ -10930,6 +11216,7 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
     dc->pc = pc_start;
     dc->singlestep_enabled = cs->singlestep_enabled;
     dc->condjmp = 0;
+    dc->cc_op = CC_OP_DYNAMIC;
 
     dc->aarch64 = 0;
     dc->thumb = ARM_TBFLAG_THUMB(tb->flags);
@@ -11007,10 +11294,9 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
      * (3) if we leave the TB unexpectedly (eg a data abort on a load)
      * then the CPUARMState will be wrong and we need to reset it.
      * This is handled in the same way as restoration of the
-     * PC in these situations: we will be called again with search_pc=1
-     * and generate a mapping of the condexec bits for each PC in
-     * gen_opc_condexec_bits[]. restore_state_to_opc() then uses
-     * this to restore the condexec bits.
+     * PC in these situations: the condexec bits of each PC are recorded
+     * in gen_opc_condexec_bits[] and saved with the TB, and
+     * restore_state_to_opc() then uses them to restore the condexec bits.
      *
      * Note that there are no instructions which can read the condexec
      * bits, and none which can write non-static values to them, so
@@ -11057,18 +11343,16 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
                 }
             }
         }
-        if (search_pc) {
-            j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-            if (lj < j) {
-                lj++;
-                while (lj < j)
-                    tcg_ctx.gen_opc_instr_start[lj++] = 0;
-            }
-            tcg_ctx.gen_opc_pc[lj] = dc->pc;
-            gen_opc_condexec_bits[lj] = (dc->condexec_cond << 4) | (dc->condexec_mask >> 1);
-            tcg_ctx.gen_opc_instr_start[lj] = 1;
-            tcg_ctx.gen_opc_icount[lj] = num_insns;
+        j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+        if (lj < j) {
+            lj++;
+            while (lj < j)
+                tcg_ctx.gen_opc_instr_start[lj++] = 0;
         }
+        tcg_ctx.gen_opc_pc[lj] = dc->pc;
+        gen_opc_condexec_bits[lj] = (dc->condexec_cond << 4) | (dc->condexec_mask >> 1);
+        tcg_ctx.gen_opc_instr_start[lj] = 1;
+        tcg_ctx.gen_opc_icount[lj] = num_insns;
 
         if (num_insns + 1 == max_insns && (tb->cflags & CF_LAST_IO))
             gen_io_start();
@@ -11110,6 +11394,10 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
         if (dc->condjmp && !dc->is_jmp) {
             gen_set_label(dc->condlabel);
             dc->condjmp = 0;
+            if (dc->cc_op != dc->condjmp_cc_op) {
+                /* which depends on whether the insn was skipped */
+                dc->cc_op = CC_OP_DYNAMIC;
+            }
         }
 
         if (tcg_check_temp_count()) {
@@ -11184,8 +11472,11 @@ static inline void gen_intermediate_code_internal(ARMCPU *cpu,
         case DISAS_NEXT:
             gen_goto_tb(dc, 1, dc->pc);
             break;
-        default:
         case DISAS_JUMP:
+            /* find the next TB without returning to the main loop */
+            tcg_gen_lookup_and_goto_ptr(cpu_env);
+            break;
+        default:
         case DISAS_UPDATE:
             /* indicate that the hash table must be used to find the next TB */
             tcg_gen_exit_tb(0);
@@ -11224,12 +11515,11 @@ done_generating:
         qemu_log("\n");
     }
 #endif
-    if (search_pc) {
-        j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-        lj++;
-        while (lj <= j)
-            tcg_ctx.gen_opc_instr_start[lj++] = 0;
-    } else {
+    j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+    lj++;
+    while (lj <= j)
+        tcg_ctx.gen_opc_instr_start[lj++] = 0;
+    if (!search_pc) {
         tb->size = dc->pc - pc_start;
         tb->icount = num_insns;
     }
@@ -10,6 +10,8 @@ typedef struct DisasContext {
     int condjmp;
     /* The label that will be jumped to when the instruction is skipped.  */
     int condlabel;
+    /* The value of cc_op at that label when the instruction is skipped.  */
+    int condjmp_cc_op;
     /* Thumb-2 conditional execution bits.  */
     int condexec_mask;
     int condexec_cond;
@@ -57,9 +59,23 @@ typedef struct DisasContext {
 #define TMP_A64_MAX 16
     int tmp_a64_count;
     TCGv_i64 tmp_a64[TMP_A64_MAX];
+    /* The value of env->cc_op at this point, or CC_OP_DYNAMIC if it is
+     * not known at translation time.  While it is CC_OP_SUB32 or
+     * CC_OP_SUB64, NF and ZF also hold the result of that subtraction.
+     */
+    int cc_op;
 } DisasContext;
 
+#define CC_OP_DYNAMIC (-1)
+
 extern TCGv_ptr cpu_env;
+extern TCGv_i32 cpu_NF, cpu_ZF, cpu_CF, cpu_VF;
+extern TCGv_i32 cpu_cc_op;
+extern TCGv_i64 cpu_exclusive_addr, cpu_exclusive_val;
+#ifdef CONFIG_USER_ONLY
+extern TCGv_i64 cpu_exclusive_test;
+extern TCGv_i32 cpu_exclusive_info;
+#endif
 
 static inline int arm_dc_feature(DisasContext *dc, int feature)
 {
@@ -84,6 +100,11 @@ static inline int get_mem_index(DisasContext *s)
 #define DISAS_EXC 6
 /* WFE */
 #define DISAS_WFE 7
+/* The pc is set, but the CPU state changed in a way that cpu_exec has
+ * to act upon (e.g. an exception return unmasking interrupts), so the
+ * next TB must not be looked up from the generated code.
+ */
+#define DISAS_EXIT 8
 
 #ifdef TARGET_AARCH64
 void a64_translate_init(void);
@@ -116,5 +137,12 @@ static inline void aarch64_cpu_dump_state(CPUState *cs, FILE *f,
 #endif
 
 void arm_gen_test_cc(int cc, int label);
+extern const TCGCond arm_cc_sub_cond[14];
+
+/* True if condition code CC depends on the C or V flag.  */
+static inline bool arm_cc_uses_cv(int cc)
+{
+    return (cc >= 2 && cc <= 3) || cc >= 6;
+}
 
 #endif /* TARGET_ARM_TRANSLATE_H */
@@ -2933,6 +2933,7 @@ static void x86_cpu_common_class_init(ObjectClass *oc, void *data)
 #else
     cc->get_memory_mapping = x86_cpu_get_memory_mapping;
     cc->get_phys_page_debug = x86_cpu_get_phys_page_debug;
+    cc->guest_backtrace = x86_cpu_guest_backtrace;
     cc->write_elf64_note = x86_cpu_write_elf64_note;
     cc->write_elf64_qemunote = x86_cpu_write_elf64_qemunote;
     cc->write_elf32_note = x86_cpu_write_elf32_note;
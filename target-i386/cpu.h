@@ -46,6 +46,9 @@
 
 #define CPUArchState struct CPUX86State
 
+/* per-insn state saved for restore_state_to_opc(): cc_op */
+#define TARGET_INSN_DATA_WORDS 1
+
 #include "exec/cpu-defs.h"
 
 #include "fpu/softfloat.h"
@@ -467,9 +467,12 @@ void cpu_x86_update_cr4(CPUX86State *env, uint32_t new_cr4)
     printf("CR4 update: CR4=%08x\n", (uint32_t)env->cr[4]);
 #endif
     if ((new_cr4 ^ env->cr[4]) &
-        (CR4_PGE_MASK | CR4_PAE_MASK | CR4_PSE_MASK |
-         CR4_SMEP_MASK | CR4_SMAP_MASK)) {
+        (CR4_PGE_MASK | CR4_PAE_MASK | CR4_PSE_MASK)) {
         tlb_flush(CPU(cpu), 1);
+    } else if ((new_cr4 ^ env->cr[4]) & (CR4_SMEP_MASK | CR4_SMAP_MASK)) {
+        /* only the supervisor permissions depend on these */
+        tlb_flush_by_mmuidx(CPU(cpu), (1 << MMU_KSMAP_IDX) |
+                                      (1 << MMU_KNOSMAP_IDX));
     }
     /* SSE handling */
     if (!(env->features[FEAT_1_EDX] & CPUID_SSE)) {
@@ -528,6 +531,7 @@ int x86_cpu_handle_mmu_fault(CPUState *cs, vaddr addr,
     uint64_t rsvd_mask = PG_HI_RSVD_MASK;
     uint32_t page_offset;
     target_ulong vaddr;
+    bool global = false;
 
     is_user = mmu_idx == MMU_USER_IDX;
 #if defined(DEBUG_MMU)
@@ -766,6 +770,8 @@ do_check_protect_pse36:
                 prot |= PAGE_WRITE;
         }
     }
+    /* global pages survive CR3 reloads */
+    global = (env->cr[4] & CR4_PGE_MASK) && (pte & PG_GLOBAL_MASK);
  do_mapping:
     pte = pte & env->a20_mask;
 
@@ -778,7 +784,11 @@ do_check_protect_pse36:
     page_offset = vaddr & (page_size - 1);
     paddr = pte + page_offset;
 
-    tlb_set_page(cs, vaddr, paddr, prot, mmu_idx, page_size);
+    if (global) {
+        tlb_set_global_page(cs, vaddr, paddr, prot, mmu_idx, page_size);
+    } else {
+        tlb_set_page(cs, vaddr, paddr, prot, mmu_idx, page_size);
+    }
     return 0;
  do_fault_rsvd:
     error_code |= PG_ERROR_RSVD_MASK;
@@ -911,6 +921,53 @@ out:
     return pte | page_offset;
 }
 
+/* Follow the chain of saved frame pointers: the frame at EBP/RBP holds
+   the caller's frame pointer, followed by the return address.  Code
+   built without frame pointers stops the walk early or yields bogus
+   callers, which is the usual trade-off of this kind of unwinding.  */
+int x86_cpu_guest_backtrace(CPUState *cs, vaddr *frames, int max)
+{
+    X86CPU *cpu = X86_CPU(cs);
+    CPUX86State *env = &cpu->env;
+    target_ulong fp, next, ret;
+    uint8_t buf[16];
+    int size, n;
+
+    if (env->hflags & HF_CS64_MASK) {
+        size = 8;
+    } else if (env->hflags & HF_CS32_MASK) {
+        size = 4;
+    } else {
+        return 0;
+    }
+
+    fp = env->regs[R_EBP];
+    for (n = 0; n < max && fp; n++) {
+        if (cpu_memory_rw_debug(cs, env->segs[R_SS].base + fp, buf,
+                                2 * size, 0) < 0) {
+            break;
+        }
+        if (size == 8) {
+            next = ldq_le_p(buf);
+            ret = ldq_le_p(buf + 8);
+        } else {
+            next = ldl_le_p(buf);
+            ret = ldl_le_p(buf + 4);
+        }
+        if (!ret) {
+            break;
+        }
+        frames[n] = env->segs[R_CS].base + ret;
+        /* the stack grows down, so callers have higher frames */
+        if (next <= fp) {
+            n++;
+            break;
+        }
+        fp = next;
+    }
+    return n;
+}
+
 void hw_breakpoint_insert(CPUX86State *env, int index)
 {
     CPUState *cs = CPU(x86_env_get_cpu(env));
@@ -76,12 +76,14 @@ static TCGv_ptr cpu_ptr0, cpu_ptr1;
 static TCGv_i32 cpu_tmp2_i32, cpu_tmp3_i32;
 static TCGv_i64 cpu_tmp1_i64;
 
-static uint8_t gen_opc_cc_op[OPC_BUF_SIZE];
+#define gen_opc_cc_op tcg_ctx.gen_opc_data[0]
 
 #include "exec/gen-icount.h"
 
 #ifdef TARGET_X86_64
-static int x86_64_hregs;
+/* per thread, as guest threads of linux-user translate concurrently */
+static DEFINE_TLS(int, x86_64_hregs);
+#define x86_64_hregs tls_var(x86_64_hregs)
 #endif
 
 typedef struct DisasContext {
@@ -1303,59 +1305,103 @@ static void gen_helper_fp_arith_STN_ST0(int op, int opreg)
 }
 
 /* if d == OR_TMP0, it means memory operand (address in A0) */
+/* With a LOCK prefix and a memory destination, the read-modify-write
+   is one atomic operation on the memory at A0.  */
 static void gen_op(DisasContext *s1, int op, TCGMemOp ot, int d)
 {
+    bool lock = d == OR_TMP0 && (s1->prefix & PREFIX_LOCK) && op != OP_CMPL;
+
     if (d != OR_TMP0) {
         gen_op_mov_v_reg(ot, cpu_T[0], d);
-    } else {
+    } else if (!lock) {
         gen_op_ld_v(s1, ot, cpu_T[0], cpu_A0);
     }
     switch(op) {
     case OP_ADCL:
         gen_compute_eflags_c(s1, cpu_tmp4);
-        tcg_gen_add_tl(cpu_T[0], cpu_T[0], cpu_T[1]);
-        tcg_gen_add_tl(cpu_T[0], cpu_T[0], cpu_tmp4);
-        gen_op_st_rm_T0_A0(s1, ot, d);
+        if (lock) {
+            tcg_gen_add_tl(cpu_T[0], cpu_tmp4, cpu_T[1]);
+            tcg_gen_atomic_add_fetch_tl(cpu_T[0], cpu_A0, cpu_T[0],
+                                        s1->mem_index, ot | MO_LE);
+        } else {
+            tcg_gen_add_tl(cpu_T[0], cpu_T[0], cpu_T[1]);
+            tcg_gen_add_tl(cpu_T[0], cpu_T[0], cpu_tmp4);
+            gen_op_st_rm_T0_A0(s1, ot, d);
+        }
         gen_op_update3_cc(cpu_tmp4);
         set_cc_op(s1, CC_OP_ADCB + ot);
         break;
     case OP_SBBL:
         gen_compute_eflags_c(s1, cpu_tmp4);
-        tcg_gen_sub_tl(cpu_T[0], cpu_T[0], cpu_T[1]);
-        tcg_gen_sub_tl(cpu_T[0], cpu_T[0], cpu_tmp4);
-        gen_op_st_rm_T0_A0(s1, ot, d);
+        if (lock) {
+            tcg_gen_add_tl(cpu_T[0], cpu_T[1], cpu_tmp4);
+            tcg_gen_neg_tl(cpu_T[0], cpu_T[0]);
+            tcg_gen_atomic_add_fetch_tl(cpu_T[0], cpu_A0, cpu_T[0],
+                                        s1->mem_index, ot | MO_LE);
+        } else {
+            tcg_gen_sub_tl(cpu_T[0], cpu_T[0], cpu_T[1]);
+            tcg_gen_sub_tl(cpu_T[0], cpu_T[0], cpu_tmp4);
+            gen_op_st_rm_T0_A0(s1, ot, d);
+        }
         gen_op_update3_cc(cpu_tmp4);
         set_cc_op(s1, CC_OP_SBBB + ot);
         break;
     case OP_ADDL:
-        tcg_gen_add_tl(cpu_T[0], cpu_T[0], cpu_T[1]);
-        gen_op_st_rm_T0_A0(s1, ot, d);
+        if (lock) {
+            tcg_gen_atomic_add_fetch_tl(cpu_T[0], cpu_A0, cpu_T[1],
+                                        s1->mem_index, ot | MO_LE);
+        } else {
+            tcg_gen_add_tl(cpu_T[0], cpu_T[0], cpu_T[1]);
+            gen_op_st_rm_T0_A0(s1, ot, d);
+        }
         gen_op_update2_cc();
         set_cc_op(s1, CC_OP_ADDB + ot);
         break;
     case OP_SUBL:
-        tcg_gen_mov_tl(cpu_cc_srcT, cpu_T[0]);
-        tcg_gen_sub_tl(cpu_T[0], cpu_T[0], cpu_T[1]);
-        gen_op_st_rm_T0_A0(s1, ot, d);
+        if (lock) {
+            tcg_gen_neg_tl(cpu_T[0], cpu_T[1]);
+            tcg_gen_atomic_fetch_add_tl(cpu_cc_srcT, cpu_A0, cpu_T[0],
+                                        s1->mem_index, ot | MO_LE);
+            tcg_gen_sub_tl(cpu_T[0], cpu_cc_srcT, cpu_T[1]);
+        } else {
+            tcg_gen_mov_tl(cpu_cc_srcT, cpu_T[0]);
+            tcg_gen_sub_tl(cpu_T[0], cpu_T[0], cpu_T[1]);
+            gen_op_st_rm_T0_A0(s1, ot, d);
+        }
         gen_op_update2_cc();
         set_cc_op(s1, CC_OP_SUBB + ot);
         break;
     default:
     case OP_ANDL:
-        tcg_gen_and_tl(cpu_T[0], cpu_T[0], cpu_T[1]);
-        gen_op_st_rm_T0_A0(s1, ot, d);
+        if (lock) {
+            tcg_gen_atomic_and_fetch_tl(cpu_T[0], cpu_A0, cpu_T[1],
+                                        s1->mem_index, ot | MO_LE);
+        } else {
+            tcg_gen_and_tl(cpu_T[0], cpu_T[0], cpu_T[1]);
+            gen_op_st_rm_T0_A0(s1, ot, d);
+        }
         gen_op_update1_cc();
         set_cc_op(s1, CC_OP_LOGICB + ot);
         break;
     case OP_ORL:
-        tcg_gen_or_tl(cpu_T[0], cpu_T[0], cpu_T[1]);
-        gen_op_st_rm_T0_A0(s1, ot, d);
+        if (lock) {
+            tcg_gen_atomic_or_fetch_tl(cpu_T[0], cpu_A0, cpu_T[1],
+                                       s1->mem_index, ot | MO_LE);
+        } else {
+            tcg_gen_or_tl(cpu_T[0], cpu_T[0], cpu_T[1]);
+            gen_op_st_rm_T0_A0(s1, ot, d);
+        }
         gen_op_update1_cc();
         set_cc_op(s1, CC_OP_LOGICB + ot);
         break;
     case OP_XORL:
-        tcg_gen_xor_tl(cpu_T[0], cpu_T[0], cpu_T[1]);
-        gen_op_st_rm_T0_A0(s1, ot, d);
+        if (lock) {
+            tcg_gen_atomic_xor_fetch_tl(cpu_T[0], cpu_A0, cpu_T[1],
+                                        s1->mem_index, ot | MO_LE);
+        } else {
+            tcg_gen_xor_tl(cpu_T[0], cpu_T[0], cpu_T[1]);
+            gen_op_st_rm_T0_A0(s1, ot, d);
+        }
         gen_op_update1_cc();
         set_cc_op(s1, CC_OP_LOGICB + ot);
         break;
@@ -1371,21 +1417,22 @@ static void gen_op(DisasContext *s1, int op, TCGMemOp ot, int d)
 /* if d == OR_TMP0, it means memory operand (address in A0) */
 static void gen_inc(DisasContext *s1, TCGMemOp ot, int d, int c)
 {
-    if (d != OR_TMP0) {
-        gen_op_mov_v_reg(ot, cpu_T[0], d);
+    if (d == OR_TMP0 && (s1->prefix & PREFIX_LOCK)) {
+        tcg_gen_movi_tl(cpu_T[0], c > 0 ? 1 : -1);
+        tcg_gen_atomic_add_fetch_tl(cpu_T[0], cpu_A0, cpu_T[0],
+                                    s1->mem_index, ot | MO_LE);
     } else {
-        gen_op_ld_v(s1, ot, cpu_T[0], cpu_A0);
+        if (d != OR_TMP0) {
+            gen_op_mov_v_reg(ot, cpu_T[0], d);
+        } else {
+            gen_op_ld_v(s1, ot, cpu_T[0], cpu_A0);
+        }
+        tcg_gen_addi_tl(cpu_T[0], cpu_T[0], c > 0 ? 1 : -1);
+        gen_op_st_rm_T0_A0(s1, ot, d);
     }
     gen_compute_eflags_c(s1, cpu_cc_src);
-    if (c > 0) {
-        tcg_gen_addi_tl(cpu_T[0], cpu_T[0], 1);
-        set_cc_op(s1, CC_OP_INCB + ot);
-    } else {
-        tcg_gen_addi_tl(cpu_T[0], cpu_T[0], -1);
-        set_cc_op(s1, CC_OP_DECB + ot);
-    }
-    gen_op_st_rm_T0_A0(s1, ot, d);
     tcg_gen_mov_tl(cpu_cc_dst, cpu_T[0]);
+    set_cc_op(s1, (c > 0 ? CC_OP_INCB : CC_OP_DECB) + ot);
 }
 
 static void gen_shift_flags(DisasContext *s, TCGMemOp ot, TCGv result,
@@ -2542,8 +2589,9 @@ static void gen_debug(DisasContext *s, target_ulong cur_eip)
 }
 
 /* generate a generic end of block. Trace exception is also generated
-   if needed */
-static void gen_eob(DisasContext *s)
+   if needed. If JR, the next TB is looked up from the generated code
+   when it could be chained to directly, see tcg_gen_lookup_and_goto_ptr */
+static void gen_eob_worker(DisasContext *s, bool jr)
 {
     gen_update_cc_op(s);
     if (s->tb->flags & HF_INHIBIT_IRQ_MASK) {
@@ -2556,12 +2604,25 @@ static void gen_eob(DisasContext *s)
         gen_helper_debug(cpu_env);
     } else if (s->tf) {
         gen_helper_single_step(cpu_env);
+    } else if (jr && s->jmp_opt) {
+        tcg_gen_lookup_and_goto_ptr(cpu_env);
     } else {
         tcg_gen_exit_tb(0);
     }
     s->is_jmp = DISAS_TB_JUMP;
 }
 
+static void gen_eob(DisasContext *s)
+{
+    gen_eob_worker(s, false);
+}
+
+/* end of block after an indirect jump within the code segment */
+static void gen_jr(DisasContext *s)
+{
+    gen_eob_worker(s, true);
+}
+
 /* generate a jump to eip. No segment change must happen before as a
    direct call to the next block may occur */
 static void gen_jmp_tb(DisasContext *s, target_ulong eip, int tb_num)
@@ -2616,10 +2677,7 @@ static inline void gen_sto_env_A0(DisasContext *s, int offset)
 
 static inline void gen_op_movo(int d_offset, int s_offset)
 {
-    tcg_gen_ld_i64(cpu_tmp1_i64, cpu_env, s_offset);
-    tcg_gen_st_i64(cpu_tmp1_i64, cpu_env, d_offset);
-    tcg_gen_ld_i64(cpu_tmp1_i64, cpu_env, s_offset + 8);
-    tcg_gen_st_i64(cpu_tmp1_i64, cpu_env, d_offset + 8);
+    tcg_gen_vec_mov(TCG_TYPE_V128, cpu_env, d_offset, s_offset);
 }
 
 static inline void gen_op_movq(int d_offset, int s_offset)
@@ -2970,6 +3028,51 @@ static const struct SSEOpHelper_eppi sse_op_table7[256] = {
     [0xdf] = AESNI_OP(aeskeygenassist),
 };
 
+/* Emit the MMX/SSE operations that have a TCG vector op, instead of
+   calling their helper.  Return false if B is not one of them.  */
+static bool gen_sse_vec(int b, int is_xmm, int op1_offset, int op2_offset)
+{
+    TCGType type = is_xmm ? TCG_TYPE_V128 : TCG_TYPE_V64;
+
+    switch (b) {
+    case 0x54: /* andps, andpd */
+    case 0xdb: /* pand */
+        tcg_gen_vec_and(type, cpu_env, op1_offset, op1_offset, op2_offset);
+        break;
+    case 0x55: /* andnps, andnpd */
+    case 0xdf: /* pandn */
+        tcg_gen_vec_andc(type, cpu_env, op1_offset, op2_offset, op1_offset);
+        break;
+    case 0x56: /* orps, orpd */
+    case 0xeb: /* por */
+        tcg_gen_vec_or(type, cpu_env, op1_offset, op1_offset, op2_offset);
+        break;
+    case 0x57: /* xorps, xorpd */
+    case 0xef: /* pxor */
+        tcg_gen_vec_xor(type, cpu_env, op1_offset, op1_offset, op2_offset);
+        break;
+    case 0xfc ... 0xfe: /* paddb, paddw, paddl */
+        tcg_gen_vec_add(type, b - 0xfc, cpu_env,
+                        op1_offset, op1_offset, op2_offset);
+        break;
+    case 0xd4: /* paddq */
+        tcg_gen_vec_add(type, MO_64, cpu_env,
+                        op1_offset, op1_offset, op2_offset);
+        break;
+    case 0xf8 ... 0xfb: /* psubb, psubw, psubl, psubq */
+        tcg_gen_vec_sub(type, b - 0xf8, cpu_env,
+                        op1_offset, op1_offset, op2_offset);
+        break;
+    case 0x74 ... 0x76: /* pcmpeqb, pcmpeqw, pcmpeql */
+        tcg_gen_vec_cmpeq(type, b - 0x74, cpu_env,
+                          op1_offset, op1_offset, op2_offset);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
 static void gen_sse(CPUX86State *env, DisasContext *s, int b,
                     target_ulong pc_start, int rex_r)
 {
@@ -4385,6 +4488,9 @@ static void gen_sse(CPUX86State *env, DisasContext *s, int b,
             sse_fn_eppt(cpu_env, cpu_ptr0, cpu_ptr1, cpu_A0);
             break;
         default:
+            if (gen_sse_vec(b, is_xmm, op1_offset, op2_offset)) {
+                break;
+            }
             tcg_gen_addi_ptr(cpu_ptr0, cpu_env, op1_offset);
             tcg_gen_addi_ptr(cpu_ptr1, cpu_env, op2_offset);
             sse_fn_epp(cpu_env, cpu_ptr0, cpu_ptr1);
@@ -4561,10 +4667,6 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
     s->aflag = aflag;
     s->dflag = dflag;
 
-    /* lock generation */
-    if (prefixes & PREFIX_LOCK)
-        gen_helper_lock();
-
     /* now check op code */
  reswitch:
     switch(b) {
@@ -4702,7 +4804,10 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
             if (op == 0)
                 s->rip_offset = insn_const_size(ot);
             gen_lea_modrm(env, s, modrm);
-            gen_op_ld_v(s, ot, cpu_T[0], cpu_A0);
+            /* a locked not does not need the old value */
+            if (!(s->prefix & PREFIX_LOCK) || op != 2) {
+                gen_op_ld_v(s, ot, cpu_T[0], cpu_A0);
+            }
         } else {
             gen_op_mov_v_reg(ot, cpu_T[0], rm);
         }
@@ -4715,19 +4820,54 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
             set_cc_op(s, CC_OP_LOGICB + ot);
             break;
         case 2: /* not */
-            tcg_gen_not_tl(cpu_T[0], cpu_T[0]);
-            if (mod != 3) {
-                gen_op_st_v(s, ot, cpu_T[0], cpu_A0);
+            if (mod != 3 && (s->prefix & PREFIX_LOCK)) {
+                tcg_gen_movi_tl(cpu_T[0], ~0);
+                tcg_gen_atomic_xor_fetch_tl(cpu_T[0], cpu_A0, cpu_T[0],
+                                            s->mem_index, ot | MO_LE);
             } else {
-                gen_op_mov_reg_v(ot, rm, cpu_T[0]);
+                tcg_gen_not_tl(cpu_T[0], cpu_T[0]);
+                if (mod != 3) {
+                    gen_op_st_v(s, ot, cpu_T[0], cpu_A0);
+                } else {
+                    gen_op_mov_reg_v(ot, rm, cpu_T[0]);
+                }
             }
             break;
         case 3: /* neg */
-            tcg_gen_neg_tl(cpu_T[0], cpu_T[0]);
-            if (mod != 3) {
-                gen_op_st_v(s, ot, cpu_T[0], cpu_A0);
+            if (mod != 3 && (s->prefix & PREFIX_LOCK)) {
+                int label1;
+                TCGv a0, t0, t1, t2;
+
+                /* No atomic negation: retry a compare-and-swap until the
+                   value it negated was still in memory.  */
+                a0 = tcg_temp_local_new();
+                t0 = tcg_temp_local_new();
+                label1 = gen_new_label();
+
+                tcg_gen_mov_tl(a0, cpu_A0);
+                tcg_gen_mov_tl(t0, cpu_T[0]);
+
+                gen_set_label(label1);
+                t1 = tcg_temp_new();
+                t2 = tcg_temp_new();
+                tcg_gen_mov_tl(t2, t0);
+                tcg_gen_neg_tl(t1, t0);
+                tcg_gen_atomic_cmpxchg_tl(t0, a0, t0, t1,
+                                          s->mem_index, ot | MO_LE);
+                tcg_temp_free(t1);
+                tcg_gen_brcond_tl(TCG_COND_NE, t0, t2, label1);
+
+                tcg_temp_free(t2);
+                tcg_temp_free(a0);
+                tcg_gen_neg_tl(cpu_T[0], t0);
+                tcg_temp_free(t0);
             } else {
-                gen_op_mov_reg_v(ot, rm, cpu_T[0]);
+                tcg_gen_neg_tl(cpu_T[0], cpu_T[0]);
+                if (mod != 3) {
+                    gen_op_st_v(s, ot, cpu_T[0], cpu_A0);
+                } else {
+                    gen_op_mov_reg_v(ot, rm, cpu_T[0]);
+                }
             }
             gen_op_update_neg_cc();
             set_cc_op(s, CC_OP_SUBB + ot);
@@ -4940,7 +5080,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
             tcg_gen_movi_tl(cpu_T[1], next_eip);
             gen_push_v(s, cpu_T[1]);
             gen_op_jmp_v(cpu_T[0]);
-            gen_eob(s);
+            gen_jr(s);
             break;
         case 3: /* lcall Ev */
             gen_op_ld_v(s, ot, cpu_T[1], cpu_A0);
@@ -4967,7 +5107,7 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
                 tcg_gen_ext16u_tl(cpu_T[0], cpu_T[0]);
             }
             gen_op_jmp_v(cpu_T[0]);
-            gen_eob(s);
+            gen_jr(s);
             break;
         case 5: /* ljmp Ev */
             gen_op_ld_v(s, ot, cpu_T[1], cpu_A0);
@@ -5135,9 +5275,15 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
         } else {
             gen_lea_modrm(env, s, modrm);
             gen_op_mov_v_reg(ot, cpu_T[0], reg);
-            gen_op_ld_v(s, ot, cpu_T[1], cpu_A0);
-            tcg_gen_add_tl(cpu_T[0], cpu_T[0], cpu_T[1]);
-            gen_op_st_v(s, ot, cpu_T[0], cpu_A0);
+            if (s->prefix & PREFIX_LOCK) {
+                tcg_gen_atomic_fetch_add_tl(cpu_T[1], cpu_A0, cpu_T[0],
+                                            s->mem_index, ot | MO_LE);
+                tcg_gen_add_tl(cpu_T[0], cpu_T[0], cpu_T[1]);
+            } else {
+                gen_op_ld_v(s, ot, cpu_T[1], cpu_A0);
+                tcg_gen_add_tl(cpu_T[0], cpu_T[0], cpu_T[1]);
+                gen_op_st_v(s, ot, cpu_T[0], cpu_A0);
+            }
             gen_op_mov_reg_v(ot, reg, cpu_T[1]);
         }
         gen_op_update2_cc();
@@ -5158,37 +5304,53 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
             t2 = tcg_temp_local_new();
             a0 = tcg_temp_local_new();
             gen_op_mov_v_reg(ot, t1, reg);
-            if (mod == 3) {
-                rm = (modrm & 7) | REX_B(s);
-                gen_op_mov_v_reg(ot, t0, rm);
-            } else {
+            if (mod != 3 && (s->prefix & PREFIX_LOCK)) {
                 gen_lea_modrm(env, s, modrm);
-                tcg_gen_mov_tl(a0, cpu_A0);
-                gen_op_ld_v(s, ot, t0, a0);
-                rm = 0; /* avoid warning */
-            }
-            label1 = gen_new_label();
-            tcg_gen_mov_tl(t2, cpu_regs[R_EAX]);
-            gen_extu(ot, t0);
-            gen_extu(ot, t2);
-            tcg_gen_brcond_tl(TCG_COND_EQ, t2, t0, label1);
-            label2 = gen_new_label();
-            if (mod == 3) {
-                gen_op_mov_reg_v(ot, R_EAX, t0);
-                tcg_gen_br(label2);
-                gen_set_label(label1);
-                gen_op_mov_reg_v(ot, rm, t1);
+                tcg_gen_mov_tl(t2, cpu_regs[R_EAX]);
+                gen_extu(ot, t2);
+                tcg_gen_atomic_cmpxchg_tl(t0, cpu_A0, t2, t1,
+                                          s->mem_index, ot | MO_LE);
+                /* the accumulator is only written on failure, which
+                   matters for the upper half of RAX */
+                if (ot == MO_32) {
+                    tcg_gen_movcond_tl(TCG_COND_EQ, cpu_regs[R_EAX], t0, t2,
+                                       cpu_regs[R_EAX], t0);
+                } else {
+                    gen_op_mov_reg_v(ot, R_EAX, t0);
+                }
             } else {
-                /* perform no-op store cycle like physical cpu; must be
-                   before changing accumulator to ensure idempotency if
-                   the store faults and the instruction is restarted */
-                gen_op_st_v(s, ot, t0, a0);
-                gen_op_mov_reg_v(ot, R_EAX, t0);
-                tcg_gen_br(label2);
-                gen_set_label(label1);
-                gen_op_st_v(s, ot, t1, a0);
+                if (mod == 3) {
+                    rm = (modrm & 7) | REX_B(s);
+                    gen_op_mov_v_reg(ot, t0, rm);
+                } else {
+                    gen_lea_modrm(env, s, modrm);
+                    tcg_gen_mov_tl(a0, cpu_A0);
+                    gen_op_ld_v(s, ot, t0, a0);
+                    rm = 0; /* avoid warning */
+                }
+                label1 = gen_new_label();
+                tcg_gen_mov_tl(t2, cpu_regs[R_EAX]);
+                gen_extu(ot, t0);
+                gen_extu(ot, t2);
+                tcg_gen_brcond_tl(TCG_COND_EQ, t2, t0, label1);
+                label2 = gen_new_label();
+                if (mod == 3) {
+                    gen_op_mov_reg_v(ot, R_EAX, t0);
+                    tcg_gen_br(label2);
+                    gen_set_label(label1);
+                    gen_op_mov_reg_v(ot, rm, t1);
+                } else {
+                    /* perform no-op store cycle like physical cpu; must be
+                       before changing accumulator to ensure idempotency if
+                       the store faults and the instruction is restarted */
+                    gen_op_st_v(s, ot, t0, a0);
+                    gen_op_mov_reg_v(ot, R_EAX, t0);
+                    tcg_gen_br(label2);
+                    gen_set_label(label1);
+                    gen_op_st_v(s, ot, t1, a0);
+                }
+                gen_set_label(label2);
             }
-            gen_set_label(label2);
             tcg_gen_mov_tl(cpu_cc_src, t0);
             tcg_gen_mov_tl(cpu_cc_srcT, t2);
             tcg_gen_sub_tl(cpu_cc_dst, t2, t0);
@@ -5217,10 +5379,42 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
         {
             if (!(s->cpuid_features & CPUID_CX8))
                 goto illegal_op;
-            gen_jmp_im(pc_start - s->cs_base);
-            gen_update_cc_op(s);
-            gen_lea_modrm(env, s, modrm);
-            gen_helper_cmpxchg8b(cpu_env, cpu_A0);
+            if (s->prefix & PREFIX_LOCK) {
+                TCGv_i64 cmp = tcg_temp_new_i64();
+                TCGv_i64 val = tcg_temp_new_i64();
+                TCGv z = tcg_const_tl(0);
+                TCGv lo = tcg_temp_new();
+                TCGv hi = tcg_temp_new();
+
+                gen_lea_modrm(env, s, modrm);
+                tcg_gen_concat_tl_i64(cmp, cpu_regs[R_EAX], cpu_regs[R_EDX]);
+                tcg_gen_concat_tl_i64(val, cpu_regs[R_EBX], cpu_regs[R_ECX]);
+                tcg_gen_atomic_cmpxchg_i64(val, cpu_A0, cmp, val,
+                                           s->mem_index, MO_LEQ);
+                tcg_gen_setcond_i64(TCG_COND_EQ, cmp, val, cmp);
+                tcg_gen_extr_i64_tl(lo, hi, val);
+
+                /* EDX:EAX are only written on failure */
+                gen_compute_eflags(s);
+                tcg_gen_trunc_i64_tl(cpu_tmp0, cmp);
+                tcg_gen_deposit_tl(cpu_cc_src, cpu_cc_src, cpu_tmp0,
+                                   ctz32(CC_Z), 1);
+                tcg_gen_movcond_tl(TCG_COND_EQ, cpu_regs[R_EAX], cpu_tmp0, z,
+                                   lo, cpu_regs[R_EAX]);
+                tcg_gen_movcond_tl(TCG_COND_EQ, cpu_regs[R_EDX], cpu_tmp0, z,
+                                   hi, cpu_regs[R_EDX]);
+
+                tcg_temp_free_i64(cmp);
+                tcg_temp_free_i64(val);
+                tcg_temp_free(z);
+                tcg_temp_free(lo);
+                tcg_temp_free(hi);
+            } else {
+                gen_jmp_im(pc_start - s->cs_base);
+                gen_update_cc_op(s);
+                gen_lea_modrm(env, s, modrm);
+                gen_helper_cmpxchg8b(cpu_env, cpu_A0);
+            }
         }
         set_cc_op(s, CC_OP_EFLAGS);
         break;
@@ -5564,12 +5758,8 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
             gen_lea_modrm(env, s, modrm);
             gen_op_mov_v_reg(ot, cpu_T[0], reg);
             /* for xchg, lock is implicit */
-            if (!(prefixes & PREFIX_LOCK))
-                gen_helper_lock();
-            gen_op_ld_v(s, ot, cpu_T[1], cpu_A0);
-            gen_op_st_v(s, ot, cpu_T[0], cpu_A0);
-            if (!(prefixes & PREFIX_LOCK))
-                gen_helper_unlock();
+            tcg_gen_atomic_xchg_tl(cpu_T[1], cpu_A0, cpu_T[0],
+                                   s->mem_index, ot | MO_LE);
             gen_op_mov_reg_v(ot, reg, cpu_T[1]);
         }
         break;
@@ -6381,14 +6571,14 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
         gen_stack_update(s, val + (1 << ot));
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(cpu_T[0]);
-        gen_eob(s);
+        gen_jr(s);
         break;
     case 0xc3: /* ret */
         ot = gen_pop_T0(s);
         gen_pop_update(s, ot);
         /* Note that gen_pop_T0 uses a zero-extending load.  */
         gen_op_jmp_v(cpu_T[0]);
-        gen_eob(s);
+        gen_jr(s);
         break;
     case 0xca: /* lret im */
         val = cpu_ldsw_code(env, s->pc);
@@ -6661,7 +6851,9 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
         if (mod != 3) {
             s->rip_offset = 1;
             gen_lea_modrm(env, s, modrm);
-            gen_op_ld_v(s, ot, cpu_T[0], cpu_A0);
+            if (!(s->prefix & PREFIX_LOCK) || op == 4) {
+                gen_op_ld_v(s, ot, cpu_T[0], cpu_A0);
+            }
         } else {
             gen_op_mov_v_reg(ot, cpu_T[0], rm);
         }
@@ -6697,38 +6889,57 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
             tcg_gen_sari_tl(cpu_tmp0, cpu_T[1], 3 + ot);
             tcg_gen_shli_tl(cpu_tmp0, cpu_tmp0, ot);
             tcg_gen_add_tl(cpu_A0, cpu_A0, cpu_tmp0);
-            gen_op_ld_v(s, ot, cpu_T[0], cpu_A0);
+            if (!(s->prefix & PREFIX_LOCK) || op == 0) {
+                gen_op_ld_v(s, ot, cpu_T[0], cpu_A0);
+            }
         } else {
             gen_op_mov_v_reg(ot, cpu_T[0], rm);
         }
     bt_op:
         tcg_gen_andi_tl(cpu_T[1], cpu_T[1], (1 << (3 + ot)) - 1);
-        tcg_gen_shr_tl(cpu_tmp4, cpu_T[0], cpu_T[1]);
-        switch(op) {
-        case 0:
-            break;
-        case 1:
-            tcg_gen_movi_tl(cpu_tmp0, 1);
-            tcg_gen_shl_tl(cpu_tmp0, cpu_tmp0, cpu_T[1]);
-            tcg_gen_or_tl(cpu_T[0], cpu_T[0], cpu_tmp0);
-            break;
-        case 2:
-            tcg_gen_movi_tl(cpu_tmp0, 1);
-            tcg_gen_shl_tl(cpu_tmp0, cpu_tmp0, cpu_T[1]);
-            tcg_gen_andc_tl(cpu_T[0], cpu_T[0], cpu_tmp0);
-            break;
-        default:
-        case 3:
-            tcg_gen_movi_tl(cpu_tmp0, 1);
-            tcg_gen_shl_tl(cpu_tmp0, cpu_tmp0, cpu_T[1]);
-            tcg_gen_xor_tl(cpu_T[0], cpu_T[0], cpu_tmp0);
-            break;
-        }
-        if (op != 0) {
-            if (mod != 3) {
-                gen_op_st_v(s, ot, cpu_T[0], cpu_A0);
-            } else {
-                gen_op_mov_reg_v(ot, rm, cpu_T[0]);
+        tcg_gen_movi_tl(cpu_tmp0, 1);
+        tcg_gen_shl_tl(cpu_tmp0, cpu_tmp0, cpu_T[1]);
+        if (mod != 3 && (s->prefix & PREFIX_LOCK) && op != 0) {
+            /* the old value is enough to compute the flags */
+            switch (op) {
+            case 1:
+                tcg_gen_atomic_fetch_or_tl(cpu_T[0], cpu_A0, cpu_tmp0,
+                                           s->mem_index, ot | MO_LE);
+                break;
+            case 2:
+                tcg_gen_not_tl(cpu_tmp0, cpu_tmp0);
+                tcg_gen_atomic_fetch_and_tl(cpu_T[0], cpu_A0, cpu_tmp0,
+                                            s->mem_index, ot | MO_LE);
+                break;
+            default:
+            case 3:
+                tcg_gen_atomic_fetch_xor_tl(cpu_T[0], cpu_A0, cpu_tmp0,
+                                            s->mem_index, ot | MO_LE);
+                break;
+            }
+            tcg_gen_shr_tl(cpu_tmp4, cpu_T[0], cpu_T[1]);
+        } else {
+            tcg_gen_shr_tl(cpu_tmp4, cpu_T[0], cpu_T[1]);
+            switch (op) {
+            case 0:
+                break;
+            case 1:
+                tcg_gen_or_tl(cpu_T[0], cpu_T[0], cpu_tmp0);
+                break;
+            case 2:
+                tcg_gen_andc_tl(cpu_T[0], cpu_T[0], cpu_tmp0);
+                break;
+            default:
+            case 3:
+                tcg_gen_xor_tl(cpu_T[0], cpu_T[0], cpu_tmp0);
+                break;
+            }
+            if (op != 0) {
+                if (mod != 3) {
+                    gen_op_st_v(s, ot, cpu_T[0], cpu_A0);
+                } else {
+                    gen_op_mov_reg_v(ot, rm, cpu_T[0]);
+                }
             }
         }
 
@@ -7828,14 +8039,8 @@ static target_ulong disas_insn(CPUX86State *env, DisasContext *s,
     default:
         goto illegal_op;
     }
-    /* lock generation */
-    if (s->prefix & PREFIX_LOCK)
-        gen_helper_unlock();
     return s->pc;
  illegal_op:
-    if (s->prefix & PREFIX_LOCK)
-        gen_helper_unlock();
-    /* XXX: ensure that no lock was generated */
     gen_exception(s, EXCP06_ILLOP, pc_start - s->cs_base);
     return s->pc;
 }
@@ -7874,6 +8079,7 @@ void optimize_flags_init(void)
     int i;
 
     cpu_env = tcg_global_reg_new_ptr(TCG_AREG0, "env");
+    tcg_ctx.tcg_env = cpu_env;
     cpu_cc_op = tcg_global_mem_new_i32(TCG_AREG0,
                                        offsetof(CPUX86State, cc_op), "cc_op");
     cpu_cc_dst = tcg_global_mem_new(TCG_AREG0, offsetof(CPUX86State, cc_dst),
@@ -7991,18 +8197,16 @@ static inline void gen_intermediate_code_internal(X86CPU *cpu,
                 }
             }
         }
-        if (search_pc) {
-            j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-            if (lj < j) {
-                lj++;
-                while (lj < j)
-                    tcg_ctx.gen_opc_instr_start[lj++] = 0;
-            }
-            tcg_ctx.gen_opc_pc[lj] = pc_ptr;
-            gen_opc_cc_op[lj] = dc->cc_op;
-            tcg_ctx.gen_opc_instr_start[lj] = 1;
-            tcg_ctx.gen_opc_icount[lj] = num_insns;
-        }
+        j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+        if (lj < j) {
+            lj++;
+            while (lj < j)
+                tcg_ctx.gen_opc_instr_start[lj++] = 0;
+        }
+        tcg_ctx.gen_opc_pc[lj] = pc_ptr;
+        gen_opc_cc_op[lj] = dc->cc_op;
+        tcg_ctx.gen_opc_instr_start[lj] = 1;
+        tcg_ctx.gen_opc_icount[lj] = num_insns;
         if (num_insns + 1 == max_insns && (tb->cflags & CF_LAST_IO))
             gen_io_start();
 
@@ -8041,12 +8245,10 @@ static inline void gen_intermediate_code_internal(X86CPU *cpu,
     gen_tb_end(tb, num_insns);
     *tcg_ctx.gen_opc_ptr = INDEX_op_end;
     /* we don't forget to fill the last values */
-    if (search_pc) {
-        j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-        lj++;
-        while (lj <= j)
-            tcg_ctx.gen_opc_instr_start[lj++] = 0;
-    }
+    j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+    lj++;
+    while (lj <= j)
+        tcg_ctx.gen_opc_instr_start[lj++] = 0;
 
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM)) {
@@ -1731,17 +1731,15 @@ gen_intermediate_code_internal(MicroBlazeCPU *cpu, TranslationBlock *tb,
 #endif
         check_breakpoint(env, dc);
 
-        if (search_pc) {
-            j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-            if (lj < j) {
-                lj++;
-                while (lj < j)
-                    tcg_ctx.gen_opc_instr_start[lj++] = 0;
-            }
-            tcg_ctx.gen_opc_pc[lj] = dc->pc;
-            tcg_ctx.gen_opc_instr_start[lj] = 1;
-                        tcg_ctx.gen_opc_icount[lj] = num_insns;
+        j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+        if (lj < j) {
+            lj++;
+            while (lj < j)
+                tcg_ctx.gen_opc_instr_start[lj++] = 0;
         }
+        tcg_ctx.gen_opc_pc[lj] = dc->pc;
+        tcg_ctx.gen_opc_instr_start[lj] = 1;
+                    tcg_ctx.gen_opc_icount[lj] = num_insns;
 
         /* Pretty disas.  */
         LOG_DIS("%8.8x:\t", dc->pc);
@@ -1847,12 +1845,11 @@ gen_intermediate_code_internal(MicroBlazeCPU *cpu, TranslationBlock *tb,
     }
     gen_tb_end(tb, num_insns);
     *tcg_ctx.gen_opc_ptr = INDEX_op_end;
-    if (search_pc) {
-        j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-        lj++;
-        while (lj <= j)
-            tcg_ctx.gen_opc_instr_start[lj++] = 0;
-    } else {
+    j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+    lj++;
+    while (lj <= j)
+        tcg_ctx.gen_opc_instr_start[lj++] = 0;
+    if (!search_pc) {
         tb->size = dc->pc - pc_start;
                 tb->icount = num_insns;
     }
@@ -10,6 +10,9 @@
 
 #define CPUArchState struct CPUMIPSState
 
+/* per-insn state saved for restore_state_to_opc(): branch state and target */
+#define TARGET_INSN_DATA_WORDS 2
+
 #include "config.h"
 #include "qemu-common.h"
 #include "mips-defs.h"
@@ -389,8 +392,6 @@ struct CPUMIPSState {
     /* XXX: Maybe make LLAddr per-TC? */
     target_ulong lladdr;
     target_ulong llval;
-    target_ulong llnewval;
-    target_ulong llreg;
     target_ulong CP0_LLAddr_rw_bitmask;
     int CP0_LLAddr_shift;
     target_ulong CP0_WatchLo[8];
@@ -1018,8 +1018,8 @@ static TCGv_i32 hflags;
 static TCGv_i32 fpu_fcr0, fpu_fcr31;
 static TCGv_i64 fpu_f64[32];
 
-static uint32_t gen_opc_hflags[OPC_BUF_SIZE];
-static target_ulong gen_opc_btarget[OPC_BUF_SIZE];
+#define gen_opc_hflags tcg_ctx.gen_opc_data[0]
+#define gen_opc_btarget tcg_ctx.gen_opc_data[1]
 
 #include "exec/gen-icount.h"
 
@@ -1533,12 +1533,18 @@ OP_LD_ATOMIC(lld,ld64);
 #undef OP_LD_ATOMIC
 
 #ifdef CONFIG_USER_ONLY
-#define OP_ST_ATOMIC(insn,fname,ldname,almask)                               \
+/* sc is a compare-and-swap against the value that ll loaded, so that
+   guest threads running in parallel do not have to stop each other.
+   Unlike a real LLbit, this misses a store of that same value by another
+   thread in between.  */
+#define OP_ST_ATOMIC(insn,almask,memop)                                      \
 static inline void op_st_##insn(TCGv arg1, TCGv arg2, int rt, DisasContext *ctx) \
 {                                                                            \
     TCGv t0 = tcg_temp_new();                                                \
+    TCGv t1;                                                                 \
     int l1 = gen_new_label();                                                \
     int l2 = gen_new_label();                                                \
+    int l3 = gen_new_label();                                                \
                                                                              \
     tcg_gen_andi_tl(t0, arg2, almask);                                       \
     tcg_gen_brcondi_tl(TCG_COND_EQ, t0, 0, l1);                              \
@@ -1547,17 +1553,23 @@ static inline void op_st_##insn(TCGv arg1, TCGv arg2, int rt, DisasContext *ctx)
     gen_set_label(l1);                                                       \
     tcg_gen_ld_tl(t0, cpu_env, offsetof(CPUMIPSState, lladdr));                  \
     tcg_gen_brcond_tl(TCG_COND_NE, arg2, t0, l2);                            \
-    tcg_gen_movi_tl(t0, rt | ((almask << 3) & 0x20));                        \
-    tcg_gen_st_tl(t0, cpu_env, offsetof(CPUMIPSState, llreg));                   \
-    tcg_gen_st_tl(arg1, cpu_env, offsetof(CPUMIPSState, llnewval));              \
-    gen_helper_0e0i(raise_exception, EXCP_SC);                               \
+    t1 = tcg_temp_new();                                                     \
+    tcg_gen_ld_tl(t1, cpu_env, offsetof(CPUMIPSState, llval));                   \
+    tcg_gen_atomic_cmpxchg_tl(t0, arg2, t1, arg1, ctx->mem_idx, memop);      \
+    tcg_gen_setcond_tl(TCG_COND_EQ, t0, t0, t1);                             \
+    tcg_temp_free(t1);                                                       \
+    gen_store_gpr(t0, rt);                                                   \
+    tcg_gen_br(l3);                                                          \
     gen_set_label(l2);                                                       \
     tcg_gen_movi_tl(t0, 0);                                                  \
     gen_store_gpr(t0, rt);                                                   \
+    gen_set_label(l3);                                                       \
+    tcg_gen_movi_tl(t0, -1);                                                 \
+    tcg_gen_st_tl(t0, cpu_env, offsetof(CPUMIPSState, lladdr));                  \
     tcg_temp_free(t0);                                                       \
 }
 #else
-#define OP_ST_ATOMIC(insn,fname,ldname,almask)                               \
+#define OP_ST_ATOMIC(insn,almask,memop)                                      \
 static inline void op_st_##insn(TCGv arg1, TCGv arg2, int rt, DisasContext *ctx) \
 {                                                                            \
     TCGv t0 = tcg_temp_new();                                                \
@@ -1566,9 +1578,9 @@ static inline void op_st_##insn(TCGv arg1, TCGv arg2, int rt, DisasContext *ctx)
     tcg_temp_free(t0);                                                       \
 }
 #endif
-OP_ST_ATOMIC(sc,st32,ld32s,0x3);
+OP_ST_ATOMIC(sc,0x3,MO_TESL);
 #if defined(TARGET_MIPS64)
-OP_ST_ATOMIC(scd,st64,ld64,0x7);
+OP_ST_ATOMIC(scd,0x7,MO_TEQ);
 #endif
 #undef OP_ST_ATOMIC
 
@@ -15694,19 +15706,17 @@ gen_intermediate_code_internal(MIPSCPU *cpu, TranslationBlock *tb,
             }
         }
 
-        if (search_pc) {
-            j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-            if (lj < j) {
-                lj++;
-                while (lj < j)
-                    tcg_ctx.gen_opc_instr_start[lj++] = 0;
-            }
-            tcg_ctx.gen_opc_pc[lj] = ctx.pc;
-            gen_opc_hflags[lj] = ctx.hflags & MIPS_HFLAG_BMASK;
-            gen_opc_btarget[lj] = ctx.btarget;
-            tcg_ctx.gen_opc_instr_start[lj] = 1;
-            tcg_ctx.gen_opc_icount[lj] = num_insns;
-        }
+        j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+        if (lj < j) {
+            lj++;
+            while (lj < j)
+                tcg_ctx.gen_opc_instr_start[lj++] = 0;
+        }
+        tcg_ctx.gen_opc_pc[lj] = ctx.pc;
+        gen_opc_hflags[lj] = ctx.hflags & MIPS_HFLAG_BMASK;
+        gen_opc_btarget[lj] = ctx.btarget;
+        tcg_ctx.gen_opc_instr_start[lj] = 1;
+        tcg_ctx.gen_opc_icount[lj] = num_insns;
         if (num_insns + 1 == max_insns && (tb->cflags & CF_LAST_IO))
             gen_io_start();
 
@@ -15780,12 +15790,11 @@ gen_intermediate_code_internal(MIPSCPU *cpu, TranslationBlock *tb,
 done_generating:
     gen_tb_end(tb, num_insns);
     *tcg_ctx.gen_opc_ptr = INDEX_op_end;
-    if (search_pc) {
-        j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-        lj++;
-        while (lj <= j)
-            tcg_ctx.gen_opc_instr_start[lj++] = 0;
-    } else {
+    j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+    lj++;
+    while (lj <= j)
+        tcg_ctx.gen_opc_instr_start[lj++] = 0;
+    if (!search_pc) {
         tb->size = ctx.pc - pc_start;
         tb->icount = num_insns;
     }
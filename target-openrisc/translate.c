@@ -1679,18 +1679,16 @@ static inline void gen_intermediate_code_internal(OpenRISCCPU *cpu,
 
     do {
         check_breakpoint(cpu, dc);
-        if (search_pc) {
-            j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-            if (k < j) {
-                k++;
-                while (k < j) {
-                    tcg_ctx.gen_opc_instr_start[k++] = 0;
-                }
+        j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+        if (k < j) {
+            k++;
+            while (k < j) {
+                tcg_ctx.gen_opc_instr_start[k++] = 0;
             }
-            tcg_ctx.gen_opc_pc[k] = dc->pc;
-            tcg_ctx.gen_opc_instr_start[k] = 1;
-            tcg_ctx.gen_opc_icount[k] = num_insns;
         }
+        tcg_ctx.gen_opc_pc[k] = dc->pc;
+        tcg_ctx.gen_opc_instr_start[k] = 1;
+        tcg_ctx.gen_opc_icount[k] = num_insns;
 
         if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP | CPU_LOG_TB_OP_OPT))) {
             tcg_gen_debug_insn_start(dc->pc);
@@ -1760,13 +1758,12 @@ static inline void gen_intermediate_code_internal(OpenRISCCPU *cpu,
 
     gen_tb_end(tb, num_insns);
     *tcg_ctx.gen_opc_ptr = INDEX_op_end;
-    if (search_pc) {
-        j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-        k++;
-        while (k <= j) {
-            tcg_ctx.gen_opc_instr_start[k++] = 0;
-        }
-    } else {
+    j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+    k++;
+    while (k <= j) {
+        tcg_ctx.gen_opc_instr_start[k++] = 0;
+    }
+    if (!search_pc) {
         tb->size = dc->pc - pc_start;
         tb->icount = num_insns;
     }
@@ -134,11 +134,14 @@ void helper_slbie(CPUPPCState *env, target_ulong addr)
     if (slb->esid & SLB_ESID_V) {
         slb->esid &= ~SLB_ESID_V;
 
-        /* XXX: given the fact that segment size is 256 MB or 1TB,
-         *      and we still don't have a tlb_flush_mask(env, n, mask)
-         *      in QEMU, we just invalidate all TLBs
-         */
-        tlb_flush(CPU(cpu), 1);
+        /* Only the translations of this segment go away.  */
+        if ((slb->vsid & SLB_VSID_B) == SLB_VSID_B_1T) {
+            tlb_flush_range(CPU(cpu), addr & SEGMENT_MASK_1T,
+                            1ULL << SEGMENT_SHIFT_1T);
+        } else {
+            tlb_flush_range(CPU(cpu), addr & SEGMENT_MASK_256M,
+                            1ULL << SEGMENT_SHIFT_256M);
+        }
     }
 }
 
@@ -2013,12 +2013,11 @@ void ppc_tlb_invalidate_one(CPUPPCState *env, target_ulong addr)
     case POWERPC_MMU_2_06:
     case POWERPC_MMU_2_06a:
     case POWERPC_MMU_2_06d:
-        /* tlbie invalidate TLBs for all segments */
-        /* XXX: given the fact that there are too many segments to invalidate,
-         *      and we still don't have a tlb_flush_mask(env, n, mask) in QEMU,
-         *      we just invalidate all TLBs
+        /* tlbie invalidate TLBs for all segments: the page index within
+         * a 256MB segment is all we can rely on, so drop that page in
+         * every segment.  This also covers 1TB segments.
          */
-        tlb_flush(CPU(cpu), 1);
+        tlb_flush_page_masked(CPU(cpu), addr, ~SEGMENT_MASK_256M);
         break;
 #endif /* defined(TARGET_PPC64) */
     default:
@@ -32,6 +32,9 @@
 
 #define CPUArchState struct CPUS390XState
 
+/* per-insn state saved for restore_state_to_opc(): cc_op */
+#define TARGET_INSN_DATA_WORDS 1
+
 #include "exec/cpu-defs.h"
 #define TARGET_PAGE_BITS 12
 
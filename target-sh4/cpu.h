@@ -39,6 +39,9 @@
 
 #define CPUArchState struct CPUSH4State
 
+/* per-insn state saved for restore_state_to_opc(): delay slot flags */
+#define TARGET_INSN_DATA_WORDS 1
+
 #include "exec/cpu-defs.h"
 
 #include "fpu/softfloat.h"
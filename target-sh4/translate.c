@@ -70,7 +70,7 @@ static TCGv cpu_fregs[32];
 /* internal register indexes */
 static TCGv cpu_flags, cpu_delayed_pc;
 
-static uint32_t gen_opc_hflags[OPC_BUF_SIZE];
+#define gen_opc_hflags tcg_ctx.gen_opc_data[0]
 
 #include "exec/gen-icount.h"
 
@@ -1865,7 +1865,7 @@ gen_intermediate_code_internal(SuperHCPU *cpu, TranslationBlock *tb,
     CPUSH4State *env = &cpu->env;
     DisasContext ctx;
     target_ulong pc_start;
-    static uint16_t *gen_opc_end;
+    uint16_t *gen_opc_end;
     CPUBreakpoint *bp;
     int i, ii;
     int num_insns;
@@ -1903,18 +1903,16 @@ gen_intermediate_code_internal(SuperHCPU *cpu, TranslationBlock *tb,
 		}
 	    }
 	}
-        if (search_pc) {
-            i = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-            if (ii < i) {
-                ii++;
-                while (ii < i)
-                    tcg_ctx.gen_opc_instr_start[ii++] = 0;
-            }
-            tcg_ctx.gen_opc_pc[ii] = ctx.pc;
-            gen_opc_hflags[ii] = ctx.flags;
-            tcg_ctx.gen_opc_instr_start[ii] = 1;
-            tcg_ctx.gen_opc_icount[ii] = num_insns;
+        i = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+        if (ii < i) {
+            ii++;
+            while (ii < i)
+                tcg_ctx.gen_opc_instr_start[ii++] = 0;
         }
+        tcg_ctx.gen_opc_pc[ii] = ctx.pc;
+        gen_opc_hflags[ii] = ctx.flags;
+        tcg_ctx.gen_opc_instr_start[ii] = 1;
+        tcg_ctx.gen_opc_icount[ii] = num_insns;
         if (num_insns + 1 == max_insns && (tb->cflags & CF_LAST_IO))
             gen_io_start();
 #if 0
@@ -1963,12 +1961,11 @@ gen_intermediate_code_internal(SuperHCPU *cpu, TranslationBlock *tb,
 
     gen_tb_end(tb, num_insns);
     *tcg_ctx.gen_opc_ptr = INDEX_op_end;
-    if (search_pc) {
-        i = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-        ii++;
-        while (ii <= i)
-            tcg_ctx.gen_opc_instr_start[ii++] = 0;
-    } else {
+    i = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+    ii++;
+    while (ii <= i)
+        tcg_ctx.gen_opc_instr_start[ii++] = 0;
+    if (!search_pc) {
         tb->size = ctx.pc - pc_start;
         tb->icount = num_insns;
     }
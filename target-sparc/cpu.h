@@ -27,6 +27,10 @@
 
 #define CPUArchState struct CPUSPARCState
 
+/* per-insn state saved for restore_state_to_opc(): npc and both targets of
+   a conditional delay slot */
+#define TARGET_INSN_DATA_WORDS 3
+
 #include "exec/cpu-defs.h"
 
 #include "fpu/softfloat.h"
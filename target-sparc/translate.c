@@ -64,8 +64,8 @@ static TCGv cpu_wim;
 /* Floating point registers */
 static TCGv_i64 cpu_fpr[TARGET_DPREGS];
 
-static target_ulong gen_opc_npc[OPC_BUF_SIZE];
-static target_ulong gen_opc_jump_pc[2];
+#define gen_opc_npc tcg_ctx.gen_opc_data[0]
+#define gen_opc_jump_pc(n) tcg_ctx.gen_opc_data[1 + (n)]
 
 #include "exec/gen-icount.h"
 
@@ -5285,18 +5285,19 @@ static inline void gen_intermediate_code_internal(SPARCCPU *cpu,
                 }
             }
         }
-        if (spc) {
-            qemu_log("Search PC...\n");
-            j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-            if (lj < j) {
-                lj++;
-                while (lj < j)
-                    tcg_ctx.gen_opc_instr_start[lj++] = 0;
-                tcg_ctx.gen_opc_pc[lj] = dc->pc;
-                gen_opc_npc[lj] = dc->npc;
-                tcg_ctx.gen_opc_instr_start[lj] = 1;
-                tcg_ctx.gen_opc_icount[lj] = num_insns;
+        j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+        if (lj < j) {
+            lj++;
+            while (lj < j)
+                tcg_ctx.gen_opc_instr_start[lj++] = 0;
+            tcg_ctx.gen_opc_pc[lj] = dc->pc;
+            gen_opc_npc[lj] = dc->npc;
+            if (dc->npc == JUMP_PC) {
+                gen_opc_jump_pc(0)[lj] = dc->jump_pc[0];
+                gen_opc_jump_pc(1)[lj] = dc->jump_pc[1];
             }
+            tcg_ctx.gen_opc_instr_start[lj] = 1;
+            tcg_ctx.gen_opc_icount[lj] = num_insns;
         }
         if (num_insns + 1 == max_insns && (tb->cflags & CF_LAST_IO))
             gen_io_start();
@@ -5343,17 +5344,14 @@ static inline void gen_intermediate_code_internal(SPARCCPU *cpu,
     }
     gen_tb_end(tb, num_insns);
     *tcg_ctx.gen_opc_ptr = INDEX_op_end;
-    if (spc) {
-        j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
-        lj++;
-        while (lj <= j)
-            tcg_ctx.gen_opc_instr_start[lj++] = 0;
+    j = tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+    lj++;
+    while (lj <= j)
+        tcg_ctx.gen_opc_instr_start[lj++] = 0;
 #if 0
-        log_page_dump();
+    log_page_dump();
 #endif
-        gen_opc_jump_pc[0] = dc->jump_pc[0];
-        gen_opc_jump_pc[1] = dc->jump_pc[1];
-    } else {
+    if (!spc) {
         tb->size = last_pc + 4 - pc_start;
         tb->icount = num_insns;
     }
@@ -5488,9 +5486,9 @@ void restore_state_to_opc(CPUSPARCState *env, TranslationBlock *tb, int pc_pos)
     } else if (npc == 2) {
         /* jump PC: use 'cond' and the jump targets of the translation */
         if (env->cond) {
-            env->npc = gen_opc_jump_pc[0];
+            env->npc = gen_opc_jump_pc(0)[pc_pos];
         } else {
-            env->npc = gen_opc_jump_pc[1];
+            env->npc = gen_opc_jump_pc(1)[pc_pos];
         }
     } else {
         env->npc = npc;
@@ -29,8 +29,11 @@
 
 #include "exec/helper-head.h"
 
+#define DEF_HELPER_FLAGS_1(name, flags, ret, t1)
 #define DEF_HELPER_FLAGS_2(name, flags, ret, t1, t2) \
   dh_ctype(ret) HELPER(name) (dh_ctype(t1), dh_ctype(t2));
+#define DEF_HELPER_FLAGS_4(name, flags, ret, t1, t2, t3, t4)
+#define DEF_HELPER_FLAGS_5(name, flags, ret, t1, t2, t3, t4, t5)
 
 #include "tcg-runtime.h"
 
@@ -139,6 +139,17 @@ static bool have_bmi2;
 # define have_bmi2 0
 #endif
 
+/* SSE2 enables the vector ops, which tcg-target.h needs to know; AVX
+   allows the three-operand VEX encoding with unaligned memory operands.
+   SSE2 is part of the x86_64 baseline.  */
+bool have_sse2 = TCG_TARGET_REG_BITS == 64;
+
+#if defined(CONFIG_CPUID_H) && defined(bit_AVX) && defined(bit_OSXSAVE)
+static bool have_avx1;
+#else
+# define have_avx1 0
+#endif
+
 static tcg_insn_unit *tb_ret_addr;
 
 static void patch_reloc(tcg_insn_unit *code_ptr, int type,
@@ -306,6 +317,7 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_ARITH_GvEv	(0x03)		/* ... plus (ARITH_FOO << 3) */
 #define OPC_ANDN        (0xf2 | P_EXT38)
 #define OPC_ADD_GvEv	(OPC_ARITH_GvEv | (ARITH_ADD << 3))
+#define OPC_AND_GvEv	(OPC_ARITH_GvEv | (ARITH_AND << 3))
 #define OPC_BSWAP	(0xc8 | P_EXT)
 #define OPC_CALL_Jz	(0xe8)
 #define OPC_CMOVCC      (0x40 | P_EXT)  /* ... plus condition code */
@@ -348,6 +360,26 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_TESTL	(0x85)
 #define OPC_XCHG_ax_r32	(0x90)
 
+#define OPC_MOVDQU_VxWx (0x6f | P_EXT | P_SIMDF3)
+#define OPC_MOVDQU_WxVx (0x7f | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_VqWq   (0x7e | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_WqVq   (0xd6 | P_EXT | P_DATA16)
+#define OPC_PADDB       (0xfc | P_EXT | P_DATA16)
+#define OPC_PADDW       (0xfd | P_EXT | P_DATA16)
+#define OPC_PADDD       (0xfe | P_EXT | P_DATA16)
+#define OPC_PADDQ       (0xd4 | P_EXT | P_DATA16)
+#define OPC_PAND        (0xdb | P_EXT | P_DATA16)
+#define OPC_PANDN       (0xdf | P_EXT | P_DATA16)
+#define OPC_PCMPEQB     (0x74 | P_EXT | P_DATA16)
+#define OPC_PCMPEQW     (0x75 | P_EXT | P_DATA16)
+#define OPC_PCMPEQD     (0x76 | P_EXT | P_DATA16)
+#define OPC_POR         (0xeb | P_EXT | P_DATA16)
+#define OPC_PSUBB       (0xf8 | P_EXT | P_DATA16)
+#define OPC_PSUBW       (0xf9 | P_EXT | P_DATA16)
+#define OPC_PSUBD       (0xfa | P_EXT | P_DATA16)
+#define OPC_PSUBQ       (0xfb | P_EXT | P_DATA16)
+#define OPC_PXOR        (0xef | P_EXT | P_DATA16)
+
 #define OPC_GRP3_Ev	(0xf7)
 #define OPC_GRP5	(0xff)
 
@@ -431,6 +463,11 @@ static void tcg_out_opc(TCGContext *s, int opc, int r, int rm, int x)
     if (opc & P_ADDR32) {
         tcg_out8(s, 0x67);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    } else if (opc & P_SIMDF2) {
+        tcg_out8(s, 0xf2);
+    }
 
     rex = 0;
     rex |= (opc & P_REXW) ? 0x8 : 0x0;  /* REX.W */
@@ -465,6 +502,11 @@ static void tcg_out_opc(TCGContext *s, int opc)
     if (opc & P_DATA16) {
         tcg_out8(s, 0x66);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    } else if (opc & P_SIMDF2) {
+        tcg_out8(s, 0xf2);
+    }
     if (opc & (P_EXT | P_EXT38)) {
         tcg_out8(s, 0x0f);
         if (opc & P_EXT38) {
@@ -485,11 +527,14 @@ static void tcg_out_modrm(TCGContext *s, int opc, int r, int rm)
     tcg_out8(s, 0xc0 | (LOWREGMASK(r) << 3) | LOWREGMASK(rm));
 }
 
-static void tcg_out_vex_modrm(TCGContext *s, int opc, int r, int v, int rm)
+static void tcg_out_vex_opc(TCGContext *s, int opc, int r, int v,
+                            int rm, int index)
 {
     int tmp;
 
-    if ((opc & (P_REXW | P_EXT | P_EXT38)) || (rm & 8)) {
+    /* The two byte form cannot encode VEX.W, VEX.X, VEX.B, nor any
+       opcode map other than 0x0f.  */
+    if ((opc & (P_REXW | P_EXT | P_EXT38)) != P_EXT || ((rm | index) & 8)) {
         /* Three byte VEX prefix.  */
         tcg_out8(s, 0xc4);
 
@@ -501,8 +546,8 @@ static void tcg_out_vex_modrm(TCGContext *s, int opc, int r, int v, int rm)
         } else {
             tcg_abort();
         }
-        tmp |= 0x40;                       /* VEX.X */
         tmp |= (r & 8 ? 0 : 0x80);         /* VEX.R */
+        tmp |= (index & 8 ? 0 : 0x40);     /* VEX.X */
         tmp |= (rm & 8 ? 0 : 0x20);        /* VEX.B */
         tcg_out8(s, tmp);
 
@@ -524,16 +569,21 @@ static void tcg_out_vex_modrm(TCGContext *s, int opc, int r, int v, int rm)
     tmp |= (~v & 15) << 3;                 /* VEX.vvvv */
     tcg_out8(s, tmp);
     tcg_out8(s, opc);
+}
+
+static void tcg_out_vex_modrm(TCGContext *s, int opc, int r, int v, int rm)
+{
+    tcg_out_vex_opc(s, opc, r, v, rm, 0);
     tcg_out8(s, 0xc0 | (LOWREGMASK(r) << 3) | LOWREGMASK(rm));
 }
 
-/* Output an opcode with a full "rm + (index<<shift) + offset" address mode.
-   We handle either RM and INDEX missing with a negative value.  In 64-bit
-   mode for absolute addresses, ~RM is the size of the immediate operand
-   that will follow the instruction.  */
+/* Output the operand bytes of a full "rm + (index<<shift) + offset" address
+   mode, after the opcode.  We handle either RM and INDEX missing with a
+   negative value.  In 64-bit mode for absolute addresses, ~RM is the size
+   of the immediate operand that will follow the instruction.  */
 
-static void tcg_out_modrm_sib_offset(TCGContext *s, int opc, int r, int rm,
-                                     int index, int shift, intptr_t offset)
+static void tcg_out_sib_offset(TCGContext *s, int r, int rm, int index,
+                               int shift, intptr_t offset)
 {
     int mod, len;
 
@@ -544,7 +594,6 @@ static void tcg_out_modrm_sib_offset(TCGContext *s, int opc, int r, int rm,
             intptr_t pc = (intptr_t)s->code_ptr + 5 + ~rm;
             intptr_t disp = offset - pc;
             if (disp == (int32_t)disp) {
-                tcg_out_opc(s, opc, r, 0, 0);
                 tcg_out8(s, (LOWREGMASK(r) << 3) | 5);
                 tcg_out32(s, disp);
                 return;
@@ -554,7 +603,6 @@ static void tcg_out_modrm_sib_offset(TCGContext *s, int opc, int r, int rm,
                use of the MODRM+SIB encoding and is therefore larger than
                rip-relative addressing.  */
             if (offset == (int32_t)offset) {
-                tcg_out_opc(s, opc, r, 0, 0);
                 tcg_out8(s, (LOWREGMASK(r) << 3) | 4);
                 tcg_out8(s, (4 << 3) | 5);
                 tcg_out32(s, offset);
@@ -565,7 +613,6 @@ static void tcg_out_modrm_sib_offset(TCGContext *s, int opc, int r, int rm,
             tcg_abort();
         } else {
             /* Absolute address.  */
-            tcg_out_opc(s, opc, r, 0, 0);
             tcg_out8(s, (r << 3) | 5);
             tcg_out32(s, offset);
             return;
@@ -588,7 +635,6 @@ static void tcg_out_modrm_sib_offset(TCGContext *s, int opc, int r, int rm,
        that would be used for %esp is the escape to the two byte form.  */
     if (index < 0 && LOWREGMASK(rm) != TCG_REG_ESP) {
         /* Single byte MODRM format.  */
-        tcg_out_opc(s, opc, r, rm, 0);
         tcg_out8(s, mod | (LOWREGMASK(r) << 3) | LOWREGMASK(rm));
     } else {
         /* Two byte MODRM+SIB format.  */
@@ -602,7 +648,6 @@ static void tcg_out_modrm_sib_offset(TCGContext *s, int opc, int r, int rm,
             assert(index != TCG_REG_ESP);
         }
 
-        tcg_out_opc(s, opc, r, rm, index);
         tcg_out8(s, mod | (LOWREGMASK(r) << 3) | 4);
         tcg_out8(s, (shift << 6) | (LOWREGMASK(index) << 3) | LOWREGMASK(rm));
     }
@@ -614,6 +659,16 @@ static void tcg_out_modrm_sib_offset(TCGContext *s, int opc, int r, int rm,
     }
 }
 
+/* Output an opcode with a full "rm + (index<<shift) + offset" address mode.
+   The operand forms are as for tcg_out_sib_offset.  */
+
+static void tcg_out_modrm_sib_offset(TCGContext *s, int opc, int r, int rm,
+                                     int index, int shift, intptr_t offset)
+{
+    tcg_out_opc(s, opc, r, rm < 0 ? 0 : rm, index < 0 ? 0 : index);
+    tcg_out_sib_offset(s, r, rm, index, shift, offset);
+}
+
 /* A simplification of the above with no index or shift.  */
 static inline void tcg_out_modrm_offset(TCGContext *s, int opc, int r,
                                         int rm, intptr_t offset)
@@ -621,6 +676,13 @@ static inline void tcg_out_modrm_offset(TCGContext *s, int opc, int r,
     tcg_out_modrm_sib_offset(s, opc, r, rm, -1, 0, offset);
 }
 
+static void tcg_out_vex_modrm_offset(TCGContext *s, int opc, int r, int v,
+                                     int rm, intptr_t offset)
+{
+    tcg_out_vex_opc(s, opc, r, v, rm, 0);
+    tcg_out_sib_offset(s, r, rm, -1, 0, offset);
+}
+
 /* Generate dest op= src.  Uses the same ARITH_* codes as tgen_arithi.  */
 static inline void tgen_arithr(TCGContext *s, int subop, int dest, int src)
 {
@@ -643,6 +705,8 @@ static inline void tcg_out_mov(TCGContext *s, TCGType type,
 static void tcg_out_movi(TCGContext *s, TCGType type,
                          TCGReg ret, tcg_target_long arg)
 {
+    tcg_insn_unit *start = s->code_ptr;
+    int idx = s->nb_code_relocs;
     tcg_target_long diff;
 
     if (arg == 0) {
@@ -666,11 +730,11 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
         tcg_out_opc(s, OPC_LEA | P_REXW, ret, 0, 0);
         tcg_out8(s, (LOWREGMASK(ret) << 3) | 5);
         tcg_out32(s, diff);
-        return;
+    } else {
+        tcg_out_opc(s, OPC_MOVL_Iv + P_REXW + LOWREGMASK(ret), 0, ret, 0);
+        tcg_out64(s, arg);
     }
-
-    tcg_out_opc(s, OPC_MOVL_Iv + P_REXW + LOWREGMASK(ret), 0, ret, 0);
-    tcg_out64(s, arg);
+    tcg_code_reloc(s, idx, TCG_CODE_RELOC_MOVI, start, type, ret, arg);
 }
 
 static inline void tcg_out_pushi(TCGContext *s, tcg_target_long val)
@@ -1101,6 +1165,8 @@ static void tcg_out_movcond64(TCGContext *s, TCGCond cond, TCGArg dest,
 
 static void tcg_out_branch(TCGContext *s, int call, tcg_insn_unit *dest)
 {
+    tcg_insn_unit *start = s->code_ptr;
+    int idx = s->nb_code_relocs;
     intptr_t disp = tcg_pcrel_diff(s, dest) - 5;
 
     if (disp == (int32_t)disp) {
@@ -1111,6 +1177,10 @@ static void tcg_out_branch(TCGContext *s, int call, tcg_insn_unit *dest)
         tcg_out_modrm(s, OPC_GRP5,
                       call ? EXT5_CALLN_Ev : EXT5_JMPN_Ev, TCG_REG_R10);
     }
+    tcg_code_reloc(s, idx, call ? TCG_CODE_RELOC_CALL
+                   : dest == tb_ret_addr ? TCG_CODE_RELOC_EPILOGUE
+                   : TCG_CODE_RELOC_JMP,
+                   start, TCG_TYPE_PTR, 0, (uintptr_t)dest);
 }
 
 static inline void tcg_out_call(TCGContext *s, tcg_insn_unit *dest)
@@ -1200,15 +1270,16 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
 
     tgen_arithi(s, ARITH_AND + trexw, r1,
                 TARGET_PAGE_MASK | ((1 << s_bits) - 1), 0);
-    tgen_arithi(s, ARITH_AND + hrexw, r0,
-                (CPU_TLB_SIZE - 1) << CPU_TLB_ENTRY_BITS, 0);
 
-    tcg_out_modrm_sib_offset(s, OPC_LEA + hrexw, r0, TCG_AREG0, r0, 0,
-                             offsetof(CPUArchState, tlb_table[mem_index][0])
-                             + which);
+    /* The TLB size is only known at run time: r0 = tlb_table[mem_index]
+       + (r0 & tlb_mask[mem_index]).  */
+    tcg_out_modrm_offset(s, OPC_AND_GvEv + hrexw, r0, TCG_AREG0,
+                         offsetof(CPUArchState, tlb_mask[mem_index]));
+    tcg_out_modrm_offset(s, OPC_ADD_GvEv + hrexw, r0, TCG_AREG0,
+                         offsetof(CPUArchState, tlb_table[mem_index]));
 
-    /* cmp 0(r0), r1 */
-    tcg_out_modrm_offset(s, OPC_CMP_GvEv + trexw, r1, r0, 0);
+    /* cmp which(r0), r1 */
+    tcg_out_modrm_offset(s, OPC_CMP_GvEv + trexw, r1, r0, which);
 
     /* Prepare for both the fast path add of the tlb addend, and the slow
        path function argument setup.  There are two cases worth note:
@@ -1224,8 +1295,8 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
     s->code_ptr += 4;
 
     if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
-        /* cmp 4(r0), addrhi */
-        tcg_out_modrm_offset(s, OPC_CMP_GvEv, addrhi, r0, 4);
+        /* cmp which+4(r0), addrhi */
+        tcg_out_modrm_offset(s, OPC_CMP_GvEv, addrhi, r0, which + 4);
 
         /* jne slow_path */
         tcg_out_opc(s, OPC_JCC_long + JCC_JNE, 0, 0, 0);
@@ -1237,7 +1308,7 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
 
     /* add addend(r0), r1 */
     tcg_out_modrm_offset(s, OPC_ADD_GvEv + hrexw, r1, r0,
-                         offsetof(CPUTLBEntry, addend) - which);
+                         offsetof(CPUTLBEntry, addend));
 }
 
 /*
@@ -1714,6 +1785,106 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args, bool is64)
 #endif
 }
 
+/* Scratch registers for the vector ops, %xmm0 and %xmm1.  The register
+   allocator does not manage the SSE registers; these two are
+   call-clobbered in all host ABIs and never hold a value across ops.  */
+#define TCG_VEC_TMP0 0
+#define TCG_VEC_TMP1 1
+
+static void tcg_out_vec_ld(TCGContext *s, TCGType type, int r,
+                           TCGReg base, intptr_t ofs)
+{
+    int opc = type == TCG_TYPE_V64 ? OPC_MOVQ_VqWq : OPC_MOVDQU_VxWx;
+
+    if (have_avx1) {
+        tcg_out_vex_modrm_offset(s, opc, r, 0, base, ofs);
+    } else {
+        tcg_out_modrm_offset(s, opc, r, base, ofs);
+    }
+}
+
+static void tcg_out_vec_st(TCGContext *s, TCGType type, int r,
+                           TCGReg base, intptr_t ofs)
+{
+    int opc = type == TCG_TYPE_V64 ? OPC_MOVQ_WqVq : OPC_MOVDQU_WxVx;
+
+    if (have_avx1) {
+        tcg_out_vex_modrm_offset(s, opc, r, 0, base, ofs);
+    } else {
+        tcg_out_modrm_offset(s, opc, r, base, ofs);
+    }
+}
+
+static void tcg_out_vec_op(TCGContext *s, TCGOpcode opc, const TCGArg *args)
+{
+    static const int add_insn[4] = {
+        OPC_PADDB, OPC_PADDW, OPC_PADDD, OPC_PADDQ
+    };
+    static const int sub_insn[4] = {
+        OPC_PSUBB, OPC_PSUBW, OPC_PSUBD, OPC_PSUBQ
+    };
+    static const int cmpeq_insn[3] = {
+        OPC_PCMPEQB, OPC_PCMPEQW, OPC_PCMPEQD
+    };
+    TCGReg base = args[0];
+    TCGType type = args[1];
+    intptr_t aofs, bofs;
+    int insn;
+
+    if (opc == INDEX_op_mov_vec) {
+        tcg_out_vec_ld(s, type, TCG_VEC_TMP0, base, args[3]);
+        tcg_out_vec_st(s, type, TCG_VEC_TMP0, base, args[2]);
+        return;
+    }
+
+    aofs = args[4];
+    bofs = args[5];
+    switch (opc) {
+    case INDEX_op_add_vec:
+        insn = add_insn[args[2]];
+        break;
+    case INDEX_op_sub_vec:
+        insn = sub_insn[args[2]];
+        break;
+    case INDEX_op_cmpeq_vec:
+        insn = cmpeq_insn[args[2]];
+        break;
+    case INDEX_op_and_vec:
+        insn = OPC_PAND;
+        break;
+    case INDEX_op_or_vec:
+        insn = OPC_POR;
+        break;
+    case INDEX_op_xor_vec:
+        insn = OPC_PXOR;
+        break;
+    case INDEX_op_andc_vec:
+        /* pandn inverts its first operand.  */
+        insn = OPC_PANDN;
+        aofs = args[5];
+        bofs = args[4];
+        break;
+    default:
+        tcg_abort();
+    }
+
+    tcg_out_vec_ld(s, type, TCG_VEC_TMP0, base, aofs);
+    if (have_avx1 && type == TCG_TYPE_V128) {
+        /* Unlike SSE, VEX encoded insns allow unaligned memory operands.  */
+        tcg_out_vex_modrm_offset(s, insn, TCG_VEC_TMP0, TCG_VEC_TMP0,
+                                 base, bofs);
+    } else {
+        tcg_out_vec_ld(s, type, TCG_VEC_TMP1, base, bofs);
+        if (have_avx1) {
+            tcg_out_vex_modrm(s, insn, TCG_VEC_TMP0, TCG_VEC_TMP0,
+                              TCG_VEC_TMP1);
+        } else {
+            tcg_out_modrm(s, insn, TCG_VEC_TMP0, TCG_VEC_TMP1);
+        }
+    }
+    tcg_out_vec_st(s, type, TCG_VEC_TMP0, base, args[3]);
+}
+
 static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
                               const TCGArg *args, const int *const_args)
 {
@@ -1731,7 +1902,14 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 
     switch(opc) {
     case INDEX_op_exit_tb:
-        tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, args[0]);
+        {
+            tcg_insn_unit *start = s->code_ptr;
+            int idx = s->nb_code_relocs;
+
+            tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, args[0]);
+            tcg_code_reloc(s, idx, TCG_CODE_RELOC_EXIT_TB, start,
+                           TCG_TYPE_PTR, TCG_REG_EAX, args[0]);
+        }
         tcg_out_jmp(s, tb_ret_addr);
         break;
     case INDEX_op_goto_tb:
@@ -1747,6 +1925,10 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         }
         s->tb_next_offset[args[0]] = tcg_current_code_size(s);
         break;
+    case INDEX_op_goto_ptr:
+        /* jmp to the given host address (could be epilogue) */
+        tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, args[0]);
+        break;
     case INDEX_op_br:
         tcg_out_jxx(s, JCC_JMP, args[0], 0);
         break;
@@ -2055,6 +2237,17 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         }
         break;
 
+    case INDEX_op_mov_vec:
+    case INDEX_op_add_vec:
+    case INDEX_op_sub_vec:
+    case INDEX_op_and_vec:
+    case INDEX_op_or_vec:
+    case INDEX_op_xor_vec:
+    case INDEX_op_andc_vec:
+    case INDEX_op_cmpeq_vec:
+        tcg_out_vec_op(s, opc, args);
+        break;
+
     case INDEX_op_mov_i32:  /* Always emitted via tcg_out_mov.  */
     case INDEX_op_mov_i64:
     case INDEX_op_movi_i32: /* Always emitted via tcg_out_movi.  */
@@ -2070,6 +2263,7 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_exit_tb, { } },
     { INDEX_op_goto_tb, { } },
+    { INDEX_op_goto_ptr, { "r" } },
     { INDEX_op_br, { } },
     { INDEX_op_ld8u_i32, { "r", "r" } },
     { INDEX_op_ld8s_i32, { "r", "r" } },
@@ -2193,6 +2387,15 @@ static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_qemu_ld_i64, { "r", "r", "L", "L" } },
     { INDEX_op_qemu_st_i64, { "L", "L", "L", "L" } },
 #endif
+
+    { INDEX_op_mov_vec, { "r" } },
+    { INDEX_op_add_vec, { "r" } },
+    { INDEX_op_sub_vec, { "r" } },
+    { INDEX_op_and_vec, { "r" } },
+    { INDEX_op_or_vec, { "r" } },
+    { INDEX_op_xor_vec, { "r" } },
+    { INDEX_op_andc_vec, { "r" } },
+    { INDEX_op_cmpeq_vec, { "r" } },
     { -1 },
 };
 
@@ -2230,6 +2433,34 @@ static int tcg_target_callee_save_regs[] = {
       + TCG_TARGET_STACK_ALIGN - 1) \
      & ~(TCG_TARGET_STACK_ALIGN - 1))
 
+static void tcg_out_code_reloc(TCGContext *s, const TCGCodeReloc *r,
+                               intptr_t value)
+{
+    switch (r->kind) {
+    case TCG_CODE_RELOC_MOVI:
+    case TCG_CODE_RELOC_EXIT_TB:
+        tcg_out_movi(s, r->type, r->reg, value);
+        break;
+    case TCG_CODE_RELOC_CALL:
+        tcg_out_branch(s, 1, (tcg_insn_unit *)value);
+        break;
+    case TCG_CODE_RELOC_JMP:
+        tcg_out_branch(s, 0, (tcg_insn_unit *)value);
+        break;
+    case TCG_CODE_RELOC_EPILOGUE:
+        tcg_out_branch(s, 0, tb_ret_addr);
+        break;
+    default:
+        tcg_abort();
+    }
+}
+
+uint32_t tcg_target_code_features(void)
+{
+    return have_cmov | have_movbe << 1 | have_bmi1 << 2 | have_bmi2 << 3
+           | have_sse2 << 4 | have_avx1 << 5;
+}
+
 /* Generate global QEMU prologue and epilogue code */
 static void tcg_target_qemu_prologue(TCGContext *s)
 {
@@ -2262,6 +2493,11 @@ static void tcg_target_qemu_prologue(TCGContext *s)
     tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, tcg_target_call_iarg_regs[1]);
 #endif
 
+    /* Return path for goto_ptr.  Set return value to 0, a-la exit_tb,
+       and fall through to the rest of the epilogue.  */
+    s->code_gen_epilogue = s->code_ptr;
+    tcg_out_movi(s, TCG_TYPE_REG, TCG_REG_EAX, 0);
+
     /* TB epilogue */
     tb_ret_addr = s->code_ptr;
 
@@ -2288,6 +2524,17 @@ static void tcg_target_init(TCGContext *s)
 
     if (max >= 1) {
         __cpuid(1, a, b, c, d);
+        have_sse2 |= (d & bit_SSE2) != 0;
+#ifndef have_avx1
+        /* AVX also needs the OS to save the extended register state,
+           which is only known from XCR0.  */
+        if (c & bit_OSXSAVE) {
+            unsigned xcrl, xcrh;
+
+            asm("xgetbv" : "=a" (xcrl), "=d" (xcrh) : "c" (0));
+            have_avx1 = (c & bit_AVX) && (xcrl & 6) == 6;
+        }
+#endif
 #ifndef have_cmov
         /* For 32-bit, 99% certainty that we're running on hardware that
            supports cmov, but we still need to check.  In case cmov is not
@@ -74,6 +74,7 @@ typedef enum {
 #endif
 
 extern bool have_bmi1;
+extern bool have_sse2;
 
 /* optional instructions */
 #define TCG_TARGET_HAS_div2_i32         1
@@ -99,6 +100,8 @@ extern bool have_bmi1;
 #define TCG_TARGET_HAS_muls2_i32        1
 #define TCG_TARGET_HAS_muluh_i32        0
 #define TCG_TARGET_HAS_mulsh_i32        0
+#define TCG_TARGET_HAS_vec              have_sse2
+#define TCG_TARGET_HAS_goto_ptr         1
 
 #if TCG_TARGET_REG_BITS == 64
 #define TCG_TARGET_HAS_trunc_shr_i32    0
@@ -141,6 +144,10 @@ extern bool have_bmi1;
 # define TCG_AREG0 TCG_REG_EBP
 #endif
 
+/* position-dependent code is logged and can be moved with
+   tcg_code_reloc_apply */
+#define TCG_TARGET_CODE_RELOCS 1
+
 static inline void flush_icache_range(uintptr_t start, uintptr_t stop)
 {
 }
@@ -1484,7 +1484,7 @@ static inline void tcg_out_movcond(TCGContext *s, TCGCond cond, TCGArg ret,
 
 #if defined(CONFIG_SOFTMMU)
 /* We're expecting to use an signed 22-bit immediate add.  */
-QEMU_BUILD_BUG_ON(offsetof(CPUArchState, tlb_table[NB_MMU_MODES - 1][1])
+QEMU_BUILD_BUG_ON(offsetof(CPUArchState, tlb_table[NB_MMU_MODES - 1])
                   > 0x1fffff)
 
 /* Load and compare a TLB entry, and return the result in (p6, p7).
@@ -1493,51 +1493,76 @@ QEMU_BUILD_BUG_ON(offsetof(CPUArchState, tlb_table[NB_MMU_MODES - 1][1])
    R1, R3 are clobbered, leaving R56 free for...
    BSWAP_1, BSWAP_2 and I-slot insns for swapping data for store.  */
 static inline void tcg_out_qemu_tlb(TCGContext *s, TCGReg addr_reg,
-                                    TCGMemOp s_bits, int off_rw, int off_add,
+                                    TCGMemOp s_bits, int mem_index,
+                                    int off_rw, int off_add,
                                     uint64_t bswap1, uint64_t bswap2)
 {
+    int mask_off = offsetof(CPUArchState, tlb_mask[mem_index]);
+    int table_off = offsetof(CPUArchState, tlb_table[mem_index]);
+
      /*
         .mii
-        mov	r2 = off_rw
-        extr.u	r3 = addr_reg, ...		# extract tlb page
+        mov	r2 = mask_off
+        extr.u	r3 = addr_reg, ...		# tlb page, times entry size
         zxt4	r57 = addr_reg                  # or mov for 64-bit guest
         ;;
-        .mii
-        addl	r2 = r2, areg0
-        shl	r3 = r3, cteb                   # via dep.z
-        dep	r1 = 0, r57, ...                # zero page ofs, keep align
+        .mmi
+        add	r2 = r2, areg0
+        ;;
+        ld8	r1 = [r2], table_off-mask_off	# tlb size mask
+        nop
+        ;;
+        .mmi
+        ld8	r2 = [r2]			# tlb base
+        and	r3 = r3, r1
+        nop
         ;;
         .mmi
         add	r2 = r2, r3
+        nop
+        dep	r1 = 0, r57, ...                # zero page ofs, keep align
+        ;;
+        .mmi
+        adds	r2 = off_rw, r2
         ;;
         ld4	r3 = [r2], off_add-off_rw	# or ld8 for 64-bit guest
         nop
         ;;
         .mmi
-        nop
+        ld8	r2 = [r2]
         cmp.eq	p6, p7 = r3, r58
         nop
         ;;
       */
     tcg_out_bundle(s, miI,
-                   tcg_opc_movi_a(TCG_REG_P0, TCG_REG_R2, off_rw),
+                   tcg_opc_movi_a(TCG_REG_P0, TCG_REG_R2, mask_off),
                    tcg_opc_i11(TCG_REG_P0, OPC_EXTR_U_I11, TCG_REG_R3,
-                               addr_reg, TARGET_PAGE_BITS, CPU_TLB_BITS - 1),
+                               addr_reg, TARGET_PAGE_BITS - CPU_TLB_ENTRY_BITS,
+                               63 - (TARGET_PAGE_BITS - CPU_TLB_ENTRY_BITS)),
                    tcg_opc_ext_i(TCG_REG_P0,
                                  TARGET_LONG_BITS == 32 ? MO_UL : MO_Q,
                                  TCG_REG_R57, addr_reg));
-    tcg_out_bundle(s, miI,
+    tcg_out_bundle(s, MmI,
                    tcg_opc_a1 (TCG_REG_P0, OPC_ADD_A1, TCG_REG_R2,
                                TCG_REG_R2, TCG_AREG0),
-                   tcg_opc_i12(TCG_REG_P0, OPC_DEP_Z_I12, TCG_REG_R3,
-                               TCG_REG_R3, 63 - CPU_TLB_ENTRY_BITS,
-                               63 - CPU_TLB_ENTRY_BITS),
+                   tcg_opc_m3 (TCG_REG_P0, OPC_LD8_M3, TCG_REG_R1,
+                               TCG_REG_R2, table_off - mask_off),
+                   INSN_NOP_I);
+    tcg_out_bundle(s, mmI,
+                   tcg_opc_m1 (TCG_REG_P0, OPC_LD8_M1, TCG_REG_R2, TCG_REG_R2),
+                   tcg_opc_a1 (TCG_REG_P0, OPC_AND_A1, TCG_REG_R3,
+                               TCG_REG_R3, TCG_REG_R1),
+                   INSN_NOP_I);
+    tcg_out_bundle(s, mmI,
+                   tcg_opc_a1 (TCG_REG_P0, OPC_ADD_A1,
+                               TCG_REG_R2, TCG_REG_R2, TCG_REG_R3),
+                   INSN_NOP_M,
                    tcg_opc_i14(TCG_REG_P0, OPC_DEP_I14, TCG_REG_R1, 0,
                                TCG_REG_R57, 63 - s_bits,
                                TARGET_PAGE_BITS - s_bits - 1));
     tcg_out_bundle(s, MmI,
-                   tcg_opc_a1 (TCG_REG_P0, OPC_ADD_A1,
-                               TCG_REG_R2, TCG_REG_R2, TCG_REG_R3),
+                   tcg_opc_a4 (TCG_REG_P0, OPC_ADDS_A4,
+                               TCG_REG_R2, off_rw, TCG_REG_R2),
                    tcg_opc_m3 (TCG_REG_P0,
                                (TARGET_LONG_BITS == 32
                                 ? OPC_LD4_M3 : OPC_LD8_M3), TCG_REG_R3,
@@ -1650,9 +1675,9 @@ static inline void tcg_out_qemu_ld(TCGContext *s, const TCGArg *args)
     s_bits = opc & MO_SIZE;
 
     /* Read the TLB entry */
-    tcg_out_qemu_tlb(s, addr_reg, s_bits,
-                     offsetof(CPUArchState, tlb_table[mem_index][0].addr_read),
-                     offsetof(CPUArchState, tlb_table[mem_index][0].addend),
+    tcg_out_qemu_tlb(s, addr_reg, s_bits, mem_index,
+                     offsetof(CPUTLBEntry, addr_read),
+                     offsetof(CPUTLBEntry, addend),
                      INSN_NOP_I, INSN_NOP_I);
 
     /* P6 is the fast path, and P7 the slow path */
@@ -1726,9 +1751,9 @@ static inline void tcg_out_qemu_st(TCGContext *s, const TCGArg *args)
         pre1 = tcg_opc_ext_i(TCG_REG_P0, opc, TCG_REG_R58, data_reg);
     }
 
-    tcg_out_qemu_tlb(s, addr_reg, s_bits,
-                     offsetof(CPUArchState, tlb_table[mem_index][0].addr_write),
-                     offsetof(CPUArchState, tlb_table[mem_index][0].addend),
+    tcg_out_qemu_tlb(s, addr_reg, s_bits, mem_index,
+                     offsetof(CPUTLBEntry, addr_write),
+                     offsetof(CPUTLBEntry, addend),
                      pre1, pre2);
 
     /* P6 is the fast path, and P7 the slow path */
@@ -939,31 +939,36 @@ static void tcg_out_tlb_load(TCGContext *s, TCGReg base, TCGReg addrl,
                              TCGReg addrh, int mem_index, TCGMemOp s_bits,
                              tcg_insn_unit *label_ptr[2], bool is_load)
 {
-    int cmp_off
-        = (is_load
-           ? offsetof(CPUArchState, tlb_table[mem_index][0].addr_read)
-           : offsetof(CPUArchState, tlb_table[mem_index][0].addr_write));
-    int add_off = offsetof(CPUArchState, tlb_table[mem_index][0].addend);
-
-    tcg_out_opc_sa(s, OPC_SRL, TCG_REG_A0, addrl,
-                   TARGET_PAGE_BITS - CPU_TLB_ENTRY_BITS);
-    tcg_out_opc_imm(s, OPC_ANDI, TCG_REG_A0, TCG_REG_A0,
-                    (CPU_TLB_SIZE - 1) << CPU_TLB_ENTRY_BITS);
-    tcg_out_opc_reg(s, OPC_ADDU, TCG_REG_A0, TCG_REG_A0, TCG_AREG0);
+    int mask_off = offsetof(CPUArchState, tlb_mask[mem_index]);
+    int table_off = offsetof(CPUArchState, tlb_table[mem_index]);
+    int cmp_off = (is_load ? offsetof(CPUTLBEntry, addr_read)
+                   : offsetof(CPUTLBEntry, addr_write));
+    int add_off = offsetof(CPUTLBEntry, addend);
+    TCGReg env = TCG_AREG0;
 
     /* Compensate for very large offsets.  */
-    if (add_off >= 0x8000) {
+    if (table_off >= 0x8000) {
         /* Most target env are smaller than 32k; none are larger than 64k.
            Simplify the logic here merely to offset by 0x7ff0, giving us a
            range just shy of 64k.  Check this assumption.  */
         QEMU_BUILD_BUG_ON(offsetof(CPUArchState,
-                                   tlb_table[NB_MMU_MODES - 1][1])
+                                   tlb_table[NB_MMU_MODES - 1])
                           > 0x7ff0 + 0x7fff);
-        tcg_out_opc_imm(s, OPC_ADDIU, TCG_REG_A0, TCG_REG_A0, 0x7ff0);
-        cmp_off -= 0x7ff0;
-        add_off -= 0x7ff0;
+        tcg_out_opc_imm(s, OPC_ADDIU, TCG_TMP0, TCG_AREG0, 0x7ff0);
+        mask_off -= 0x7ff0;
+        table_off -= 0x7ff0;
+        env = TCG_TMP0;
     }
 
+    /* Load the current size mask and base of the tlb for this mode.  */
+    tcg_out_opc_imm(s, OPC_LW, TCG_TMP1, env, mask_off);
+    tcg_out_opc_imm(s, OPC_LW, TCG_REG_A0, env, table_off);
+
+    tcg_out_opc_sa(s, OPC_SRL, TCG_TMP0, addrl,
+                   TARGET_PAGE_BITS - CPU_TLB_ENTRY_BITS);
+    tcg_out_opc_reg(s, OPC_AND, TCG_TMP0, TCG_TMP0, TCG_TMP1);
+    tcg_out_opc_reg(s, OPC_ADDU, TCG_REG_A0, TCG_REG_A0, TCG_TMP0);
+
     /* Load the tlb comparator.  */
     tcg_out_opc_imm(s, OPC_LW, TCG_TMP0, TCG_REG_A0, cmp_off + LO_OFF);
     if (TARGET_LONG_BITS == 64) {
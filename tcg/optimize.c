@@ -49,7 +49,14 @@ struct tcg_temp_info {
     tcg_target_ulong mask;
 };
 
-static struct tcg_temp_info temps[TCG_MAX_TEMPS];
+static inline TCGTemp *ctx_temp(TCGContext *s, TCGArg temp)
+{
+    return &s->temps[temp];
+}
+
+/* per thread, as guest threads of linux-user translate concurrently */
+static DEFINE_TLS(struct tcg_temp_info[TCG_MAX_TEMPS], temps);
+#define temps tls_var(temps)
 
 /* Reset TEMP's state to TCG_TEMP_UNDEF.  If TEMP only had one copy, remove
    the copy flag from the left temp.  */
@@ -128,9 +135,9 @@ static TCGArg find_better_copy(TCGContext *s, TCGArg temp)
     }
 
     /* If it is a temp, search for a temp local. */
-    if (!s->temps[temp].temp_local) {
+    if (!ctx_temp(s, temp)->temp_local) {
         for (i = temps[temp].next_copy ; i != temp ; i = temps[i].next_copy) {
-            if (s->temps[i].temp_local) {
+            if (ctx_temp(s, i)->temp_local) {
                 return i;
             }
         }
@@ -180,7 +187,7 @@ static void tcg_opt_gen_mov(TCGContext *s, int op_index, TCGArg *gen_args,
 
     assert(temps[src].state != TCG_TEMP_CONST);
 
-    if (s->temps[src].type == s->temps[dst].type) {
+    if (ctx_temp(s, src)->type == ctx_temp(s, dst)->type) {
         if (temps[src].state != TCG_TEMP_COPY) {
             temps[src].state = TCG_TEMP_COPY;
             temps[src].next_copy = src;
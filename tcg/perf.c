@@ -0,0 +1,283 @@
+/*
+ * Linux perf integration for translated code
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "qemu-common.h"
+#include "elf.h"
+#include "exec/exec-all.h"
+#include "disas/disas.h"
+#include "tcg/perf.h"
+
+/* perf only knows about the code generation buffer as one anonymous
+   mapping.  Two formats tell it what lives there:
+
+   - the perf map, /tmp/perf-<pid>.map, has one "start size name" line
+     per piece of code.  perf report and perf top read it directly.
+
+   - the jitdump file also holds a copy of the code.  perf record -k 1
+     notices it from the executable mapping that we make of it, and
+     perf inject --jit turns each record into an ELF object, so that
+     perf annotate can show the host instructions of a TB even after its
+     space in the buffer was reused.
+
+   Each TB is named after its guest pc and, if known, the guest symbol
+   that contains it.  */
+
+static FILE *perfmap;
+static FILE *jitdump;
+static void *jitdump_marker;
+static bool perf_exit_registered;
+static uint64_t jitdump_code_index;
+
+static const void *prologue_start;
+static size_t prologue_size;
+
+/* the jitdump format, see tools/perf/Documentation/jitdump-specification.txt
+   in Linux */
+#define JITHEADER_MAGIC 0x4A695444
+#define JITHEADER_VERSION 1
+
+struct jitheader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+enum {
+    JIT_CODE_LOAD = 0,
+    JIT_CODE_CLOSE = 3,
+};
+
+struct jr_prefix {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+struct jr_code_load {
+    struct jr_prefix p;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+/* perf record -k 1 samples CLOCK_MONOTONIC, so records must use it too */
+static uint64_t perf_timestamp(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* the ELF machine of the host, which perf inject puts in its objects */
+static uint32_t perf_elf_machine(void)
+{
+    uint8_t ehdr[EI_NIDENT + 4];
+    uint16_t machine = EM_NONE;
+    int fd;
+
+    fd = open("/proc/self/exe", O_RDONLY);
+    if (fd < 0) {
+        return EM_NONE;
+    }
+    if (read(fd, ehdr, sizeof(ehdr)) == sizeof(ehdr) &&
+        !memcmp(ehdr, ELFMAG, SELFMAG)) {
+        /* e_machine follows e_ident and e_type in both classes */
+        memcpy(&machine, ehdr + EI_NIDENT + 2, sizeof(machine));
+    }
+    close(fd);
+    return machine;
+}
+
+static void perf_register_exit(void)
+{
+    if (!perf_exit_registered) {
+        atexit(perf_exit);
+        perf_exit_registered = true;
+    }
+}
+
+static void perfmap_write(const void *start, size_t size, const char *name)
+{
+    fprintf(perfmap, "%" PRIxPTR " %zx %s\n", (uintptr_t)start, size, name);
+}
+
+static void jitdump_write(const void *start, size_t size, const char *name)
+{
+    struct jr_code_load r;
+    size_t name_len = strlen(name) + 1;
+
+    memset(&r, 0, sizeof(r));
+    r.p.id = JIT_CODE_LOAD;
+    r.p.total_size = sizeof(r) + name_len + size;
+    r.p.timestamp = perf_timestamp();
+    r.pid = getpid();
+    r.tid = qemu_get_thread_id();
+    r.vma = (uintptr_t)start;
+    r.code_addr = (uintptr_t)start;
+    r.code_size = size;
+    r.code_index = jitdump_code_index++;
+    fwrite(&r, sizeof(r), 1, jitdump);
+    fwrite(name, name_len, 1, jitdump);
+    fwrite(start, size, 1, jitdump);
+}
+
+static void perf_write(const void *start, size_t size, const char *name)
+{
+    if (perfmap) {
+        perfmap_write(start, size, name);
+    }
+    if (jitdump) {
+        jitdump_write(start, size, name);
+    }
+}
+
+void perf_enable_perfmap(void)
+{
+    char *path;
+
+    if (perfmap) {
+        return;
+    }
+    path = g_strdup_printf("/tmp/perf-%d.map", getpid());
+    perfmap = fopen(path, "w");
+    if (!perfmap) {
+        fprintf(stderr, "qemu: cannot create %s: %s\n", path,
+                strerror(errno));
+        g_free(path);
+        return;
+    }
+    g_free(path);
+    /* perf top reads the map while we run */
+    setvbuf(perfmap, NULL, _IOLBF, 0);
+    perf_register_exit();
+    if (prologue_start) {
+        perfmap_write(prologue_start, prologue_size, "tcg-prologue");
+    }
+}
+
+void perf_enable_jitdump(void)
+{
+    struct jitheader h;
+    char *path;
+    int fd;
+
+    if (jitdump) {
+        return;
+    }
+    path = g_strdup_printf("%s/jit-%d.dump", g_get_tmp_dir(), getpid());
+    fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0) {
+        goto fail;
+    }
+    /* perf record only looks at files mapped for execution */
+    jitdump_marker = mmap(NULL, getpagesize(), PROT_READ | PROT_EXEC,
+                          MAP_PRIVATE, fd, 0);
+    if (jitdump_marker == MAP_FAILED) {
+        jitdump_marker = NULL;
+        close(fd);
+        goto fail;
+    }
+    jitdump = fdopen(fd, "w+");
+    if (!jitdump) {
+        munmap(jitdump_marker, getpagesize());
+        jitdump_marker = NULL;
+        close(fd);
+        goto fail;
+    }
+    g_free(path);
+
+    memset(&h, 0, sizeof(h));
+    h.magic = JITHEADER_MAGIC;
+    h.version = JITHEADER_VERSION;
+    h.total_size = sizeof(h);
+    h.elf_mach = perf_elf_machine();
+    h.pid = getpid();
+    h.timestamp = perf_timestamp();
+    fwrite(&h, sizeof(h), 1, jitdump);
+
+    perf_register_exit();
+    if (prologue_start) {
+        jitdump_write(prologue_start, prologue_size, "tcg-prologue");
+    }
+    return;
+
+ fail:
+    fprintf(stderr, "qemu: cannot create %s: %s\n", path, strerror(errno));
+    g_free(path);
+}
+
+bool perf_enable(const char *mode)
+{
+    if (!strcmp(mode, "map")) {
+        perf_enable_perfmap();
+    } else if (!strcmp(mode, "jitdump")) {
+        perf_enable_jitdump();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool perf_enabled(void)
+{
+    return perfmap || jitdump;
+}
+
+void perf_report_prologue(const void *start, size_t size)
+{
+    prologue_start = start;
+    prologue_size = size;
+    perf_write(start, size, "tcg-prologue");
+}
+
+void perf_report_code(TranslationBlock *tb, size_t size)
+{
+    const char *sym;
+    char name[256];
+
+    if (likely(!perf_enabled())) {
+        return;
+    }
+    sym = lookup_symbol(tb->pc);
+    snprintf(name, sizeof(name), "%s%s[guest %s" TARGET_FMT_lx "]",
+             sym, *sym ? " " : "", tb->trace ? "trace " : "", tb->pc);
+    perf_write(tb->tc_ptr, size, name);
+}
+
+void perf_exit(void)
+{
+    if (perfmap) {
+        fclose(perfmap);
+        perfmap = NULL;
+    }
+    if (jitdump) {
+        struct jr_prefix r;
+
+        r.id = JIT_CODE_CLOSE;
+        r.total_size = sizeof(r);
+        r.timestamp = perf_timestamp();
+        fwrite(&r, sizeof(r), 1, jitdump);
+        fclose(jitdump);
+        jitdump = NULL;
+        munmap(jitdump_marker, getpagesize());
+        jitdump_marker = NULL;
+    }
+}
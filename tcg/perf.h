@@ -0,0 +1,29 @@
+/*
+ * Linux perf integration for translated code
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef TCG_PERF_H
+#define TCG_PERF_H
+
+#include "qemu-common.h"
+
+/* Describe each TB in /tmp/perf-<pid>.map, for perf report and perf top.  */
+void perf_enable_perfmap(void);
+/* Write each TB, with its code, to the jitdump file jit-<pid>.dump in
+   the temporary directory, for perf record -k 1 and perf inject --jit.  */
+void perf_enable_jitdump(void);
+/* Enable the output named by MODE, "map" or "jitdump".  Returns false
+   if MODE is not one of these.  */
+bool perf_enable(const char *mode);
+/* Whether any output is enabled, so that guest symbols are worth loading.  */
+bool perf_enabled(void);
+
+void perf_report_prologue(const void *start, size_t size);
+/* Report the SIZE bytes of host code of TB, which was just generated.  */
+void perf_report_code(struct TranslationBlock *tb, size_t size);
+
+void perf_exit(void);
+
+#endif
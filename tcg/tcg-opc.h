@@ -184,6 +184,7 @@ DEF(debug_insn_start, 0, 0, 1, TCG_OPF_NOT_PRESENT)
 #endif
 DEF(exit_tb, 0, 0, 1, TCG_OPF_BB_END)
 DEF(goto_tb, 0, 0, 1, TCG_OPF_BB_END)
+DEF(goto_ptr, 0, 1, 0, TCG_OPF_BB_END | IMPL(TCG_TARGET_HAS_goto_ptr))
 
 #define TLADDR_ARGS    (TARGET_LONG_BITS <= TCG_TARGET_REG_BITS ? 1 : 2)
 #define DATA64_ARGS  (TCG_TARGET_REG_BITS == 64 ? 1 : 2)
@@ -197,6 +198,18 @@ DEF(qemu_ld_i64, DATA64_ARGS, TLADDR_ARGS, 2,
 DEF(qemu_st_i64, 0, TLADDR_ARGS + DATA64_ARGS, 2,
     TCG_OPF_CALL_CLOBBER | TCG_OPF_SIDE_EFFECTS | TCG_OPF_64BIT)
 
+/* vector ops, operating on memory at fixed offsets from a host pointer:
+   mov: base, type, dofs, aofs
+   others: base, type, vece, dofs, aofs, bofs */
+DEF(mov_vec, 0, 1, 3, IMPL(TCG_TARGET_HAS_vec))
+DEF(add_vec, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+DEF(sub_vec, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+DEF(and_vec, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+DEF(or_vec, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+DEF(xor_vec, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+DEF(andc_vec, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+DEF(cmpeq_vec, 0, 1, 5, IMPL(TCG_TARGET_HAS_vec))
+
 #undef TLADDR_ARGS
 #undef DATA64_ARGS
 #undef IMPL
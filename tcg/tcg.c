@@ -47,6 +47,7 @@
 #include "cpu.h"
 
 #include "tcg-op.h"
+#include "tcg/perf.h"
 
 #if UINTPTR_MAX == UINT32_MAX
 # define ELF_CLASS  ELFCLASS32
@@ -112,6 +113,32 @@ static int tcg_target_const_match(tcg_target_long val, TCGType type,
 static void tcg_out_tb_init(TCGContext *s);
 static void tcg_out_tb_finalize(TCGContext *s);
 
+/* Log the instruction emitted since START.  IDX is the value that
+   nb_code_relocs had at START: relocations logged by the instructions
+   that make up this one are dropped.  */
+static inline void tcg_code_reloc(TCGContext *s, int idx, int kind,
+                                  tcg_insn_unit *start, TCGType type,
+                                  TCGReg reg, intptr_t value)
+{
+    TCGCodeReloc *r;
+
+    if (!s->code_relocs) {
+        return;
+    }
+    if (idx >= TCG_MAX_CODE_RELOCS) {
+        s->code_uncacheable = true;
+        return;
+    }
+    r = &s->code_relocs[idx];
+    r->offset = (uint8_t *)start - (uint8_t *)s->code_buf;
+    r->len = (uint8_t *)s->code_ptr - (uint8_t *)start;
+    r->kind = kind;
+    r->type = type;
+    r->reg = reg;
+    r->value = value;
+    s->nb_code_relocs = idx + 1;
+}
+
 
 TCGOpDef tcg_op_defs[] = {
 #define DEF(s, oargs, iargs, cargs, flags) { #s, oargs, iargs, cargs, iargs + oargs + cargs, flags },
@@ -316,6 +343,18 @@ void tcg_pool_reset(TCGContext *s)
     s->pool_current = NULL;
 }
 
+void tcg_pool_delete(TCGContext *s)
+{
+    TCGPool *p, *t;
+
+    tcg_pool_reset(s);
+    for (p = s->pool_first; p; p = t) {
+        t = p->next;
+        g_free(p);
+    }
+    s->pool_first = NULL;
+}
+
 typedef struct TCGHelperInfo {
     void *func;
     const char *name;
@@ -380,6 +419,7 @@ void tcg_prologue_init(TCGContext *s)
     s->code_ptr = s->code_buf;
     tcg_target_qemu_prologue(s);
     flush_icache_range((uintptr_t)s->code_buf, (uintptr_t)s->code_ptr);
+    perf_report_prologue(s->code_buf, tcg_current_code_size(s));
 
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_OUT_ASM)) {
@@ -399,6 +439,27 @@ void tcg_set_frame(TCGContext *s, int reg, intptr_t start, intptr_t size)
     s->frame_reg = reg;
 }
 
+/* Return a new context for another thread to translate in, sharing the
+   globals, helpers and code buffer of S.  S must not be translating.  */
+TCGContext *tcg_context_clone(TCGContext *s)
+{
+    TCGContext *n = g_malloc(sizeof(*n));
+
+    memcpy(n, s, sizeof(*n));
+    n->pool_first = n->pool_current = n->pool_first_large = NULL;
+    n->pool_cur = n->pool_end = NULL;
+    /* the relocation log of the TB cache stays shared: while it is kept,
+       translation only happens under tb_lock */
+    n->region = NULL;
+    return n;
+}
+
+void tcg_context_free(TCGContext *s)
+{
+    tcg_pool_delete(s);
+    g_free(s);
+}
+
 void tcg_func_start(TCGContext *s)
 {
     tcg_pool_reset(s);
@@ -418,6 +479,9 @@ void tcg_func_start(TCGContext *s)
     s->gen_opc_ptr = s->gen_opc_buf;
     s->gen_opparam_ptr = s->gen_opparam_buf;
 
+    s->nb_code_relocs = 0;
+    s->code_uncacheable = false;
+
     s->be = tcg_malloc(sizeof(TCGBackendData));
 }
 
@@ -1007,6 +1071,384 @@ void tcg_gen_qemu_st_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
     *tcg_ctx.gen_opparam_ptr++ = idx;
 }
 
+/* Atomic operations on guest memory, as calls to the helpers generated
+   from atomic_template.h for each size and endianness.  */
+
+typedef void (*gen_atomic_cx_i32)(TCGv_i32, TCGv_ptr, TCGv, TCGv_i32,
+                                  TCGv_i32, TCGv_i32);
+typedef void (*gen_atomic_cx_i64)(TCGv_i64, TCGv_ptr, TCGv, TCGv_i64,
+                                  TCGv_i64, TCGv_i32);
+typedef void (*gen_atomic_op_i32)(TCGv_i32, TCGv_ptr, TCGv, TCGv_i32,
+                                  TCGv_i32);
+typedef void (*gen_atomic_op_i64)(TCGv_i64, TCGv_ptr, TCGv, TCGv_i64,
+                                  TCGv_i32);
+
+static void tcg_gen_ext_memop_i32(TCGv_i32 ret, TCGv_i32 val, TCGMemOp opc)
+{
+    switch (opc & (MO_SIZE | MO_SIGN)) {
+    case MO_UB:
+        tcg_gen_ext8u_i32(ret, val);
+        break;
+    case MO_SB:
+        tcg_gen_ext8s_i32(ret, val);
+        break;
+    case MO_UW:
+        tcg_gen_ext16u_i32(ret, val);
+        break;
+    case MO_SW:
+        tcg_gen_ext16s_i32(ret, val);
+        break;
+    default:
+        tcg_gen_mov_i32(ret, val);
+        break;
+    }
+}
+
+static void * const table_cmpxchg[16] = {
+    [MO_8] = gen_helper_atomic_cmpxchgb,
+    [MO_16 | MO_LE] = gen_helper_atomic_cmpxchgw_le,
+    [MO_16 | MO_BE] = gen_helper_atomic_cmpxchgw_be,
+    [MO_32 | MO_LE] = gen_helper_atomic_cmpxchgl_le,
+    [MO_32 | MO_BE] = gen_helper_atomic_cmpxchgl_be,
+    [MO_64 | MO_LE] = gen_helper_atomic_cmpxchgq_le,
+    [MO_64 | MO_BE] = gen_helper_atomic_cmpxchgq_be,
+};
+
+void tcg_gen_atomic_cmpxchg_i32(TCGv_i32 retv, TCGv addr, TCGv_i32 cmpv,
+                                TCGv_i32 newv, TCGArg idx, TCGMemOp memop)
+{
+    gen_atomic_cx_i32 gen;
+    TCGv_i32 t_idx;
+
+    memop = tcg_canonicalize_memop(memop, 0, 0);
+    gen = table_cmpxchg[memop & (MO_SIZE | MO_BSWAP)];
+    tcg_debug_assert(gen != NULL);
+
+    t_idx = tcg_const_i32(idx);
+    gen(retv, tcg_ctx.tcg_env, addr, cmpv, newv, t_idx);
+    tcg_temp_free_i32(t_idx);
+
+    if (memop & MO_SIGN) {
+        tcg_gen_ext_memop_i32(retv, retv, memop);
+    }
+}
+
+void tcg_gen_atomic_cmpxchg_i64(TCGv_i64 retv, TCGv addr, TCGv_i64 cmpv,
+                                TCGv_i64 newv, TCGArg idx, TCGMemOp memop)
+{
+    memop = tcg_canonicalize_memop(memop, 1, 0);
+
+    if ((memop & MO_SIZE) == MO_64) {
+        gen_atomic_cx_i64 gen;
+        TCGv_i32 t_idx;
+
+        gen = table_cmpxchg[memop & (MO_SIZE | MO_BSWAP)];
+        t_idx = tcg_const_i32(idx);
+        gen(retv, tcg_ctx.tcg_env, addr, cmpv, newv, t_idx);
+        tcg_temp_free_i32(t_idx);
+    } else {
+        TCGv_i32 c32 = tcg_temp_new_i32();
+        TCGv_i32 n32 = tcg_temp_new_i32();
+        TCGv_i32 r32 = tcg_temp_new_i32();
+
+        tcg_gen_trunc_i64_i32(c32, cmpv);
+        tcg_gen_trunc_i64_i32(n32, newv);
+        tcg_gen_atomic_cmpxchg_i32(r32, addr, c32, n32, idx, memop);
+        tcg_temp_free_i32(c32);
+        tcg_temp_free_i32(n32);
+
+        if (memop & MO_SIGN) {
+            tcg_gen_ext_i32_i64(retv, r32);
+        } else {
+            tcg_gen_extu_i32_i64(retv, r32);
+        }
+        tcg_temp_free_i32(r32);
+    }
+}
+
+static void do_atomic_op_i32(TCGv_i32 ret, TCGv addr, TCGv_i32 val,
+                             TCGArg idx, TCGMemOp memop, void * const table[])
+{
+    gen_atomic_op_i32 gen;
+    TCGv_i32 t_idx;
+
+    memop = tcg_canonicalize_memop(memop, 0, 0);
+    gen = table[memop & (MO_SIZE | MO_BSWAP)];
+    tcg_debug_assert(gen != NULL);
+
+    t_idx = tcg_const_i32(idx);
+    gen(ret, tcg_ctx.tcg_env, addr, val, t_idx);
+    tcg_temp_free_i32(t_idx);
+
+    if (memop & MO_SIGN) {
+        tcg_gen_ext_memop_i32(ret, ret, memop);
+    }
+}
+
+static void do_atomic_op_i64(TCGv_i64 ret, TCGv addr, TCGv_i64 val,
+                             TCGArg idx, TCGMemOp memop, void * const table[])
+{
+    memop = tcg_canonicalize_memop(memop, 1, 0);
+
+    if ((memop & MO_SIZE) == MO_64) {
+        gen_atomic_op_i64 gen;
+        TCGv_i32 t_idx;
+
+        gen = table[memop & (MO_SIZE | MO_BSWAP)];
+        t_idx = tcg_const_i32(idx);
+        gen(ret, tcg_ctx.tcg_env, addr, val, t_idx);
+        tcg_temp_free_i32(t_idx);
+    } else {
+        TCGv_i32 v32 = tcg_temp_new_i32();
+        TCGv_i32 r32 = tcg_temp_new_i32();
+
+        tcg_gen_trunc_i64_i32(v32, val);
+        do_atomic_op_i32(r32, addr, v32, idx, memop, table);
+        tcg_temp_free_i32(v32);
+
+        if (memop & MO_SIGN) {
+            tcg_gen_ext_i32_i64(ret, r32);
+        } else {
+            tcg_gen_extu_i32_i64(ret, r32);
+        }
+        tcg_temp_free_i32(r32);
+    }
+}
+
+#define GEN_ATOMIC_HELPER(NAME)                                         \
+static void * const table_##NAME[16] = {                                \
+    [MO_8] = gen_helper_atomic_##NAME##b,                               \
+    [MO_16 | MO_LE] = gen_helper_atomic_##NAME##w_le,                   \
+    [MO_16 | MO_BE] = gen_helper_atomic_##NAME##w_be,                   \
+    [MO_32 | MO_LE] = gen_helper_atomic_##NAME##l_le,                   \
+    [MO_32 | MO_BE] = gen_helper_atomic_##NAME##l_be,                   \
+    [MO_64 | MO_LE] = gen_helper_atomic_##NAME##q_le,                   \
+    [MO_64 | MO_BE] = gen_helper_atomic_##NAME##q_be,                   \
+};                                                                      \
+void tcg_gen_atomic_##NAME##_i32                                        \
+    (TCGv_i32 ret, TCGv addr, TCGv_i32 val, TCGArg idx, TCGMemOp memop) \
+{                                                                       \
+    do_atomic_op_i32(ret, addr, val, idx, memop, table_##NAME);         \
+}                                                                       \
+void tcg_gen_atomic_##NAME##_i64                                        \
+    (TCGv_i64 ret, TCGv addr, TCGv_i64 val, TCGArg idx, TCGMemOp memop) \
+{                                                                       \
+    do_atomic_op_i64(ret, addr, val, idx, memop, table_##NAME);         \
+}
+
+GEN_ATOMIC_HELPER(xchg)
+GEN_ATOMIC_HELPER(fetch_add)
+GEN_ATOMIC_HELPER(fetch_and)
+GEN_ATOMIC_HELPER(fetch_or)
+GEN_ATOMIC_HELPER(fetch_xor)
+GEN_ATOMIC_HELPER(add_fetch)
+GEN_ATOMIC_HELPER(and_fetch)
+GEN_ATOMIC_HELPER(or_fetch)
+GEN_ATOMIC_HELPER(xor_fetch)
+
+#undef GEN_ATOMIC_HELPER
+
+/* Vector operations on memory at fixed offsets from BASE, typically
+   guest SIMD registers in CPUArchState.  If the backend lacks
+   TCG_TARGET_HAS_vec, they are expanded into 64-bit integer operations,
+   working on all the lanes of each 64-bit chunk at once.  */
+
+/* Replicate the lane-sized constant C into all lanes of a 64-bit chunk.  */
+static inline uint64_t tcg_vec_dup_const(TCGMemOp vece, uint64_t c)
+{
+    return c * (UINT64_MAX / (UINT64_MAX >> (64 - (8 << vece))));
+}
+
+static void tcg_gen_vec_expand_i64(TCGOpcode opc, TCGMemOp vece, TCGv_i64 d,
+                                   TCGv_i64 a, TCGv_i64 b)
+{
+    int bits = 8 << vece;
+    uint64_t msb;
+    TCGv_i64 m, t1, t2, t3;
+
+    switch (opc) {
+    case INDEX_op_and_vec:
+        tcg_gen_and_i64(d, a, b);
+        return;
+    case INDEX_op_or_vec:
+        tcg_gen_or_i64(d, a, b);
+        return;
+    case INDEX_op_xor_vec:
+        tcg_gen_xor_i64(d, a, b);
+        return;
+    case INDEX_op_andc_vec:
+        tcg_gen_andc_i64(d, a, b);
+        return;
+    default:
+        break;
+    }
+
+    if (vece == MO_64) {
+        switch (opc) {
+        case INDEX_op_add_vec:
+            tcg_gen_add_i64(d, a, b);
+            break;
+        case INDEX_op_sub_vec:
+            tcg_gen_sub_i64(d, a, b);
+            break;
+        case INDEX_op_cmpeq_vec:
+            tcg_gen_setcond_i64(TCG_COND_EQ, d, a, b);
+            tcg_gen_neg_i64(d, d);
+            break;
+        default:
+            tcg_abort();
+        }
+        return;
+    }
+
+    /* M has the most significant bit of each lane set.  Arithmetic is
+       done on the remaining bits, so that no carry or borrow crosses a
+       lane boundary, and the top bits are then fixed up separately.  */
+    msb = tcg_vec_dup_const(vece, 1ull << (bits - 1));
+    m = tcg_const_i64(msb);
+    t1 = tcg_temp_new_i64();
+    t2 = tcg_temp_new_i64();
+    t3 = tcg_temp_new_i64();
+    switch (opc) {
+    case INDEX_op_add_vec:
+        tcg_gen_andc_i64(t1, a, m);
+        tcg_gen_andc_i64(t2, b, m);
+        tcg_gen_xor_i64(t3, a, b);
+        tcg_gen_add_i64(d, t1, t2);
+        tcg_gen_and_i64(t3, t3, m);
+        tcg_gen_xor_i64(d, d, t3);
+        break;
+    case INDEX_op_sub_vec:
+        tcg_gen_or_i64(t1, a, m);
+        tcg_gen_andc_i64(t2, b, m);
+        tcg_gen_eqv_i64(t3, a, b);
+        tcg_gen_sub_i64(d, t1, t2);
+        tcg_gen_and_i64(t3, t3, m);
+        tcg_gen_xor_i64(d, d, t3);
+        break;
+    case INDEX_op_cmpeq_vec:
+        /* The top bit of each lane of T1 is set iff the lane of A ^ B
+           is nonzero; turn the inverse of it into a full lane mask.  */
+        tcg_gen_xor_i64(t3, a, b);
+        tcg_gen_andc_i64(t1, t3, m);
+        tcg_gen_addi_i64(t1, t1, ~msb);
+        tcg_gen_or_i64(t1, t1, t3);
+        tcg_gen_andc_i64(d, m, t1);
+        tcg_gen_shri_i64(d, d, bits - 1);
+        tcg_gen_muli_i64(d, d, (1ull << bits) - 1);
+        break;
+    default:
+        tcg_abort();
+    }
+    tcg_temp_free_i64(m);
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+static void tcg_gen_vec_op(TCGOpcode opc, TCGType type, TCGMemOp vece,
+                           TCGv_ptr base, tcg_target_long dofs,
+                           tcg_target_long aofs, tcg_target_long bofs)
+{
+    TCGv_i64 ta, tb;
+    int i;
+
+    if (TCG_TARGET_HAS_vec) {
+        *tcg_ctx.gen_opc_ptr++ = opc;
+        *tcg_ctx.gen_opparam_ptr++ = GET_TCGV_PTR(base);
+        *tcg_ctx.gen_opparam_ptr++ = type;
+        *tcg_ctx.gen_opparam_ptr++ = vece;
+        *tcg_ctx.gen_opparam_ptr++ = dofs;
+        *tcg_ctx.gen_opparam_ptr++ = aofs;
+        *tcg_ctx.gen_opparam_ptr++ = bofs;
+        return;
+    }
+
+    ta = tcg_temp_new_i64();
+    tb = tcg_temp_new_i64();
+    for (i = 0; i < TCG_TYPE_VEC_SIZE(type); i += 8) {
+        tcg_gen_ld_i64(ta, base, aofs + i);
+        tcg_gen_ld_i64(tb, base, bofs + i);
+        tcg_gen_vec_expand_i64(opc, vece, ta, ta, tb);
+        tcg_gen_st_i64(ta, base, dofs + i);
+    }
+    tcg_temp_free_i64(ta);
+    tcg_temp_free_i64(tb);
+}
+
+void tcg_gen_vec_mov(TCGType type, TCGv_ptr base,
+                     tcg_target_long dofs, tcg_target_long aofs)
+{
+    TCGv_i64 t;
+    int i;
+
+    if (dofs == aofs) {
+        return;
+    }
+    if (TCG_TARGET_HAS_vec) {
+        *tcg_ctx.gen_opc_ptr++ = INDEX_op_mov_vec;
+        *tcg_ctx.gen_opparam_ptr++ = GET_TCGV_PTR(base);
+        *tcg_ctx.gen_opparam_ptr++ = type;
+        *tcg_ctx.gen_opparam_ptr++ = dofs;
+        *tcg_ctx.gen_opparam_ptr++ = aofs;
+        return;
+    }
+
+    t = tcg_temp_new_i64();
+    for (i = 0; i < TCG_TYPE_VEC_SIZE(type); i += 8) {
+        tcg_gen_ld_i64(t, base, aofs + i);
+        tcg_gen_st_i64(t, base, dofs + i);
+    }
+    tcg_temp_free_i64(t);
+}
+
+void tcg_gen_vec_add(TCGType type, TCGMemOp vece, TCGv_ptr base,
+                     tcg_target_long dofs, tcg_target_long aofs,
+                     tcg_target_long bofs)
+{
+    tcg_gen_vec_op(INDEX_op_add_vec, type, vece, base, dofs, aofs, bofs);
+}
+
+void tcg_gen_vec_sub(TCGType type, TCGMemOp vece, TCGv_ptr base,
+                     tcg_target_long dofs, tcg_target_long aofs,
+                     tcg_target_long bofs)
+{
+    tcg_gen_vec_op(INDEX_op_sub_vec, type, vece, base, dofs, aofs, bofs);
+}
+
+void tcg_gen_vec_cmpeq(TCGType type, TCGMemOp vece, TCGv_ptr base,
+                       tcg_target_long dofs, tcg_target_long aofs,
+                       tcg_target_long bofs)
+{
+    /* SSE2 has no 64-bit lane compare.  */
+    tcg_debug_assert(vece <= MO_32);
+    tcg_gen_vec_op(INDEX_op_cmpeq_vec, type, vece, base, dofs, aofs, bofs);
+}
+
+void tcg_gen_vec_and(TCGType type, TCGv_ptr base, tcg_target_long dofs,
+                     tcg_target_long aofs, tcg_target_long bofs)
+{
+    tcg_gen_vec_op(INDEX_op_and_vec, type, MO_64, base, dofs, aofs, bofs);
+}
+
+void tcg_gen_vec_or(TCGType type, TCGv_ptr base, tcg_target_long dofs,
+                    tcg_target_long aofs, tcg_target_long bofs)
+{
+    tcg_gen_vec_op(INDEX_op_or_vec, type, MO_64, base, dofs, aofs, bofs);
+}
+
+void tcg_gen_vec_xor(TCGType type, TCGv_ptr base, tcg_target_long dofs,
+                     tcg_target_long aofs, tcg_target_long bofs)
+{
+    tcg_gen_vec_op(INDEX_op_xor_vec, type, MO_64, base, dofs, aofs, bofs);
+}
+
+void tcg_gen_vec_andc(TCGType type, TCGv_ptr base, tcg_target_long dofs,
+                      tcg_target_long aofs, tcg_target_long bofs)
+{
+    tcg_gen_vec_op(INDEX_op_andc_vec, type, MO_64, base, dofs, aofs, bofs);
+}
+
 static void tcg_reg_alloc_start(TCGContext *s)
 {
     int i;
@@ -1029,6 +1471,9 @@ static void tcg_reg_alloc_start(TCGContext *s)
         ts->mem_allocated = 0;
         ts->fixed_reg = 0;
     }
+    for(i = 0; i < s->nb_temps; i++) {
+        s->temps[i].next_use = TCG_NO_NEXT_USE;
+    }
     for(i = 0; i < TCG_TARGET_NB_REGS; i++) {
         s->reg_to_temp[i] = -1;
     }
@@ -1380,6 +1825,18 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs)
 #endif
 }
 
+/* No next use and no preferred register for any argument, until the
+   liveness analysis finds out.  */
+static void tcg_alloc_param_uses(TCGContext *s)
+{
+    int nb_params = s->gen_opparam_ptr - s->gen_opparam_buf;
+
+    s->param_next_use = tcg_malloc(nb_params * sizeof(uint16_t));
+    memset(s->param_next_use, 0xff, nb_params * sizeof(uint16_t));
+    s->param_pref = tcg_malloc(nb_params * sizeof(TCGRegSet));
+    memset(s->param_pref, 0, nb_params * sizeof(TCGRegSet));
+}
+
 #ifdef USE_LIVENESS_ANALYSIS
 
 /* set a nop for an operation using 'nb_args' */
@@ -1419,6 +1876,89 @@ static inline void tcg_la_bb_end(TCGContext *s, uint8_t *dead_temps,
     }
 }
 
+/* liveness analysis: end of basic block at a label or a branch to one.
+   A basic block loads globals and local temps from memory, so they need
+   to be in memory at its start only if they are live there or needed in
+   memory later on, that is unless every path from there writes them
+   before reading them.  LABEL_MEM keeps this for each label that the
+   backward walk went through, for the branches to it; a branch to a
+   label not seen yet goes backward and falls back to tcg_la_bb_end.  */
+static void tcg_la_label_end(TCGContext *s, TCGOpcode op, const TCGArg *args,
+                             uint8_t *dead_temps, uint8_t *mem_temps,
+                             uint8_t **label_mem)
+{
+    const uint8_t *target;
+    int i;
+
+    /* the requirement of the code that follows */
+    for (i = 0; i < s->nb_temps; i++) {
+        if (i < s->nb_globals || s->temps[i].temp_local) {
+            mem_temps[i] |= !dead_temps[i];
+        }
+    }
+
+    switch (op) {
+    case INDEX_op_set_label:
+        label_mem[args[0]] = tcg_malloc(s->nb_temps);
+        memcpy(label_mem[args[0]], mem_temps, s->nb_temps);
+        break;
+    case INDEX_op_br:
+        target = label_mem[args[0]];
+        if (!target) {
+            goto bb_end;
+        }
+        memcpy(mem_temps, target, s->nb_temps);
+        break;
+    case INDEX_op_brcond_i32:
+    case INDEX_op_brcond_i64:
+    case INDEX_op_brcond2_i32:
+        target = label_mem[args[tcg_op_defs[op].nb_args - 1]];
+        if (!target) {
+            goto bb_end;
+        }
+        for (i = 0; i < s->nb_temps; i++) {
+            mem_temps[i] |= target[i];
+        }
+        break;
+    default:
+    bb_end:
+        tcg_la_bb_end(s, dead_temps, mem_temps);
+        return;
+    }
+    memset(dead_temps, 1, s->nb_temps);
+}
+
+/* liveness analysis: record in param_next_use and param_pref, for the
+   NB_ARGS temp arguments at ARGS, when the temp is read next and where
+   it would best be until then, as found in NEXT_USE and PREF.  */
+static inline void tcg_la_record_uses(TCGContext *s, const TCGArg *args,
+                                      int nb_args, const uint16_t *next_use,
+                                      const TCGRegSet *pref)
+{
+    int i, idx = args - s->gen_opparam_buf;
+
+    for (i = 0; i < nb_args; i++) {
+        if (args[i] != TCG_CALL_DUMMY_ARG) {
+            s->param_next_use[idx + i] = next_use[args[i]];
+            s->param_pref[idx + i] = pref[args[i]];
+        }
+    }
+}
+
+/* liveness analysis: a temp live across a call would best be in a
+   register that the call preserves */
+static inline void tcg_la_call_clobber(TCGContext *s, const uint16_t *next_use,
+                                       TCGRegSet *pref)
+{
+    int i;
+
+    for (i = 0; i < s->nb_temps; i++) {
+        if (next_use[i] != TCG_NO_NEXT_USE) {
+            pref[i] &= ~tcg_target_call_clobber_regs;
+        }
+    }
+}
+
 /* Liveness analysis : update the opc_dead_args array to tell if a
    given input arguments is dead. Instructions updating dead
    temporaries are removed. */
@@ -1429,6 +1969,9 @@ static void tcg_liveness_analysis(TCGContext *s)
     TCGArg *args, arg;
     const TCGOpDef *def;
     uint8_t *dead_temps, *mem_temps;
+    uint8_t **label_mem;
+    uint16_t *next_use;
+    TCGRegSet *pref;
     uint16_t dead_args;
     uint8_t sync_args;
     bool have_op_new2;
@@ -1439,10 +1982,19 @@ static void tcg_liveness_analysis(TCGContext *s)
 
     s->op_dead_args = tcg_malloc(nb_ops * sizeof(uint16_t));
     s->op_sync_args = tcg_malloc(nb_ops * sizeof(uint8_t));
-    
+    tcg_alloc_param_uses(s);
+
+    /* next reads in the same basic block */
+    next_use = tcg_malloc(s->nb_temps * sizeof(uint16_t));
+    memset(next_use, 0xff, s->nb_temps * sizeof(uint16_t));
+    pref = tcg_malloc(s->nb_temps * sizeof(TCGRegSet));
+    memset(pref, 0, s->nb_temps * sizeof(TCGRegSet));
+
     dead_temps = tcg_malloc(s->nb_temps);
     mem_temps = tcg_malloc(s->nb_temps);
     tcg_la_func_end(s, dead_temps, mem_temps);
+    label_mem = tcg_malloc(s->nb_labels * sizeof(uint8_t *));
+    memset(label_mem, 0, s->nb_labels * sizeof(uint8_t *));
 
     args = s->gen_opparam_ptr;
     op_index = nb_ops - 1;
@@ -1474,6 +2026,8 @@ static void tcg_liveness_analysis(TCGContext *s)
                                 args - 1, nb_args);
                 } else {
                 do_not_remove_call:
+                    tcg_la_record_uses(s, args, nb_oargs + nb_iargs,
+                                       next_use, pref);
 
                     /* output args are dead */
                     dead_args = 0;
@@ -1488,7 +2042,9 @@ static void tcg_liveness_analysis(TCGContext *s)
                         }
                         dead_temps[arg] = 1;
                         mem_temps[arg] = 0;
+                        next_use[arg] = TCG_NO_NEXT_USE;
                     }
+                    tcg_la_call_clobber(s, next_use, pref);
 
                     if (!(call_flags & TCG_CALL_NO_READ_GLOBALS)) {
                         /* globals should be synced to memory */
@@ -1504,10 +2060,20 @@ static void tcg_liveness_analysis(TCGContext *s)
                     for (i = nb_oargs; i < nb_iargs + nb_oargs; i++) {
                         arg = args[i];
                         if (arg != TCG_CALL_DUMMY_ARG) {
+                            /* a value still needed after the call
+                               keeps to the preserved registers, others
+                               head for their argument register */
                             if (dead_temps[arg]) {
                                 dead_args |= (1 << i);
+                                pref[arg] = 0;
+                                if (i - nb_oargs
+                                    < ARRAY_SIZE(tcg_target_call_iarg_regs)) {
+                                    tcg_regset_set_reg(pref[arg],
+                                        tcg_target_call_iarg_regs[i - nb_oargs]);
+                                }
                             }
                             dead_temps[arg] = 0;
+                            next_use[arg] = op_index;
                         }
                     }
                     s->op_dead_args[op_index] = dead_args;
@@ -1528,6 +2094,7 @@ static void tcg_liveness_analysis(TCGContext *s)
             /* mark the temporary as dead */
             dead_temps[args[0]] = 1;
             mem_temps[args[0]] = 0;
+            next_use[args[0]] = TCG_NO_NEXT_USE;
             break;
         case INDEX_op_end:
             break;
@@ -1639,6 +2206,8 @@ static void tcg_liveness_analysis(TCGContext *s)
 #endif
             } else {
             do_not_remove:
+                tcg_la_record_uses(s, args, nb_oargs + nb_iargs,
+                                   next_use, pref);
 
                 /* output args are dead */
                 dead_args = 0;
@@ -1653,15 +2222,22 @@ static void tcg_liveness_analysis(TCGContext *s)
                     }
                     dead_temps[arg] = 1;
                     mem_temps[arg] = 0;
+                    next_use[arg] = TCG_NO_NEXT_USE;
                 }
 
                 /* if end of basic block, update */
                 if (def->flags & TCG_OPF_BB_END) {
-                    tcg_la_bb_end(s, dead_temps, mem_temps);
+                    tcg_la_label_end(s, op, args, dead_temps, mem_temps,
+                                     label_mem);
+                    memset(next_use, 0xff, s->nb_temps * sizeof(uint16_t));
+                    memset(pref, 0, s->nb_temps * sizeof(TCGRegSet));
                 } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
                     /* globals should be synced to memory */
                     memset(mem_temps, 1, s->nb_globals);
                 }
+                if (def->flags & TCG_OPF_CALL_CLOBBER) {
+                    tcg_la_call_clobber(s, next_use, pref);
+                }
 
                 /* input args are live */
                 for(i = nb_oargs; i < nb_oargs + nb_iargs; i++) {
@@ -1670,6 +2246,8 @@ static void tcg_liveness_analysis(TCGContext *s)
                         dead_args |= (1 << i);
                     }
                     dead_temps[arg] = 0;
+                    next_use[arg] = op_index;
+                    pref[arg] = def->args_ct[i].u.regs;
                 }
                 s->op_dead_args[op_index] = dead_args;
                 s->op_sync_args[op_index] = sync_args;
@@ -1694,6 +2272,7 @@ static void tcg_liveness_analysis(TCGContext *s)
     memset(s->op_dead_args, 0, nb_ops * sizeof(uint16_t));
     s->op_sync_args = tcg_malloc(nb_ops * sizeof(uint8_t));
     memset(s->op_sync_args, 0, nb_ops * sizeof(uint8_t));
+    tcg_alloc_param_uses(s);
 }
 #endif
 
@@ -1821,33 +2400,98 @@ static void tcg_reg_free(TCGContext *s, int reg)
     }
 }
 
-/* Allocate a register belonging to reg1 & ~reg2 */
-static int tcg_reg_alloc(TCGContext *s, TCGRegSet reg1, TCGRegSet reg2)
+/* Allocate a register belonging to reg1 & ~reg2, if possible one of
+   PREFERRED */
+static int tcg_reg_alloc(TCGContext *s, TCGRegSet reg1, TCGRegSet reg2,
+                         TCGRegSet preferred)
 {
-    int i, reg;
-    TCGRegSet reg_ct;
+    int i, reg, best_reg, best_use, use;
+    bool best_coherent, coherent;
+    TCGRegSet reg_ct, reg_pref;
+    TCGTemp *ts;
 
     tcg_regset_andnot(reg_ct, reg1, reg2);
-
-    /* first try free registers */
+    reg_pref = reg_ct & preferred;
+
+    /* first try free registers, preferred ones first */
+    if (reg_pref) {
+        for (i = 0; i < ARRAY_SIZE(tcg_target_reg_alloc_order); i++) {
+            reg = tcg_target_reg_alloc_order[i];
+            if (tcg_regset_test_reg(reg_pref, reg)
+                && s->reg_to_temp[reg] == -1) {
+                return reg;
+            }
+        }
+    }
     for(i = 0; i < ARRAY_SIZE(tcg_target_reg_alloc_order); i++) {
         reg = tcg_target_reg_alloc_order[i];
         if (tcg_regset_test_reg(reg_ct, reg) && s->reg_to_temp[reg] == -1)
             return reg;
     }
 
-    /* XXX: do better spill choice */
+    /* then spill the register whose value is read last in the basic
+       block, if at all, and among those one which needs no store */
+    best_reg = -1;
+    best_use = -1;
+    best_coherent = false;
     for(i = 0; i < ARRAY_SIZE(tcg_target_reg_alloc_order); i++) {
         reg = tcg_target_reg_alloc_order[i];
-        if (tcg_regset_test_reg(reg_ct, reg)) {
-            tcg_reg_free(s, reg);
-            return reg;
+        if (tcg_regset_test_reg(reg_ct, reg) && s->reg_to_temp[reg] >= 0) {
+            ts = &s->temps[s->reg_to_temp[reg]];
+            use = ts->next_use;
+            coherent = ts->mem_coherent;
+            if (use > best_use || (use == best_use && coherent
+                                   && !best_coherent)) {
+                best_reg = reg;
+                best_use = use;
+                best_coherent = coherent;
+            }
         }
     }
+    if (best_reg >= 0) {
+#ifdef CONFIG_PROFILER
+        s->evict_count++;
+        s->spill_count += !best_coherent;
+#endif
+        tcg_reg_free(s, best_reg);
+        return best_reg;
+    }
 
     tcg_abort();
 }
 
+/* The registers where the temp argument at ARGS would best be until its
+   next use, see TCGContext::param_pref.  */
+static inline TCGRegSet tcg_arg_pref(TCGContext *s, const TCGArg *args)
+{
+    return s->param_pref[args - s->gen_opparam_buf];
+}
+
+/* Update the next use of the temps read or written by the operation at
+   ARGS, as the allocator reaches it.  */
+static void tcg_reg_alloc_uses(TCGContext *s, TCGOpcode opc,
+                               const TCGArg *args)
+{
+    const TCGOpDef *def = &tcg_op_defs[opc];
+    const uint16_t *next_use;
+    int i, nb_args;
+
+    if (opc == INDEX_op_call) {
+        nb_args = (args[0] >> 16) + (args[0] & 0xffff);
+        args++;
+    } else if (opc == INDEX_op_nopn) {
+        return;
+    } else {
+        nb_args = def->nb_oargs + def->nb_iargs;
+    }
+    next_use = s->param_next_use + (args - s->gen_opparam_buf);
+    for (i = 0; i < nb_args; i++) {
+        if (args[i] != TCG_CALL_DUMMY_ARG) {
+            s->temps[args[i]].next_use = next_use[i];
+        }
+    }
+}
+
 /* mark a temporary as dead. */
 static inline void temp_dead(TCGContext *s, int temp)
 {
@@ -1877,7 +2521,7 @@ static inline void temp_sync(TCGContext *s, int temp, TCGRegSet allocated_regs)
         switch(ts->val_type) {
         case TEMP_VAL_CONST:
             ts->reg = tcg_reg_alloc(s, tcg_target_available_regs[ts->type],
-                                    allocated_regs);
+                                    allocated_regs, 0);
             ts->val_type = TEMP_VAL_REG;
             s->reg_to_temp[ts->reg] = temp;
             ts->mem_coherent = 0;
@@ -2017,7 +2661,7 @@ static void tcg_reg_alloc_mov(TCGContext *s, const TCGOpDef *def,
     if (((NEED_SYNC_ARG(0) || ots->fixed_reg) && ts->val_type != TEMP_VAL_REG)
         || ts->val_type == TEMP_VAL_MEM) {
         ts->reg = tcg_reg_alloc(s, tcg_target_available_regs[itype],
-                                allocated_regs);
+                                allocated_regs, tcg_arg_pref(s, &args[1]));
         if (ts->val_type == TEMP_VAL_MEM) {
             tcg_out_ld(s, itype, ts->reg, ts->mem_reg, ts->mem_offset);
             ts->mem_coherent = 1;
@@ -2066,7 +2710,8 @@ static void tcg_reg_alloc_mov(TCGContext *s, const TCGOpDef *def,
                    input one. */
                 tcg_regset_set_reg(allocated_regs, ts->reg);
                 ots->reg = tcg_reg_alloc(s, tcg_target_available_regs[otype],
-                                         allocated_regs);
+                                         allocated_regs,
+                                         tcg_arg_pref(s, &args[0]));
             }
             tcg_out_mov(s, otype, ots->reg, ts->reg);
         }
@@ -2108,7 +2753,8 @@ static void tcg_reg_alloc_op(TCGContext *s,
         arg_ct = &def->args_ct[i];
         ts = &s->temps[arg];
         if (ts->val_type == TEMP_VAL_MEM) {
-            reg = tcg_reg_alloc(s, arg_ct->u.regs, allocated_regs);
+            reg = tcg_reg_alloc(s, arg_ct->u.regs, allocated_regs,
+                                tcg_arg_pref(s, &args[i]));
             tcg_out_ld(s, ts->type, reg, ts->mem_reg, ts->mem_offset);
             ts->val_type = TEMP_VAL_REG;
             ts->reg = reg;
@@ -2122,7 +2768,8 @@ static void tcg_reg_alloc_op(TCGContext *s,
                 goto iarg_end;
             } else {
                 /* need to move to a register */
-                reg = tcg_reg_alloc(s, arg_ct->u.regs, allocated_regs);
+                reg = tcg_reg_alloc(s, arg_ct->u.regs, allocated_regs,
+                                    tcg_arg_pref(s, &args[i]));
                 tcg_out_movi(s, ts->type, reg, ts->val);
                 ts->val_type = TEMP_VAL_REG;
                 ts->reg = reg;
@@ -2153,7 +2800,7 @@ static void tcg_reg_alloc_op(TCGContext *s,
         allocate_in_reg:
             /* allocate a new register matching the constraint 
                and move the temporary register into it */
-            reg = tcg_reg_alloc(s, arg_ct->u.regs, allocated_regs);
+            reg = tcg_reg_alloc(s, arg_ct->u.regs, allocated_regs, 0);
             tcg_out_mov(s, ts->type, reg, ts->reg);
         }
         new_args[i] = reg;
@@ -2202,7 +2849,8 @@ static void tcg_reg_alloc_op(TCGContext *s,
                     tcg_regset_test_reg(arg_ct->u.regs, reg)) {
                     goto oarg_end;
                 }
-                reg = tcg_reg_alloc(s, arg_ct->u.regs, allocated_regs);
+                reg = tcg_reg_alloc(s, arg_ct->u.regs, allocated_regs,
+                                    tcg_arg_pref(s, &args[i]));
             }
             tcg_regset_set_reg(allocated_regs, reg);
             /* if a fixed register is used, then a move will be done afterwards */
@@ -2297,13 +2945,13 @@ static int tcg_reg_alloc_call(TCGContext *s, const TCGOpDef *def,
                 tcg_out_st(s, ts->type, ts->reg, TCG_REG_CALL_STACK, stack_offset);
             } else if (ts->val_type == TEMP_VAL_MEM) {
                 reg = tcg_reg_alloc(s, tcg_target_available_regs[ts->type], 
-                                    s->reserved_regs);
+                                    s->reserved_regs, 0);
                 /* XXX: not correct if reading values from the stack */
                 tcg_out_ld(s, ts->type, reg, ts->mem_reg, ts->mem_offset);
                 tcg_out_st(s, ts->type, reg, TCG_REG_CALL_STACK, stack_offset);
             } else if (ts->val_type == TEMP_VAL_CONST) {
                 reg = tcg_reg_alloc(s, tcg_target_available_regs[ts->type], 
-                                    s->reserved_regs);
+                                    s->reserved_regs, 0);
                 /* XXX: sign extend may be needed on some targets */
                 tcg_out_movi(s, ts->type, reg, ts->val);
                 tcg_out_st(s, ts->type, reg, TCG_REG_CALL_STACK, stack_offset);
@@ -2323,7 +2971,9 @@ static int tcg_reg_alloc_call(TCGContext *s, const TCGOpDef *def,
         if (arg != TCG_CALL_DUMMY_ARG) {
             ts = &s->temps[arg];
             reg = tcg_target_call_iarg_regs[i];
-            tcg_reg_free(s, reg);
+            if (ts->val_type != TEMP_VAL_REG || ts->reg != reg) {
+                tcg_reg_free(s, reg);
+            }
             if (ts->val_type == TEMP_VAL_REG) {
                 if (ts->reg != reg) {
                     tcg_out_mov(s, ts->type, reg, ts->reg);
@@ -2400,13 +3050,53 @@ static int tcg_reg_alloc_call(TCGContext *s, const TCGOpDef *def,
 #ifdef CONFIG_PROFILER
 
 static int64_t tcg_table_op_count[NB_OPS];
+static int64_t tcg_table_op_bytes[NB_OPS];
+static int64_t tcg_table_op_insns[NB_OPS];
 
 static void dump_op_count(void)
 {
     int i;
 
+    qemu_log("%-20s %12s %12s %8s %12s %8s\n", "op", "count",
+             "host bytes", "bytes/op", "host insns", "insns/op");
     for(i = INDEX_op_end; i < NB_OPS; i++) {
-        qemu_log("%s %" PRId64 "\n", tcg_op_defs[i].name, tcg_table_op_count[i]);
+        qemu_log("%-20s %12" PRId64 " %12" PRId64 " %8.1f %12" PRId64
+                 " %8.2f\n",
+                 tcg_op_defs[i].name, tcg_table_op_count[i],
+                 tcg_table_op_bytes[i],
+                 tcg_table_op_count[i] ?
+                 (double)tcg_table_op_bytes[i] / tcg_table_op_count[i] : 0,
+                 tcg_table_op_insns[i],
+                 tcg_table_op_count[i] ?
+                 (double)tcg_table_op_insns[i] / tcg_table_op_count[i] : 0);
+    }
+}
+
+/* Count the host instructions of the code just generated, in total and
+   for each op, by running the host disassembler over it.  This is slow,
+   so it is kept out of code_time.  */
+void tcg_profile_host_insns(TCGContext *s, int guest_insns)
+{
+    int i, n;
+
+    s->guest_insn_count += guest_insns;
+    if (s->host_insn_count < 0) {
+        return;
+    }
+    n = disas_host_insn_count(s->code_buf, tcg_current_code_size(s));
+    if (n < 0) {
+        s->host_insn_count = -1;
+        return;
+    }
+    s->host_insn_count += n;
+
+    /* the op_end entry holds the end of the code of the last op */
+    for (i = 0; s->gen_opc_buf[i] != INDEX_op_end; i++) {
+        uint32_t off = s->gen_opc_code_off[i];
+
+        tcg_table_op_insns[s->gen_opc_buf[i]] +=
+            disas_host_insn_count(s->code_buf + off,
+                                  s->gen_opc_code_off[i + 1] - off);
     }
 }
 #endif
@@ -2469,10 +3159,12 @@ static inline int tcg_gen_code_common(TCGContext *s,
 
     for(;;) {
         opc = s->gen_opc_buf[op_index];
+        s->gen_opc_code_off[op_index] = tcg_current_code_size(s);
 #ifdef CONFIG_PROFILER
         tcg_table_op_count[opc]++;
 #endif
         def = &tcg_op_defs[opc];
+        tcg_reg_alloc_uses(s, opc, args);
 #if 0
         printf("%s: %d %d %d\n", def->name,
                def->nb_oargs, def->nb_iargs, def->nb_cargs);
@@ -2528,6 +3220,10 @@ static inline int tcg_gen_code_common(TCGContext *s,
         }
         args += def->nb_args;
     next:
+#ifdef CONFIG_PROFILER
+        tcg_table_op_bytes[opc] += tcg_current_code_size(s)
+                                   - s->gen_opc_code_off[op_index];
+#endif
         if (search_pc >= 0 && search_pc < tcg_current_code_size(s)) {
             return op_index;
         }
@@ -2576,6 +3272,51 @@ int tcg_gen_code_search_pc(TCGContext *s, tcg_insn_unit *gen_code_buf,
     return tcg_gen_code_common(s, gen_code_buf, offset);
 }
 
+/* Emit again the instruction described by R, at the same offset in the
+   code starting at CODE, with VALUE as its operand.  Returns false if the
+   instruction would now have a different length; the code at CODE must
+   then be generated from scratch.  */
+bool tcg_code_reloc_apply(TCGContext *s, void *code, const TCGCodeReloc *r,
+                          intptr_t value)
+{
+#ifdef TCG_TARGET_CODE_RELOCS
+    tcg_insn_unit *save_buf = s->code_buf;
+    tcg_insn_unit *save_ptr = s->code_ptr;
+    TCGCodeReloc *save_relocs = s->code_relocs;
+    uint8_t *start = (uint8_t *)code + r->offset;
+    bool ok;
+
+    s->code_relocs = NULL;
+    s->code_buf = code;
+    s->code_ptr = (tcg_insn_unit *)start;
+    tcg_out_code_reloc(s, r, value);
+    ok = (uint8_t *)s->code_ptr - start == r->len;
+
+    s->code_buf = save_buf;
+    s->code_ptr = save_ptr;
+    s->code_relocs = save_relocs;
+    return ok;
+#else
+    return false;
+#endif
+}
+
+/* Return the number of parameters of the op OPC, whose parameters start
+   at ARGS.  */
+int tcg_op_nb_params(TCGOpcode opc, const TCGArg *args)
+{
+    const TCGOpDef *def = &tcg_op_defs[opc];
+
+    switch (opc) {
+    case INDEX_op_call:
+        return 1 + (args[0] >> 16) + (args[0] & 0xffff) + def->nb_cargs;
+    case INDEX_op_nopn:
+        return args[0];
+    default:
+        return def->nb_args;
+    }
+}
+
 #ifdef CONFIG_PROFILER
 void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf)
 {
@@ -2598,7 +3339,20 @@ void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf)
                 s->tb_count ? 
                 (double)s->temp_count / s->tb_count : 0,
                 s->temp_count_max);
-    
+    cpu_fprintf(f, "reg evictions/TB    %0.2f (spills=%0.2f)\n",
+                s->tb_count ? (double)s->evict_count / s->tb_count : 0,
+                s->tb_count ? (double)s->spill_count / s->tb_count : 0);
+    cpu_fprintf(f, "host bytes/op       %0.1f\n",
+                s->op_count ? (double)s->code_out_len / s->op_count : 0);
+    if (s->host_insn_count >= 0) {
+        cpu_fprintf(f, "host insns/op       %0.2f\n",
+                    s->op_count ? (double)s->host_insn_count / s->op_count
+                                : 0);
+        cpu_fprintf(f, "host insns/guest insn %0.2f\n",
+                    s->guest_insn_count ?
+                    (double)s->host_insn_count / s->guest_insn_count : 0);
+    }
+
     cpu_fprintf(f, "cycles/op           %0.1f\n", 
                 s->op_count ? (double)tot / s->op_count : 0);
     cpu_fprintf(f, "cycles/in byte      %0.1f\n", 
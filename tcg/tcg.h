@@ -27,6 +27,7 @@
 
 #include "qemu-common.h"
 #include "qemu/bitops.h"
+#include "qemu/tls.h"
 #include "tcg-target.h"
 
 /* Default target word size to pointer size.  */
@@ -187,6 +188,9 @@ typedef struct TCGPool {
 
 #define TCG_MAX_TEMPS 512
 
+/* see TCGTemp::next_use */
+#define TCG_NO_NEXT_USE 0xffff
+
 /* when the size of the arguments of a called function is smaller than
    this value, they are statically allocated in the TB stack frame */
 #define TCG_STATIC_CALL_ARGS_SIZE 128
@@ -216,8 +220,16 @@ typedef enum TCGType {
 #else
     TCG_TYPE_TL = TCG_TYPE_I32,
 #endif
+
+    /* Vector types.  These only describe the memory operands of the
+       *_vec ops; there are no temps of these types.  */
+    TCG_TYPE_V64 = TCG_TYPE_COUNT,
+    TCG_TYPE_V128,
 } TCGType;
 
+/* Size in bytes of a vector type.  */
+#define TCG_TYPE_VEC_SIZE(type) ((type) == TCG_TYPE_V64 ? 8 : 16)
+
 /* Constants for qemu_ld and qemu_st for the Memory Operation field.  */
 typedef enum TCGMemOp {
     MO_8     = 0,
@@ -439,11 +451,37 @@ typedef struct TCGTemp {
                                   basic blocks. Otherwise, it is not
                                   preserved across basic blocks. */
     unsigned int temp_allocated:1; /* never used for code gen */
+    /* index of the next operation reading the temp in the current basic
+       block, or TCG_NO_NEXT_USE; kept up to date by the allocator */
+    int next_use;
     const char *name;
 } TCGTemp;
 
 typedef struct TCGContext TCGContext;
 
+/* An instruction whose encoding depends on where the code is placed or on
+   a host address, logged so that a TB can be moved to another location or
+   another process.  The instruction is re-emitted by tcg_code_reloc_apply
+   with a new operand.  */
+enum {
+    TCG_CODE_RELOC_MOVI,        /* constant whose encoding is pc-relative */
+    TCG_CODE_RELOC_EXIT_TB,     /* exit_tb value, a TB pointer */
+    TCG_CODE_RELOC_CALL,        /* call to a helper */
+    TCG_CODE_RELOC_JMP,         /* jump to host code outside the TB */
+    TCG_CODE_RELOC_EPILOGUE,    /* jump to the epilogue */
+};
+
+typedef struct TCGCodeReloc {
+    uint32_t offset;
+    uint8_t len;
+    uint8_t kind;
+    uint8_t type;
+    uint8_t reg;
+    int64_t value;
+} TCGCodeReloc;
+
+#define TCG_MAX_CODE_RELOCS 512
+
 typedef struct TCGTempSet {
     unsigned long l[BITS_TO_LONGS(TCG_MAX_TEMPS)];
 } TCGTempSet;
@@ -462,12 +500,37 @@ struct TCGContext {
     uint16_t *tb_next_offset;
     uint16_t *tb_jmp_offset; /* != NULL if USE_DIRECT_JUMP */
 
+    /* log of position-dependent instructions, only kept when code_relocs
+       is not NULL (see linux-user/tbcache.c) */
+    TCGCodeReloc *code_relocs;
+    int nb_code_relocs;
+    /* the TB embeds host pointers or too many relocations to be moved */
+    bool code_uncacheable;
+
+    /* index of the TB being translated in a trace (see TBTrace); only
+       the first one checks for exit requests */
+    int trace_member;
+
+    /* exit request and instruction count checks of the TB being
+       translated (see gen-icount.h) */
+    TCGArg *icount_arg;
+    int icount_label;
+    int exitreq_label;
+
     /* liveness analysis */
     uint16_t *op_dead_args; /* for each operation, each bit tells if the
                                corresponding argument is dead */
     uint8_t *op_sync_args;  /* for each operation, each bit tells if the
                                corresponding output argument needs to be
                                sync to memory. */
+    uint16_t *param_next_use; /* for each temp argument, indexed like
+                                 gen_opparam_buf, the index of the next
+                                 operation reading the temp in the same
+                                 basic block, or TCG_NO_NEXT_USE */
+    TCGRegSet *param_pref;  /* for the same arguments, the registers where
+                               the temp would best be until then (none
+                               if 0): the argument register of a call,
+                               or a call-saved one across a call */
     
     /* tells in which temporary a given register is. It does not take
        into account fixed registers */
@@ -482,6 +545,10 @@ struct TCGContext {
     TCGTemp temps[TCG_MAX_TEMPS]; /* globals first, temps after */
     TCGTempSet free_temps[TCG_TYPE_COUNT * 2];
 
+    /* the env global of the front end, for the helpers that the
+       generic expansions (e.g. atomic operations) call */
+    TCGv_ptr tcg_env;
+
     GHashTable *helpers;
 
 #ifdef CONFIG_PROFILER
@@ -493,8 +560,12 @@ struct TCGContext {
     int64_t temp_count;
     int temp_count_max;
     int64_t del_op_count;
+    int64_t spill_count; /* registers evicted with a store */
+    int64_t evict_count; /* registers evicted */
     int64_t code_in_len;
     int64_t code_out_len;
+    int64_t guest_insn_count;
+    int64_t host_insn_count;  /* -1 without a host disassembler */
     int64_t interm_time;
     int64_t code_time;
     int64_t la_time;
@@ -516,6 +587,9 @@ struct TCGContext {
     target_ulong gen_opc_pc[OPC_BUF_SIZE];
     uint16_t gen_opc_icount[OPC_BUF_SIZE];
     uint8_t gen_opc_instr_start[OPC_BUF_SIZE];
+    target_ulong gen_opc_data[TCG_MAX_INSN_DATA][OPC_BUF_SIZE];
+    /* offset of the host code of each op, filled in by tcg_gen_code() */
+    uint32_t gen_opc_code_off[OPC_BUF_SIZE];
 
     /* Code generation.  Note that we specifically do not use tcg_insn_unit
        here, because there's too much arithmetic throughout that relies
@@ -523,19 +597,33 @@ struct TCGContext {
        extension that allows arithmetic on void*.  */
     int code_gen_max_blocks;
     void *code_gen_prologue;
+    /* code in the prologue that returns 0 to cpu_exec, for goto_ptr
+       when there is no TB to go to; NULL if goto_ptr returns itself */
+    void *code_gen_epilogue;
     void *code_gen_buffer;
     size_t code_gen_buffer_size;
     /* threshold to flush the translated code buffer */
     size_t code_gen_buffer_max_size;
+    /* end of the code of the last TB translated in this context */
     void *code_gen_ptr;
 
-    TBContext tb_ctx;
+    /* code region that this context fills without holding tb_lock, and
+       the value of tb_ctx.code_write_gen when its last TB was started
+       (see tb_gen_code_parallel) */
+    struct TBRegion *region;
+    unsigned int region_write_gen;
 
     /* The TCGBackendData structure is private to tcg-target.c.  */
     struct TCGBackendData *be;
 };
 
-extern TCGContext tcg_ctx;
+extern TCGContext tcg_init_ctx;
+
+/* The translation context of the calling thread.  Guest threads of
+   linux-user translate in parallel, each in a copy of tcg_init_ctx (see
+   tcg_context_clone); everybody else shares tcg_init_ctx.  */
+DECLARE_TLS(TCGContext *, tcg_ctx_ptr);
+#define tcg_ctx (*tls_var(tcg_ctx_ptr))
 
 /* pool based memory allocation */
 
@@ -559,12 +647,21 @@ static inline void *tcg_malloc(int size)
 }
 
 void tcg_context_init(TCGContext *s);
+TCGContext *tcg_context_clone(TCGContext *s);
+void tcg_context_free(TCGContext *s);
 void tcg_prologue_init(TCGContext *s);
 void tcg_func_start(TCGContext *s);
 
 int tcg_gen_code(TCGContext *s, tcg_insn_unit *gen_code_buf);
 int tcg_gen_code_search_pc(TCGContext *s, tcg_insn_unit *gen_code_buf,
                            long offset);
+bool tcg_code_reloc_apply(TCGContext *s, void *code, const TCGCodeReloc *r,
+                          intptr_t value);
+int tcg_op_nb_params(TCGOpcode opc, const TCGArg *args);
+#ifdef TCG_TARGET_CODE_RELOCS
+/* host features that the generated code depends on */
+uint32_t tcg_target_code_features(void);
+#endif
 
 void tcg_set_frame(TCGContext *s, int reg, intptr_t start, intptr_t size);
 
@@ -610,6 +707,9 @@ int tcg_check_temp_count(void);
 #endif
 
 void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf);
+#ifdef CONFIG_PROFILER
+void tcg_profile_host_insns(TCGContext *s, int guest_insns);
+#endif
 
 #define TCG_CT_ALIAS  0x80
 #define TCG_CT_IALIAS 0x40
@@ -682,7 +782,9 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I32(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I32(GET_TCGV_PTR(n))
 
-#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i32((intptr_t)(V)))
+#define tcg_const_ptr(V) \
+    (tcg_ctx.code_uncacheable = true, \
+     TCGV_NAT_TO_PTR(tcg_const_i32((intptr_t)(V))))
 #define tcg_global_reg_new_ptr(R, N) \
     TCGV_NAT_TO_PTR(tcg_global_reg_new_i32((R), (N)))
 #define tcg_global_mem_new_ptr(R, O, N) \
@@ -693,7 +795,9 @@ void tcg_add_target_add_op_defs(const TCGTargetOpDef *tdefs);
 #define TCGV_NAT_TO_PTR(n) MAKE_TCGV_PTR(GET_TCGV_I64(n))
 #define TCGV_PTR_TO_NAT(n) MAKE_TCGV_I64(GET_TCGV_PTR(n))
 
-#define tcg_const_ptr(V) TCGV_NAT_TO_PTR(tcg_const_i64((intptr_t)(V)))
+#define tcg_const_ptr(V) \
+    (tcg_ctx.code_uncacheable = true, \
+     TCGV_NAT_TO_PTR(tcg_const_i64((intptr_t)(V))))
 #define tcg_global_reg_new_ptr(R, N) \
     TCGV_NAT_TO_PTR(tcg_global_reg_new_i64((R), (N)))
 #define tcg_global_mem_new_ptr(R, O, N) \
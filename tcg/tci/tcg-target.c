@@ -22,7 +22,21 @@
  * THE SOFTWARE.
  */
 
-#include "tcg-be-null.h"
+typedef struct TCGBackendData {
+    /* the last instruction written, which tci_out_op may fuse with the
+       next one */
+    tcg_insn_unit *last_insn;
+    TCIOpcode last_op;
+} TCGBackendData;
+
+static inline void tcg_out_tb_init(TCGContext *s)
+{
+    s->be->last_insn = NULL;
+}
+
+static inline void tcg_out_tb_finalize(TCGContext *s)
+{
+}
 
 /* TODO list:
  * - See TODO comments in code.
@@ -59,6 +73,7 @@
 static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_exit_tb, { NULL } },
     { INDEX_op_goto_tb, { NULL } },
+    { INDEX_op_goto_ptr, { R } },
     { INDEX_op_br, { NULL } },
 
     { INDEX_op_ld8u_i32, { R, R } },
@@ -70,9 +85,9 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_st16_i32, { R, R } },
     { INDEX_op_st_i32, { R, R } },
 
-    { INDEX_op_add_i32, { R, RI, RI } },
-    { INDEX_op_sub_i32, { R, RI, RI } },
-    { INDEX_op_mul_i32, { R, RI, RI } },
+    { INDEX_op_add_i32, { R, R, RI } },
+    { INDEX_op_sub_i32, { R, R, RI } },
+    { INDEX_op_mul_i32, { R, R, RI } },
 #if TCG_TARGET_HAS_div_i32
     { INDEX_op_div_i32, { R, R, R } },
     { INDEX_op_divu_i32, { R, R, R } },
@@ -82,32 +97,33 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_div2_i32, { R, R, "0", "1", R } },
     { INDEX_op_divu2_i32, { R, R, "0", "1", R } },
 #endif
-    /* TODO: Does R, RI, RI result in faster code than R, R, RI?
-       If both operands are constants, we can optimize. */
-    { INDEX_op_and_i32, { R, RI, RI } },
+    /* Only the second input may be a constant: each instruction of the
+       interpreter has one form with a register and one with a constant
+       there (see tci-opc.h).  */
+    { INDEX_op_and_i32, { R, R, RI } },
 #if TCG_TARGET_HAS_andc_i32
-    { INDEX_op_andc_i32, { R, RI, RI } },
+    { INDEX_op_andc_i32, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_eqv_i32
-    { INDEX_op_eqv_i32, { R, RI, RI } },
+    { INDEX_op_eqv_i32, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_nand_i32
-    { INDEX_op_nand_i32, { R, RI, RI } },
+    { INDEX_op_nand_i32, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_nor_i32
-    { INDEX_op_nor_i32, { R, RI, RI } },
+    { INDEX_op_nor_i32, { R, R, RI } },
 #endif
-    { INDEX_op_or_i32, { R, RI, RI } },
+    { INDEX_op_or_i32, { R, R, RI } },
 #if TCG_TARGET_HAS_orc_i32
-    { INDEX_op_orc_i32, { R, RI, RI } },
+    { INDEX_op_orc_i32, { R, R, RI } },
 #endif
-    { INDEX_op_xor_i32, { R, RI, RI } },
-    { INDEX_op_shl_i32, { R, RI, RI } },
-    { INDEX_op_shr_i32, { R, RI, RI } },
-    { INDEX_op_sar_i32, { R, RI, RI } },
+    { INDEX_op_xor_i32, { R, R, RI } },
+    { INDEX_op_shl_i32, { R, R, RI } },
+    { INDEX_op_shr_i32, { R, R, RI } },
+    { INDEX_op_sar_i32, { R, R, RI } },
 #if TCG_TARGET_HAS_rot_i32
-    { INDEX_op_rotl_i32, { R, RI, RI } },
-    { INDEX_op_rotr_i32, { R, RI, RI } },
+    { INDEX_op_rotl_i32, { R, R, RI } },
+    { INDEX_op_rotr_i32, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_deposit_i32
     { INDEX_op_deposit_i32, { R, "0", R } },
@@ -121,12 +137,11 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
 #endif /* TCG_TARGET_REG_BITS == 64 */
 
 #if TCG_TARGET_REG_BITS == 32
-    /* TODO: Support R, R, R, R, RI, RI? Will it be faster? */
     { INDEX_op_add2_i32, { R, R, R, R, R, R } },
     { INDEX_op_sub2_i32, { R, R, R, R, R, R } },
-    { INDEX_op_brcond2_i32, { R, R, RI, RI } },
+    { INDEX_op_brcond2_i32, { R, R, R, R } },
     { INDEX_op_mulu2_i32, { R, R, R, R } },
-    { INDEX_op_setcond2_i32, { R, R, R, RI, RI } },
+    { INDEX_op_setcond2_i32, { R, R, R, R, R } },
 #endif
 
 #if TCG_TARGET_HAS_not_i32
@@ -150,9 +165,9 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_st32_i64, { R, R } },
     { INDEX_op_st_i64, { R, R } },
 
-    { INDEX_op_add_i64, { R, RI, RI } },
-    { INDEX_op_sub_i64, { R, RI, RI } },
-    { INDEX_op_mul_i64, { R, RI, RI } },
+    { INDEX_op_add_i64, { R, R, RI } },
+    { INDEX_op_sub_i64, { R, R, RI } },
+    { INDEX_op_mul_i64, { R, R, RI } },
 #if TCG_TARGET_HAS_div_i64
     { INDEX_op_div_i64, { R, R, R } },
     { INDEX_op_divu_i64, { R, R, R } },
@@ -162,30 +177,30 @@ static const TCGTargetOpDef tcg_target_op_defs[] = {
     { INDEX_op_div2_i64, { R, R, "0", "1", R } },
     { INDEX_op_divu2_i64, { R, R, "0", "1", R } },
 #endif
-    { INDEX_op_and_i64, { R, RI, RI } },
+    { INDEX_op_and_i64, { R, R, RI } },
 #if TCG_TARGET_HAS_andc_i64
-    { INDEX_op_andc_i64, { R, RI, RI } },
+    { INDEX_op_andc_i64, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_eqv_i64
-    { INDEX_op_eqv_i64, { R, RI, RI } },
+    { INDEX_op_eqv_i64, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_nand_i64
-    { INDEX_op_nand_i64, { R, RI, RI } },
+    { INDEX_op_nand_i64, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_nor_i64
-    { INDEX_op_nor_i64, { R, RI, RI } },
+    { INDEX_op_nor_i64, { R, R, RI } },
 #endif
-    { INDEX_op_or_i64, { R, RI, RI } },
+    { INDEX_op_or_i64, { R, R, RI } },
 #if TCG_TARGET_HAS_orc_i64
-    { INDEX_op_orc_i64, { R, RI, RI } },
+    { INDEX_op_orc_i64, { R, R, RI } },
 #endif
-    { INDEX_op_xor_i64, { R, RI, RI } },
-    { INDEX_op_shl_i64, { R, RI, RI } },
-    { INDEX_op_shr_i64, { R, RI, RI } },
-    { INDEX_op_sar_i64, { R, RI, RI } },
+    { INDEX_op_xor_i64, { R, R, RI } },
+    { INDEX_op_shl_i64, { R, R, RI } },
+    { INDEX_op_shr_i64, { R, R, RI } },
+    { INDEX_op_sar_i64, { R, R, RI } },
 #if TCG_TARGET_HAS_rot_i64
-    { INDEX_op_rotl_i64, { R, RI, RI } },
-    { INDEX_op_rotr_i64, { R, RI, RI } },
+    { INDEX_op_rotl_i64, { R, R, RI } },
+    { INDEX_op_rotr_i64, { R, R, RI } },
 #endif
 #if TCG_TARGET_HAS_deposit_i64
     { INDEX_op_deposit_i64, { R, "0", R } },
@@ -407,156 +422,276 @@ static void tcg_out_i(TCGContext *s, tcg_target_ulong v)
     }
 }
 
-/* Write opcode. */
-static void tcg_out_op_t(TCGContext *s, TCGOpcode op)
+/* Pairs of instructions which have a handler running both. */
+static const struct {
+    TCIOpcode a, b, fused;
+} tci_fusions[] = {
+#define DEF(name, nconst)
+#define FUSE(a, b) { TCI_##a, TCI_##b, TCI_##a##__##b },
+#include "tci-opc.h"
+};
+
+/* Write the handler of OP and its N register bytes R.  If the previous
+   instruction ends here and has a handler fused with OP, switch it to
+   that handler.  The instruction written here stays complete, so that
+   jumps to it still work.  */
+static void tci_out_op(TCGContext *s, TCIOpcode op, const uint8_t *r, int n)
 {
-    tcg_out8(s, op);
-    tcg_out8(s, 0);
+    TCGBackendData *be = s->be;
+    uint8_t bytes[TCI_REG_BYTES] = { 0 };
+    int i;
+
+    if (be->last_insn &&
+        be->last_insn + TCI_INSN_WORDS(tci_op_nconst[be->last_op])
+                        * sizeof(tcg_target_ulong) == s->code_ptr) {
+        for (i = 0; i < ARRAY_SIZE(tci_fusions); i++) {
+            if (tci_fusions[i].a == be->last_op && tci_fusions[i].b == op) {
+                *(tcg_target_ulong *)be->last_insn =
+                    (uintptr_t)tci_handlers[tci_fusions[i].fused];
+                break;
+            }
+        }
+    }
+    be->last_insn = s->code_ptr;
+    be->last_op = op;
+
+    tcg_out_i(s, (uintptr_t)tci_handlers[op]);
+    assert(n <= TCI_REG_BYTES);
+    for (i = 0; i < n; i++) {
+        bytes[i] = r[i];
+    }
+    memcpy(s->code_ptr, bytes, TCI_REG_BYTES);
+    s->code_ptr += TCI_REG_BYTES;
 }
 
-/* Write register. */
-static void tcg_out_r(TCGContext *s, TCGArg t0)
+/* Write instruction OP with the register bytes given as arguments. */
+#define tci_out_r(s, op, ...) \
+    do { \
+        const uint8_t r_[] = { __VA_ARGS__ }; \
+        tci_out_op(s, op, r_, ARRAY_SIZE(r_)); \
+    } while (0)
+
+/* Write label. */
+static void tci_out_label(TCGContext *s, TCGArg arg)
 {
-    assert(t0 < TCG_TARGET_NB_REGS);
-    tcg_out8(s, t0);
+    TCGLabel *label = &s->labels[arg];
+    if (label->has_value) {
+        tcg_out_i(s, label->u.value);
+        assert(label->u.value);
+    } else {
+        tcg_out_reloc(s, s->code_ptr, sizeof(tcg_target_ulong), arg, 0);
+        s->code_ptr += sizeof(tcg_target_ulong);
+    }
 }
 
-/* Write register or constant (native size). */
-static void tcg_out_ri(TCGContext *s, int const_arg, TCGArg arg)
+/* Offset of condition COND in the instructions of DEF_COND. */
+static int tci_cond(TCGCond cond)
 {
-    if (const_arg) {
-        assert(const_arg == 1);
-        tcg_out8(s, TCG_CONST);
-        tcg_out_i(s, arg);
-    } else {
-        tcg_out_r(s, arg);
+    switch (cond) {
+    case TCG_COND_EQ:
+        return 0;
+    case TCG_COND_NE:
+        return 1;
+    case TCG_COND_LT:
+        return 2;
+    case TCG_COND_GE:
+        return 3;
+    case TCG_COND_LE:
+        return 4;
+    case TCG_COND_GT:
+        return 5;
+    case TCG_COND_LTU:
+        return 6;
+    case TCG_COND_GEU:
+        return 7;
+    case TCG_COND_LEU:
+        return 8;
+    case TCG_COND_GTU:
+        return 9;
+    default:
+        tcg_abort();
     }
 }
 
-/* Write register or constant (32 bit). */
-static void tcg_out_ri32(TCGContext *s, int const_arg, TCGArg arg)
+/* Write OP_rr, or OP_ri if the second input is a constant. */
+static void tci_out_binary(TCGContext *s, TCIOpcode op_rr, const TCGArg *args,
+                           const int *const_args)
 {
-    if (const_arg) {
-        assert(const_arg == 1);
-        tcg_out8(s, TCG_CONST);
-        tcg_out32(s, arg);
+    if (const_args[2]) {
+        tci_out_r(s, op_rr + 1, args[0], args[1]);
+        tcg_out_i(s, args[2]);
     } else {
-        tcg_out_r(s, arg);
+        tci_out_r(s, op_rr, args[0], args[1], args[2]);
     }
 }
 
-#if TCG_TARGET_REG_BITS == 64
-/* Write register or constant (64 bit). */
-static void tcg_out_ri64(TCGContext *s, int const_arg, TCGArg arg)
+/* Write a load or store of host memory. */
+static void tci_out_ldst(TCGContext *s, TCIOpcode op, TCGReg val,
+                         TCGReg base, intptr_t offset)
+{
+    tci_out_r(s, op, val, base);
+    tcg_out_i(s, offset);
+}
+
+/* Write brcond COND of A with B (OP_rr) or with constant B (OP_ri). */
+static void tci_out_brcond(TCGContext *s, TCIOpcode op_rr, TCIOpcode op_ri,
+                           TCGArg a, TCGArg b, int const_b, TCGCond cond,
+                           TCGArg label)
 {
-    if (const_arg) {
-        assert(const_arg == 1);
-        tcg_out8(s, TCG_CONST);
-        tcg_out64(s, arg);
+    if (const_b) {
+        tci_out_r(s, op_ri + tci_cond(cond), a);
+        tcg_out_i(s, b);
     } else {
-        tcg_out_r(s, arg);
+        tci_out_r(s, op_rr + tci_cond(cond), a, b);
     }
+    tci_out_label(s, label);
 }
-#endif
 
-/* Write label. */
-static void tci_out_label(TCGContext *s, TCGArg arg)
+static TCIOpcode tci_qemu_ld_op(TCGMemOp memop, bool is64)
 {
-    TCGLabel *label = &s->labels[arg];
-    if (label->has_value) {
-        tcg_out_i(s, label->u.value);
-        assert(label->u.value);
-    } else {
-        tcg_out_reloc(s, s->code_ptr, sizeof(tcg_target_ulong), arg, 0);
-        s->code_ptr += sizeof(tcg_target_ulong);
+    switch (memop) {
+    case MO_UB:
+        return is64 ? TCI_qemu_ld_i64_ub : TCI_qemu_ld_i32_ub;
+    case MO_SB:
+        return is64 ? TCI_qemu_ld_i64_sb : TCI_qemu_ld_i32_sb;
+    case MO_LEUW:
+        return is64 ? TCI_qemu_ld_i64_leuw : TCI_qemu_ld_i32_leuw;
+    case MO_LESW:
+        return is64 ? TCI_qemu_ld_i64_lesw : TCI_qemu_ld_i32_lesw;
+    case MO_LEUL:
+        return is64 ? TCI_qemu_ld_i64_leul : TCI_qemu_ld_i32_leul;
+    case MO_BEUW:
+        return is64 ? TCI_qemu_ld_i64_beuw : TCI_qemu_ld_i32_beuw;
+    case MO_BESW:
+        return is64 ? TCI_qemu_ld_i64_besw : TCI_qemu_ld_i32_besw;
+    case MO_BEUL:
+        return is64 ? TCI_qemu_ld_i64_beul : TCI_qemu_ld_i32_beul;
+    default:
+        break;
+    }
+    if (is64) {
+        switch (memop) {
+        case MO_LESL:
+            return TCI_qemu_ld_i64_lesl;
+        case MO_LEQ:
+            return TCI_qemu_ld_i64_leq;
+        case MO_BESL:
+            return TCI_qemu_ld_i64_besl;
+        case MO_BEQ:
+            return TCI_qemu_ld_i64_beq;
+        default:
+            break;
+        }
+    }
+    tcg_abort();
+}
+
+static TCIOpcode tci_qemu_st_op(TCGMemOp memop, bool is64)
+{
+    switch (memop) {
+    case MO_UB:
+        return is64 ? TCI_qemu_st_i64_b : TCI_qemu_st_i32_b;
+    case MO_LEUW:
+        return is64 ? TCI_qemu_st_i64_lew : TCI_qemu_st_i32_lew;
+    case MO_LEUL:
+        return is64 ? TCI_qemu_st_i64_lel : TCI_qemu_st_i32_lel;
+    case MO_BEUW:
+        return is64 ? TCI_qemu_st_i64_bew : TCI_qemu_st_i32_bew;
+    case MO_BEUL:
+        return is64 ? TCI_qemu_st_i64_bel : TCI_qemu_st_i32_bel;
+    case MO_LEQ:
+        if (is64) {
+            return TCI_qemu_st_i64_leq;
+        }
+        break;
+    case MO_BEQ:
+        if (is64) {
+            return TCI_qemu_st_i64_beq;
+        }
+        break;
+    default:
+        break;
     }
+    tcg_abort();
+}
+
+/* Write qemu_ld/st: the data and address registers, then the mmu index
+   in system emulation.  */
+static void tci_out_qemu_ldst(TCGContext *s, const TCGArg *args, bool is64,
+                              bool is_ld)
+{
+    int nb_regs = (is64 && TCG_TARGET_REG_BITS == 32 ? 2 : 1)
+                  + (TARGET_LONG_BITS > TCG_TARGET_REG_BITS ? 2 : 1);
+    uint8_t r[TCI_REG_BYTES];
+    TCGMemOp memop;
+    int i;
+
+    for (i = 0; i < nb_regs; i++) {
+        r[i] = args[i];
+    }
+    memop = args[nb_regs];
+#ifdef CONFIG_SOFTMMU
+    r[nb_regs] = args[nb_regs + 1];
+    nb_regs++;
+#endif
+    tci_out_op(s, is_ld ? tci_qemu_ld_op(memop, is64)
+                        : tci_qemu_st_op(memop, is64), r, nb_regs);
 }
 
 static void tcg_out_ld(TCGContext *s, TCGType type, TCGReg ret, TCGReg arg1,
                        intptr_t arg2)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
     if (type == TCG_TYPE_I32) {
-        tcg_out_op_t(s, INDEX_op_ld_i32);
-        tcg_out_r(s, ret);
-        tcg_out_r(s, arg1);
-        tcg_out32(s, arg2);
+        tci_out_ldst(s, TCI_ld32u, ret, arg1, arg2);
     } else {
         assert(type == TCG_TYPE_I64);
 #if TCG_TARGET_REG_BITS == 64
-        tcg_out_op_t(s, INDEX_op_ld_i64);
-        tcg_out_r(s, ret);
-        tcg_out_r(s, arg1);
-        assert(arg2 == (int32_t)arg2);
-        tcg_out32(s, arg2);
+        tci_out_ldst(s, TCI_ld_i64, ret, arg1, arg2);
 #else
         TODO();
 #endif
     }
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
 }
 
 static void tcg_out_mov(TCGContext *s, TCGType type, TCGReg ret, TCGReg arg)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
     assert(ret != arg);
-#if TCG_TARGET_REG_BITS == 32
-    tcg_out_op_t(s, INDEX_op_mov_i32);
-#else
-    tcg_out_op_t(s, INDEX_op_mov_i64);
-#endif
-    tcg_out_r(s, ret);
-    tcg_out_r(s, arg);
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
+    tci_out_r(s, TCI_mov, ret, arg);
 }
 
 static void tcg_out_movi(TCGContext *s, TCGType type,
                          TCGReg t0, tcg_target_long arg)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
-    uint32_t arg32 = arg;
-    if (type == TCG_TYPE_I32 || arg == arg32) {
-        tcg_out_op_t(s, INDEX_op_movi_i32);
-        tcg_out_r(s, t0);
-        tcg_out32(s, arg32);
+    tci_out_r(s, TCI_movi, t0);
+    if (type == TCG_TYPE_I32) {
+        tcg_out_i(s, (uint32_t)arg);
     } else {
-        assert(type == TCG_TYPE_I64);
-#if TCG_TARGET_REG_BITS == 64
-        tcg_out_op_t(s, INDEX_op_movi_i64);
-        tcg_out_r(s, t0);
-        tcg_out64(s, arg);
-#else
-        TODO();
-#endif
+        tcg_out_i(s, arg);
     }
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
 }
 
 static inline void tcg_out_call(TCGContext *s, tcg_insn_unit *arg)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
-    tcg_out_op_t(s, INDEX_op_call);
-    tcg_out_ri(s, 1, (uintptr_t)arg);
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
+    tci_out_op(s, TCI_call, NULL, 0);
+    tcg_out_i(s, (uintptr_t)arg);
 }
 
 static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
                        const int *const_args)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
-
-    tcg_out_op_t(s, opc);
-
     switch (opc) {
     case INDEX_op_exit_tb:
-        tcg_out64(s, args[0]);
+        tci_out_op(s, TCI_exit_tb, NULL, 0);
+        tcg_out_i(s, args[0]);
         break;
     case INDEX_op_goto_tb:
         if (s->tb_jmp_offset) {
-            /* Direct jump method. */
+            /* Direct jump method: the offset is in the last 4 register
+               bytes, relative to the next instruction, and 0 until the
+               jump is set.  */
+            tci_out_op(s, TCI_goto_tb, NULL, 0);
             assert(args[0] < ARRAY_SIZE(s->tb_jmp_offset));
-            s->tb_jmp_offset[args[0]] = tcg_current_code_size(s);
-            tcg_out32(s, 0);
+            s->tb_jmp_offset[args[0]] = tcg_current_code_size(s) - 4;
         } else {
             /* Indirect jump method. */
             TODO();
@@ -564,248 +699,267 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
         assert(args[0] < ARRAY_SIZE(s->tb_next_offset));
         s->tb_next_offset[args[0]] = tcg_current_code_size(s);
         break;
+    case INDEX_op_goto_ptr:
+        tci_out_r(s, TCI_goto_ptr, args[0]);
+        break;
     case INDEX_op_br:
+        tci_out_op(s, TCI_br, NULL, 0);
         tci_out_label(s, args[0]);
         break;
     case INDEX_op_setcond_i32:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
-        tcg_out8(s, args[3]);   /* condition */
+        if (const_args[2]) {
+            tci_out_r(s, TCI_setcond_i32_ri, args[0], args[1], args[3]);
+            tcg_out_i(s, args[2]);
+        } else {
+            tci_out_r(s, TCI_setcond_i32_rr, args[0], args[1], args[2],
+                      args[3]);
+        }
         break;
 #if TCG_TARGET_REG_BITS == 32
     case INDEX_op_setcond2_i32:
         /* setcond2_i32 cond, t0, t1_low, t1_high, t2_low, t2_high */
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_r(s, args[2]);
-        tcg_out_ri32(s, const_args[3], args[3]);
-        tcg_out_ri32(s, const_args[4], args[4]);
-        tcg_out8(s, args[5]);   /* condition */
+        tci_out_r(s, TCI_setcond2_i32, args[0], args[1], args[2], args[3],
+                  args[4], args[5]);
         break;
 #elif TCG_TARGET_REG_BITS == 64
     case INDEX_op_setcond_i64:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_ri64(s, const_args[2], args[2]);
-        tcg_out8(s, args[3]);   /* condition */
+        if (const_args[2]) {
+            tci_out_r(s, TCI_setcond_i64_ri, args[0], args[1], args[3]);
+            tcg_out_i(s, args[2]);
+        } else {
+            tci_out_r(s, TCI_setcond_i64_rr, args[0], args[1], args[2],
+                      args[3]);
+        }
         break;
 #endif
     case INDEX_op_ld8u_i32:
+    case INDEX_op_ld8u_i64:
+        tci_out_ldst(s, TCI_ld8u, args[0], args[1], args[2]);
+        break;
     case INDEX_op_ld8s_i32:
+        tci_out_ldst(s, TCI_ld8s_i32, args[0], args[1], args[2]);
+        break;
     case INDEX_op_ld16u_i32:
+    case INDEX_op_ld16u_i64:
+        tci_out_ldst(s, TCI_ld16u, args[0], args[1], args[2]);
+        break;
     case INDEX_op_ld16s_i32:
+        tci_out_ldst(s, TCI_ld16s_i32, args[0], args[1], args[2]);
+        break;
     case INDEX_op_ld_i32:
-    case INDEX_op_st8_i32:
-    case INDEX_op_st16_i32:
-    case INDEX_op_st_i32:
-    case INDEX_op_ld8u_i64:
-    case INDEX_op_ld8s_i64:
-    case INDEX_op_ld16u_i64:
-    case INDEX_op_ld16s_i64:
     case INDEX_op_ld32u_i64:
-    case INDEX_op_ld32s_i64:
-    case INDEX_op_ld_i64:
+        tci_out_ldst(s, TCI_ld32u, args[0], args[1], args[2]);
+        break;
+    case INDEX_op_st8_i32:
     case INDEX_op_st8_i64:
+        tci_out_ldst(s, TCI_st8, args[0], args[1], args[2]);
+        break;
+    case INDEX_op_st16_i32:
     case INDEX_op_st16_i64:
+        tci_out_ldst(s, TCI_st16, args[0], args[1], args[2]);
+        break;
+    case INDEX_op_st_i32:
     case INDEX_op_st32_i64:
-    case INDEX_op_st_i64:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        assert(args[2] == (int32_t)args[2]);
-        tcg_out32(s, args[2]);
+        tci_out_ldst(s, TCI_st32, args[0], args[1], args[2]);
         break;
     case INDEX_op_add_i32:
+        tci_out_binary(s, TCI_add_i32_rr, args, const_args);
+        break;
     case INDEX_op_sub_i32:
+        tci_out_binary(s, TCI_sub_i32_rr, args, const_args);
+        break;
     case INDEX_op_mul_i32:
+        tci_out_binary(s, TCI_mul_i32_rr, args, const_args);
+        break;
     case INDEX_op_and_i32:
-    case INDEX_op_andc_i32:     /* Optional (TCG_TARGET_HAS_andc_i32). */
-    case INDEX_op_eqv_i32:      /* Optional (TCG_TARGET_HAS_eqv_i32). */
-    case INDEX_op_nand_i32:     /* Optional (TCG_TARGET_HAS_nand_i32). */
-    case INDEX_op_nor_i32:      /* Optional (TCG_TARGET_HAS_nor_i32). */
+        tci_out_binary(s, TCI_and_i32_rr, args, const_args);
+        break;
     case INDEX_op_or_i32:
-    case INDEX_op_orc_i32:      /* Optional (TCG_TARGET_HAS_orc_i32). */
+        tci_out_binary(s, TCI_or_i32_rr, args, const_args);
+        break;
     case INDEX_op_xor_i32:
+        tci_out_binary(s, TCI_xor_i32_rr, args, const_args);
+        break;
     case INDEX_op_shl_i32:
+        tci_out_binary(s, TCI_shl_i32_rr, args, const_args);
+        break;
     case INDEX_op_shr_i32:
+        tci_out_binary(s, TCI_shr_i32_rr, args, const_args);
+        break;
     case INDEX_op_sar_i32:
+        tci_out_binary(s, TCI_sar_i32_rr, args, const_args);
+        break;
     case INDEX_op_rotl_i32:     /* Optional (TCG_TARGET_HAS_rot_i32). */
+        tci_out_binary(s, TCI_rotl_i32_rr, args, const_args);
+        break;
     case INDEX_op_rotr_i32:     /* Optional (TCG_TARGET_HAS_rot_i32). */
-        tcg_out_r(s, args[0]);
-        tcg_out_ri32(s, const_args[1], args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
+        tci_out_binary(s, TCI_rotr_i32_rr, args, const_args);
         break;
     case INDEX_op_deposit_i32:  /* Optional (TCG_TARGET_HAS_deposit_i32). */
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_r(s, args[2]);
-        assert(args[3] <= UINT8_MAX);
-        tcg_out8(s, args[3]);
-        assert(args[4] <= UINT8_MAX);
-        tcg_out8(s, args[4]);
+        tci_out_r(s, TCI_deposit_i32, args[0], args[1], args[2], args[3]);
+        tcg_out_i(s, (uint32_t)deposit64(0, args[3], args[4], -1));
         break;
 
 #if TCG_TARGET_REG_BITS == 64
+    case INDEX_op_ld8s_i64:
+        tci_out_ldst(s, TCI_ld8s_i64, args[0], args[1], args[2]);
+        break;
+    case INDEX_op_ld16s_i64:
+        tci_out_ldst(s, TCI_ld16s_i64, args[0], args[1], args[2]);
+        break;
+    case INDEX_op_ld32s_i64:
+        tci_out_ldst(s, TCI_ld32s_i64, args[0], args[1], args[2]);
+        break;
+    case INDEX_op_ld_i64:
+        tci_out_ldst(s, TCI_ld_i64, args[0], args[1], args[2]);
+        break;
+    case INDEX_op_st_i64:
+        tci_out_ldst(s, TCI_st_i64, args[0], args[1], args[2]);
+        break;
     case INDEX_op_add_i64:
+        tci_out_binary(s, TCI_add_i64_rr, args, const_args);
+        break;
     case INDEX_op_sub_i64:
+        tci_out_binary(s, TCI_sub_i64_rr, args, const_args);
+        break;
     case INDEX_op_mul_i64:
+        tci_out_binary(s, TCI_mul_i64_rr, args, const_args);
+        break;
     case INDEX_op_and_i64:
-    case INDEX_op_andc_i64:     /* Optional (TCG_TARGET_HAS_andc_i64). */
-    case INDEX_op_eqv_i64:      /* Optional (TCG_TARGET_HAS_eqv_i64). */
-    case INDEX_op_nand_i64:     /* Optional (TCG_TARGET_HAS_nand_i64). */
-    case INDEX_op_nor_i64:      /* Optional (TCG_TARGET_HAS_nor_i64). */
+        tci_out_binary(s, TCI_and_i64_rr, args, const_args);
+        break;
     case INDEX_op_or_i64:
-    case INDEX_op_orc_i64:      /* Optional (TCG_TARGET_HAS_orc_i64). */
+        tci_out_binary(s, TCI_or_i64_rr, args, const_args);
+        break;
     case INDEX_op_xor_i64:
+        tci_out_binary(s, TCI_xor_i64_rr, args, const_args);
+        break;
     case INDEX_op_shl_i64:
+        tci_out_binary(s, TCI_shl_i64_rr, args, const_args);
+        break;
     case INDEX_op_shr_i64:
+        tci_out_binary(s, TCI_shr_i64_rr, args, const_args);
+        break;
     case INDEX_op_sar_i64:
+        tci_out_binary(s, TCI_sar_i64_rr, args, const_args);
+        break;
     case INDEX_op_rotl_i64:     /* Optional (TCG_TARGET_HAS_rot_i64). */
+        tci_out_binary(s, TCI_rotl_i64_rr, args, const_args);
+        break;
     case INDEX_op_rotr_i64:     /* Optional (TCG_TARGET_HAS_rot_i64). */
-        tcg_out_r(s, args[0]);
-        tcg_out_ri64(s, const_args[1], args[1]);
-        tcg_out_ri64(s, const_args[2], args[2]);
+        tci_out_binary(s, TCI_rotr_i64_rr, args, const_args);
         break;
     case INDEX_op_deposit_i64:  /* Optional (TCG_TARGET_HAS_deposit_i64). */
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_r(s, args[2]);
-        assert(args[3] <= UINT8_MAX);
-        tcg_out8(s, args[3]);
-        assert(args[4] <= UINT8_MAX);
-        tcg_out8(s, args[4]);
-        break;
-    case INDEX_op_div_i64:      /* Optional (TCG_TARGET_HAS_div_i64). */
-    case INDEX_op_divu_i64:     /* Optional (TCG_TARGET_HAS_div_i64). */
-    case INDEX_op_rem_i64:      /* Optional (TCG_TARGET_HAS_div_i64). */
-    case INDEX_op_remu_i64:     /* Optional (TCG_TARGET_HAS_div_i64). */
-        TODO();
-        break;
-    case INDEX_op_div2_i64:     /* Optional (TCG_TARGET_HAS_div2_i64). */
-    case INDEX_op_divu2_i64:    /* Optional (TCG_TARGET_HAS_div2_i64). */
-        TODO();
+        tci_out_r(s, TCI_deposit_i64, args[0], args[1], args[2], args[3]);
+        tcg_out_i(s, deposit64(0, args[3], args[4], -1));
         break;
     case INDEX_op_brcond_i64:
-        tcg_out_r(s, args[0]);
-        tcg_out_ri64(s, const_args[1], args[1]);
-        tcg_out8(s, args[2]);           /* condition */
-        tci_out_label(s, args[3]);
+        tci_out_brcond(s, TCI_brcond_i64_rr_eq, TCI_brcond_i64_ri_eq,
+                       args[0], args[1], const_args[1], args[2], args[3]);
         break;
     case INDEX_op_bswap16_i64:  /* Optional (TCG_TARGET_HAS_bswap16_i64). */
+        tci_out_r(s, TCI_bswap16_i64, args[0], args[1]);
+        break;
     case INDEX_op_bswap32_i64:  /* Optional (TCG_TARGET_HAS_bswap32_i64). */
+        tci_out_r(s, TCI_bswap32_i64, args[0], args[1]);
+        break;
     case INDEX_op_bswap64_i64:  /* Optional (TCG_TARGET_HAS_bswap64_i64). */
+        tci_out_r(s, TCI_bswap64_i64, args[0], args[1]);
+        break;
     case INDEX_op_not_i64:      /* Optional (TCG_TARGET_HAS_not_i64). */
+        tci_out_r(s, TCI_not_i64, args[0], args[1]);
+        break;
     case INDEX_op_neg_i64:      /* Optional (TCG_TARGET_HAS_neg_i64). */
+        tci_out_r(s, TCI_neg_i64, args[0], args[1]);
+        break;
     case INDEX_op_ext8s_i64:    /* Optional (TCG_TARGET_HAS_ext8s_i64). */
+        tci_out_r(s, TCI_ext8s_i64, args[0], args[1]);
+        break;
     case INDEX_op_ext8u_i64:    /* Optional (TCG_TARGET_HAS_ext8u_i64). */
+        tci_out_r(s, TCI_ext8u_i64, args[0], args[1]);
+        break;
     case INDEX_op_ext16s_i64:   /* Optional (TCG_TARGET_HAS_ext16s_i64). */
+        tci_out_r(s, TCI_ext16s_i64, args[0], args[1]);
+        break;
     case INDEX_op_ext16u_i64:   /* Optional (TCG_TARGET_HAS_ext16u_i64). */
+        tci_out_r(s, TCI_ext16u_i64, args[0], args[1]);
+        break;
     case INDEX_op_ext32s_i64:   /* Optional (TCG_TARGET_HAS_ext32s_i64). */
+        tci_out_r(s, TCI_ext32s_i64, args[0], args[1]);
+        break;
     case INDEX_op_ext32u_i64:   /* Optional (TCG_TARGET_HAS_ext32u_i64). */
+        tci_out_r(s, TCI_ext32u_i64, args[0], args[1]);
+        break;
 #endif /* TCG_TARGET_REG_BITS == 64 */
     case INDEX_op_neg_i32:      /* Optional (TCG_TARGET_HAS_neg_i32). */
+        tci_out_r(s, TCI_neg_i32, args[0], args[1]);
+        break;
     case INDEX_op_not_i32:      /* Optional (TCG_TARGET_HAS_not_i32). */
+        tci_out_r(s, TCI_not_i32, args[0], args[1]);
+        break;
     case INDEX_op_ext8s_i32:    /* Optional (TCG_TARGET_HAS_ext8s_i32). */
+        tci_out_r(s, TCI_ext8s_i32, args[0], args[1]);
+        break;
     case INDEX_op_ext16s_i32:   /* Optional (TCG_TARGET_HAS_ext16s_i32). */
+        tci_out_r(s, TCI_ext16s_i32, args[0], args[1]);
+        break;
     case INDEX_op_ext8u_i32:    /* Optional (TCG_TARGET_HAS_ext8u_i32). */
+        tci_out_r(s, TCI_ext8u_i32, args[0], args[1]);
+        break;
     case INDEX_op_ext16u_i32:   /* Optional (TCG_TARGET_HAS_ext16u_i32). */
+        tci_out_r(s, TCI_ext16u_i32, args[0], args[1]);
+        break;
     case INDEX_op_bswap16_i32:  /* Optional (TCG_TARGET_HAS_bswap16_i32). */
+        tci_out_r(s, TCI_bswap16_i32, args[0], args[1]);
+        break;
     case INDEX_op_bswap32_i32:  /* Optional (TCG_TARGET_HAS_bswap32_i32). */
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
+        tci_out_r(s, TCI_bswap32_i32, args[0], args[1]);
         break;
     case INDEX_op_div_i32:      /* Optional (TCG_TARGET_HAS_div_i32). */
+        tci_out_r(s, TCI_div_i32, args[0], args[1], args[2]);
+        break;
     case INDEX_op_divu_i32:     /* Optional (TCG_TARGET_HAS_div_i32). */
+        tci_out_r(s, TCI_divu_i32, args[0], args[1], args[2]);
+        break;
     case INDEX_op_rem_i32:      /* Optional (TCG_TARGET_HAS_div_i32). */
-    case INDEX_op_remu_i32:     /* Optional (TCG_TARGET_HAS_div_i32). */
-        tcg_out_r(s, args[0]);
-        tcg_out_ri32(s, const_args[1], args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
+        tci_out_r(s, TCI_rem_i32, args[0], args[1], args[2]);
         break;
-    case INDEX_op_div2_i32:     /* Optional (TCG_TARGET_HAS_div2_i32). */
-    case INDEX_op_divu2_i32:    /* Optional (TCG_TARGET_HAS_div2_i32). */
-        TODO();
+    case INDEX_op_remu_i32:     /* Optional (TCG_TARGET_HAS_div_i32). */
+        tci_out_r(s, TCI_remu_i32, args[0], args[1], args[2]);
         break;
 #if TCG_TARGET_REG_BITS == 32
     case INDEX_op_add2_i32:
+        tci_out_r(s, TCI_add2_i32, args[0], args[1], args[2], args[3],
+                  args[4], args[5]);
+        break;
     case INDEX_op_sub2_i32:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_r(s, args[2]);
-        tcg_out_r(s, args[3]);
-        tcg_out_r(s, args[4]);
-        tcg_out_r(s, args[5]);
+        tci_out_r(s, TCI_sub2_i32, args[0], args[1], args[2], args[3],
+                  args[4], args[5]);
         break;
     case INDEX_op_brcond2_i32:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_ri32(s, const_args[2], args[2]);
-        tcg_out_ri32(s, const_args[3], args[3]);
-        tcg_out8(s, args[4]);           /* condition */
+        tci_out_r(s, TCI_brcond2_i32, args[0], args[1], args[2], args[3],
+                  args[4]);
         tci_out_label(s, args[5]);
         break;
     case INDEX_op_mulu2_i32:
-        tcg_out_r(s, args[0]);
-        tcg_out_r(s, args[1]);
-        tcg_out_r(s, args[2]);
-        tcg_out_r(s, args[3]);
+        tci_out_r(s, TCI_mulu2_i32, args[0], args[1], args[2], args[3]);
         break;
 #endif
     case INDEX_op_brcond_i32:
-        tcg_out_r(s, args[0]);
-        tcg_out_ri32(s, const_args[1], args[1]);
-        tcg_out8(s, args[2]);           /* condition */
-        tci_out_label(s, args[3]);
+        tci_out_brcond(s, TCI_brcond_i32_rr_eq, TCI_brcond_i32_ri_eq,
+                       args[0], args[1], const_args[1], args[2], args[3]);
         break;
     case INDEX_op_qemu_ld_i32:
-        tcg_out_r(s, *args++);
-        tcg_out_r(s, *args++);
-        if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
-            tcg_out_r(s, *args++);
-        }
-        tcg_out_i(s, *args++);
-#ifdef CONFIG_SOFTMMU
-        tcg_out_i(s, *args);
-#endif
+        tci_out_qemu_ldst(s, args, false, true);
         break;
     case INDEX_op_qemu_ld_i64:
-        tcg_out_r(s, *args++);
-        if (TCG_TARGET_REG_BITS == 32) {
-            tcg_out_r(s, *args++);
-        }
-        tcg_out_r(s, *args++);
-        if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
-            tcg_out_r(s, *args++);
-        }
-        tcg_out_i(s, *args++);
-#ifdef CONFIG_SOFTMMU
-        tcg_out_i(s, *args);
-#endif
+        tci_out_qemu_ldst(s, args, true, true);
         break;
     case INDEX_op_qemu_st_i32:
-        tcg_out_r(s, *args++);
-        tcg_out_r(s, *args++);
-        if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
-            tcg_out_r(s, *args++);
-        }
-        tcg_out_i(s, *args++);
-#ifdef CONFIG_SOFTMMU
-        tcg_out_i(s, *args);
-#endif
+        tci_out_qemu_ldst(s, args, false, false);
         break;
     case INDEX_op_qemu_st_i64:
-        tcg_out_r(s, *args++);
-        if (TCG_TARGET_REG_BITS == 32) {
-            tcg_out_r(s, *args++);
-        }
-        tcg_out_r(s, *args++);
-        if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
-            tcg_out_r(s, *args++);
-        }
-        tcg_out_i(s, *args++);
-#ifdef CONFIG_SOFTMMU
-        tcg_out_i(s, *args);
-#endif
+        tci_out_qemu_ldst(s, args, true, false);
         break;
     case INDEX_op_mov_i32:  /* Always emitted via tcg_out_mov.  */
     case INDEX_op_mov_i64:
@@ -815,30 +969,21 @@ static void tcg_out_op(TCGContext *s, TCGOpcode opc, const TCGArg *args,
     default:
         tcg_abort();
     }
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
 }
 
 static void tcg_out_st(TCGContext *s, TCGType type, TCGReg arg, TCGReg arg1,
                        intptr_t arg2)
 {
-    uint8_t *old_code_ptr = s->code_ptr;
     if (type == TCG_TYPE_I32) {
-        tcg_out_op_t(s, INDEX_op_st_i32);
-        tcg_out_r(s, arg);
-        tcg_out_r(s, arg1);
-        tcg_out32(s, arg2);
+        tci_out_ldst(s, TCI_st32, arg, arg1, arg2);
     } else {
         assert(type == TCG_TYPE_I64);
 #if TCG_TARGET_REG_BITS == 64
-        tcg_out_op_t(s, INDEX_op_st_i64);
-        tcg_out_r(s, arg);
-        tcg_out_r(s, arg1);
-        tcg_out32(s, arg2);
+        tci_out_ldst(s, TCI_st_i64, arg, arg1, arg2);
 #else
         TODO();
 #endif
     }
-    old_code_ptr[1] = s->code_ptr - old_code_ptr;
 }
 
 /* Test if a constant matches the constraint. */
@@ -858,8 +1003,7 @@ static void tcg_target_init(TCGContext *s)
     }
 #endif
 
-    /* The current code uses uint8_t for tcg operations. */
-    assert(ARRAY_SIZE(tcg_op_defs) <= UINT8_MAX);
+    tci_init();
 
     /* Registers available for 32 bit operations. */
     tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I32], 0,
@@ -81,6 +81,8 @@
 #define TCG_TARGET_HAS_muls2_i32        0
 #define TCG_TARGET_HAS_muluh_i32        0
 #define TCG_TARGET_HAS_mulsh_i32        0
+#define TCG_TARGET_HAS_vec              0
+#define TCG_TARGET_HAS_goto_ptr         1
 
 #if TCG_TARGET_REG_BITS == 64
 #define TCG_TARGET_HAS_trunc_shr_i32    0
@@ -162,8 +164,6 @@ typedef enum {
     TCG_REG_R31,
 #endif
 #endif
-    /* Special value UINT8_MAX is used by TCI to encode constant values. */
-    TCG_CONST = UINT8_MAX
 } TCGReg;
 
 #define TCG_AREG0                       (TCG_TARGET_NB_REGS - 2)
@@ -175,6 +175,26 @@ typedef enum {
 
 void tci_disas(uint8_t opc);
 
+/* Layout of an instruction of the interpreter, see tci-opc.h.  */
+#define TCI_REG_BYTES 8
+#define TCI_REG_WORDS (TCI_REG_BYTES / (TCG_TARGET_REG_BITS / 8))
+#define TCI_INSN_WORDS(nconst) (1 + TCI_REG_WORDS + (nconst))
+
+typedef enum {
+#define DEF(name, nconst) TCI_##name,
+#define FUSE(a, b) TCI_##a##__##b,
+#include "tci-opc.h"
+    TCI_NB_OPS
+} TCIOpcode;
+
+/* Filled by tci_init with the address of the handler of each
+   instruction, which starts the instruction in the bytecode.  */
+extern const void *tci_handlers[TCI_NB_OPS];
+/* The number of constants of each instruction; a fused instruction has
+   those of its first part.  */
+extern const uint8_t tci_op_nconst[TCI_NB_OPS];
+void tci_init(void);
+
 uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr);
 #define tcg_qemu_tb_exec tcg_qemu_tb_exec
 
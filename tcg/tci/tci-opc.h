@@ -0,0 +1,203 @@
+/*
+ * Tiny Code Interpreter for QEMU - instruction set
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * DEF(name, nconst)
+ *
+ * An instruction is the address of its handler in tci.c, TCI_REG_BYTES
+ * bytes of register numbers and small operands, and NCONST words of
+ * constants.  The comments give the bytes, then the words.  Operands
+ * that TCG leaves to be either a register or a constant get one
+ * instruction for each case (_rr, _ri), and so do the conditions of
+ * brcond and the access kinds of qemu_ld/st.
+ *
+ * FUSE(a, b)
+ *
+ * An instruction with the handler of a__b runs a and then the
+ * instruction b that follows it, with a single dispatch.
+ */
+
+#ifndef FUSE
+#define FUSE(a, b)
+#endif
+
+/* one instruction for each condition, in the order of tci_cond() */
+#define DEF_COND(name, nconst) \
+    DEF(name##_eq, nconst)  \
+    DEF(name##_ne, nconst)  \
+    DEF(name##_lt, nconst)  \
+    DEF(name##_ge, nconst)  \
+    DEF(name##_le, nconst)  \
+    DEF(name##_gt, nconst)  \
+    DEF(name##_ltu, nconst) \
+    DEF(name##_geu, nconst) \
+    DEF(name##_leu, nconst) \
+    DEF(name##_gtu, nconst)
+
+/* one instruction with a register and one with a constant second input */
+#define DEF_BINARY(name) \
+    DEF(name##_rr, 0)      /* ret, a, b */ \
+    DEF(name##_ri, 1)      /* ret, a; b */
+
+/* control */
+DEF(exit_tb, 1)                 /* ; value */
+DEF(goto_tb, 0)                 /* 4 bytes of padding, 32-bit offset */
+DEF(goto_ptr, 0)                /* ptr */
+DEF(br, 1)                      /* ; label */
+DEF(call, 1)                    /* ; function */
+
+DEF(mov, 0)                     /* ret, arg */
+DEF(movi, 1)                    /* ret; value */
+
+/* host memory */
+DEF(ld8u, 1)                    /* ret, base; offset */
+DEF(ld8s_i32, 1)
+DEF(ld16u, 1)
+DEF(ld16s_i32, 1)
+DEF(ld32u, 1)
+DEF(st8, 1)                     /* arg, base; offset */
+DEF(st16, 1)
+DEF(st32, 1)
+
+/* 32 bit */
+DEF_BINARY(add_i32)
+DEF_BINARY(sub_i32)
+DEF_BINARY(mul_i32)
+DEF_BINARY(and_i32)
+DEF_BINARY(or_i32)
+DEF_BINARY(xor_i32)
+DEF_BINARY(shl_i32)
+DEF_BINARY(shr_i32)
+DEF_BINARY(sar_i32)
+DEF_BINARY(rotl_i32)
+DEF_BINARY(rotr_i32)
+DEF(div_i32, 0)                 /* ret, a, b */
+DEF(divu_i32, 0)
+DEF(rem_i32, 0)
+DEF(remu_i32, 0)
+DEF(neg_i32, 0)                 /* ret, arg */
+DEF(not_i32, 0)
+DEF(ext8s_i32, 0)
+DEF(ext8u_i32, 0)
+DEF(ext16s_i32, 0)
+DEF(ext16u_i32, 0)
+DEF(bswap16_i32, 0)
+DEF(bswap32_i32, 0)
+DEF(deposit_i32, 1)             /* ret, a, b, pos; mask */
+DEF_COND(brcond_i32_rr, 1)      /* a, b; label */
+DEF_COND(brcond_i32_ri, 2)      /* a; b, label */
+DEF(setcond_i32_rr, 0)          /* ret, a, b, cond */
+DEF(setcond_i32_ri, 1)          /* ret, a, cond; b */
+
+#if TCG_TARGET_REG_BITS == 32
+DEF(add2_i32, 0)                /* retl, reth, al, ah, bl, bh */
+DEF(sub2_i32, 0)
+DEF(mulu2_i32, 0)               /* retl, reth, a, b */
+DEF(brcond2_i32, 1)             /* al, ah, bl, bh, cond; label */
+DEF(setcond2_i32, 0)            /* ret, al, ah, bl, bh, cond */
+#else
+/* 64 bit */
+DEF(ld8s_i64, 1)                /* ret, base; offset */
+DEF(ld16s_i64, 1)
+DEF(ld32s_i64, 1)
+DEF(ld_i64, 1)
+DEF(st_i64, 1)                  /* arg, base; offset */
+DEF_BINARY(add_i64)
+DEF_BINARY(sub_i64)
+DEF_BINARY(mul_i64)
+DEF_BINARY(and_i64)
+DEF_BINARY(or_i64)
+DEF_BINARY(xor_i64)
+DEF_BINARY(shl_i64)
+DEF_BINARY(shr_i64)
+DEF_BINARY(sar_i64)
+DEF_BINARY(rotl_i64)
+DEF_BINARY(rotr_i64)
+DEF(neg_i64, 0)                 /* ret, arg */
+DEF(not_i64, 0)
+DEF(ext8s_i64, 0)
+DEF(ext8u_i64, 0)
+DEF(ext16s_i64, 0)
+DEF(ext16u_i64, 0)
+DEF(ext32s_i64, 0)
+DEF(ext32u_i64, 0)
+DEF(bswap16_i64, 0)
+DEF(bswap32_i64, 0)
+DEF(bswap64_i64, 0)
+DEF(deposit_i64, 1)             /* ret, a, b, pos; mask */
+DEF_COND(brcond_i64_rr, 1)      /* a, b; label */
+DEF_COND(brcond_i64_ri, 2)      /* a; b, label */
+DEF(setcond_i64_rr, 0)          /* ret, a, b, cond */
+DEF(setcond_i64_ri, 1)          /* ret, a, cond; b */
+#endif
+
+/* guest memory: data (low, high), address (low, high), mmu index */
+DEF(qemu_ld_i32_ub, 0)
+DEF(qemu_ld_i32_sb, 0)
+DEF(qemu_ld_i32_leuw, 0)
+DEF(qemu_ld_i32_lesw, 0)
+DEF(qemu_ld_i32_leul, 0)
+DEF(qemu_ld_i32_beuw, 0)
+DEF(qemu_ld_i32_besw, 0)
+DEF(qemu_ld_i32_beul, 0)
+DEF(qemu_ld_i64_ub, 0)
+DEF(qemu_ld_i64_sb, 0)
+DEF(qemu_ld_i64_leuw, 0)
+DEF(qemu_ld_i64_lesw, 0)
+DEF(qemu_ld_i64_leul, 0)
+DEF(qemu_ld_i64_lesl, 0)
+DEF(qemu_ld_i64_leq, 0)
+DEF(qemu_ld_i64_beuw, 0)
+DEF(qemu_ld_i64_besw, 0)
+DEF(qemu_ld_i64_beul, 0)
+DEF(qemu_ld_i64_besl, 0)
+DEF(qemu_ld_i64_beq, 0)
+DEF(qemu_st_i32_b, 0)
+DEF(qemu_st_i32_lew, 0)
+DEF(qemu_st_i32_lel, 0)
+DEF(qemu_st_i32_bew, 0)
+DEF(qemu_st_i32_bel, 0)
+DEF(qemu_st_i64_b, 0)
+DEF(qemu_st_i64_lew, 0)
+DEF(qemu_st_i64_lel, 0)
+DEF(qemu_st_i64_leq, 0)
+DEF(qemu_st_i64_bew, 0)
+DEF(qemu_st_i64_bel, 0)
+DEF(qemu_st_i64_beq, 0)
+
+/* The most frequent pairs, counted while running x86_64 guests.  The
+   first instruction of a pair must not jump.  */
+FUSE(movi, st32)
+FUSE(ld32u, brcond_i32_ri_ne)
+#if TCG_TARGET_REG_BITS == 64
+FUSE(st_i64, ld_i64)
+FUSE(st_i64, st_i64)
+FUSE(st_i64, movi)
+FUSE(ld_i64, add_i64_ri)
+FUSE(ld_i64, st_i64)
+FUSE(ld_i64, ld_i64)
+FUSE(movi, st_i64)
+FUSE(add_i64_ri, st_i64)
+FUSE(add_i64_ri, qemu_ld_i64_leq)
+FUSE(ext32u_i64, st_i64)
+FUSE(qemu_ld_i64_leq, st_i64)
+#endif
+
+#undef DEF_COND
+#undef DEF_BINARY
+#undef DEF
+#undef FUSE
@@ -55,285 +55,21 @@ typedef uint64_t (*helper_function)(tcg_target_ulong, tcg_target_ulong,
 /* Targets which don't use GETPC also don't need tci_tb_ptr
    which makes them a little faster. */
 #if defined(GETPC)
-uintptr_t tci_tb_ptr;
+__thread uintptr_t tci_tb_ptr;
 #endif
 
-static tcg_target_ulong tci_reg[TCG_TARGET_NB_REGS];
+const void *tci_handlers[TCI_NB_OPS];
 
-static tcg_target_ulong tci_read_reg(TCGReg index)
-{
-    assert(index < ARRAY_SIZE(tci_reg));
-    return tci_reg[index];
-}
-
-#if TCG_TARGET_HAS_ext8s_i32 || TCG_TARGET_HAS_ext8s_i64
-static int8_t tci_read_reg8s(TCGReg index)
-{
-    return (int8_t)tci_read_reg(index);
-}
-#endif
-
-#if TCG_TARGET_HAS_ext16s_i32 || TCG_TARGET_HAS_ext16s_i64
-static int16_t tci_read_reg16s(TCGReg index)
-{
-    return (int16_t)tci_read_reg(index);
-}
-#endif
-
-#if TCG_TARGET_REG_BITS == 64
-static int32_t tci_read_reg32s(TCGReg index)
-{
-    return (int32_t)tci_read_reg(index);
-}
-#endif
-
-static uint8_t tci_read_reg8(TCGReg index)
-{
-    return (uint8_t)tci_read_reg(index);
-}
-
-static uint16_t tci_read_reg16(TCGReg index)
-{
-    return (uint16_t)tci_read_reg(index);
-}
-
-static uint32_t tci_read_reg32(TCGReg index)
-{
-    return (uint32_t)tci_read_reg(index);
-}
-
-#if TCG_TARGET_REG_BITS == 64
-static uint64_t tci_read_reg64(TCGReg index)
-{
-    return tci_read_reg(index);
-}
-#endif
-
-static void tci_write_reg(TCGReg index, tcg_target_ulong value)
-{
-    assert(index < ARRAY_SIZE(tci_reg));
-    assert(index != TCG_AREG0);
-    assert(index != TCG_REG_CALL_STACK);
-    tci_reg[index] = value;
-}
-
-#if TCG_TARGET_REG_BITS == 64
-static void tci_write_reg32s(TCGReg index, int32_t value)
-{
-    tci_write_reg(index, value);
-}
-#endif
-
-static void tci_write_reg8(TCGReg index, uint8_t value)
-{
-    tci_write_reg(index, value);
-}
-
-static void tci_write_reg32(TCGReg index, uint32_t value)
-{
-    tci_write_reg(index, value);
-}
-
-#if TCG_TARGET_REG_BITS == 32
-static void tci_write_reg64(uint32_t high_index, uint32_t low_index,
-                            uint64_t value)
-{
-    tci_write_reg(low_index, value);
-    tci_write_reg(high_index, value >> 32);
-}
-#elif TCG_TARGET_REG_BITS == 64
-static void tci_write_reg64(TCGReg index, uint64_t value)
-{
-    tci_write_reg(index, value);
-}
-#endif
-
-#if TCG_TARGET_REG_BITS == 32
-/* Create a 64 bit value from two 32 bit values. */
-static uint64_t tci_uint64(uint32_t high, uint32_t low)
-{
-    return ((uint64_t)high << 32) + low;
-}
-#endif
-
-/* Read constant (native size) from bytecode. */
-static tcg_target_ulong tci_read_i(uint8_t **tb_ptr)
-{
-    tcg_target_ulong value = *(tcg_target_ulong *)(*tb_ptr);
-    *tb_ptr += sizeof(value);
-    return value;
-}
-
-/* Read unsigned constant (32 bit) from bytecode. */
-static uint32_t tci_read_i32(uint8_t **tb_ptr)
-{
-    uint32_t value = *(uint32_t *)(*tb_ptr);
-    *tb_ptr += sizeof(value);
-    return value;
-}
-
-/* Read signed constant (32 bit) from bytecode. */
-static int32_t tci_read_s32(uint8_t **tb_ptr)
-{
-    int32_t value = *(int32_t *)(*tb_ptr);
-    *tb_ptr += sizeof(value);
-    return value;
-}
-
-#if TCG_TARGET_REG_BITS == 64
-/* Read constant (64 bit) from bytecode. */
-static uint64_t tci_read_i64(uint8_t **tb_ptr)
-{
-    uint64_t value = *(uint64_t *)(*tb_ptr);
-    *tb_ptr += sizeof(value);
-    return value;
-}
-#endif
-
-/* Read indexed register (native size) from bytecode. */
-static tcg_target_ulong tci_read_r(uint8_t **tb_ptr)
-{
-    tcg_target_ulong value = tci_read_reg(**tb_ptr);
-    *tb_ptr += 1;
-    return value;
-}
-
-/* Read indexed register (8 bit) from bytecode. */
-static uint8_t tci_read_r8(uint8_t **tb_ptr)
-{
-    uint8_t value = tci_read_reg8(**tb_ptr);
-    *tb_ptr += 1;
-    return value;
-}
-
-#if TCG_TARGET_HAS_ext8s_i32 || TCG_TARGET_HAS_ext8s_i64
-/* Read indexed register (8 bit signed) from bytecode. */
-static int8_t tci_read_r8s(uint8_t **tb_ptr)
-{
-    int8_t value = tci_read_reg8s(**tb_ptr);
-    *tb_ptr += 1;
-    return value;
-}
-#endif
-
-/* Read indexed register (16 bit) from bytecode. */
-static uint16_t tci_read_r16(uint8_t **tb_ptr)
-{
-    uint16_t value = tci_read_reg16(**tb_ptr);
-    *tb_ptr += 1;
-    return value;
-}
-
-#if TCG_TARGET_HAS_ext16s_i32 || TCG_TARGET_HAS_ext16s_i64
-/* Read indexed register (16 bit signed) from bytecode. */
-static int16_t tci_read_r16s(uint8_t **tb_ptr)
-{
-    int16_t value = tci_read_reg16s(**tb_ptr);
-    *tb_ptr += 1;
-    return value;
-}
-#endif
-
-/* Read indexed register (32 bit) from bytecode. */
-static uint32_t tci_read_r32(uint8_t **tb_ptr)
-{
-    uint32_t value = tci_read_reg32(**tb_ptr);
-    *tb_ptr += 1;
-    return value;
-}
-
-#if TCG_TARGET_REG_BITS == 32
-/* Read two indexed registers (2 * 32 bit) from bytecode. */
-static uint64_t tci_read_r64(uint8_t **tb_ptr)
-{
-    uint32_t low = tci_read_r32(tb_ptr);
-    return tci_uint64(tci_read_r32(tb_ptr), low);
-}
-#elif TCG_TARGET_REG_BITS == 64
-/* Read indexed register (32 bit signed) from bytecode. */
-static int32_t tci_read_r32s(uint8_t **tb_ptr)
-{
-    int32_t value = tci_read_reg32s(**tb_ptr);
-    *tb_ptr += 1;
-    return value;
-}
-
-/* Read indexed register (64 bit) from bytecode. */
-static uint64_t tci_read_r64(uint8_t **tb_ptr)
-{
-    uint64_t value = tci_read_reg64(**tb_ptr);
-    *tb_ptr += 1;
-    return value;
-}
-#endif
-
-/* Read indexed register(s) with target address from bytecode. */
-static target_ulong tci_read_ulong(uint8_t **tb_ptr)
-{
-    target_ulong taddr = tci_read_r(tb_ptr);
-#if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
-    taddr += (uint64_t)tci_read_r(tb_ptr) << 32;
-#endif
-    return taddr;
-}
+enum {
+#define DEF(name, nconst) TCI_NCONST_##name = nconst,
+#include "tci-opc.h"
+};
 
-/* Read indexed register or constant (native size) from bytecode. */
-static tcg_target_ulong tci_read_ri(uint8_t **tb_ptr)
-{
-    tcg_target_ulong value;
-    TCGReg r = **tb_ptr;
-    *tb_ptr += 1;
-    if (r == TCG_CONST) {
-        value = tci_read_i(tb_ptr);
-    } else {
-        value = tci_read_reg(r);
-    }
-    return value;
-}
-
-/* Read indexed register or constant (32 bit) from bytecode. */
-static uint32_t tci_read_ri32(uint8_t **tb_ptr)
-{
-    uint32_t value;
-    TCGReg r = **tb_ptr;
-    *tb_ptr += 1;
-    if (r == TCG_CONST) {
-        value = tci_read_i32(tb_ptr);
-    } else {
-        value = tci_read_reg32(r);
-    }
-    return value;
-}
-
-#if TCG_TARGET_REG_BITS == 32
-/* Read two indexed registers or constants (2 * 32 bit) from bytecode. */
-static uint64_t tci_read_ri64(uint8_t **tb_ptr)
-{
-    uint32_t low = tci_read_ri32(tb_ptr);
-    return tci_uint64(tci_read_ri32(tb_ptr), low);
-}
-#elif TCG_TARGET_REG_BITS == 64
-/* Read indexed register or constant (64 bit) from bytecode. */
-static uint64_t tci_read_ri64(uint8_t **tb_ptr)
-{
-    uint64_t value;
-    TCGReg r = **tb_ptr;
-    *tb_ptr += 1;
-    if (r == TCG_CONST) {
-        value = tci_read_i64(tb_ptr);
-    } else {
-        value = tci_read_reg64(r);
-    }
-    return value;
-}
-#endif
-
-static tcg_target_ulong tci_read_label(uint8_t **tb_ptr)
-{
-    tcg_target_ulong label = tci_read_i(tb_ptr);
-    assert(label != 0);
-    return label;
-}
+const uint8_t tci_op_nconst[TCI_NB_OPS] = {
+#define DEF(name, nconst) nconst,
+#define FUSE(a, b) TCI_NCONST_##a,
+#include "tci-opc.h"
+};
 
 static bool tci_compare32(uint32_t u0, uint32_t u1, TCGCond condition)
 {
@@ -419,850 +155,384 @@ static bool tci_compare64(uint64_t u0, uint64_t u1, TCGCond condition)
     return result;
 }
 
-#ifdef CONFIG_SOFTMMU
-# define mmuidx          tci_read_i(&tb_ptr)
-# define qemu_ld_ub \
-    helper_ret_ldub_mmu(env, taddr, mmuidx, (uintptr_t)tb_ptr)
-# define qemu_ld_leuw \
-    helper_le_lduw_mmu(env, taddr, mmuidx, (uintptr_t)tb_ptr)
-# define qemu_ld_leul \
-    helper_le_ldul_mmu(env, taddr, mmuidx, (uintptr_t)tb_ptr)
-# define qemu_ld_leq \
-    helper_le_ldq_mmu(env, taddr, mmuidx, (uintptr_t)tb_ptr)
-# define qemu_ld_beuw \
-    helper_be_lduw_mmu(env, taddr, mmuidx, (uintptr_t)tb_ptr)
-# define qemu_ld_beul \
-    helper_be_ldul_mmu(env, taddr, mmuidx, (uintptr_t)tb_ptr)
-# define qemu_ld_beq \
-    helper_be_ldq_mmu(env, taddr, mmuidx, (uintptr_t)tb_ptr)
-# define qemu_st_b(X) \
-    helper_ret_stb_mmu(env, taddr, X, mmuidx, (uintptr_t)tb_ptr)
-# define qemu_st_lew(X) \
-    helper_le_stw_mmu(env, taddr, X, mmuidx, (uintptr_t)tb_ptr)
-# define qemu_st_lel(X) \
-    helper_le_stl_mmu(env, taddr, X, mmuidx, (uintptr_t)tb_ptr)
-# define qemu_st_leq(X) \
-    helper_le_stq_mmu(env, taddr, X, mmuidx, (uintptr_t)tb_ptr)
-# define qemu_st_bew(X) \
-    helper_be_stw_mmu(env, taddr, X, mmuidx, (uintptr_t)tb_ptr)
-# define qemu_st_bel(X) \
-    helper_be_stl_mmu(env, taddr, X, mmuidx, (uintptr_t)tb_ptr)
-# define qemu_st_beq(X) \
-    helper_be_stq_mmu(env, taddr, X, mmuidx, (uintptr_t)tb_ptr)
-#else
-# define qemu_ld_ub      ldub_p(g2h(taddr))
-# define qemu_ld_leuw    lduw_le_p(g2h(taddr))
-# define qemu_ld_leul    (uint32_t)ldl_le_p(g2h(taddr))
-# define qemu_ld_leq     ldq_le_p(g2h(taddr))
-# define qemu_ld_beuw    lduw_be_p(g2h(taddr))
-# define qemu_ld_beul    (uint32_t)ldl_be_p(g2h(taddr))
-# define qemu_ld_beq     ldq_be_p(g2h(taddr))
-# define qemu_st_b(X)    stb_p(g2h(taddr), X)
-# define qemu_st_lew(X)  stw_le_p(g2h(taddr), X)
-# define qemu_st_lel(X)  stl_le_p(g2h(taddr), X)
-# define qemu_st_leq(X)  stq_le_p(g2h(taddr), X)
-# define qemu_st_bew(X)  stw_be_p(g2h(taddr), X)
-# define qemu_st_bel(X)  stl_be_p(g2h(taddr), X)
-# define qemu_st_beq(X)  stq_be_p(g2h(taddr), X)
-#endif
-
-/* Interpret pseudo code in tb. */
-uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
-{
-    long tcg_temps[CPU_TEMP_BUF_NLONGS];
-    uintptr_t sp_value = (uintptr_t)(tcg_temps + CPU_TEMP_BUF_NLONGS);
-    uintptr_t next_tb = 0;
-
-    tci_reg[TCG_AREG0] = (tcg_target_ulong)env;
-    tci_reg[TCG_REG_CALL_STACK] = sp_value;
-    assert(tb_ptr);
+/* Operands of the instruction at pc: register byte N, the register it
+   names and constant N (see tci-opc.h).  */
+#define B(n)            (((const uint8_t *)(pc + 1))[n])
+#define R(n)            regs[B(n)]
+#define C(n)            pc[1 + TCI_REG_WORDS + (n)]
 
-    for (;;) {
-        TCGOpcode opc = tb_ptr[0];
-#if !defined(NDEBUG)
-        uint8_t op_size = tb_ptr[1];
-        uint8_t *old_code_ptr = tb_ptr;
-#endif
-        tcg_target_ulong t0;
-        tcg_target_ulong t1;
-        tcg_target_ulong t2;
-        tcg_target_ulong label;
-        TCGCond condition;
-        target_ulong taddr;
-        uint8_t tmp8;
-        uint16_t tmp16;
-        uint32_t tmp32;
-        uint64_t tmp64;
-#if TCG_TARGET_REG_BITS == 32
-        uint64_t v64;
-#endif
-        TCGMemOp memop;
+/* Run the instruction at pc. */
+#define DISPATCH()      goto *(void *)pc[0]
+/* Step over an instruction with NCONST constants. */
+#define STEP(nconst)    pc += TCI_INSN_WORDS(nconst)
+#define JUMP(label) \
+    do { \
+        pc = (const tcg_target_ulong *)(label); \
+        DISPATCH(); \
+    } while (0)
 
-#if defined(GETPC)
-        tci_tb_ptr = (uintptr_t)tb_ptr;
-#endif
+/* The handler of instruction NAME is "OP_NAME; STEP(nconst); DISPATCH()",
+   see the end of tci_run.  */
 
-        /* Skip opcode and size entry. */
-        tb_ptr += 2;
+#define OP_exit_tb      return C(0)
+/* The offset, in the last 4 register bytes, is relative to the next
+   instruction.  */
+#define OP_goto_tb \
+    JUMP((const uint8_t *)(pc + TCI_INSN_WORDS(0)) + *(const int32_t *)&B(4))
+/* A NULL ptr is the epilogue of tcg_gen_lookup_and_goto_ptr.  */
+#define OP_goto_ptr \
+    do { \
+        if (!R(0)) { \
+            return 0; \
+        } \
+        JUMP(R(0)); \
+    } while (0)
+#define OP_br           JUMP(C(0))
 
-        switch (opc) {
-        case INDEX_op_end:
-        case INDEX_op_nop:
-            break;
-        case INDEX_op_nop1:
-        case INDEX_op_nop2:
-        case INDEX_op_nop3:
-        case INDEX_op_nopn:
-        case INDEX_op_discard:
-            TODO();
-            break;
-        case INDEX_op_set_label:
-            TODO();
-            break;
-        case INDEX_op_call:
-            t0 = tci_read_ri(&tb_ptr);
 #if TCG_TARGET_REG_BITS == 32
-            tmp64 = ((helper_function)t0)(tci_read_reg(TCG_REG_R0),
-                                          tci_read_reg(TCG_REG_R1),
-                                          tci_read_reg(TCG_REG_R2),
-                                          tci_read_reg(TCG_REG_R3),
-                                          tci_read_reg(TCG_REG_R5),
-                                          tci_read_reg(TCG_REG_R6),
-                                          tci_read_reg(TCG_REG_R7),
-                                          tci_read_reg(TCG_REG_R8),
-                                          tci_read_reg(TCG_REG_R9),
-                                          tci_read_reg(TCG_REG_R10));
-            tci_write_reg(TCG_REG_R0, tmp64);
-            tci_write_reg(TCG_REG_R1, tmp64 >> 32);
+#define OP_call \
+    do { \
+        uint64_t ret; \
+        tci_tb_ptr = (uintptr_t)pc; \
+        ret = ((helper_function)C(0))(regs[TCG_REG_R0], regs[TCG_REG_R1], \
+                                      regs[TCG_REG_R2], regs[TCG_REG_R3], \
+                                      regs[TCG_REG_R5], regs[TCG_REG_R6], \
+                                      regs[TCG_REG_R7], regs[TCG_REG_R8], \
+                                      regs[TCG_REG_R9], regs[TCG_REG_R10]); \
+        regs[TCG_REG_R0] = ret; \
+        regs[TCG_REG_R1] = ret >> 32; \
+    } while (0)
 #else
-            tmp64 = ((helper_function)t0)(tci_read_reg(TCG_REG_R0),
-                                          tci_read_reg(TCG_REG_R1),
-                                          tci_read_reg(TCG_REG_R2),
-                                          tci_read_reg(TCG_REG_R3),
-                                          tci_read_reg(TCG_REG_R5));
-            tci_write_reg(TCG_REG_R0, tmp64);
-#endif
-            break;
-        case INDEX_op_br:
-            label = tci_read_label(&tb_ptr);
-            assert(tb_ptr == old_code_ptr + op_size);
-            tb_ptr = (uint8_t *)label;
-            continue;
-        case INDEX_op_setcond_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            condition = *tb_ptr++;
-            tci_write_reg32(t0, tci_compare32(t1, t2, condition));
-            break;
-#if TCG_TARGET_REG_BITS == 32
-        case INDEX_op_setcond2_i32:
-            t0 = *tb_ptr++;
-            tmp64 = tci_read_r64(&tb_ptr);
-            v64 = tci_read_ri64(&tb_ptr);
-            condition = *tb_ptr++;
-            tci_write_reg32(t0, tci_compare64(tmp64, v64, condition));
-            break;
-#elif TCG_TARGET_REG_BITS == 64
-        case INDEX_op_setcond_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            condition = *tb_ptr++;
-            tci_write_reg64(t0, tci_compare64(t1, t2, condition));
-            break;
+#define OP_call \
+    do { \
+        tci_tb_ptr = (uintptr_t)pc; \
+        regs[TCG_REG_R0] = \
+            ((helper_function)C(0))(regs[TCG_REG_R0], regs[TCG_REG_R1], \
+                                    regs[TCG_REG_R2], regs[TCG_REG_R3], \
+                                    regs[TCG_REG_R5]); \
+    } while (0)
 #endif
-        case INDEX_op_mov_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
-        case INDEX_op_movi_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_i32(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
 
-            /* Load/store operations (32 bit). */
-
-        case INDEX_op_ld8u_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            tci_write_reg8(t0, *(uint8_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld8s_i32:
-        case INDEX_op_ld16u_i32:
-            TODO();
-            break;
-        case INDEX_op_ld16s_i32:
-            TODO();
-            break;
-        case INDEX_op_ld_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            tci_write_reg32(t0, *(uint32_t *)(t1 + t2));
-            break;
-        case INDEX_op_st8_i32:
-            t0 = tci_read_r8(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            *(uint8_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st16_i32:
-            t0 = tci_read_r16(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            *(uint16_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st_i32:
-            t0 = tci_read_r32(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            assert(t1 != sp_value || (int32_t)t2 < 0);
-            *(uint32_t *)(t1 + t2) = t0;
-            break;
-
-            /* Arithmetic operations (32 bit). */
+#define OP_mov          R(0) = R(1)
+#define OP_movi         R(0) = C(0)
+
+/* Load/store operations on host memory. */
+
+#define HOST_ADDR       (R(1) + C(0))
+#define OP_ld8u         R(0) = *(uint8_t *)HOST_ADDR
+#define OP_ld8s_i32     R(0) = (uint32_t)*(int8_t *)HOST_ADDR
+#define OP_ld16u        R(0) = *(uint16_t *)HOST_ADDR
+#define OP_ld16s_i32    R(0) = (uint32_t)*(int16_t *)HOST_ADDR
+#define OP_ld32u        R(0) = *(uint32_t *)HOST_ADDR
+#define OP_st8          *(uint8_t *)HOST_ADDR = R(0)
+#define OP_st16         *(uint16_t *)HOST_ADDR = R(0)
+#define OP_st32         *(uint32_t *)HOST_ADDR = R(0)
+#define OP_ld8s_i64     R(0) = *(int8_t *)HOST_ADDR
+#define OP_ld16s_i64    R(0) = *(int16_t *)HOST_ADDR
+#define OP_ld32s_i64    R(0) = *(int32_t *)HOST_ADDR
+#define OP_ld_i64       R(0) = *(uint64_t *)HOST_ADDR
+#define OP_st_i64       *(uint64_t *)HOST_ADDR = R(0)
+
+/* Arithmetic operations (32 bit).  The inputs are truncated, the
+   result is zero-extended.  */
+
+#define I32(expr)       R(0) = (uint32_t)(expr)
+#define A32             ((uint32_t)R(1))
+#define OP_add_i32_rr   I32(R(1) + R(2))
+#define OP_add_i32_ri   I32(R(1) + C(0))
+#define OP_sub_i32_rr   I32(R(1) - R(2))
+#define OP_sub_i32_ri   I32(R(1) - C(0))
+#define OP_mul_i32_rr   I32(A32 * (uint32_t)R(2))
+#define OP_mul_i32_ri   I32(A32 * (uint32_t)C(0))
+#define OP_and_i32_rr   I32(R(1) & R(2))
+#define OP_and_i32_ri   I32(R(1) & C(0))
+#define OP_or_i32_rr    I32(R(1) | R(2))
+#define OP_or_i32_ri    I32(R(1) | C(0))
+#define OP_xor_i32_rr   I32(R(1) ^ R(2))
+#define OP_xor_i32_ri   I32(R(1) ^ C(0))
+#define OP_shl_i32_rr   I32(A32 << (R(2) & 31))
+#define OP_shl_i32_ri   I32(A32 << (C(0) & 31))
+#define OP_shr_i32_rr   I32(A32 >> (R(2) & 31))
+#define OP_shr_i32_ri   I32(A32 >> (C(0) & 31))
+#define OP_sar_i32_rr   I32((int32_t)A32 >> (R(2) & 31))
+#define OP_sar_i32_ri   I32((int32_t)A32 >> (C(0) & 31))
+#define OP_rotl_i32_rr  I32(rol32(A32, R(2) & 31))
+#define OP_rotl_i32_ri  I32(rol32(A32, C(0) & 31))
+#define OP_rotr_i32_rr  I32(ror32(A32, R(2) & 31))
+#define OP_rotr_i32_ri  I32(ror32(A32, C(0) & 31))
+#define OP_div_i32      I32((int32_t)A32 / (int32_t)R(2))
+#define OP_divu_i32     I32(A32 / (uint32_t)R(2))
+#define OP_rem_i32      I32((int32_t)A32 % (int32_t)R(2))
+#define OP_remu_i32     I32(A32 % (uint32_t)R(2))
+#define OP_neg_i32      I32(-R(1))
+#define OP_not_i32      I32(~R(1))
+#define OP_ext8s_i32    I32((int8_t)R(1))
+#define OP_ext8u_i32    I32((uint8_t)R(1))
+#define OP_ext16s_i32   I32((int16_t)R(1))
+#define OP_ext16u_i32   I32((uint16_t)R(1))
+#define OP_bswap16_i32  I32(bswap16(R(1)))
+#define OP_bswap32_i32  I32(bswap32(R(1)))
+#define OP_deposit_i32  I32((R(1) & ~C(0)) | ((R(2) << B(3)) & C(0)))
+#define OP_setcond_i32_rr \
+    R(0) = tci_compare32(R(1), R(2), B(3))
+#define OP_setcond_i32_ri \
+    R(0) = tci_compare32(R(1), C(0), B(2))
+
+/* Branch to LABEL if A OP B, compared as type T. */
+#define BRCOND(T, a, op, b, label) \
+    if ((T)(a) op (T)(b)) { \
+        JUMP(label); \
+    }
+#define OP_brcond_i32_rr_eq     BRCOND(uint32_t, R(0), ==, R(1), C(0))
+#define OP_brcond_i32_rr_ne     BRCOND(uint32_t, R(0), !=, R(1), C(0))
+#define OP_brcond_i32_rr_lt     BRCOND(int32_t, R(0), <, R(1), C(0))
+#define OP_brcond_i32_rr_ge     BRCOND(int32_t, R(0), >=, R(1), C(0))
+#define OP_brcond_i32_rr_le     BRCOND(int32_t, R(0), <=, R(1), C(0))
+#define OP_brcond_i32_rr_gt     BRCOND(int32_t, R(0), >, R(1), C(0))
+#define OP_brcond_i32_rr_ltu    BRCOND(uint32_t, R(0), <, R(1), C(0))
+#define OP_brcond_i32_rr_geu    BRCOND(uint32_t, R(0), >=, R(1), C(0))
+#define OP_brcond_i32_rr_leu    BRCOND(uint32_t, R(0), <=, R(1), C(0))
+#define OP_brcond_i32_rr_gtu    BRCOND(uint32_t, R(0), >, R(1), C(0))
+#define OP_brcond_i32_ri_eq     BRCOND(uint32_t, R(0), ==, C(0), C(1))
+#define OP_brcond_i32_ri_ne     BRCOND(uint32_t, R(0), !=, C(0), C(1))
+#define OP_brcond_i32_ri_lt     BRCOND(int32_t, R(0), <, C(0), C(1))
+#define OP_brcond_i32_ri_ge     BRCOND(int32_t, R(0), >=, C(0), C(1))
+#define OP_brcond_i32_ri_le     BRCOND(int32_t, R(0), <=, C(0), C(1))
+#define OP_brcond_i32_ri_gt     BRCOND(int32_t, R(0), >, C(0), C(1))
+#define OP_brcond_i32_ri_ltu    BRCOND(uint32_t, R(0), <, C(0), C(1))
+#define OP_brcond_i32_ri_geu    BRCOND(uint32_t, R(0), >=, C(0), C(1))
+#define OP_brcond_i32_ri_leu    BRCOND(uint32_t, R(0), <=, C(0), C(1))
+#define OP_brcond_i32_ri_gtu    BRCOND(uint32_t, R(0), >, C(0), C(1))
 
-        case INDEX_op_add_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 + t2);
-            break;
-        case INDEX_op_sub_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 - t2);
-            break;
-        case INDEX_op_mul_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 * t2);
-            break;
-#if TCG_TARGET_HAS_div_i32
-        case INDEX_op_div_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, (int32_t)t1 / (int32_t)t2);
-            break;
-        case INDEX_op_divu_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 / t2);
-            break;
-        case INDEX_op_rem_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, (int32_t)t1 % (int32_t)t2);
-            break;
-        case INDEX_op_remu_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 % t2);
-            break;
-#elif TCG_TARGET_HAS_div2_i32
-        case INDEX_op_div2_i32:
-        case INDEX_op_divu2_i32:
-            TODO();
-            break;
-#endif
-        case INDEX_op_and_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 & t2);
-            break;
-        case INDEX_op_or_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 | t2);
-            break;
-        case INDEX_op_xor_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 ^ t2);
-            break;
+#if TCG_TARGET_REG_BITS == 32
+/* Create a 64 bit value from two 32 bit registers. */
+#define R64(lo)         ((uint64_t)R((lo) + 1) << 32 | R(lo))
+#define SET64(v) \
+    do { \
+        uint64_t v_ = (v); \
+        R(0) = v_; \
+        R(1) = v_ >> 32; \
+    } while (0)
+#define OP_add2_i32     SET64(R64(2) + R64(4))
+#define OP_sub2_i32     SET64(R64(2) - R64(4))
+#define OP_mulu2_i32    SET64((uint64_t)R(2) * R(3))
+#define OP_brcond2_i32 \
+    if (tci_compare64(R64(0), R64(2), B(4))) { \
+        JUMP(C(0)); \
+    }
+#define OP_setcond2_i32 \
+    R(0) = tci_compare64(R64(1), R64(3), B(5))
+#else
+#define R64(n)          R(n)
+#define SET64(v)        R(0) = (v)
+
+/* Arithmetic operations (64 bit). */
+
+#define OP_add_i64_rr   R(0) = R(1) + R(2)
+#define OP_add_i64_ri   R(0) = R(1) + C(0)
+#define OP_sub_i64_rr   R(0) = R(1) - R(2)
+#define OP_sub_i64_ri   R(0) = R(1) - C(0)
+#define OP_mul_i64_rr   R(0) = R(1) * R(2)
+#define OP_mul_i64_ri   R(0) = R(1) * C(0)
+#define OP_and_i64_rr   R(0) = R(1) & R(2)
+#define OP_and_i64_ri   R(0) = R(1) & C(0)
+#define OP_or_i64_rr    R(0) = R(1) | R(2)
+#define OP_or_i64_ri    R(0) = R(1) | C(0)
+#define OP_xor_i64_rr   R(0) = R(1) ^ R(2)
+#define OP_xor_i64_ri   R(0) = R(1) ^ C(0)
+#define OP_shl_i64_rr   R(0) = R(1) << (R(2) & 63)
+#define OP_shl_i64_ri   R(0) = R(1) << (C(0) & 63)
+#define OP_shr_i64_rr   R(0) = R(1) >> (R(2) & 63)
+#define OP_shr_i64_ri   R(0) = R(1) >> (C(0) & 63)
+#define OP_sar_i64_rr   R(0) = (int64_t)R(1) >> (R(2) & 63)
+#define OP_sar_i64_ri   R(0) = (int64_t)R(1) >> (C(0) & 63)
+#define OP_rotl_i64_rr  R(0) = rol64(R(1), R(2) & 63)
+#define OP_rotl_i64_ri  R(0) = rol64(R(1), C(0) & 63)
+#define OP_rotr_i64_rr  R(0) = ror64(R(1), R(2) & 63)
+#define OP_rotr_i64_ri  R(0) = ror64(R(1), C(0) & 63)
+#define OP_neg_i64      R(0) = -R(1)
+#define OP_not_i64      R(0) = ~R(1)
+#define OP_ext8s_i64    R(0) = (int8_t)R(1)
+#define OP_ext8u_i64    R(0) = (uint8_t)R(1)
+#define OP_ext16s_i64   R(0) = (int16_t)R(1)
+#define OP_ext16u_i64   R(0) = (uint16_t)R(1)
+#define OP_ext32s_i64   R(0) = (int32_t)R(1)
+#define OP_ext32u_i64   R(0) = (uint32_t)R(1)
+#define OP_bswap16_i64  R(0) = bswap16(R(1))
+#define OP_bswap32_i64  R(0) = bswap32(R(1))
+#define OP_bswap64_i64  R(0) = bswap64(R(1))
+#define OP_deposit_i64  R(0) = (R(1) & ~C(0)) | ((R(2) << B(3)) & C(0))
+#define OP_setcond_i64_rr \
+    R(0) = tci_compare64(R(1), R(2), B(3))
+#define OP_setcond_i64_ri \
+    R(0) = tci_compare64(R(1), C(0), B(2))
+
+#define OP_brcond_i64_rr_eq     BRCOND(uint64_t, R(0), ==, R(1), C(0))
+#define OP_brcond_i64_rr_ne     BRCOND(uint64_t, R(0), !=, R(1), C(0))
+#define OP_brcond_i64_rr_lt     BRCOND(int64_t, R(0), <, R(1), C(0))
+#define OP_brcond_i64_rr_ge     BRCOND(int64_t, R(0), >=, R(1), C(0))
+#define OP_brcond_i64_rr_le     BRCOND(int64_t, R(0), <=, R(1), C(0))
+#define OP_brcond_i64_rr_gt     BRCOND(int64_t, R(0), >, R(1), C(0))
+#define OP_brcond_i64_rr_ltu    BRCOND(uint64_t, R(0), <, R(1), C(0))
+#define OP_brcond_i64_rr_geu    BRCOND(uint64_t, R(0), >=, R(1), C(0))
+#define OP_brcond_i64_rr_leu    BRCOND(uint64_t, R(0), <=, R(1), C(0))
+#define OP_brcond_i64_rr_gtu    BRCOND(uint64_t, R(0), >, R(1), C(0))
+#define OP_brcond_i64_ri_eq     BRCOND(uint64_t, R(0), ==, C(0), C(1))
+#define OP_brcond_i64_ri_ne     BRCOND(uint64_t, R(0), !=, C(0), C(1))
+#define OP_brcond_i64_ri_lt     BRCOND(int64_t, R(0), <, C(0), C(1))
+#define OP_brcond_i64_ri_ge     BRCOND(int64_t, R(0), >=, C(0), C(1))
+#define OP_brcond_i64_ri_le     BRCOND(int64_t, R(0), <=, C(0), C(1))
+#define OP_brcond_i64_ri_gt     BRCOND(int64_t, R(0), >, C(0), C(1))
+#define OP_brcond_i64_ri_ltu    BRCOND(uint64_t, R(0), <, C(0), C(1))
+#define OP_brcond_i64_ri_geu    BRCOND(uint64_t, R(0), >=, C(0), C(1))
+#define OP_brcond_i64_ri_leu    BRCOND(uint64_t, R(0), <=, C(0), C(1))
+#define OP_brcond_i64_ri_gtu    BRCOND(uint64_t, R(0), >, C(0), C(1))
+#endif /* TCG_TARGET_REG_BITS == 64 */
 
-            /* Shift/rotate operations (32 bit). */
+/* QEMU specific operations: the data registers (one, or two for i64 on
+   a 32 bit host) come first, then the address registers and, in system
+   emulation, the mmu index.  */
 
-        case INDEX_op_shl_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 << (t2 & 31));
-            break;
-        case INDEX_op_shr_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, t1 >> (t2 & 31));
-            break;
-        case INDEX_op_sar_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, ((int32_t)t1 >> (t2 & 31)));
-            break;
-#if TCG_TARGET_HAS_rot_i32
-        case INDEX_op_rotl_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, rol32(t1, t2 & 31));
-            break;
-        case INDEX_op_rotr_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri32(&tb_ptr);
-            t2 = tci_read_ri32(&tb_ptr);
-            tci_write_reg32(t0, ror32(t1, t2 & 31));
-            break;
-#endif
-#if TCG_TARGET_HAS_deposit_i32
-        case INDEX_op_deposit_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            t2 = tci_read_r32(&tb_ptr);
-            tmp16 = *tb_ptr++;
-            tmp8 = *tb_ptr++;
-            tmp32 = (((1 << tmp8) - 1) << tmp16);
-            tci_write_reg32(t0, (t1 & ~tmp32) | ((t2 << tmp16) & tmp32));
-            break;
-#endif
-        case INDEX_op_brcond_i32:
-            t0 = tci_read_r32(&tb_ptr);
-            t1 = tci_read_ri32(&tb_ptr);
-            condition = *tb_ptr++;
-            label = tci_read_label(&tb_ptr);
-            if (tci_compare32(t0, t1, condition)) {
-                assert(tb_ptr == old_code_ptr + op_size);
-                tb_ptr = (uint8_t *)label;
-                continue;
-            }
-            break;
 #if TCG_TARGET_REG_BITS == 32
-        case INDEX_op_add2_i32:
-            t0 = *tb_ptr++;
-            t1 = *tb_ptr++;
-            tmp64 = tci_read_r64(&tb_ptr);
-            tmp64 += tci_read_r64(&tb_ptr);
-            tci_write_reg64(t1, t0, tmp64);
-            break;
-        case INDEX_op_sub2_i32:
-            t0 = *tb_ptr++;
-            t1 = *tb_ptr++;
-            tmp64 = tci_read_r64(&tb_ptr);
-            tmp64 -= tci_read_r64(&tb_ptr);
-            tci_write_reg64(t1, t0, tmp64);
-            break;
-        case INDEX_op_brcond2_i32:
-            tmp64 = tci_read_r64(&tb_ptr);
-            v64 = tci_read_ri64(&tb_ptr);
-            condition = *tb_ptr++;
-            label = tci_read_label(&tb_ptr);
-            if (tci_compare64(tmp64, v64, condition)) {
-                assert(tb_ptr == old_code_ptr + op_size);
-                tb_ptr = (uint8_t *)label;
-                continue;
-            }
-            break;
-        case INDEX_op_mulu2_i32:
-            t0 = *tb_ptr++;
-            t1 = *tb_ptr++;
-            t2 = tci_read_r32(&tb_ptr);
-            tmp64 = tci_read_r32(&tb_ptr);
-            tci_write_reg64(t1, t0, t2 * tmp64);
-            break;
-#endif /* TCG_TARGET_REG_BITS == 32 */
-#if TCG_TARGET_HAS_ext8s_i32
-        case INDEX_op_ext8s_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r8s(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
-#endif
-#if TCG_TARGET_HAS_ext16s_i32
-        case INDEX_op_ext16s_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16s(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
-#endif
-#if TCG_TARGET_HAS_ext8u_i32
-        case INDEX_op_ext8u_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r8(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
-#endif
-#if TCG_TARGET_HAS_ext16u_i32
-        case INDEX_op_ext16u_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16(&tb_ptr);
-            tci_write_reg32(t0, t1);
-            break;
-#endif
-#if TCG_TARGET_HAS_bswap16_i32
-        case INDEX_op_bswap16_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16(&tb_ptr);
-            tci_write_reg32(t0, bswap16(t1));
-            break;
-#endif
-#if TCG_TARGET_HAS_bswap32_i32
-        case INDEX_op_bswap32_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg32(t0, bswap32(t1));
-            break;
-#endif
-#if TCG_TARGET_HAS_not_i32
-        case INDEX_op_not_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg32(t0, ~t1);
-            break;
-#endif
-#if TCG_TARGET_HAS_neg_i32
-        case INDEX_op_neg_i32:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg32(t0, -t1);
-            break;
+# define DATA64         2
+#else
+# define DATA64         1
 #endif
-#if TCG_TARGET_REG_BITS == 64
-        case INDEX_op_mov_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
-        case INDEX_op_movi_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_i64(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
-
-            /* Load/store operations (64 bit). */
-
-        case INDEX_op_ld8u_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            tci_write_reg8(t0, *(uint8_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld8s_i64:
-        case INDEX_op_ld16u_i64:
-        case INDEX_op_ld16s_i64:
-            TODO();
-            break;
-        case INDEX_op_ld32u_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            tci_write_reg32(t0, *(uint32_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld32s_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            tci_write_reg32s(t0, *(int32_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            tci_write_reg64(t0, *(uint64_t *)(t1 + t2));
-            break;
-        case INDEX_op_st8_i64:
-            t0 = tci_read_r8(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            *(uint8_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st16_i64:
-            t0 = tci_read_r16(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            *(uint16_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st32_i64:
-            t0 = tci_read_r32(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            *(uint32_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st_i64:
-            t0 = tci_read_r64(&tb_ptr);
-            t1 = tci_read_r(&tb_ptr);
-            t2 = tci_read_s32(&tb_ptr);
-            assert(t1 != sp_value || (int32_t)t2 < 0);
-            *(uint64_t *)(t1 + t2) = t0;
-            break;
 
-            /* Arithmetic operations (64 bit). */
-
-        case INDEX_op_add_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 + t2);
-            break;
-        case INDEX_op_sub_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 - t2);
-            break;
-        case INDEX_op_mul_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 * t2);
-            break;
-#if TCG_TARGET_HAS_div_i64
-        case INDEX_op_div_i64:
-        case INDEX_op_divu_i64:
-        case INDEX_op_rem_i64:
-        case INDEX_op_remu_i64:
-            TODO();
-            break;
-#elif TCG_TARGET_HAS_div2_i64
-        case INDEX_op_div2_i64:
-        case INDEX_op_divu2_i64:
-            TODO();
-            break;
+#if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
+# define TADDR(n)       ((uint64_t)R((n) + 1) << 32 | R(n))
+# define MMUIDX(n)      B((n) + 2)
+#else
+# define TADDR(n)       ((target_ulong)R(n))
+# define MMUIDX(n)      B((n) + 1)
 #endif
-        case INDEX_op_and_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 & t2);
-            break;
-        case INDEX_op_or_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 | t2);
-            break;
-        case INDEX_op_xor_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 ^ t2);
-            break;
 
-            /* Shift/rotate operations (64 bit). */
+#ifdef CONFIG_SOFTMMU
+# define qemu_ld_ub(n) \
+    helper_ret_ldub_mmu(env, TADDR(n), MMUIDX(n), (uintptr_t)pc)
+# define qemu_ld_leuw(n) \
+    helper_le_lduw_mmu(env, TADDR(n), MMUIDX(n), (uintptr_t)pc)
+# define qemu_ld_leul(n) \
+    helper_le_ldul_mmu(env, TADDR(n), MMUIDX(n), (uintptr_t)pc)
+# define qemu_ld_leq(n) \
+    helper_le_ldq_mmu(env, TADDR(n), MMUIDX(n), (uintptr_t)pc)
+# define qemu_ld_beuw(n) \
+    helper_be_lduw_mmu(env, TADDR(n), MMUIDX(n), (uintptr_t)pc)
+# define qemu_ld_beul(n) \
+    helper_be_ldul_mmu(env, TADDR(n), MMUIDX(n), (uintptr_t)pc)
+# define qemu_ld_beq(n) \
+    helper_be_ldq_mmu(env, TADDR(n), MMUIDX(n), (uintptr_t)pc)
+# define qemu_st_b(n, X) \
+    helper_ret_stb_mmu(env, TADDR(n), X, MMUIDX(n), (uintptr_t)pc)
+# define qemu_st_lew(n, X) \
+    helper_le_stw_mmu(env, TADDR(n), X, MMUIDX(n), (uintptr_t)pc)
+# define qemu_st_lel(n, X) \
+    helper_le_stl_mmu(env, TADDR(n), X, MMUIDX(n), (uintptr_t)pc)
+# define qemu_st_leq(n, X) \
+    helper_le_stq_mmu(env, TADDR(n), X, MMUIDX(n), (uintptr_t)pc)
+# define qemu_st_bew(n, X) \
+    helper_be_stw_mmu(env, TADDR(n), X, MMUIDX(n), (uintptr_t)pc)
+# define qemu_st_bel(n, X) \
+    helper_be_stl_mmu(env, TADDR(n), X, MMUIDX(n), (uintptr_t)pc)
+# define qemu_st_beq(n, X) \
+    helper_be_stq_mmu(env, TADDR(n), X, MMUIDX(n), (uintptr_t)pc)
+#else
+# define qemu_ld_ub(n)          ldub_p(g2h(TADDR(n)))
+# define qemu_ld_leuw(n)        lduw_le_p(g2h(TADDR(n)))
+# define qemu_ld_leul(n)        (uint32_t)ldl_le_p(g2h(TADDR(n)))
+# define qemu_ld_leq(n)         ldq_le_p(g2h(TADDR(n)))
+# define qemu_ld_beuw(n)        lduw_be_p(g2h(TADDR(n)))
+# define qemu_ld_beul(n)        (uint32_t)ldl_be_p(g2h(TADDR(n)))
+# define qemu_ld_beq(n)         ldq_be_p(g2h(TADDR(n)))
+# define qemu_st_b(n, X)        stb_p(g2h(TADDR(n)), X)
+# define qemu_st_lew(n, X)      stw_le_p(g2h(TADDR(n)), X)
+# define qemu_st_lel(n, X)      stl_le_p(g2h(TADDR(n)), X)
+# define qemu_st_leq(n, X)      stq_le_p(g2h(TADDR(n)), X)
+# define qemu_st_bew(n, X)      stw_be_p(g2h(TADDR(n)), X)
+# define qemu_st_bel(n, X)      stl_be_p(g2h(TADDR(n)), X)
+# define qemu_st_beq(n, X)      stq_be_p(g2h(TADDR(n)), X)
+#endif
+
+#define OP_qemu_ld_i32_ub       I32(qemu_ld_ub(1))
+#define OP_qemu_ld_i32_sb       I32((int8_t)qemu_ld_ub(1))
+#define OP_qemu_ld_i32_leuw     I32(qemu_ld_leuw(1))
+#define OP_qemu_ld_i32_lesw     I32((int16_t)qemu_ld_leuw(1))
+#define OP_qemu_ld_i32_leul     I32(qemu_ld_leul(1))
+#define OP_qemu_ld_i32_beuw     I32(qemu_ld_beuw(1))
+#define OP_qemu_ld_i32_besw     I32((int16_t)qemu_ld_beuw(1))
+#define OP_qemu_ld_i32_beul     I32(qemu_ld_beul(1))
+#define OP_qemu_ld_i64_ub       SET64(qemu_ld_ub(DATA64))
+#define OP_qemu_ld_i64_sb       SET64((int8_t)qemu_ld_ub(DATA64))
+#define OP_qemu_ld_i64_leuw     SET64(qemu_ld_leuw(DATA64))
+#define OP_qemu_ld_i64_lesw     SET64((int16_t)qemu_ld_leuw(DATA64))
+#define OP_qemu_ld_i64_leul     SET64(qemu_ld_leul(DATA64))
+#define OP_qemu_ld_i64_lesl     SET64((int32_t)qemu_ld_leul(DATA64))
+#define OP_qemu_ld_i64_leq      SET64(qemu_ld_leq(DATA64))
+#define OP_qemu_ld_i64_beuw     SET64(qemu_ld_beuw(DATA64))
+#define OP_qemu_ld_i64_besw     SET64((int16_t)qemu_ld_beuw(DATA64))
+#define OP_qemu_ld_i64_beul     SET64(qemu_ld_beul(DATA64))
+#define OP_qemu_ld_i64_besl     SET64((int32_t)qemu_ld_beul(DATA64))
+#define OP_qemu_ld_i64_beq      SET64(qemu_ld_beq(DATA64))
+#define OP_qemu_st_i32_b        qemu_st_b(1, R(0))
+#define OP_qemu_st_i32_lew      qemu_st_lew(1, R(0))
+#define OP_qemu_st_i32_lel      qemu_st_lel(1, R(0))
+#define OP_qemu_st_i32_bew      qemu_st_bew(1, R(0))
+#define OP_qemu_st_i32_bel      qemu_st_bel(1, R(0))
+#define OP_qemu_st_i64_b        qemu_st_b(DATA64, R64(0))
+#define OP_qemu_st_i64_lew      qemu_st_lew(DATA64, R64(0))
+#define OP_qemu_st_i64_lel      qemu_st_lel(DATA64, R64(0))
+#define OP_qemu_st_i64_leq      qemu_st_leq(DATA64, R64(0))
+#define OP_qemu_st_i64_bew      qemu_st_bew(DATA64, R64(0))
+#define OP_qemu_st_i64_bel      qemu_st_bel(DATA64, R64(0))
+#define OP_qemu_st_i64_beq      qemu_st_beq(DATA64, R64(0))
+
+/* Interpret the bytecode at pc.  Every instruction starts with the
+   address of its handler here, so an instruction jumps directly to the
+   next one.  Called with a NULL env by tci_init, to publish these
+   addresses; not inlined, so that there is only one copy of them.  */
+static uintptr_t __attribute__((noinline))
+tci_run(CPUArchState *env, const tcg_target_ulong *pc)
+{
+    static const void *const handlers[TCI_NB_OPS] = {
+#define DEF(name, nconst) [TCI_##name] = &&L_##name,
+#define FUSE(a, b) [TCI_##a##__##b] = &&L_##a##__##b,
+#include "tci-opc.h"
+    };
+    long tcg_temps[CPU_TEMP_BUF_NLONGS];
+    tcg_target_ulong regs[TCG_TARGET_NB_REGS];
 
-        case INDEX_op_shl_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 << (t2 & 63));
-            break;
-        case INDEX_op_shr_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, t1 >> (t2 & 63));
-            break;
-        case INDEX_op_sar_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, ((int64_t)t1 >> (t2 & 63)));
-            break;
-#if TCG_TARGET_HAS_rot_i64
-        case INDEX_op_rotl_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, rol64(t1, t2 & 63));
-            break;
-        case INDEX_op_rotr_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_ri64(&tb_ptr);
-            t2 = tci_read_ri64(&tb_ptr);
-            tci_write_reg64(t0, ror64(t1, t2 & 63));
-            break;
-#endif
-#if TCG_TARGET_HAS_deposit_i64
-        case INDEX_op_deposit_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            t2 = tci_read_r64(&tb_ptr);
-            tmp16 = *tb_ptr++;
-            tmp8 = *tb_ptr++;
-            tmp64 = (((1ULL << tmp8) - 1) << tmp16);
-            tci_write_reg64(t0, (t1 & ~tmp64) | ((t2 << tmp16) & tmp64));
-            break;
-#endif
-        case INDEX_op_brcond_i64:
-            t0 = tci_read_r64(&tb_ptr);
-            t1 = tci_read_ri64(&tb_ptr);
-            condition = *tb_ptr++;
-            label = tci_read_label(&tb_ptr);
-            if (tci_compare64(t0, t1, condition)) {
-                assert(tb_ptr == old_code_ptr + op_size);
-                tb_ptr = (uint8_t *)label;
-                continue;
-            }
-            break;
-#if TCG_TARGET_HAS_ext8u_i64
-        case INDEX_op_ext8u_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r8(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
-#endif
-#if TCG_TARGET_HAS_ext8s_i64
-        case INDEX_op_ext8s_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r8s(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
-#endif
-#if TCG_TARGET_HAS_ext16s_i64
-        case INDEX_op_ext16s_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16s(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
-#endif
-#if TCG_TARGET_HAS_ext16u_i64
-        case INDEX_op_ext16u_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
-#endif
-#if TCG_TARGET_HAS_ext32s_i64
-        case INDEX_op_ext32s_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32s(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
-#endif
-#if TCG_TARGET_HAS_ext32u_i64
-        case INDEX_op_ext32u_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg64(t0, t1);
-            break;
-#endif
-#if TCG_TARGET_HAS_bswap16_i64
-        case INDEX_op_bswap16_i64:
-            TODO();
-            t0 = *tb_ptr++;
-            t1 = tci_read_r16(&tb_ptr);
-            tci_write_reg64(t0, bswap16(t1));
-            break;
-#endif
-#if TCG_TARGET_HAS_bswap32_i64
-        case INDEX_op_bswap32_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r32(&tb_ptr);
-            tci_write_reg64(t0, bswap32(t1));
-            break;
-#endif
-#if TCG_TARGET_HAS_bswap64_i64
-        case INDEX_op_bswap64_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            tci_write_reg64(t0, bswap64(t1));
-            break;
-#endif
-#if TCG_TARGET_HAS_not_i64
-        case INDEX_op_not_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            tci_write_reg64(t0, ~t1);
-            break;
-#endif
-#if TCG_TARGET_HAS_neg_i64
-        case INDEX_op_neg_i64:
-            t0 = *tb_ptr++;
-            t1 = tci_read_r64(&tb_ptr);
-            tci_write_reg64(t0, -t1);
-            break;
-#endif
-#endif /* TCG_TARGET_REG_BITS == 64 */
+    if (!env) {
+        memcpy(tci_handlers, handlers, sizeof(handlers));
+        return 0;
+    }
 
-            /* QEMU specific operations. */
+    regs[TCG_AREG0] = (tcg_target_ulong)env;
+    regs[TCG_REG_CALL_STACK] = (uintptr_t)(tcg_temps + CPU_TEMP_BUF_NLONGS);
+    DISPATCH();
+
+#define DEF(name, nconst) \
+    L_##name: \
+        OP_##name; \
+        STEP(nconst); \
+        DISPATCH();
+#define FUSE(a, b) \
+    L_##a##__##b: \
+        OP_##a; \
+        STEP(TCI_NCONST_##a); \
+        OP_##b; \
+        STEP(TCI_NCONST_##b); \
+        DISPATCH();
+#include "tci-opc.h"
+}
 
-#if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
-        case INDEX_op_debug_insn_start:
-            TODO();
-            break;
-#else
-        case INDEX_op_debug_insn_start:
-            TODO();
-            break;
-#endif
-        case INDEX_op_exit_tb:
-            next_tb = *(uint64_t *)tb_ptr;
-            goto exit;
-            break;
-        case INDEX_op_goto_tb:
-            t0 = tci_read_i32(&tb_ptr);
-            assert(tb_ptr == old_code_ptr + op_size);
-            tb_ptr += (int32_t)t0;
-            continue;
-        case INDEX_op_qemu_ld_i32:
-            t0 = *tb_ptr++;
-            taddr = tci_read_ulong(&tb_ptr);
-            memop = tci_read_i(&tb_ptr);
-            switch (memop) {
-            case MO_UB:
-                tmp32 = qemu_ld_ub;
-                break;
-            case MO_SB:
-                tmp32 = (int8_t)qemu_ld_ub;
-                break;
-            case MO_LEUW:
-                tmp32 = qemu_ld_leuw;
-                break;
-            case MO_LESW:
-                tmp32 = (int16_t)qemu_ld_leuw;
-                break;
-            case MO_LEUL:
-                tmp32 = qemu_ld_leul;
-                break;
-            case MO_BEUW:
-                tmp32 = qemu_ld_beuw;
-                break;
-            case MO_BESW:
-                tmp32 = (int16_t)qemu_ld_beuw;
-                break;
-            case MO_BEUL:
-                tmp32 = qemu_ld_beul;
-                break;
-            default:
-                tcg_abort();
-            }
-            tci_write_reg(t0, tmp32);
-            break;
-        case INDEX_op_qemu_ld_i64:
-            t0 = *tb_ptr++;
-            if (TCG_TARGET_REG_BITS == 32) {
-                t1 = *tb_ptr++;
-            }
-            taddr = tci_read_ulong(&tb_ptr);
-            memop = tci_read_i(&tb_ptr);
-            switch (memop) {
-            case MO_UB:
-                tmp64 = qemu_ld_ub;
-                break;
-            case MO_SB:
-                tmp64 = (int8_t)qemu_ld_ub;
-                break;
-            case MO_LEUW:
-                tmp64 = qemu_ld_leuw;
-                break;
-            case MO_LESW:
-                tmp64 = (int16_t)qemu_ld_leuw;
-                break;
-            case MO_LEUL:
-                tmp64 = qemu_ld_leul;
-                break;
-            case MO_LESL:
-                tmp64 = (int32_t)qemu_ld_leul;
-                break;
-            case MO_LEQ:
-                tmp64 = qemu_ld_leq;
-                break;
-            case MO_BEUW:
-                tmp64 = qemu_ld_beuw;
-                break;
-            case MO_BESW:
-                tmp64 = (int16_t)qemu_ld_beuw;
-                break;
-            case MO_BEUL:
-                tmp64 = qemu_ld_beul;
-                break;
-            case MO_BESL:
-                tmp64 = (int32_t)qemu_ld_beul;
-                break;
-            case MO_BEQ:
-                tmp64 = qemu_ld_beq;
-                break;
-            default:
-                tcg_abort();
-            }
-            tci_write_reg(t0, tmp64);
-            if (TCG_TARGET_REG_BITS == 32) {
-                tci_write_reg(t1, tmp64 >> 32);
-            }
-            break;
-        case INDEX_op_qemu_st_i32:
-            t0 = tci_read_r(&tb_ptr);
-            taddr = tci_read_ulong(&tb_ptr);
-            memop = tci_read_i(&tb_ptr);
-            switch (memop) {
-            case MO_UB:
-                qemu_st_b(t0);
-                break;
-            case MO_LEUW:
-                qemu_st_lew(t0);
-                break;
-            case MO_LEUL:
-                qemu_st_lel(t0);
-                break;
-            case MO_BEUW:
-                qemu_st_bew(t0);
-                break;
-            case MO_BEUL:
-                qemu_st_bel(t0);
-                break;
-            default:
-                tcg_abort();
-            }
-            break;
-        case INDEX_op_qemu_st_i64:
-            tmp64 = tci_read_r64(&tb_ptr);
-            taddr = tci_read_ulong(&tb_ptr);
-            memop = tci_read_i(&tb_ptr);
-            switch (memop) {
-            case MO_UB:
-                qemu_st_b(tmp64);
-                break;
-            case MO_LEUW:
-                qemu_st_lew(tmp64);
-                break;
-            case MO_LEUL:
-                qemu_st_lel(tmp64);
-                break;
-            case MO_LEQ:
-                qemu_st_leq(tmp64);
-                break;
-            case MO_BEUW:
-                qemu_st_bew(tmp64);
-                break;
-            case MO_BEUL:
-                qemu_st_bel(tmp64);
-                break;
-            case MO_BEQ:
-                qemu_st_beq(tmp64);
-                break;
-            default:
-                tcg_abort();
-            }
-            break;
-        default:
-            TODO();
-            break;
-        }
-        assert(tb_ptr == old_code_ptr + op_size);
-    }
-exit:
-    return next_tb;
+/* Interpret pseudo code in tb. */
+uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
+{
+    assert(tb_ptr);
+    return tci_run(env, (const tcg_target_ulong *)tb_ptr);
+}
+
+void tci_init(void)
+{
+    tci_run(NULL, NULL);
 }
@@ -0,0 +1,136 @@
+/*
+ *  Floating point throughput microbenchmark
+ *
+ *  Runs float32/float64 add, sub, mul and div in a dependent loop and
+ *  reports the throughput of each operation.  Every operation is timed
+ *  twice: once in round-to-nearest-even, where the softfloat host FPU
+ *  fast path applies, and once in round-toward-zero, which forces the
+ *  bit-exact software routines.  Run it natively and under qemu to
+ *  compare.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fenv.h>
+#include <sys/time.h>
+
+#define N_OPS   (4 * 1024 * 1024)
+#define N_LANES 8
+
+static int64_t get_clock_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+/* Use several independent chains so that the loop is bound by the
+ * throughput of the operation rather than by its latency.  The operands
+ * stay in a normal range so that no exceptions other than inexact are
+ * raised.
+ */
+#define DEFINE_BENCH(type, name, OP, seed, step)                        \
+static double bench_##name(int n)                                       \
+{                                                                       \
+    volatile type vstep = step;                                         \
+    type acc[N_LANES], s = vstep, r = 0;                                \
+    int i, j;                                                           \
+                                                                        \
+    for (j = 0; j < N_LANES; j++) {                                     \
+        acc[j] = seed + j;                                              \
+    }                                                                   \
+    for (i = 0; i < n; i += N_LANES) {                                  \
+        for (j = 0; j < N_LANES; j++) {                                 \
+            acc[j] = OP(acc[j], s);                                     \
+        }                                                               \
+    }                                                                   \
+    for (j = 0; j < N_LANES; j++) {                                     \
+        r += acc[j];                                                    \
+    }                                                                   \
+    return r;                                                           \
+}
+
+#define ADD(a, b) ((a) + (b))
+#define SUB(a, b) ((a) - (b))
+#define MUL(a, b) ((a) * (b))
+#define DIV(a, b) ((a) / (b))
+
+DEFINE_BENCH(float, f32_add, ADD, 1.0f, 0.3f)
+DEFINE_BENCH(float, f32_sub, SUB, 1e6f, 0.3f)
+DEFINE_BENCH(float, f32_mul, MUL, 1.0f, 1.0000001f)
+DEFINE_BENCH(float, f32_div, DIV, 1.0f, 1.0000001f)
+DEFINE_BENCH(double, f64_add, ADD, 1.0, 0.3)
+DEFINE_BENCH(double, f64_sub, SUB, 1e6, 0.3)
+DEFINE_BENCH(double, f64_mul, MUL, 1.0, 1.0000000001)
+DEFINE_BENCH(double, f64_div, DIV, 1.0, 1.0000000001)
+
+typedef struct {
+    const char *name;
+    double (*fn)(int n);
+} BenchDef;
+
+static const BenchDef benches[] = {
+    { "float32 add", bench_f32_add },
+    { "float32 sub", bench_f32_sub },
+    { "float32 mul", bench_f32_mul },
+    { "float32 div", bench_f32_div },
+    { "float64 add", bench_f64_add },
+    { "float64 sub", bench_f64_sub },
+    { "float64 mul", bench_f64_mul },
+    { "float64 div", bench_f64_div },
+};
+
+static double run_one(const BenchDef *b, int round, int n, double *res)
+{
+    int64_t t;
+
+    fesetround(round);
+    t = get_clock_us();
+    *res = b->fn(n);
+    t = get_clock_us() - t;
+    fesetround(FE_TONEAREST);
+    if (t <= 0) {
+        t = 1;
+    }
+    return (double)n / t;
+}
+
+int main(int argc, char **argv)
+{
+    int n = N_OPS;
+    int i;
+
+    if (argc > 1) {
+        n = atoi(argv[1]);
+        if (n <= 0) {
+            fprintf(stderr, "usage: %s [ops-per-test]\n", argv[0]);
+            return 1;
+        }
+    }
+    n = (n + N_LANES - 1) & ~(N_LANES - 1);
+
+    printf("%-12s %14s %14s\n", "op", "nearest Mop/s", "to-zero Mop/s");
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        double rn, rz, res_rn, res_rz;
+
+        rn = run_one(&benches[i], FE_TONEAREST, n, &res_rn);
+        rz = run_one(&benches[i], FE_TOWARDZERO, n, &res_rz);
+        printf("%-12s %14.1f %14.1f   (%g %g)\n", benches[i].name,
+               rn, rz, res_rn, res_rz);
+    }
+    return 0;
+}
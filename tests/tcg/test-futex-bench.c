@@ -0,0 +1,216 @@
+/*
+ *  thread wake-up latency microbenchmark
+ *
+ *  Two threads take turns: each one wakes the other and sleeps until it
+ *  is woken in turn, so a round trip costs two wake-ups.  This is done
+ *  with bare futexes, with a pthread mutex and condition variable, and
+ *  with a signal whose handler wakes the sender.  Under qemu the numbers
+ *  are dominated by the way in and out of the emulator around the
+ *  system calls and by the delivery of the signals.  Run it natively and
+ *  under qemu to compare.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <linux/futex.h>
+
+#define N_OPS    (20 * 1000)
+
+static int n = N_OPS;
+
+/* whose turn it is: 0 for the main thread, 1 for the other one */
+static volatile int turn;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+/* set by the signal handler of the other thread */
+static volatile int signalled;
+
+static int64_t get_clock_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static void report(const char *name, int n, int64_t t)
+{
+    if (t <= 0) {
+        t = 1;
+    }
+    printf("%-16s %8d round trips %10.3f us/round trip\n",
+           name, n, (double)t / n);
+}
+
+static void fail(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+static void futex_wait(volatile int *addr, int val)
+{
+    if (syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0) &&
+        errno != EAGAIN && errno != EINTR) {
+        fail("FUTEX_WAIT");
+    }
+}
+
+static void futex_wake(volatile int *addr)
+{
+    if (syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0) < 0) {
+        fail("FUTEX_WAKE");
+    }
+}
+
+/* give the turn to the other thread and wait for it to come back */
+static void futex_pass(void)
+{
+    turn = 1;
+    futex_wake(&turn);
+    while (turn != 0) {
+        futex_wait(&turn, 1);
+    }
+}
+
+static void *futex_thread(void *arg)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        while (turn != 1) {
+            futex_wait(&turn, 0);
+        }
+        turn = 0;
+        futex_wake(&turn);
+    }
+    return NULL;
+}
+
+static void cond_pass(void)
+{
+    pthread_mutex_lock(&lock);
+    turn = 1;
+    pthread_cond_signal(&cond);
+    while (turn != 0) {
+        pthread_cond_wait(&cond, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static void *cond_thread(void *arg)
+{
+    int i;
+
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < n; i++) {
+        while (turn != 1) {
+            pthread_cond_wait(&cond, &lock);
+        }
+        turn = 0;
+        pthread_cond_signal(&cond);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static void sigusr1_handler(int sig, siginfo_t *info, void *uc)
+{
+    signalled = 1;
+    futex_wake(&signalled);
+}
+
+static void *signal_thread(void *arg)
+{
+    for (;;) {
+        pause();
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    struct sigaction sa;
+    pthread_t thread;
+    sigset_t set;
+    int64_t t;
+    int i;
+
+    if (argc > 1) {
+        n = atoi(argv[1]);
+        if (n <= 0) {
+            fprintf(stderr, "usage: %s [round trips]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    turn = 0;
+    if (pthread_create(&thread, NULL, futex_thread, NULL)) {
+        fail("pthread_create");
+    }
+    t = get_clock_us();
+    for (i = 0; i < n; i++) {
+        futex_pass();
+    }
+    report("futex", n, get_clock_us() - t);
+    pthread_join(thread, NULL);
+
+    turn = 0;
+    if (pthread_create(&thread, NULL, cond_thread, NULL)) {
+        fail("pthread_create");
+    }
+    t = get_clock_us();
+    for (i = 0; i < n; i++) {
+        cond_pass();
+    }
+    report("pthread_cond", n, get_clock_us() - t);
+    pthread_join(thread, NULL);
+
+    /* only the other thread takes SIGUSR1; SA_SIGINFO as qemu only has
+       rt signal frames for some targets */
+    sa.sa_sigaction = sigusr1_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    if (sigaction(SIGUSR1, &sa, NULL)) {
+        fail("sigaction");
+    }
+    if (pthread_create(&thread, NULL, signal_thread, NULL)) {
+        fail("pthread_create");
+    }
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    t = get_clock_us();
+    for (i = 0; i < n; i++) {
+        signalled = 0;
+        if (pthread_kill(thread, SIGUSR1)) {
+            fail("pthread_kill");
+        }
+        while (!signalled) {
+            futex_wait(&signalled, 0);
+        }
+    }
+    report("signal", n, get_clock_us() - t);
+    return 0;
+}
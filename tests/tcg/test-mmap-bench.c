@@ -0,0 +1,198 @@
+/*
+ *  mmap microbenchmark
+ *
+ *  Keeps a few thousand anonymous mappings of mixed sizes and
+ *  protections alive, then times mmap/munmap churn, mprotect, and
+ *  syscalls that pass guest buffers to the kernel.  Last, it reserves
+ *  large heaps and commits only their start.  This is the pattern of
+ *  allocators and language runtimes, and it stresses the bookkeeping
+ *  of the guest address space rather than the translated code.  Run it
+ *  natively and under qemu to compare.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#define N_MAPS   4096
+#define N_CHURN  (64 * 1024)
+#define MAX_PAGES 16
+#define N_RESERVE 64
+#define RESERVE_SIZE (64 * 1024 * 1024)
+#define COMMIT_SIZE (1024 * 1024)
+
+typedef struct {
+    char *addr;
+    size_t len;
+} Mapping;
+
+static Mapping maps[N_MAPS];
+static size_t page_size;
+static uint32_t seed = 1;
+
+static uint32_t rnd(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static int64_t get_clock_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+/* Alternate the protections, so that neighbouring mappings stay
+ * distinct regions.
+ */
+static void map_one(int i)
+{
+    int prot = PROT_READ | (i & 1 ? PROT_WRITE : 0);
+
+    maps[i].len = (1 + rnd() % MAX_PAGES) * page_size;
+    maps[i].addr = mmap(NULL, maps[i].len, prot,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (maps[i].addr == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    if (prot & PROT_WRITE) {
+        maps[i].addr[0] = i;
+    }
+}
+
+static void unmap_range(char *addr, size_t len)
+{
+    if (munmap(addr, len)) {
+        perror("munmap");
+        exit(1);
+    }
+}
+
+static void unmap_one(int i)
+{
+    unmap_range(maps[i].addr, maps[i].len);
+}
+
+static void report(const char *name, int n, int64_t t)
+{
+    if (t <= 0) {
+        t = 1;
+    }
+    printf("%-10s %8d ops %10.3f us/op\n", name, n, (double)t / n);
+}
+
+int main(int argc, char **argv)
+{
+    int churn = N_CHURN;
+    int64_t t;
+    char buf[256];
+    int fd, i;
+
+    if (argc > 1) {
+        churn = atoi(argv[1]);
+        if (churn <= 0) {
+            fprintf(stderr, "usage: %s [churn-ops]\n", argv[0]);
+            return 1;
+        }
+    }
+    page_size = getpagesize();
+
+    t = get_clock_us();
+    for (i = 0; i < N_MAPS; i++) {
+        map_one(i);
+    }
+    report("mmap", N_MAPS, get_clock_us() - t);
+
+    /* replace random mappings, which fragments the address space */
+    t = get_clock_us();
+    for (i = 0; i < churn; i++) {
+        int j = rnd() % N_MAPS;
+
+        unmap_one(j);
+        map_one(j);
+    }
+    report("churn", churn, get_clock_us() - t);
+
+    t = get_clock_us();
+    for (i = 0; i < churn; i++) {
+        int j = rnd() % N_MAPS;
+        int prot = PROT_READ | (i & 1 ? PROT_WRITE : 0);
+
+        if (mprotect(maps[j].addr, maps[j].len, prot)) {
+            perror("mprotect");
+            return 1;
+        }
+    }
+    report("mprotect", churn, get_clock_us() - t);
+
+    /* every read checks that the buffer is mapped and writable */
+    fd = open("/dev/zero", O_RDONLY);
+    if (fd < 0) {
+        perror("/dev/zero");
+        return 1;
+    }
+    for (i = 0; i < N_MAPS; i++) {
+        if (mprotect(maps[i].addr, maps[i].len, PROT_READ | PROT_WRITE)) {
+            perror("mprotect");
+            return 1;
+        }
+    }
+    t = get_clock_us();
+    for (i = 0; i < churn; i++) {
+        int j = rnd() % N_MAPS;
+        size_t len = maps[j].len < sizeof(buf) ? maps[j].len : sizeof(buf);
+
+        if (read(fd, maps[j].addr + maps[j].len - len, len) != len) {
+            perror("read");
+            return 1;
+        }
+    }
+    report("read", churn, get_clock_us() - t);
+    close(fd);
+
+    t = get_clock_us();
+    for (i = 0; i < N_MAPS; i++) {
+        unmap_one(i);
+    }
+    report("munmap", N_MAPS, get_clock_us() - t);
+
+    /* reserve a large heap, commit its start, and release it */
+    t = get_clock_us();
+    for (i = 0; i < N_RESERVE; i++) {
+        char *p = mmap(NULL, RESERVE_SIZE, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if (p == MAP_FAILED) {
+            perror("mmap");
+            return 1;
+        }
+        if (mprotect(p, COMMIT_SIZE, PROT_READ | PROT_WRITE)) {
+            perror("mprotect");
+            return 1;
+        }
+        p[0] = i;
+        unmap_range(p, RESERVE_SIZE);
+    }
+    report("reserve", N_RESERVE, get_clock_us() - t);
+    return 0;
+}
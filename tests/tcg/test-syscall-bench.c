@@ -0,0 +1,216 @@
+/*
+ *  syscall rate microbenchmark
+ *
+ *  Times cheap syscalls whose arguments qemu has to check or convert:
+ *  plain buffers, iovec arrays, pollfd arrays, fd_sets and socket
+ *  addresses.  The kernel does little work for each of them, so the
+ *  numbers are dominated by the cost of getting in and out of the
+ *  emulator and of marshalling the arguments.  Run it natively and under
+ *  qemu to compare.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#define N_OPS    (100 * 1000)
+#define N_FDS    16
+#define N_IOV    4
+#define IOV_LEN  16
+
+static int pipes[N_FDS][2];
+
+static int64_t get_clock_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static void report(const char *name, int n, int64_t t)
+{
+    if (t <= 0) {
+        t = 1;
+    }
+    printf("%-16s %8d ops %10.3f us/op\n", name, n, (double)t / n);
+}
+
+static void fail(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int n = N_OPS;
+    char buf[N_IOV * IOV_LEN], out[N_IOV * IOV_LEN];
+    struct iovec iov[N_IOV];
+    struct pollfd pfd[N_FDS];
+    struct sockaddr_un sa, dst;
+    socklen_t salen, dstlen;
+    struct stat st;
+    int64_t t;
+    int sv[2];
+    int i, j;
+
+    if (argc > 1) {
+        n = atoi(argv[1]);
+        if (n <= 0) {
+            fprintf(stderr, "usage: %s [ops]\n", argv[0]);
+            return 1;
+        }
+    }
+    for (i = 0; i < N_FDS; i++) {
+        if (pipe(pipes[i])) {
+            fail("pipe");
+        }
+    }
+    for (i = 0; i < sizeof(buf); i++) {
+        buf[i] = i;
+    }
+
+    t = get_clock_us();
+    for (i = 0; i < n; i++) {
+        getppid();
+    }
+    report("getppid", n, get_clock_us() - t);
+
+    t = get_clock_us();
+    for (i = 0; i < n; i++) {
+        if (fstat(pipes[0][0], &st)) {
+            fail("fstat");
+        }
+    }
+    report("fstat", n, get_clock_us() - t);
+
+    t = get_clock_us();
+    for (i = 0; i < n; i++) {
+        if (write(pipes[0][1], buf, sizeof(buf)) != sizeof(buf) ||
+            read(pipes[0][0], out, sizeof(out)) != sizeof(out)) {
+            fail("pipe I/O");
+        }
+    }
+    report("read+write", n, get_clock_us() - t);
+
+    t = get_clock_us();
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < N_IOV; j++) {
+            iov[j].iov_base = buf + j * IOV_LEN;
+            iov[j].iov_len = IOV_LEN;
+        }
+        if (writev(pipes[0][1], iov, N_IOV) != sizeof(buf)) {
+            fail("writev");
+        }
+        for (j = 0; j < N_IOV; j++) {
+            iov[j].iov_base = out + (N_IOV - 1 - j) * IOV_LEN;
+        }
+        if (readv(pipes[0][0], iov, N_IOV) != sizeof(out)) {
+            fail("readv");
+        }
+    }
+    report("readv+writev", n, get_clock_us() - t);
+    for (j = 0; j < N_IOV; j++) {
+        if (memcmp(out + (N_IOV - 1 - j) * IOV_LEN, buf + j * IOV_LEN,
+                   IOV_LEN)) {
+            fprintf(stderr, "readv: bad data\n");
+            return 1;
+        }
+    }
+
+    /* one of the pipes is readable */
+    if (write(pipes[N_FDS / 2][1], buf, 1) != 1) {
+        fail("write");
+    }
+    t = get_clock_us();
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < N_FDS; j++) {
+            pfd[j].fd = pipes[j][0];
+            pfd[j].events = POLLIN;
+        }
+        if (poll(pfd, N_FDS, 0) != 1 || !(pfd[N_FDS / 2].revents & POLLIN)) {
+            fail("poll");
+        }
+    }
+    report("poll", n, get_clock_us() - t);
+
+    t = get_clock_us();
+    for (i = 0; i < n; i++) {
+        struct timeval tv = { 0, 0 };
+        fd_set rfds;
+        int max = 0;
+
+        FD_ZERO(&rfds);
+        for (j = 0; j < N_FDS; j++) {
+            FD_SET(pipes[j][0], &rfds);
+            max = pipes[j][0] > max ? pipes[j][0] : max;
+        }
+        if (select(max + 1, &rfds, NULL, NULL, &tv) != 1 ||
+            !FD_ISSET(pipes[N_FDS / 2][0], &rfds)) {
+            fail("select");
+        }
+    }
+    report("select", n, get_clock_us() - t);
+
+    /* two sockets in the abstract namespace; the sender's name is chosen
+     * by the kernel
+     */
+    memset(&dst, 0, sizeof(dst));
+    dst.sun_family = AF_UNIX;
+    dstlen = offsetof(struct sockaddr_un, sun_path) + 1 +
+        snprintf(dst.sun_path + 1, sizeof(dst.sun_path) - 1,
+                 "qemu-syscall-bench-%d", (int)getpid());
+    sv[0] = socket(AF_UNIX, SOCK_DGRAM, 0);
+    sv[1] = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (sv[0] < 0 || sv[1] < 0) {
+        fail("socket");
+    }
+    sa.sun_family = AF_UNIX;
+    if (bind(sv[0], (struct sockaddr *)&sa, sizeof(sa.sun_family)) ||
+        bind(sv[1], (struct sockaddr *)&dst, dstlen)) {
+        fail("bind");
+    }
+    t = get_clock_us();
+    for (i = 0; i < n; i++) {
+        if (sendto(sv[0], buf, sizeof(buf), 0,
+                   (struct sockaddr *)&dst, dstlen) != sizeof(buf)) {
+            fail("sendto");
+        }
+        salen = sizeof(sa);
+        if (recvfrom(sv[1], out, sizeof(out), 0,
+                     (struct sockaddr *)&sa, &salen) != sizeof(out) ||
+            salen <= sizeof(sa.sun_family) || salen > sizeof(sa) ||
+            sa.sun_family != AF_UNIX) {
+            fail("recvfrom");
+        }
+    }
+    report("sendto+recvfrom", n, get_clock_us() - t);
+    if (memcmp(out, buf, sizeof(buf))) {
+        fprintf(stderr, "recvfrom: bad data\n");
+        return 1;
+    }
+    return 0;
+}
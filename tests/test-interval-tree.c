@@ -0,0 +1,193 @@
+/*
+ * Interval tree unit-tests.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#include <glib.h>
+#include "qemu/interval-tree.h"
+
+#define N 2000
+
+static IntervalTreeRoot root;
+static IntervalTreeNode nodes[N];
+static bool in_tree[N];
+
+/* Check the tree shape and return its black height.  */
+static int check_subtree(IntervalTreeNode *n, IntervalTreeNode *parent,
+                         size_t *count)
+{
+    uint64_t max;
+    int lh, rh;
+
+    if (!n) {
+        return 1;
+    }
+    g_assert(n->parent == parent);
+    if (n->red) {
+        g_assert(!n->left || !n->left->red);
+        g_assert(!n->right || !n->right->red);
+    }
+    max = n->last;
+    if (n->left) {
+        g_assert_cmpuint(n->left->start, <=, n->start);
+        max = MAX(max, n->left->subtree_last);
+    }
+    if (n->right) {
+        g_assert_cmpuint(n->right->start, >=, n->start);
+        max = MAX(max, n->right->subtree_last);
+    }
+    g_assert_cmpuint(n->subtree_last, ==, max);
+
+    lh = check_subtree(n->left, n, count);
+    rh = check_subtree(n->right, n, count);
+    g_assert_cmpint(lh, ==, rh);
+    (*count)++;
+    return lh + !n->red;
+}
+
+static void check_tree(void)
+{
+    size_t count = 0;
+    size_t expected = 0;
+    int i;
+
+    g_assert(!root.root || !root.root->red);
+    check_subtree(root.root, NULL, &count);
+    for (i = 0; i < N; i++) {
+        expected += in_tree[i];
+    }
+    g_assert_cmpuint(count, ==, expected);
+}
+
+/* Compare a query against a scan of all the intervals.  */
+static void check_query(uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *n;
+    uint64_t prev_start = 0;
+    size_t found = 0;
+    size_t expected = 0;
+    int i;
+
+    for (n = interval_tree_iter_first(&root, start, last); n;
+         n = interval_tree_iter_next(n, start, last)) {
+        g_assert(in_tree[n - nodes]);
+        g_assert_cmpuint(n->start, <=, last);
+        g_assert_cmpuint(n->last, >=, start);
+        g_assert_cmpuint(n->start, >=, prev_start);
+        prev_start = n->start;
+        found++;
+    }
+    for (i = 0; i < N; i++) {
+        if (in_tree[i] && nodes[i].start <= last && nodes[i].last >= start) {
+            expected++;
+        }
+    }
+    g_assert_cmpuint(found, ==, expected);
+}
+
+static void insert(int i, uint64_t start, uint64_t last)
+{
+    nodes[i].start = start;
+    nodes[i].last = last;
+    interval_tree_insert(&nodes[i], &root);
+    in_tree[i] = true;
+}
+
+static void rm(int i)
+{
+    interval_tree_remove(&nodes[i], &root);
+    in_tree[i] = false;
+}
+
+static void test_disjoint(void)
+{
+    IntervalTreeNode *n;
+    int i;
+
+    root.root = NULL;
+    g_assert(interval_tree_is_empty(&root));
+    /* [10i, 10i + 4], inserted out of order */
+    for (i = 0; i < N; i++) {
+        int j = (i * 7) % N;
+        insert(j, j * 10, j * 10 + 4);
+    }
+    check_tree();
+
+    n = interval_tree_iter_first(&root, 25, 25);
+    g_assert(n == NULL);
+    n = interval_tree_iter_first(&root, 24, 31);
+    g_assert(n == &nodes[2]);
+    n = interval_tree_iter_next(n, 24, 31);
+    g_assert(n == &nodes[3]);
+    g_assert(interval_tree_iter_next(n, 24, 31) == NULL);
+    check_query(0, UINT64_MAX);
+    check_query(N * 10, UINT64_MAX);
+
+    for (i = 0; i < N; i += 2) {
+        rm(i);
+    }
+    check_tree();
+    g_assert(interval_tree_iter_first(&root, 0, 9) == NULL);
+    check_query(5, 105);
+
+    for (i = 1; i < N; i += 2) {
+        rm(i);
+    }
+    g_assert(interval_tree_is_empty(&root));
+}
+
+static void test_random(void)
+{
+    GRand *r = g_rand_new_with_seed(1);
+    int iter, i;
+
+    root.root = NULL;
+    for (iter = 0; iter < 20000; iter++) {
+        i = g_rand_int_range(r, 0, N);
+        if (in_tree[i]) {
+            rm(i);
+        } else {
+            uint64_t start = g_rand_int_range(r, 0, 100000);
+            insert(i, start, start + g_rand_int_range(r, 0, 1000));
+        }
+        if (iter % 1000 == 0) {
+            check_tree();
+        }
+        if (iter % 100 == 0) {
+            uint64_t start = g_rand_int_range(r, 0, 101000);
+            check_query(start, start + g_rand_int_range(r, 0, 3000));
+        }
+    }
+    check_tree();
+
+    /* intervals that reach the top of the range */
+    for (i = 0; i < N; i++) {
+        if (in_tree[i]) {
+            rm(i);
+        }
+    }
+    insert(0, UINT64_MAX - 10, UINT64_MAX);
+    insert(1, 0, UINT64_MAX);
+    insert(2, 5, 5);
+    check_tree();
+    check_query(UINT64_MAX, UINT64_MAX);
+    check_query(0, 4);
+    check_query(5, 6);
+    rm(1);
+    check_query(UINT64_MAX, UINT64_MAX);
+    check_query(0, 4);
+    rm(0);
+    rm(2);
+    g_assert(interval_tree_is_empty(&root));
+    g_rand_free(r);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/interval-tree/disjoint", test_disjoint);
+    g_test_add_func("/interval-tree/random", test_random);
+    return g_test_run();
+}
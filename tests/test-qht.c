@@ -0,0 +1,182 @@
+/*
+ * QHT unit-tests.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#include <glib.h>
+#include "qemu/qht.h"
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
+
+#define N 5000
+
+static QHT ht;
+static int32_t arr[N * 2];
+
+/* a poor hash on purpose, so that chains get some overflow buckets */
+static uint32_t hash_func(int32_t v)
+{
+    return v & 0xffff00ff;
+}
+
+static bool is_equal(const void *obj, const void *userp)
+{
+    const int32_t *a = obj;
+    const int32_t *b = userp;
+
+    return *a == *b;
+}
+
+static bool check(int32_t v)
+{
+    return qht_lookup(&ht, is_equal, &v, hash_func(v)) != NULL;
+}
+
+static void insert(int a, int b)
+{
+    int i;
+
+    for (i = a; i < b; i++) {
+        arr[i] = i;
+        g_assert(qht_insert(&ht, &arr[i], hash_func(i)));
+    }
+}
+
+static void rm(int a, int b)
+{
+    int i;
+
+    for (i = a; i < b; i++) {
+        g_assert(qht_remove(&ht, &arr[i], hash_func(i)));
+    }
+}
+
+static void count_func(void *obj, uint32_t hash, void *userp)
+{
+    int32_t *v = obj;
+
+    g_assert_cmpuint(hash, ==, hash_func(*v));
+    (*(size_t *)userp)++;
+}
+
+static size_t count(void)
+{
+    size_t n = 0;
+
+    qht_iter(&ht, count_func, &n);
+    return n;
+}
+
+static void test_insert_remove(void)
+{
+    int i;
+
+    qht_init(&ht, 0);
+    insert(0, N);
+    for (i = 0; i < N; i++) {
+        g_assert(check(i));
+    }
+    g_assert(!check(N));
+    g_assert_cmpuint(count(), ==, N);
+
+    /* duplicates and missing entries are refused */
+    g_assert(!qht_insert(&ht, &arr[10], hash_func(10)));
+    g_assert(!qht_remove(&ht, &arr[N], hash_func(N)));
+
+    rm(0, N / 2);
+    for (i = 0; i < N; i++) {
+        g_assert(check(i) == (i >= N / 2));
+    }
+    g_assert_cmpuint(count(), ==, N - N / 2);
+
+    insert(0, N / 4);
+    for (i = 0; i < N; i++) {
+        g_assert(check(i) == (i < N / 4 || i >= N / 2));
+    }
+    qht_destroy(&ht);
+}
+
+static void test_grow_reset(void)
+{
+    QHTStats st;
+    int i;
+
+    qht_init(&ht, 8);
+    qht_statistics(&ht, &st);
+    g_assert_cmpuint(st.head_buckets, <=, 8);
+    g_assert_cmpuint(st.resizes, ==, 0);
+
+    insert(0, N);
+    qht_statistics(&ht, &st);
+    g_assert_cmpuint(st.entries, ==, N);
+    g_assert_cmpuint(st.resizes, >, 0);
+    g_assert_cmpuint(st.head_buckets, >=, N / 8);
+
+    qht_reset(&ht);
+    qht_statistics(&ht, &st);
+    g_assert_cmpuint(st.entries, ==, 0);
+    g_assert_cmpuint(st.overflow_buckets, ==, 0);
+    g_assert_cmpuint(count(), ==, 0);
+    for (i = 0; i < N; i++) {
+        g_assert(!check(i));
+    }
+
+    insert(0, N);
+    for (i = 0; i < N; i++) {
+        g_assert(check(i));
+    }
+    qht_destroy(&ht);
+}
+
+static int reader_stop;
+static int reader_misses;
+
+static void *reader_fn(void *opaque)
+{
+    int i;
+
+    while (!atomic_read(&reader_stop)) {
+        /* entries below N are never removed and must always be found */
+        for (i = 0; i < N; i++) {
+            if (!check(i)) {
+                atomic_inc(&reader_misses);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void test_concurrent(void)
+{
+    QemuThread thread;
+    int i;
+
+    qht_init(&ht, 16);
+    insert(0, N);
+    reader_stop = 0;
+    reader_misses = 0;
+    qemu_thread_create(&thread, "qht-reader", reader_fn, NULL,
+                       QEMU_THREAD_JOINABLE);
+
+    /* grow the table and churn entries under the reader's feet */
+    for (i = 0; i < 100; i++) {
+        insert(N, 2 * N);
+        rm(N, 2 * N);
+    }
+
+    atomic_set(&reader_stop, 1);
+    qemu_thread_join(&thread);
+    g_assert_cmpint(reader_misses, ==, 0);
+    qht_destroy(&ht);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/qht/insert-remove", test_insert_remove);
+    g_test_add_func("/qht/grow-reset", test_grow_reset);
+    g_test_add_func("/qht/concurrent", test_concurrent);
+    return g_test_run();
+}
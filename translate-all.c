@@ -36,8 +36,11 @@
 #include "trace.h"
 #include "disas/disas.h"
 #include "tcg.h"
+#include "tcg/perf.h"
+#include "qemu/timer.h"
 #if defined(CONFIG_USER_ONLY)
 #include "qemu.h"
+#include "qemu/interval-tree.h"
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
 #include <sys/param.h>
 #if __FreeBSD_version >= 700104
@@ -55,6 +58,7 @@
 #endif
 #else
 #include "exec/address-spaces.h"
+#include "sysemu/cpus.h"
 #endif
 
 #include "exec/cputlb.h"
@@ -79,10 +83,11 @@ typedef struct PageDesc {
     /* in order to optimize self modifying code, we count the number
        of lookups we do to a given page to use a bitmap */
     unsigned int code_write_count;
+    /* one bit per byte of the page that holds translated code.  Once
+       built, it is updated as TBs are added; bits of invalidated TBs
+       are only cleared when the page is next walked, which is safe
+       because a stale bit merely sends a write down the slow path. */
     uint8_t *code_bitmap;
-#if defined(CONFIG_USER_ONLY)
-    unsigned long flags;
-#endif
 } PageDesc;
 
 /* In system mode we want L1_MAP to be based on ram offsets,
@@ -124,17 +129,200 @@ uintptr_t qemu_host_page_mask;
 static void *l1_map[V_L1_SIZE];
 
 /* code generation context */
-TCGContext tcg_ctx;
+TCGContext tcg_init_ctx;
+DEFINE_TLS(TCGContext *, tcg_ctx_ptr) = &tcg_init_ctx;
+
+/* translated code, shared by all the contexts */
+TBContext tb_ctx;
+
+bool parallel_cpus;
+unsigned hot_trace_threshold;
+
+/* tb_lock is taken recursively: the invalidation paths can be entered
+   both from cpu_exec (already holding it) and from helpers.  The time
+   spent waiting for it is shown by dump_exec_info.  */
+static DEFINE_TLS(int, tb_lock_depth);
+
+void tb_lock(void)
+{
+    if (tls_var(tb_lock_depth)++ == 0 && spin_trylock(&tb_ctx.tb_lock)) {
+        int64_t t = get_clock();
+
+        spin_lock(&tb_ctx.tb_lock);
+        tb_ctx.tb_lock_wait_count++;
+        tb_ctx.tb_lock_wait_time += get_clock() - t;
+    }
+}
+
+void tb_unlock(void)
+{
+    assert(tls_var(tb_lock_depth) > 0);
+    if (--tls_var(tb_lock_depth) == 0) {
+        spin_unlock(&tb_ctx.tb_lock);
+    }
+}
+
+/* Drop tb_lock if this thread holds it; used after a longjmp out of code
+   that was run with the lock held.  */
+void tb_lock_reset(void)
+{
+    if (tls_var(tb_lock_depth)) {
+        tls_var(tb_lock_depth) = 0;
+        spin_unlock(&tb_ctx.tb_lock);
+    }
+}
 
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                          tb_page_addr_t phys_page2);
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr);
+static TBRegion *tb_region_find(void *tc_ptr);
 
 void cpu_gen_init(void)
 {
     tcg_context_init(&tcg_ctx); 
 }
 
+/* The search table of a TB, which follows its host code, tells the
+   guest instruction at each host code offset without translating the
+   TB again.  Each guest instruction has 3 + TARGET_INSN_DATA_WORDS
+   fields: the offset of its host code, its icount, its pc and the
+   target data of restore_state_to_opc().  They are stored as the
+   difference from the previous instruction (the first one from the
+   start of the TB), in signed LEB128, after the number of instructions
+   and before the end of the host code that belongs to instructions.  */
+#define TB_SEARCH_FIELDS (3 + TARGET_INSN_DATA_WORDS)
+/* bytes of a target_ulong in signed LEB128 */
+#define TB_SEARCH_MAX_BYTES ((TARGET_LONG_BITS + 6) / 7)
+
+static uint8_t *encode_sleb128(uint8_t *p, target_long val)
+{
+    int more, byte;
+
+    do {
+        byte = val & 0x7f;
+        val >>= 7;
+        more = !((val == 0 && (byte & 0x40) == 0) ||
+                 (val == -1 && (byte & 0x40) != 0));
+        if (more) {
+            byte |= 0x80;
+        }
+        *p++ = byte;
+    } while (more);
+
+    return p;
+}
+
+static target_long decode_sleb128(uint8_t **pp)
+{
+    uint8_t *p = *pp;
+    target_long val = 0;
+    int byte, shift = 0;
+
+    do {
+        byte = *p++;
+        val |= (target_ulong)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    if (shift < TARGET_LONG_BITS && (byte & 0x40)) {
+        val |= -(target_ulong)1 << shift;
+    }
+
+    *pp = p;
+    return val;
+}
+
+/* Return the end of the LEB128 number at P, or NULL if it does not end
+   before END or is longer than any that encode_sleb128 writes.  */
+static const uint8_t *skip_sleb128(const uint8_t *p, const uint8_t *end)
+{
+    const uint8_t *q;
+
+    for (q = p; q < end && q - p < TB_SEARCH_MAX_BYTES; q++) {
+        if (!(*q & 0x80)) {
+            return q + 1;
+        }
+    }
+    return NULL;
+}
+
+bool tb_search_table_check(const uint8_t *table, size_t len)
+{
+    const uint8_t *end = table + len;
+    uint8_t *p = (uint8_t *)table;
+    target_long n, i;
+
+    if (!skip_sleb128(p, end)) {
+        return false;
+    }
+    n = decode_sleb128(&p);
+    if (n <= 0 || n > OPC_BUF_SIZE) {
+        return false;
+    }
+    /* the fields of each instruction, and the end of the last one */
+    for (i = 0; i < n * TB_SEARCH_FIELDS + 1; i++) {
+        p = (uint8_t *)skip_sleb128(p, end);
+        if (!p) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void tb_search_fields(int j, target_ulong *f)
+{
+    TCGContext *s = &tcg_ctx;
+    int k;
+
+    f[0] = s->gen_opc_code_off[j];
+    f[1] = s->gen_opc_icount[j];
+    f[2] = s->gen_opc_pc[j];
+    for (k = 0; k < TARGET_INSN_DATA_WORDS; k++) {
+        f[3 + k] = s->gen_opc_data[k][j];
+    }
+}
+
+/* Write the search table of TB, whose ops were just generated as host
+   code, at BLOCK.  Returns its size, or 0 if the TB is left without
+   one.  */
+static int encode_search(TranslationBlock *tb, uint8_t *block)
+{
+    TCGContext *s = &tcg_ctx;
+    TBRegion *r = tb_region_find(tb->tc_ptr);
+    int nb_ops = s->gen_opc_ptr - s->gen_opc_buf;
+    target_ulong prev[TB_SEARCH_FIELDS], cur[TB_SEARCH_FIELDS];
+    uint8_t *p = block;
+    int i, j, n;
+
+    tb->tc_search = NULL;
+    n = 0;
+    for (j = 0; j < nb_ops; j++) {
+        n += s->gen_opc_instr_start[j];
+    }
+    if (n == 0 ||
+        block + (n * TB_SEARCH_FIELDS + 2) * TB_SEARCH_MAX_BYTES >
+        r->end + TCG_MAX_OP_SIZE * OPC_BUF_SIZE) {
+        return 0;
+    }
+
+    memset(prev, 0, sizeof(prev));
+    prev[2] = tb->pc;
+    p = encode_sleb128(p, n);
+    for (j = 0; j < nb_ops; j++) {
+        if (!s->gen_opc_instr_start[j]) {
+            continue;
+        }
+        tb_search_fields(j, cur);
+        for (i = 0; i < TB_SEARCH_FIELDS; i++) {
+            p = encode_sleb128(p, cur[i] - prev[i]);
+        }
+        memcpy(prev, cur, sizeof(prev));
+    }
+    p = encode_sleb128(p, s->gen_opc_code_off[nb_ops] - prev[0]);
+
+    tb->tc_search = block;
+    return p - block;
+}
+
 /* return non zero if the very first instruction is invalid so that
    the virtual CPU can trigger an exception.
 
@@ -145,7 +333,7 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
 {
     TCGContext *s = &tcg_ctx;
     tcg_insn_unit *gen_code_buf;
-    int gen_code_size;
+    int gen_code_size, search_size;
 #ifdef CONFIG_PROFILER
     int64_t ti;
 #endif
@@ -180,11 +368,13 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
     s->code_time -= profile_getclock();
 #endif
     gen_code_size = tcg_gen_code(s, gen_code_buf);
-    *gen_code_size_ptr = gen_code_size;
+    search_size = encode_search(tb, (uint8_t *)gen_code_buf + gen_code_size);
+    *gen_code_size_ptr = gen_code_size + search_size;
 #ifdef CONFIG_PROFILER
     s->code_time += profile_getclock();
     s->code_in_len += tb->size;
     s->code_out_len += gen_code_size;
+    tcg_profile_host_insns(s, tb->icount);
 #endif
 
 #ifdef DEBUG_DISAS
@@ -200,6 +390,126 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
 
 /* The cpu state corresponding to 'searched_pc' is restored.
  */
+static int tb_trace_gen_ops(CPUArchState *env, TranslationBlock *tb,
+                            TBTrace *t);
+
+/* The guest state at a host pc of a trace is found in two steps: the
+   whole trace tells the op, hence the member, and then the member alone
+   tells the guest instruction.  */
+static int cpu_restore_state_from_trace(CPUState *cpu, TranslationBlock *tb,
+                                        uintptr_t searched_pc)
+{
+    CPUArchState *env = cpu->env_ptr;
+    TCGContext *s = &tcg_ctx;
+    TBTrace *t = tb->trace;
+    TBTraceMember *m = NULL;
+    target_ulong pc = tb->pc;
+    uint64_t flags = tb->flags;
+    uint16_t size = tb->size;
+    uintptr_t tc_ptr = (uintptr_t)tb->tc_ptr;
+    int i, j;
+
+    if (searched_pc < tc_ptr ||
+        tb_trace_gen_ops(env, tb, t) < t->nb_members) {
+        return -1;
+    }
+    s->tb_next_offset = tb->tb_next_offset;
+#ifdef USE_DIRECT_JUMP
+    s->tb_jmp_offset = tb->tb_jmp_offset;
+    s->tb_next = NULL;
+#else
+    s->tb_jmp_offset = NULL;
+    s->tb_next = tb->tb_next;
+#endif
+    j = tcg_gen_code_search_pc(s, (tcg_insn_unit *)tc_ptr,
+                               searched_pc - tc_ptr);
+    if (j < 0) {
+        return -1;
+    }
+
+    for (i = 0; i < t->nb_members; i++) {
+        m = &t->members[i];
+        if (j >= m->op_start && j < m->op_start + m->op_len) {
+            j -= m->op_start;
+            break;
+        }
+        if (j >= m->rem_start && j < m->rem_start + m->rem_len) {
+            /* the moved ops followed the exit to the next member */
+            j += m->op_len + 1 - m->rem_start;
+            break;
+        }
+    }
+    if (i == t->nb_members) {
+        return -1;
+    }
+
+    tcg_func_start(s);
+    tb->pc = m->pc;
+    tb->flags = m->flags;
+    s->trace_member = i;
+    gen_intermediate_code_pc(env, tb);
+    s->trace_member = 0;
+    while (s->gen_opc_instr_start[j] == 0) {
+        j--;
+    }
+    restore_state_to_opc(env, tb, j);
+    tb->pc = pc;
+    tb->flags = flags;
+    tb->size = size;
+    return 0;
+}
+
+/* Restore the state at SEARCHED_PC from the search table of TB.  */
+static int cpu_restore_state_from_search(CPUState *cpu, TranslationBlock *tb,
+                                         uintptr_t searched_pc)
+{
+    CPUArchState *env = cpu->env_ptr;
+    TCGContext *s = &tcg_ctx;
+    target_ulong data[TB_SEARCH_FIELDS], next[TB_SEARCH_FIELDS];
+    uint8_t *p = tb->tc_search;
+    uintptr_t off;
+    int i, k, n;
+
+    if (searched_pc < (uintptr_t)tb->tc_ptr) {
+        return -1;
+    }
+    off = searched_pc - (uintptr_t)tb->tc_ptr;
+
+    /* find the last instruction whose code starts at or before OFF */
+    memset(data, 0, sizeof(data));
+    data[2] = tb->pc;
+    n = decode_sleb128(&p);
+    for (i = 0; i < n; i++) {
+        for (k = 0; k < TB_SEARCH_FIELDS; k++) {
+            next[k] = data[k] + decode_sleb128(&p);
+        }
+        if (next[0] > off) {
+            break;
+        }
+        memcpy(data, next, sizeof(data));
+    }
+    if (i == 0 || (i == n && off >= data[0] + decode_sleb128(&p))) {
+        return -1;
+    }
+
+    if (use_icount) {
+        /* Reset the cycle counter to the start of the block.  */
+        cpu->icount_decr.u16.low += tb->icount;
+        /* Clear the IO flag.  */
+        cpu->can_do_io = 0;
+    }
+    cpu->icount_decr.u16.low -= data[1];
+
+    s->gen_opc_pc[0] = data[2];
+    s->gen_opc_icount[0] = data[1];
+    s->gen_opc_instr_start[0] = 1;
+    for (k = 0; k < TARGET_INSN_DATA_WORDS; k++) {
+        s->gen_opc_data[k][0] = data[3 + k];
+    }
+    restore_state_to_opc(env, tb, 0);
+    return 0;
+}
+
 static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
                                      uintptr_t searched_pc)
 {
@@ -211,9 +521,24 @@ static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
     int64_t ti;
 #endif
 
+    if (tb->trace) {
+        return cpu_restore_state_from_trace(cpu, tb, searched_pc);
+    }
+
 #ifdef CONFIG_PROFILER
     ti = profile_getclock();
 #endif
+    if (tb->tc_search &&
+        cpu_restore_state_from_search(cpu, tb, searched_pc) == 0) {
+#ifdef CONFIG_PROFILER
+        s->restore_time += profile_getclock() - ti;
+        s->restore_count++;
+#endif
+        return 0;
+    }
+
+    /* no table, e.g. for a target that does not mark its instructions:
+       translate the TB again to find the instruction */
     tcg_func_start(s);
 
     gen_intermediate_code_pc(env, tb);
@@ -260,13 +585,16 @@ static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
 bool cpu_restore_state(CPUState *cpu, uintptr_t retaddr)
 {
     TranslationBlock *tb;
+    bool found = false;
 
+    tb_lock();
     tb = tb_find_pc(retaddr);
     if (tb) {
         cpu_restore_state_from_tb(cpu, tb, retaddr);
-        return true;
+        found = true;
     }
-    return false;
+    tb_unlock();
+    return found;
 }
 
 #ifdef _WIN32
@@ -432,9 +760,190 @@ static inline PageDesc *page_find(tb_page_addr_t index)
     return page_find_alloc(index, 0);
 }
 
-#if !defined(CONFIG_USER_ONLY)
-#define mmap_lock() do { } while (0)
-#define mmap_unlock() do { } while (0)
+#if defined(CONFIG_USER_ONLY)
+/* The PAGE_* flags of the guest address space are kept as an interval
+   tree of mappings, so that mmap, mprotect and range checks cost one
+   operation per mapping rather than one per page.  Nodes never overlap,
+   and neighbours with the same flags are merged.  Unmapped pages have no
+   node.  The tree is modified and read with mmap_lock held.  */
+typedef struct PageFlagsNode {
+    IntervalTreeNode itree;
+    int flags;
+    struct PageFlagsNode *next_free;
+} PageFlagsNode;
+
+static IntervalTreeRoot pageflags_root;
+
+/* Like the l1_map, the nodes do not come from g_malloc: they are carved
+   out of anonymous mappings and recycled.  */
+#define PAGEFLAGS_CHUNK_SIZE (64 * 1024)
+
+static PageFlagsNode *pageflags_free_list;
+
+/* The mapping that page_check_range found last.  Syscalls check their
+   buffers in the same few mappings over and over.  */
+static PageFlagsNode *pageflags_last_checked;
+
+static void pageflags_release(PageFlagsNode *p)
+{
+    p->next_free = pageflags_free_list;
+    pageflags_free_list = p;
+}
+
+static PageFlagsNode *pageflags_alloc(void)
+{
+    PageFlagsNode *p;
+
+    if (!pageflags_free_list) {
+        size_t i;
+
+        p = mmap(NULL, PAGEFLAGS_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            abort();
+        }
+        for (i = 0; i < PAGEFLAGS_CHUNK_SIZE / sizeof(PageFlagsNode); i++) {
+            pageflags_release(&p[i]);
+        }
+    }
+    p = pageflags_free_list;
+    pageflags_free_list = p->next_free;
+    return p;
+}
+
+static inline PageFlagsNode *pageflags_of(IntervalTreeNode *n)
+{
+    return n ? container_of(n, PageFlagsNode, itree) : NULL;
+}
+
+/* Return the lowest mapping that overlaps [start, last].  */
+static PageFlagsNode *pageflags_find(target_ulong start, target_ulong last)
+{
+    return pageflags_of(interval_tree_iter_first(&pageflags_root,
+                                                 start, last));
+}
+
+static PageFlagsNode *pageflags_next(PageFlagsNode *p, target_ulong start,
+                                     target_ulong last)
+{
+    return pageflags_of(interval_tree_iter_next(&p->itree, start, last));
+}
+
+static void pageflags_create(target_ulong start, target_ulong last, int flags)
+{
+    PageFlagsNode *p = pageflags_alloc();
+
+    p->itree.start = start;
+    p->itree.last = last;
+    p->flags = flags;
+    interval_tree_insert(&p->itree, &pageflags_root);
+}
+
+static void pageflags_remove(PageFlagsNode *p)
+{
+    if (p == pageflags_last_checked) {
+        pageflags_last_checked = NULL;
+    }
+    interval_tree_remove(&p->itree, &pageflags_root);
+    pageflags_release(p);
+}
+
+/* Give [start, last] the flags FLAGS, or unmap it if FLAGS is 0.  */
+static void pageflags_set(target_ulong start, target_ulong last, int flags)
+{
+    PageFlagsNode *p, *prev, *next;
+
+    /* a mapping that changes as a whole keeps its node, unless it takes
+       the flags of a neighbour */
+    if (flags) {
+        prev = NULL;
+        p = pageflags_find(start != 0 ? start - 1 : 0, last);
+        if (p && p->itree.last < start) {
+            prev = p;
+            p = pageflags_next(p, start, last);
+        }
+        if (p && p->itree.start == start && p->itree.last == last) {
+            next = last != (target_ulong)-1
+                   ? pageflags_next(p, last + 1, last + 1) : NULL;
+            if ((!prev || prev->flags != flags) &&
+                (!next || next->flags != flags)) {
+                p->flags = flags;
+                return;
+            }
+        }
+    }
+
+    /* cut the range out of the mappings it overlaps */
+    while ((p = pageflags_find(start, last)) != NULL) {
+        target_ulong p_start = p->itree.start;
+        target_ulong p_last = p->itree.last;
+        int p_flags = p->flags;
+
+        pageflags_remove(p);
+        if (p_start < start) {
+            pageflags_create(p_start, start - 1, p_flags);
+        }
+        if (p_last > last) {
+            pageflags_create(last + 1, p_last, p_flags);
+        }
+    }
+    if (!flags) {
+        return;
+    }
+
+    /* and absorb the neighbours that have the same flags */
+    if (start != 0) {
+        p = pageflags_find(start - 1, start - 1);
+        if (p && p->flags == flags) {
+            start = p->itree.start;
+            pageflags_remove(p);
+        }
+    }
+    if (last != (target_ulong)-1) {
+        p = pageflags_find(last + 1, last + 1);
+        if (p && p->flags == flags) {
+            last = p->itree.last;
+            pageflags_remove(p);
+        }
+    }
+    pageflags_create(start, last, flags);
+}
+
+/* Set the bits SET and clear the bits CLEAR in the flags of the mapped
+   pages of [start, last].  */
+static void pageflags_set_clear(target_ulong start, target_ulong last,
+                                int set, int clear)
+{
+    target_ulong addr = start;
+    PageFlagsNode *p;
+
+    while ((p = pageflags_find(addr, last)) != NULL) {
+        target_ulong s = MAX(p->itree.start, addr);
+        target_ulong l = MIN(p->itree.last, last);
+        int flags = (p->flags | set) & ~clear;
+
+        if (flags != p->flags) {
+            pageflags_set(s, l, flags);
+        }
+        if (l == last) {
+            break;
+        }
+        addr = l + 1;
+    }
+}
+
+/* Return the union of the flags of the pages of [start, last].  */
+static int pageflags_union(target_ulong start, target_ulong last)
+{
+    PageFlagsNode *p;
+    int flags = 0;
+
+    for (p = pageflags_find(start, last); p;
+         p = pageflags_next(p, start, last)) {
+        flags |= p->flags;
+    }
+    return flags;
+}
 #endif
 
 #if defined(CONFIG_USER_ONLY)
@@ -677,10 +1186,78 @@ static inline void code_gen_alloc(size_t tb_size)
         (TCG_MAX_OP_SIZE * OPC_BUF_SIZE);
     tcg_ctx.code_gen_max_blocks = tcg_ctx.code_gen_buffer_size /
             CODE_GEN_AVG_BLOCK_SIZE;
-    tcg_ctx.tb_ctx.tbs =
+    tb_ctx.tbs =
             g_malloc(tcg_ctx.code_gen_max_blocks * sizeof(TranslationBlock));
 }
 
+static void tb_region_reset(TBRegion *r)
+{
+    r->ptr = r->start;
+    r->nb_tbs = 0;
+}
+
+static void tb_region_init(void)
+{
+    TBContext *t = &tb_ctx;
+    size_t max_tb_size = TCG_MAX_OP_SIZE * OPC_BUF_SIZE;
+    int i, n = CODE_GEN_MAX_REGIONS;
+
+    /* each region must hold a good number of worst-case TBs, otherwise
+       eviction would run too often; a single region means a plain flush */
+    while (n > 1 && tcg_ctx.code_gen_buffer_size / n < 8 * max_tb_size) {
+        n >>= 1;
+    }
+    t->nb_regions = n;
+    t->region_size = (tcg_ctx.code_gen_buffer_size / n) & ~(CODE_GEN_ALIGN - 1);
+    for (i = 0; i < n; i++) {
+        TBRegion *r = &t->regions[i];
+
+        r->start = tcg_ctx.code_gen_buffer + i * t->region_size;
+        r->end = r->start + t->region_size - max_tb_size;
+        r->max_tbs = tcg_ctx.code_gen_max_blocks / n;
+        r->tbs = t->tbs + i * r->max_tbs;
+        tb_region_reset(r);
+    }
+    t->cur_region = 0;
+}
+
+static inline TBRegion *tb_region_find(void *tc_ptr)
+{
+    return &tb_ctx.regions[((uint8_t *)tc_ptr -
+                            (uint8_t *)tcg_ctx.code_gen_buffer) /
+                           tb_ctx.region_size];
+}
+
+/* The region to fill after the current one, and thus the next one to
+   evict: the oldest one that no thread owns.  NULL if there is none.  */
+static TBRegion *tb_region_following(void)
+{
+    TBContext *t = &tb_ctx;
+    int i;
+
+    for (i = 1; i < t->nb_regions; i++) {
+        TBRegion *r = &t->regions[(t->cur_region + i) % t->nb_regions];
+
+        if (!r->owned) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+/* Start filling the next region.  Returns false if it still holds TBs,
+   which must be evicted first.  */
+static bool tb_region_next(void)
+{
+    TBRegion *r = tb_region_following();
+
+    if (!r || r->nb_tbs) {
+        return false;
+    }
+    tb_ctx.cur_region = r - tb_ctx.regions;
+    return true;
+}
+
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
    (in bytes) allocated to the translation buffer. Zero means default
    size. */
@@ -688,8 +1265,9 @@ void tcg_exec_init(unsigned long tb_size)
 {
     cpu_gen_init();
     code_gen_alloc(tb_size);
-    tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
+    tb_region_init();
     tcg_register_jit(tcg_ctx.code_gen_buffer, tcg_ctx.code_gen_buffer_size);
+    qht_init(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
     page_init();
 #if !defined(CONFIG_USER_ONLY) || !defined(CONFIG_USE_GUEST_BASE)
     /* There's no guest base to take into account, so go ahead and
@@ -703,32 +1281,48 @@ bool tcg_enabled(void)
     return tcg_ctx.code_gen_buffer != NULL;
 }
 
-/* Allocate a new translation block. Flush the translation buffer if
-   too many translation blocks or too much generated code. */
-static TranslationBlock *tb_alloc(target_ulong pc)
+/* Allocate a new translation block at the end of region R. Return NULL
+   if R has too many translation blocks or too much generated code.  The
+   TB becomes part of R once its code is generated, with tb_region_add.  */
+static TranslationBlock *tb_alloc(TBRegion *r, target_ulong pc)
 {
     TranslationBlock *tb;
 
-    if (tcg_ctx.tb_ctx.nb_tbs >= tcg_ctx.code_gen_max_blocks ||
-        (tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer) >=
-         tcg_ctx.code_gen_buffer_max_size) {
+    if (r->nb_tbs >= r->max_tbs || r->ptr >= r->end) {
         return NULL;
     }
-    tb = &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs++];
+    tb = &r->tbs[r->nb_tbs];
+    tb->tc_ptr = r->ptr;
     tb->pc = pc;
     tb->cflags = 0;
+    tb->trace_count[0] = 0;
+    tb->trace_count[1] = 0;
+    tb->trace = NULL;
+    tb->tc_search = NULL;
     return tb;
 }
 
+/* Add TB, allocated by tb_alloc, to R.  Its code ends at END.  */
+static void tb_region_add(TBRegion *r, TranslationBlock *tb, void *end)
+{
+    assert(tb == &r->tbs[r->nb_tbs]);
+    r->ptr = (uint8_t *)(((uintptr_t)end + CODE_GEN_ALIGN - 1) &
+                         ~(CODE_GEN_ALIGN - 1));
+    r->nb_tbs++;
+    tb_ctx.nb_tbs++;
+}
+
 void tb_free(TranslationBlock *tb)
 {
+    TBRegion *r = tb_region_find(tb->tc_ptr);
+
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (tcg_ctx.tb_ctx.nb_tbs > 0 &&
-            tb == &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs - 1]) {
-        tcg_ctx.code_gen_ptr = tb->tc_ptr;
-        tcg_ctx.tb_ctx.nb_tbs--;
+    if (r->nb_tbs > 0 && tb == &r->tbs[r->nb_tbs - 1]) {
+        r->ptr = tb->tc_ptr;
+        r->nb_tbs--;
+        tb_ctx.nb_tbs--;
     }
 }
 
@@ -774,93 +1368,187 @@ static void page_flush_tb(void)
     }
 }
 
+static void do_tb_phys_invalidate(TranslationBlock *tb,
+                                  tb_page_addr_t page_addr);
+
+/* qht_reset and the reuse of TB descriptors need every vCPU to be out of
+   cpu_exec: there must be no concurrent qht_lookup, and nobody may be
+   running the code that goes away.  tb_flush_request takes care of it.  */
+static inline void assert_tb_flush_exclusive(void)
+{
+#if !defined(CONFIG_USER_ONLY) || defined(CONFIG_LINUX_USER)
+    assert(!parallel_cpus || cpu_in_exclusive_section());
+#endif
+}
+
 /* flush all the translation blocks */
-/* XXX: tb_flush is currently not thread safe */
-void tb_flush(CPUArchState *env1)
+static void do_tb_flush(CPUArchState *env1)
 {
     CPUState *cpu = ENV_GET_CPU(env1);
+    int i;
+
+    assert_tb_flush_exclusive();
 
 #if defined(DEBUG_FLUSH)
-    printf("qemu: flush code_size=%ld nb_tbs=%d avg_tb_size=%ld\n",
-           (unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer),
-           tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.tb_ctx.nb_tbs > 0 ?
-           ((unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer)) /
-           tcg_ctx.tb_ctx.nb_tbs : 0);
+    printf("qemu: flush nb_tbs=%d nb_regions=%d\n",
+           tb_ctx.nb_tbs, tb_ctx.nb_regions);
 #endif
-    if ((unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer)
-        > tcg_ctx.code_gen_buffer_size) {
-        cpu_abort(cpu, "Internal error: code buffer overflow\n");
+    for (i = 0; i < tb_ctx.nb_regions; i++) {
+        TBRegion *r = &tb_ctx.regions[i];
+
+        if (r->ptr > r->start + tb_ctx.region_size) {
+            cpu_abort(cpu, "Internal error: code buffer overflow\n");
+        }
     }
-    tcg_ctx.tb_ctx.nb_tbs = 0;
+    tb_ctx.nb_tbs = 0;
 
     CPU_FOREACH(cpu) {
         memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
     }
 
-    memset(tcg_ctx.tb_ctx.tb_phys_hash, 0, sizeof(tcg_ctx.tb_ctx.tb_phys_hash));
+    qht_reset(&tb_ctx.htable);
     page_flush_tb();
 
-    tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
+    /* the regions owned by threads stay theirs */
+    for (i = 0; i < tb_ctx.nb_regions; i++) {
+        tb_region_reset(&tb_ctx.regions[i]);
+    }
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
-    tcg_ctx.tb_ctx.tb_flush_count++;
+    tb_ctx.tb_flush_count++;
+    tb_ctx.tb_flush_pending = 0;
 }
 
-#ifdef DEBUG_TB_CHECK
-
-static void tb_invalidate_check(target_ulong address)
+/* evict the TBs of the oldest region and start filling it again */
+static void do_tb_evict(CPUArchState *env1)
 {
-    TranslationBlock *tb;
+    TBContext *t = &tb_ctx;
+    CPUState *cpu;
+    TBRegion *r;
     int i;
 
-    address &= TARGET_PAGE_MASK;
-    for (i = 0; i < CODE_GEN_PHYS_HASH_SIZE; i++) {
-        for (tb = tb_ctx.tb_phys_hash[i]; tb != NULL; tb = tb->phys_hash_next) {
-            if (!(address + TARGET_PAGE_SIZE <= tb->pc ||
-                  address >= tb->pc + tb->size)) {
-                printf("ERROR invalidate: address=" TARGET_FMT_lx
-                       " PC=%08lx size=%04x\n",
-                       address, (long)tb->pc, tb->size);
-            }
+    assert_tb_flush_exclusive();
+    if (tb_region_next()) {
+        /* somebody else already made room */
+        t->tb_flush_pending = 0;
+        return;
+    }
+    r = tb_region_following();
+    if (!r) {
+        /* a single region, or all the others are owned by threads */
+        do_tb_flush(env1);
+        return;
+    }
+
+    for (i = 0; i < r->nb_tbs; i++) {
+        TranslationBlock *tb = &r->tbs[i];
+
+        if (tb->page_addr[0] != -1) {
+            do_tb_phys_invalidate(tb, -1);
         }
     }
+    /* a vCPU may have cached a TB of the region after it was invalidated;
+       its descriptor is about to be reused */
+    CPU_FOREACH(cpu) {
+        memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
+    }
+    t->nb_tbs -= r->nb_tbs;
+    t->tb_evict_tb_count += r->nb_tbs;
+    t->tb_evict_count++;
+    tb_region_reset(r);
+    tb_region_next();
+    t->tb_flush_pending = 0;
 }
 
-/* verify that all the pages have correct rights for code */
-static void tb_page_check(void)
+static void do_tb_flush_kind(CPUArchState *env1, int kind)
 {
-    TranslationBlock *tb;
-    int i, flags1, flags2;
-
-    for (i = 0; i < CODE_GEN_PHYS_HASH_SIZE; i++) {
-        for (tb = tcg_ctx.tb_ctx.tb_phys_hash[i]; tb != NULL;
-                tb = tb->phys_hash_next) {
-            flags1 = page_get_flags(tb->pc);
-            flags2 = page_get_flags(tb->pc + tb->size - 1);
-            if ((flags1 & PAGE_WRITE) || (flags2 & PAGE_WRITE)) {
-                printf("ERROR page flags: PC=%08lx size=%04x f1=%x f2=%x\n",
-                       (long)tb->pc, tb->size, flags1, flags2);
-            }
-        }
+    if (kind == TB_FLUSH_ALL) {
+        do_tb_flush(env1);
+    } else {
+        do_tb_evict(env1);
     }
 }
 
-#endif
-
-static inline void tb_hash_remove(TranslationBlock **ptb, TranslationBlock *tb)
+static void tb_flush_request(CPUArchState *env1, int kind)
 {
-    TranslationBlock *tb1;
-
-    for (;;) {
-        tb1 = *ptb;
-        if (tb1 == tb) {
-            *ptb = tb1->phys_hash_next;
-            break;
+#if !defined(CONFIG_USER_ONLY) || defined(CONFIG_LINUX_USER)
+    /* With one thread per vCPU the code buffer can only be reset while no
+       vCPU executes from it.  From guest context just record the request
+       and leave the CPU loop: the vCPU thread calls tb_flush_pending_work
+       once outside cpu_exec, and we stop everybody else for the duration
+       of the flush.  */
+    if (parallel_cpus) {
+        if (current_cpu) {
+            tb_ctx.tb_flush_pending =
+                MAX(tb_ctx.tb_flush_pending, kind);
+            cpu_exit(current_cpu);
+            return;
         }
-        ptb = &tb1->phys_hash_next;
+        start_exclusive();
+        do_tb_flush_kind(env1, kind);
+        end_exclusive();
+        return;
     }
+#endif
+    do_tb_flush_kind(env1, kind);
+}
+
+void tb_flush(CPUArchState *env1)
+{
+    tb_flush_request(env1, TB_FLUSH_ALL);
 }
 
+void tb_flush_pending_work(CPUArchState *env1)
+{
+    int kind = tb_ctx.tb_flush_pending;
+
+    if (kind) {
+        tb_flush_request(env1, kind);
+    }
+}
+
+#ifdef DEBUG_TB_CHECK
+
+static void do_tb_invalidate_check(void *p, uint32_t hash, void *userp)
+{
+    TranslationBlock *tb = p;
+    target_ulong address = *(target_ulong *)userp;
+
+    if (!(address + TARGET_PAGE_SIZE <= tb->pc ||
+          address >= tb->pc + tb->size)) {
+        printf("ERROR invalidate: address=" TARGET_FMT_lx
+               " PC=%08lx size=%04x\n",
+               address, (long)tb->pc, tb->size);
+    }
+}
+
+static void tb_invalidate_check(target_ulong address)
+{
+    address &= TARGET_PAGE_MASK;
+    qht_iter(&tb_ctx.htable, do_tb_invalidate_check, &address);
+}
+
+static void do_tb_page_check(void *p, uint32_t hash, void *userp)
+{
+    TranslationBlock *tb = p;
+    int flags1, flags2;
+
+    flags1 = page_get_flags(tb->pc);
+    flags2 = page_get_flags(tb->pc + tb->size - 1);
+    if ((flags1 & PAGE_WRITE) || (flags2 & PAGE_WRITE)) {
+        printf("ERROR page flags: PC=%08lx size=%04x f1=%x f2=%x\n",
+               (long)tb->pc, tb->size, flags1, flags2);
+    }
+}
+
+/* verify that all the pages have correct rights for code */
+static void tb_page_check(void)
+{
+    qht_iter(&tb_ctx.htable, do_tb_page_check, NULL);
+}
+
+#endif
+
 static inline void tb_page_remove(TranslationBlock **ptb, TranslationBlock *tb)
 {
     TranslationBlock *tb1;
@@ -914,8 +1602,8 @@ static inline void tb_reset_jump(TranslationBlock *tb, int n)
     tb_set_jmp_target(tb, n, (uintptr_t)(tb->tc_ptr + tb->tb_next_offset[n]));
 }
 
-/* invalidate one TB */
-void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
+static void do_tb_phys_invalidate(TranslationBlock *tb,
+                                  tb_page_addr_t page_addr)
 {
     CPUState *cpu;
     PageDesc *p;
@@ -925,22 +1613,20 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 
     /* remove the TB from the hash list */
     phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
-    h = tb_phys_hash_func(phys_pc);
-    tb_hash_remove(&tcg_ctx.tb_ctx.tb_phys_hash[h], tb);
+    qht_remove(&tb_ctx.htable, tb,
+               tb_hash_func(phys_pc, tb->pc, tb->flags));
 
     /* remove the TB from the page list */
     if (tb->page_addr[0] != page_addr) {
         p = page_find(tb->page_addr[0] >> TARGET_PAGE_BITS);
         tb_page_remove(&p->first_tb, tb);
-        invalidate_page_bitmap(p);
     }
     if (tb->page_addr[1] != -1 && tb->page_addr[1] != page_addr) {
         p = page_find(tb->page_addr[1] >> TARGET_PAGE_BITS);
         tb_page_remove(&p->first_tb, tb);
-        invalidate_page_bitmap(p);
     }
 
-    tcg_ctx.tb_ctx.tb_invalidated_flag = 1;
+    tb_ctx.tb_invalidated_flag = 1;
 
     /* remove the TB from the hash list */
     h = tb_jmp_cache_hash_func(tb->pc);
@@ -969,7 +1655,15 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
     tb->jmp_first = (TranslationBlock *)((uintptr_t)tb | 2); /* fail safe */
 
-    tcg_ctx.tb_ctx.tb_phys_invalidate_count++;
+    /* mark the TB as dead, so that eviction does not invalidate it again */
+    tb->page_addr[0] = -1;
+}
+
+/* invalidate one TB */
+void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
+{
+    do_tb_phys_invalidate(tb, page_addr);
+    tb_ctx.tb_phys_invalidate_count++;
 }
 
 static inline void set_bits(uint8_t *tab, int start, int len)
@@ -999,31 +1693,45 @@ static inline void set_bits(uint8_t *tab, int start, int len)
     }
 }
 
+/* mark the bytes of page N of TB in the code bitmap of P */
+static void page_bitmap_add_tb(PageDesc *p, TranslationBlock *tb, int n)
+{
+    int tb_start, tb_end;
+
+    /* NOTE: this is subtle as a TB may span two physical pages */
+    if (n == 0) {
+        /* NOTE: tb_end may be after the end of the page, but
+           it is not a problem */
+        tb_start = tb->pc & ~TARGET_PAGE_MASK;
+        tb_end = tb_start + tb->size;
+        if (tb_end > TARGET_PAGE_SIZE) {
+            tb_end = TARGET_PAGE_SIZE;
+        }
+    } else {
+        tb_start = 0;
+        tb_end = ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
+    }
+    set_bits(p->code_bitmap, tb_start, tb_end - tb_start);
+}
+
+/* build the code bitmap of P, or rebuild it to drop the bits of
+   TBs that have been invalidated since */
 static void build_page_bitmap(PageDesc *p)
 {
-    int n, tb_start, tb_end;
+    int n;
     TranslationBlock *tb;
 
-    p->code_bitmap = g_malloc0(TARGET_PAGE_SIZE / 8);
+    if (p->code_bitmap) {
+        memset(p->code_bitmap, 0, TARGET_PAGE_SIZE / 8);
+    } else {
+        p->code_bitmap = g_malloc0(TARGET_PAGE_SIZE / 8);
+    }
 
     tb = p->first_tb;
     while (tb != NULL) {
         n = (uintptr_t)tb & 3;
         tb = (TranslationBlock *)((uintptr_t)tb & ~3);
-        /* NOTE: this is subtle as a TB may span two physical pages */
-        if (n == 0) {
-            /* NOTE: tb_end may be after the end of the page, but
-               it is not a problem */
-            tb_start = tb->pc & ~TARGET_PAGE_MASK;
-            tb_end = tb_start + tb->size;
-            if (tb_end > TARGET_PAGE_SIZE) {
-                tb_end = TARGET_PAGE_SIZE;
-            }
-        } else {
-            tb_start = 0;
-            tb_end = ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
-        }
-        set_bits(p->code_bitmap, tb_start, tb_end - tb_start);
+        page_bitmap_add_tb(p, tb, n);
         tb = tb->page_next[n];
     }
 }
@@ -1034,27 +1742,47 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 {
     CPUArchState *env = cpu->env_ptr;
     TranslationBlock *tb;
+    TBRegion *r;
     tb_page_addr_t phys_pc, phys_page2;
     target_ulong virt_page2;
     int code_gen_size;
 
     phys_pc = get_page_addr_code(env, pc);
-    tb = tb_alloc(pc);
+    mmap_lock();
+    tb_lock();
+    r = &tb_ctx.regions[tb_ctx.cur_region];
+    tb = tb_alloc(r, pc);
     if (!tb) {
-        /* flush must be done */
-        tb_flush(env);
+        /* the current region is full: move to the next one, evicting
+           the oldest TBs if all regions are in use */
+        if (!tb_region_next()) {
+            tb_flush_request(env, TB_FLUSH_EVICT);
+            if (tb_ctx.tb_flush_pending) {
+                /* other vCPUs may still run from the region; translate
+                   again once the eviction is done */
+                cpu_loop_exit(cpu);
+            }
+            /* Don't forget to invalidate previous TB info.  */
+            tb_ctx.tb_invalidated_flag = 1;
+        }
         /* cannot fail at this point */
-        tb = tb_alloc(pc);
-        /* Don't forget to invalidate previous TB info.  */
-        tcg_ctx.tb_ctx.tb_invalidated_flag = 1;
+        r = &tb_ctx.regions[tb_ctx.cur_region];
+        tb = tb_alloc(r, pc);
     }
-    tb->tc_ptr = tcg_ctx.code_gen_ptr;
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
+#ifdef CONFIG_LINUX_USER
+    if (!tb_cache_restore(tb, &code_gen_size)) {
+        cpu_gen_code(env, tb, &code_gen_size);
+        tb_cache_record(tb, code_gen_size);
+    }
+#else
     cpu_gen_code(env, tb, &code_gen_size);
-    tcg_ctx.code_gen_ptr = (void *)(((uintptr_t)tcg_ctx.code_gen_ptr +
-            code_gen_size + CODE_GEN_ALIGN - 1) & ~(CODE_GEN_ALIGN - 1));
+#endif
+    perf_report_code(tb, tb->tc_search ? tb->tc_search - (uint8_t *)tb->tc_ptr
+                                       : code_gen_size);
+    tb_region_add(r, tb, tb->tc_ptr + code_gen_size);
 
     /* check next page if needed */
     virt_page2 = (pc + tb->size - 1) & TARGET_PAGE_MASK;
@@ -1063,9 +1791,457 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         phys_page2 = get_page_addr_code(env, virt_page2);
     }
     tb_link_page(tb, phys_pc, phys_page2);
+    tb_unlock();
+    mmap_unlock();
+    return tb;
+}
+
+#ifdef CONFIG_USER_ONLY
+/* Give S an empty region to translate in, instead of the one it owns.
+   Returns false if there is none left.  Called with tb_lock held.  */
+static bool tb_region_claim(TCGContext *s)
+{
+    TBContext *t = &tb_ctx;
+    int i;
+
+    if (s->region) {
+        s->region->owned = false;
+        s->region = NULL;
+    }
+    /* start from the regions that tb_region_next reaches last */
+    for (i = t->nb_regions - 1; i > 0; i--) {
+        TBRegion *r = &t->regions[(t->cur_region + i) % t->nb_regions];
+
+        if (!r->owned && !r->nb_tbs) {
+            r->owned = true;
+            s->region = r;
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+/* Translate the TB at PC in the region owned by the context of this
+   thread, without holding tb_lock or mmap_lock, so that guest threads
+   translate concurrently.  The TB is not visible until tb_publish adds
+   it.  Returns NULL if tb_gen_code must translate it instead.  */
+TranslationBlock *tb_gen_code_parallel(CPUState *cpu, target_ulong pc,
+                                       target_ulong cs_base, int flags)
+{
+#ifdef CONFIG_USER_ONLY
+    CPUArchState *env = cpu->env_ptr;
+    TCGContext *s = &tcg_ctx;
+    TranslationBlock *tb = NULL;
+    int code_gen_size;
+
+    /* the TB cache logs relocations in a single buffer */
+    if (!parallel_cpus || s->code_relocs) {
+        return NULL;
+    }
+    if (s->region) {
+        tb = tb_alloc(s->region, pc);
+    }
+    if (!tb) {
+        tb_lock();
+        if (tb_region_claim(s)) {
+            tb = tb_alloc(s->region, pc);
+        }
+        tb_unlock();
+        if (!tb) {
+            return NULL;
+        }
+    }
+    /* guest code written from now on may not be seen by the translation */
+    s->region_write_gen = atomic_read(&tb_ctx.code_write_gen);
+    smp_rmb();
+
+    tb->cs_base = cs_base;
+    tb->flags = flags;
+    cpu_gen_code(env, tb, &code_gen_size);
+    s->code_gen_ptr = tb->tc_ptr + code_gen_size;
+    return tb;
+#else
+    return NULL;
+#endif
+}
+
+/* Make TB, translated by tb_gen_code_parallel, visible to all threads.
+   Returns false if guest code was invalidated since the translation
+   started: TB may be stale and is dropped.  Called with mmap_lock and
+   tb_lock held.  */
+bool tb_publish(CPUState *cpu, TranslationBlock *tb)
+{
+    CPUArchState *env = cpu->env_ptr;
+    TCGContext *s = &tcg_ctx;
+    tb_page_addr_t phys_pc, phys_page2;
+    target_ulong virt_page2;
+
+    if (s->region_write_gen != tb_ctx.code_write_gen) {
+        tb_ctx.tb_parallel_drop_count++;
+        return false;
+    }
+    tb_region_add(s->region, tb, s->code_gen_ptr);
+    tb_ctx.tb_parallel_count++;
+    perf_report_code(tb, tb->tc_search ? tb->tc_search - (uint8_t *)tb->tc_ptr
+                                       : (uint8_t *)s->code_gen_ptr -
+                                         (uint8_t *)tb->tc_ptr);
+
+    phys_pc = get_page_addr_code(env, tb->pc);
+    virt_page2 = (tb->pc + tb->size - 1) & TARGET_PAGE_MASK;
+    phys_page2 = -1;
+    if ((tb->pc & TARGET_PAGE_MASK) != virt_page2) {
+        phys_page2 = get_page_addr_code(env, virt_page2);
+    }
+    tb_link_page(tb, phys_pc, phys_page2);
+    return true;
+}
+
+#ifdef CONFIG_USER_ONLY
+/* Make S the translation context of the calling thread.  */
+void tcg_register_thread(TCGContext *s)
+{
+    tls_var(tcg_ctx_ptr) = s;
+}
+
+/* Called by an exiting thread: give back its region and free its
+   context.  */
+void tcg_unregister_thread(void)
+{
+    TCGContext *s = &tcg_ctx;
+
+    tb_lock();
+    if (s->region) {
+        s->region->owned = false;
+        s->region = NULL;
+    }
+    tb_unlock();
+    if (s != &tcg_init_ctx) {
+        tls_var(tcg_ctx_ptr) = &tcg_init_ctx;
+        tcg_context_free(s);
+    }
+}
+
+/* In the child of fork only the calling thread is left; the regions of
+   the others are free again.  */
+void tcg_fork_end_child(void)
+{
+    int i;
+
+    for (i = 0; i < tb_ctx.nb_regions; i++) {
+        tb_ctx.regions[i].owned = &tb_ctx.regions[i] == tcg_ctx.region;
+    }
+}
+#endif
+
+
+/* Ops of the members of a trace that come after their exit to the next
+   member, waiting to be put back at the end of the trace.  */
+static uint16_t trace_rem_opc[OPC_BUF_SIZE];
+static TCGArg trace_rem_opparam[OPPARAM_BUF_SIZE];
+
+static inline bool tb_trace_is_jump_exit(TranslationBlock *tb, TCGArg arg)
+{
+    return (arg & ~(TCGArg)TB_EXIT_MASK) == (uintptr_t)tb &&
+        (arg & TB_EXIT_MASK) <= TB_EXIT_IDX1;
+}
+
+/* Make member M, whose ops start at OPC_START, fall through into the
+   next member.  Its exit through jump slot m->slot is removed together
+   with the ops after it, which are saved to the trace_rem buffers at
+   *REM_OPC and *REM_ARGS; its other direct jumps are turned into plain
+   returns to the main loop, since a TB has only two jump slots.  */
+static bool tb_trace_splice(TranslationBlock *tb, TBTraceMember *m,
+                            uint16_t *opc_start, TCGArg *args_start,
+                            uint16_t **rem_opc, TCGArg **rem_args)
+{
+    TCGContext *s = &tcg_ctx;
+    uint16_t *opc, *exit_opc = NULL;
+    TCGArg *args, *exit_args = NULL;
+    int n;
+
+    for (opc = opc_start, args = args_start; opc < s->gen_opc_ptr;
+         args += tcg_op_nb_params(*opc, args), opc++) {
+        if (*opc == INDEX_op_goto_tb) {
+            *opc = INDEX_op_nop1;
+        } else if (*opc == INDEX_op_exit_tb &&
+                   tb_trace_is_jump_exit(tb, args[0])) {
+            if (args[0] == (uintptr_t)tb + m->slot) {
+                if (exit_opc) {
+                    /* cannot tell which one is the hot path */
+                    return false;
+                }
+                exit_opc = opc;
+                exit_args = args;
+            }
+            args[0] = 0;
+        }
+    }
+    if (!exit_opc) {
+        return false;
+    }
+
+    m->op_len = exit_opc - opc_start;
+    m->rem_len = s->gen_opc_ptr - (exit_opc + 1);
+    n = tcg_op_nb_params(*exit_opc, exit_args);
+    memcpy(*rem_opc, exit_opc + 1, m->rem_len * sizeof(*opc));
+    memcpy(*rem_args, exit_args + n,
+           (s->gen_opparam_ptr - (exit_args + n)) * sizeof(*args));
+    *rem_opc += m->rem_len;
+    *rem_args += s->gen_opparam_ptr - (exit_args + n);
+    s->gen_opc_ptr = exit_opc;
+    s->gen_opparam_ptr = exit_args;
+    return true;
+}
+
+/* Generate the ops of trace T into tcg_ctx.  Returns the number of
+   members that could be translated as they were on their own; the ops
+   are only complete if that is t->nb_members.  */
+static int tb_trace_gen_ops(CPUArchState *env, TranslationBlock *tb,
+                            TBTrace *t)
+{
+    TCGContext *s = &tcg_ctx;
+    target_ulong pc = tb->pc;
+    uint64_t flags = tb->flags;
+    uint16_t size = tb->size;
+    uint16_t *rem_opc = trace_rem_opc;
+    TCGArg *rem_args = trace_rem_opparam;
+    int i;
+
+    tcg_func_start(s);
+    for (i = 0; i < t->nb_members; i++) {
+        TBTraceMember *m = &t->members[i];
+        uint16_t *opc_start = s->gen_opc_ptr;
+        TCGArg *args_start = s->gen_opparam_ptr;
+
+        tb->pc = m->pc;
+        tb->flags = m->flags;
+        s->trace_member = i;
+        gen_intermediate_code(env, tb);
+
+        /* the op buffer may have filled up before the end of the TB */
+        if (tb->size != m->size) {
+            break;
+        }
+        m->op_start = opc_start - s->gen_opc_buf;
+        m->op_len = s->gen_opc_ptr - opc_start;
+        m->rem_len = 0;
+        if (i + 1 < t->nb_members &&
+            !tb_trace_splice(tb, m, opc_start, args_start,
+                             &rem_opc, &rem_args)) {
+            break;
+        }
+        /* the ops moved away must fit back */
+        if ((s->gen_opc_ptr - s->gen_opc_buf) +
+            (rem_opc - trace_rem_opc) > OPC_MAX_SIZE) {
+            break;
+        }
+    }
+    tb->pc = pc;
+    tb->flags = flags;
+    tb->size = size;
+    s->trace_member = 0;
+    if (i < t->nb_members) {
+        return i;
+    }
+
+    /* the code moved out of the way is only reached through labels */
+    rem_opc = trace_rem_opc;
+    for (i = 0; i < t->nb_members; i++) {
+        TBTraceMember *m = &t->members[i];
+
+        m->rem_start = s->gen_opc_ptr - s->gen_opc_buf;
+        memcpy(s->gen_opc_ptr, rem_opc, m->rem_len * sizeof(*rem_opc));
+        s->gen_opc_ptr += m->rem_len;
+        rem_opc += m->rem_len;
+    }
+    memcpy(s->gen_opparam_ptr, trace_rem_opparam,
+           (rem_args - trace_rem_opparam) * sizeof(*rem_args));
+    s->gen_opparam_ptr += rem_args - trace_rem_opparam;
+    *s->gen_opc_ptr = INDEX_op_end;
+    return t->nb_members;
+}
+
+static bool tb_trace_cmp(const void *p, const void *d)
+{
+    const TranslationBlock *tb = p;
+    const TranslationBlock *desc = d;
+
+    return tb->pc == desc->pc &&
+        tb->cs_base == desc->cs_base &&
+        tb->flags == desc->flags &&
+        tb->page_addr[0] == desc->page_addr[0] &&
+        tb->page_addr[1] == -1;
+}
+
+/* Find the TB for the code at PC, on the same page as HEAD.  */
+static TranslationBlock *tb_trace_lookup(TranslationBlock *head,
+                                         target_ulong pc, uint64_t flags)
+{
+    TranslationBlock desc;
+
+    desc.pc = pc;
+    desc.cs_base = head->cs_base;
+    desc.flags = flags;
+    desc.page_addr[0] = head->page_addr[0];
+    return qht_lookup(&tb_ctx.htable, tb_trace_cmp, &desc,
+                      tb_hash_func(desc.page_addr[0] +
+                                   (pc & ~TARGET_PAGE_MASK), pc, flags));
+}
+
+/* Follow the hot path from HEAD, as recorded in the TBs' profile.  The
+   members must not come before HEAD nor leave its page, so that the
+   trace covers a range of guest code as any other TB.  */
+static void tb_trace_collect(TranslationBlock *head, TBTrace *t)
+{
+    TranslationBlock *cur = head;
+    target_ulong page = head->pc & TARGET_PAGE_MASK;
+
+    t->nb_members = 0;
+    for (;;) {
+        TBTraceMember *m = &t->members[t->nb_members++];
+        target_ulong next_pc;
+        int slot;
+
+        m->pc = cur->pc;
+        m->flags = cur->flags;
+        m->size = cur->size;
+        if (t->nb_members == TB_TRACE_MAX_MEMBERS) {
+            break;
+        }
+        slot = cur->trace_count[1] > cur->trace_count[0];
+        /* a warm side exit would leave the trace through the
+           dispatcher; end the trace there and keep both exits chained */
+        if (cur->trace_count[slot] < hot_trace_threshold / 2 ||
+            cur->trace_count[!slot] * 4 > cur->trace_count[slot]) {
+            break;
+        }
+        next_pc = cur->trace_pc[slot];
+        if (next_pc == head->pc ||
+            next_pc < head->pc || (next_pc & TARGET_PAGE_MASK) != page) {
+            break;
+        }
+        cur = tb_trace_lookup(head, next_pc, cur->flags);
+        if (!cur || cur->trace || cur->cflags ||
+            ((cur->pc + cur->size - 1) & TARGET_PAGE_MASK) != page) {
+            break;
+        }
+        m->slot = slot;
+    }
+}
+
+/* Build a trace starting with HEAD, and make it replace HEAD.  */
+static TranslationBlock *tb_gen_trace(CPUState *cpu, TranslationBlock *head)
+{
+    CPUArchState *env = cpu->env_ptr;
+    TCGContext *s = &tcg_ctx;
+    TBRegion *r = &tb_ctx.regions[tb_ctx.cur_region];
+    TranslationBlock *tb;
+    TBTrace t;
+    uint8_t *end;
+    target_ulong tb_end;
+    tb_page_addr_t phys_pc;
+    int i, n, code_size;
+
+    tb_trace_collect(head, &t);
+    if (t.nb_members < 2) {
+        return NULL;
+    }
+    tb = tb_alloc(r, head->pc);
+    if (!tb) {
+        /* not worth evicting code for */
+        return NULL;
+    }
+    tb->cs_base = head->cs_base;
+    tb->flags = head->flags;
+
+    while ((n = tb_trace_gen_ops(env, tb, &t)) < t.nb_members) {
+        if (n < 2) {
+            return NULL;
+        }
+        t.nb_members = n;
+    }
+
+    tb->tb_next_offset[0] = 0xffff;
+    tb->tb_next_offset[1] = 0xffff;
+    s->tb_next_offset = tb->tb_next_offset;
+#ifdef USE_DIRECT_JUMP
+    s->tb_jmp_offset = tb->tb_jmp_offset;
+    s->tb_next = NULL;
+#else
+    s->tb_jmp_offset = NULL;
+    s->tb_next = tb->tb_next;
+#endif
+    code_size = tcg_gen_code(s, tb->tc_ptr);
+
+    /* keep the description of the trace next to its code, where it is
+       reclaimed together with it */
+    end = (uint8_t *)QEMU_ALIGN_UP((uintptr_t)tb->tc_ptr + code_size,
+                                   sizeof(uint64_t));
+    if (end + sizeof(t) > r->end + TCG_MAX_OP_SIZE * OPC_BUF_SIZE) {
+        return NULL;
+    }
+    memcpy(end, &t, sizeof(t));
+    tb->trace = (TBTrace *)end;
+    tb_region_add(r, tb, end + sizeof(t));
+
+    tb_end = head->pc;
+    for (i = 0; i < t.nb_members; i++) {
+        tb_end = MAX(tb_end, t.members[i].pc + t.members[i].size);
+    }
+    tb->size = tb_end - head->pc;
+
+    /* invalidating HEAD marks it dead by clearing its page address */
+    phys_pc = head->page_addr[0];
+    do_tb_phys_invalidate(head, -1);
+    tb_link_page(tb, phys_pc, -1);
+    tb_ctx.tb_trace_count++;
+    tb_ctx.tb_trace_member_count += t.nb_members;
+    perf_report_code(tb, code_size);
+
+#ifdef DEBUG_DISAS
+    if (qemu_loglevel_mask(CPU_LOG_TB_OUT_ASM)) {
+        qemu_log("OUT: [trace of %d TBs, size=%d]\n", t.nb_members,
+                 code_size);
+        log_disas(tb->tc_ptr, code_size);
+        qemu_log("\n");
+        qemu_log_flush();
+    }
+#endif
     return tb;
 }
 
+/* Called with tb_lock held when LAST left through jump slot N and TB
+   is the next TB to run, before the jump is patched.  The jump is left
+   unpatched for a while so that the main loop can count how many times
+   it is taken.  When a jump backwards becomes hot, the loop it closes is
+   built into a trace, which replaces *PTB.
+
+   Returns true if the jump must not be patched yet.  */
+bool tb_trace_profile(CPUState *cpu, TranslationBlock *last, int n,
+                      TranslationBlock **ptb)
+{
+    TranslationBlock *tb = *ptb, *trace;
+
+    if (!hot_trace_threshold || use_icount) {
+        return false;
+    }
+    last->trace_pc[n] = tb->pc;
+    if (last->trace_count[n] < hot_trace_threshold) {
+        last->trace_count[n]++;
+        return true;
+    }
+    if (tb->pc > last->pc || tb->trace || tb->cflags) {
+        return false;
+    }
+    trace = tb_gen_trace(cpu, tb);
+    if (!trace) {
+        return false;
+    }
+    *ptb = trace;
+    return true;
+}
+
 /*
  * Invalidate all TBs which intersect with the target physical address range
  * [start;end[. NOTE: start and end may refer to *different* physical pages.
@@ -1110,16 +2286,14 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
     int current_flags = 0;
 #endif /* TARGET_HAS_PRECISE_SMC */
 
+    /* before the lookup: code being translated outside of tb_lock is not
+       on the page yet */
+    atomic_inc(&tb_ctx.code_write_gen);
     p = page_find(start >> TARGET_PAGE_BITS);
     if (!p) {
         return;
     }
-    if (!p->code_bitmap &&
-        ++p->code_write_count >= SMC_BITMAP_USE_THRESHOLD &&
-        is_cpu_write_access) {
-        /* build code bitmap */
-        build_page_bitmap(p);
-    }
+    tb_lock();
 #if defined(TARGET_HAS_PRECISE_SMC)
     if (cpu != NULL) {
         env = cpu->env_ptr;
@@ -1176,6 +2350,11 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
                 cpu->current_tb = NULL;
             }
             tb_phys_invalidate(tb, -1);
+            if (is_cpu_write_access) {
+                tb_ctx.tb_invalidate_smc_count++;
+            } else {
+                tb_ctx.tb_invalidate_write_count++;
+            }
             if (cpu != NULL) {
                 cpu->current_tb = saved_tb;
                 if (cpu->interrupt_request && cpu->current_tb) {
@@ -1185,25 +2364,32 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
         }
         tb = tb_next;
     }
-#if !defined(CONFIG_USER_ONLY)
-    /* if no code remaining, no need to continue to use slow writes */
     if (!p->first_tb) {
         invalidate_page_bitmap(p);
+#if !defined(CONFIG_USER_ONLY)
+        /* if no code remaining, no need to continue to use slow writes */
         if (is_cpu_write_access) {
             tlb_unprotect_code_phys(cpu, start, cpu->mem_io_vaddr);
         }
-    }
 #endif
+    } else if (is_cpu_write_access &&
+               (p->code_bitmap ||
+                ++p->code_write_count >= SMC_BITMAP_USE_THRESHOLD)) {
+        /* (re)build the code bitmap so that further writes to the data
+           around the remaining TBs take the fast path */
+        build_page_bitmap(p);
+    }
 #ifdef TARGET_HAS_PRECISE_SMC
     if (current_tb_modified) {
         /* we generate a block containing just the instruction
            modifying the memory. It will ensure that it cannot modify
-           itself */
+           itself.  tb_lock is dropped by cpu_exec after the longjmp. */
         cpu->current_tb = NULL;
         tb_gen_code(cpu, current_pc, current_cs_base, current_flags, 1);
         cpu_resume_from_signal(cpu, NULL);
     }
 #endif
+    tb_unlock();
 }
 
 /* len must be <= 8 and start must be a multiple of len */
@@ -1225,16 +2411,20 @@ void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len)
     if (!p) {
         return;
     }
-    if (p->code_bitmap) {
+    tb_lock();
+    tb_ctx.tb_smc_write_count++;
+    if (p->code_bitmap && p->first_tb) {
         offset = start & ~TARGET_PAGE_MASK;
         b = p->code_bitmap[offset >> 3] >> (offset & 7);
         if (b & ((1 << len) - 1)) {
             goto do_invalidate;
         }
+        tb_ctx.tb_smc_filtered_count++;
     } else {
     do_invalidate:
         tb_invalidate_phys_page_range(start, start + len, 1);
     }
+    tb_unlock();
 }
 
 #if !defined(CONFIG_SOFTMMU)
@@ -1255,11 +2445,13 @@ static void tb_invalidate_phys_page(tb_page_addr_t addr,
     int current_flags = 0;
 #endif
 
+    atomic_inc(&tb_ctx.code_write_gen);
     addr &= TARGET_PAGE_MASK;
     p = page_find(addr >> TARGET_PAGE_BITS);
     if (!p) {
         return;
     }
+    tb_lock();
     tb = p->first_tb;
 #ifdef TARGET_HAS_PRECISE_SMC
     if (tb && pc != 0) {
@@ -1288,9 +2480,15 @@ static void tb_invalidate_phys_page(tb_page_addr_t addr,
         }
 #endif /* TARGET_HAS_PRECISE_SMC */
         tb_phys_invalidate(tb, addr);
+        if (locked) {
+            tb_ctx.tb_invalidate_smc_count++;
+        } else {
+            tb_ctx.tb_invalidate_write_count++;
+        }
         tb = tb->page_next[n];
     }
     p->first_tb = NULL;
+    invalidate_page_bitmap(p);
 #ifdef TARGET_HAS_PRECISE_SMC
     if (current_tb_modified) {
         /* we generate a block containing just the instruction
@@ -1304,6 +2502,7 @@ static void tb_invalidate_phys_page(tb_page_addr_t addr,
         cpu_resume_from_signal(cpu, puc);
     }
 #endif
+    tb_unlock();
 }
 #endif
 
@@ -1323,30 +2522,23 @@ static inline void tb_alloc_page(TranslationBlock *tb,
     page_already_protected = p->first_tb != NULL;
 #endif
     p->first_tb = (TranslationBlock *)((uintptr_t)tb | n);
-    invalidate_page_bitmap(p);
+    if (p->code_bitmap) {
+        page_bitmap_add_tb(p, tb, n);
+    }
 
 #if defined(TARGET_HAS_SMC) || 1
 
 #if defined(CONFIG_USER_ONLY)
-    if (p->flags & PAGE_WRITE) {
-        target_ulong addr;
-        PageDesc *p2;
+    if (page_get_flags(page_addr) & PAGE_WRITE) {
+        target_ulong last;
         int prot;
 
         /* force the host page as non writable (writes will have a
            page fault + mprotect overhead) */
         page_addr &= qemu_host_page_mask;
-        prot = 0;
-        for (addr = page_addr; addr < page_addr + qemu_host_page_size;
-            addr += TARGET_PAGE_SIZE) {
-
-            p2 = page_find(addr >> TARGET_PAGE_BITS);
-            if (!p2) {
-                continue;
-            }
-            prot |= p2->flags;
-            p2->flags &= ~PAGE_WRITE;
-          }
+        last = page_addr + qemu_host_page_size - 1;
+        prot = pageflags_union(page_addr, last);
+        pageflags_set_clear(page_addr, last, 0, PAGE_WRITE);
         mprotect(g2h(page_addr), qemu_host_page_size,
                  (prot & PAGE_BITS) & ~PAGE_WRITE);
 #ifdef DEBUG_TB_INVALIDATE
@@ -1371,17 +2563,9 @@ static inline void tb_alloc_page(TranslationBlock *tb,
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                          tb_page_addr_t phys_page2)
 {
-    unsigned int h;
-    TranslationBlock **ptb;
-
     /* Grab the mmap lock to stop another thread invalidating this TB
        before we are done.  */
     mmap_lock();
-    /* add in the physical hash table */
-    h = tb_phys_hash_func(phys_pc);
-    ptb = &tcg_ctx.tb_ctx.tb_phys_hash[h];
-    tb->phys_hash_next = *ptb;
-    *ptb = tb;
 
     /* add in the page list */
     tb_alloc_page(tb, 0, phys_pc & TARGET_PAGE_MASK);
@@ -1403,6 +2587,11 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
         tb_reset_jump(tb, 1);
     }
 
+    /* add in the physical hash table last: lookups do not take any
+       lock, so the TB must be complete once it becomes visible */
+    qht_insert(&tb_ctx.htable, tb,
+               tb_hash_func(phys_pc, tb->pc, tb->flags));
+
 #ifdef DEBUG_TB_CHECK
     tb_page_check();
 #endif
@@ -1413,23 +2602,33 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
    tb[1].tc_ptr. Return NULL if not found */
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
 {
-    int m_min, m_max, m;
+    TBContext *t = &tb_ctx;
+    int m_min, m_max, m, i;
     uintptr_t v;
     TranslationBlock *tb;
+    TBRegion *r;
 
-    if (tcg_ctx.tb_ctx.nb_tbs <= 0) {
+    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer) {
         return NULL;
     }
-    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer ||
-        tc_ptr >= (uintptr_t)tcg_ctx.code_gen_ptr) {
+    /* TBs are sorted by tc_ptr within a region */
+    i = (tc_ptr - (uintptr_t)tcg_ctx.code_gen_buffer) / t->region_size;
+    if (i >= t->nb_regions) {
+        return NULL;
+    }
+    r = &t->regions[i];
+    if (r->nb_tbs <= 0 || tc_ptr < (uintptr_t)r->tbs[0].tc_ptr) {
+        return NULL;
+    }
+    if (tc_ptr >= (uintptr_t)r->ptr) {
         return NULL;
     }
     /* binary search (cf Knuth) */
     m_min = 0;
-    m_max = tcg_ctx.tb_ctx.nb_tbs - 1;
+    m_max = r->nb_tbs - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
-        tb = &tcg_ctx.tb_ctx.tbs[m];
+        tb = &r->tbs[m];
         v = (uintptr_t)tb->tc_ptr;
         if (v == tc_ptr) {
             return tb;
@@ -1439,7 +2638,7 @@ static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
             m_min = m + 1;
         }
     }
-    return &tcg_ctx.tb_ctx.tbs[m_max];
+    return &r->tbs[m_max];
 }
 
 #if defined(TARGET_HAS_ICE) && !defined(CONFIG_USER_ONLY)
@@ -1464,6 +2663,7 @@ void tb_check_watchpoint(CPUState *cpu)
 {
     TranslationBlock *tb;
 
+    tb_lock();
     tb = tb_find_pc(cpu->mem_io_pc);
     if (!tb) {
         cpu_abort(cpu, "check_watchpoint: could not find TB for pc=%p",
@@ -1471,6 +2671,18 @@ void tb_check_watchpoint(CPUState *cpu)
     }
     cpu_restore_state_from_tb(cpu, tb, cpu->mem_io_pc);
     tb_phys_invalidate(tb, -1);
+    tb_ctx.tb_invalidate_watch_count++;
+    tb_unlock();
+}
+
+/* Translation outside of tb_lock, and the time spent waiting for it */
+void dump_tb_lock_info(FILE *f, fprintf_function cpu_fprintf)
+{
+    cpu_fprintf(f, "TB parallel count   %d (%d dropped)\n",
+                tb_ctx.tb_parallel_count, tb_ctx.tb_parallel_drop_count);
+    cpu_fprintf(f, "TB lock waits       %d (%" PRId64 " us)\n",
+                tb_ctx.tb_lock_wait_count,
+                tb_ctx.tb_lock_wait_time / SCALE_US);
 }
 
 #ifndef CONFIG_USER_ONLY
@@ -1516,6 +2728,8 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
     target_ulong pc, cs_base;
     uint64_t flags;
 
+    /* tb_lock is dropped by cpu_exec after cpu_resume_from_signal() */
+    tb_lock();
     tb = tb_find_pc(retaddr);
     if (!tb) {
         cpu_abort(cpu, "cpu_io_recompile: could not find TB for pc=%p",
@@ -1556,6 +2770,7 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
     cs_base = tb->cs_base;
     flags = tb->flags;
     tb_phys_invalidate(tb, -1);
+    tb_ctx.tb_invalidate_io_count++;
     /* FIXME: In theory this could raise an exception.  In practice
        we have already translated the block once so it's probably ok.  */
     tb_gen_code(cpu, pc, cs_base, flags, cflags);
@@ -1584,64 +2799,129 @@ void tb_flush_jmp_cache(CPUState *cpu, target_ulong addr)
 
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
-    int i, target_code_size, max_target_code_size;
-    int direct_jmp_count, direct_jmp2_count, cross_page;
+    TBContext *t = &tb_ctx;
+    int i, j, target_code_size, max_target_code_size;
+    int direct_jmp_count, direct_jmp2_count, cross_page, owned;
+    ptrdiff_t code_size;
     TranslationBlock *tb;
+    QHTStats hst;
+    TLBSlowPathStats tlb = { 0 };
+    uint64_t lookup_hit = 0, lookup_miss = 0;
+    CPUState *cpu;
 
     target_code_size = 0;
     max_target_code_size = 0;
     cross_page = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
-    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
-        tb = &tcg_ctx.tb_ctx.tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size) {
-            max_target_code_size = tb->size;
-        }
-        if (tb->page_addr[1] != -1) {
-            cross_page++;
-        }
-        if (tb->tb_next_offset[0] != 0xffff) {
-            direct_jmp_count++;
-            if (tb->tb_next_offset[1] != 0xffff) {
-                direct_jmp2_count++;
+    code_size = 0;
+    owned = 0;
+    for (j = 0; j < t->nb_regions; j++) {
+        TBRegion *r = &t->regions[j];
+
+        code_size += r->ptr - r->start;
+        owned += r->owned;
+        for (i = 0; i < r->nb_tbs; i++) {
+            tb = &r->tbs[i];
+            target_code_size += tb->size;
+            if (tb->size > max_target_code_size) {
+                max_target_code_size = tb->size;
+            }
+            if (tb->page_addr[1] != -1) {
+                cross_page++;
+            }
+            if (tb->tb_next_offset[0] != 0xffff) {
+                direct_jmp_count++;
+                if (tb->tb_next_offset[1] != 0xffff) {
+                    direct_jmp2_count++;
+                }
             }
         }
     }
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
     cpu_fprintf(f, "gen code size       %td/%zd\n",
-                tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer,
-                tcg_ctx.code_gen_buffer_max_size);
+                code_size, tcg_ctx.code_gen_buffer_max_size);
+    cpu_fprintf(f, "code regions        %d (current %d, %d owned by "
+                "threads)\n", t->nb_regions, t->cur_region, owned);
     cpu_fprintf(f, "TB count            %d/%d\n",
-            tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.code_gen_max_blocks);
+            tb_ctx.nb_tbs, tcg_ctx.code_gen_max_blocks);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
-            tcg_ctx.tb_ctx.nb_tbs ? target_code_size /
-                    tcg_ctx.tb_ctx.nb_tbs : 0,
+            tb_ctx.nb_tbs ? target_code_size /
+                    tb_ctx.nb_tbs : 0,
             max_target_code_size);
     cpu_fprintf(f, "TB avg host size    %td bytes (expansion ratio: %0.1f)\n",
-            tcg_ctx.tb_ctx.nb_tbs ? (tcg_ctx.code_gen_ptr -
-                                     tcg_ctx.code_gen_buffer) /
-                                     tcg_ctx.tb_ctx.nb_tbs : 0,
-                target_code_size ? (double) (tcg_ctx.code_gen_ptr -
-                                             tcg_ctx.code_gen_buffer) /
-                                             target_code_size : 0);
+            tb_ctx.nb_tbs ? code_size / tb_ctx.nb_tbs : 0,
+            target_code_size ? (double) code_size / target_code_size : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n", cross_page,
-            tcg_ctx.tb_ctx.nb_tbs ? (cross_page * 100) /
-                                    tcg_ctx.tb_ctx.nb_tbs : 0);
+            tb_ctx.nb_tbs ? (cross_page * 100) /
+                                    tb_ctx.nb_tbs : 0);
     cpu_fprintf(f, "direct jump count   %d (%d%%) (2 jumps=%d %d%%)\n",
                 direct_jmp_count,
-                tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp_count * 100) /
-                        tcg_ctx.tb_ctx.nb_tbs : 0,
+                tb_ctx.nb_tbs ? (direct_jmp_count * 100) /
+                        tb_ctx.nb_tbs : 0,
                 direct_jmp2_count,
-                tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp2_count * 100) /
-                        tcg_ctx.tb_ctx.nb_tbs : 0);
+                tb_ctx.nb_tbs ? (direct_jmp2_count * 100) /
+                        tb_ctx.nb_tbs : 0);
+
+    qht_statistics(&tb_ctx.htable, &hst);
+    cpu_fprintf(f, "TB hash buckets     %zu/%zu (%zu%% head buckets used)\n",
+                hst.used_head_buckets, hst.head_buckets,
+                hst.head_buckets ? (hst.used_head_buckets * 100) /
+                        hst.head_buckets : 0);
+    cpu_fprintf(f, "TB hash overflow    %zu buckets, max chain %zu\n",
+                hst.overflow_buckets, hst.max_chain);
+    cpu_fprintf(f, "TB hash resizes     %u\n", hst.resizes);
     cpu_fprintf(f, "\nStatistics:\n");
-    cpu_fprintf(f, "TB flush count      %d\n", tcg_ctx.tb_ctx.tb_flush_count);
+    cpu_fprintf(f, "TB flush count      %d\n", tb_ctx.tb_flush_count);
+    cpu_fprintf(f, "TB evict count      %d regions, %d TBs "
+                "(full flushes avoided)\n",
+                tb_ctx.tb_evict_count, tb_ctx.tb_evict_tb_count);
     cpu_fprintf(f, "TB invalidate count %d\n",
-            tcg_ctx.tb_ctx.tb_phys_invalidate_count);
+            tb_ctx.tb_phys_invalidate_count);
+    cpu_fprintf(f, "  by guest store    %d\n",
+                tb_ctx.tb_invalidate_smc_count);
+    cpu_fprintf(f, "  by other write    %d (DMA, debugger, mmap)\n",
+                tb_ctx.tb_invalidate_write_count);
+    cpu_fprintf(f, "  by I/O recompile  %d\n",
+                tb_ctx.tb_invalidate_io_count);
+    cpu_fprintf(f, "  by watchpoint     %d\n",
+                tb_ctx.tb_invalidate_watch_count);
+    cpu_fprintf(f, "code page writes    %d (%d%% missed all TBs)\n",
+                tb_ctx.tb_smc_write_count,
+                tb_ctx.tb_smc_write_count ?
+                (int)((int64_t)tb_ctx.tb_smc_filtered_count * 100 /
+                      tb_ctx.tb_smc_write_count) : 0);
+    cpu_fprintf(f, "TB trace count      %d (avg %d TBs per trace)\n",
+                tb_ctx.tb_trace_count,
+                tb_ctx.tb_trace_count ?
+                tb_ctx.tb_trace_member_count /
+                tb_ctx.tb_trace_count : 0);
+    dump_tb_lock_info(f, cpu_fprintf);
+    CPU_FOREACH(cpu) {
+        const TLBSlowPathStats *s = &cpu->tlb_slow_stats;
+
+        lookup_hit += cpu->tb_lookup_hit_count;
+        lookup_miss += cpu->tb_lookup_miss_count;
+        tlb.fill += s->fill;
+        tlb.victim += s->victim;
+        tlb.io += s->io;
+        tlb.unaligned += s->unaligned;
+        tlb.cross_page += s->cross_page;
+        tlb.cross_page_split += s->cross_page_split;
+    }
+    cpu_fprintf(f, "TB lookup in code   %" PRIu64 " (%" PRIu64
+                " back to main loop)\n",
+                lookup_hit + lookup_miss, lookup_miss);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+    cpu_fprintf(f, "TLB refills         %" PRIu64 " (%" PRIu64
+                " from victim TLB)\n",
+                tlb.fill + tlb.victim, tlb.victim);
+    cpu_fprintf(f, "slow path accesses  %" PRIu64 " I/O or clean page, %"
+                PRIu64 " unaligned\n",
+                tlb.io, tlb.unaligned);
+    cpu_fprintf(f, "cross page accesses %" PRIu64 " (%" PRIu64 " split)\n",
+                tlb.cross_page + tlb.cross_page_split, tlb.cross_page_split);
     tcg_dump_info(f, cpu_fprintf);
 }
 
@@ -1657,88 +2937,35 @@ void cpu_interrupt(CPUState *cpu, int mask)
  * Walks guest process memory "regions" one by one
  * and calls callback function 'fn' for each region.
  */
-struct walk_memory_regions_data {
-    walk_memory_regions_fn fn;
-    void *priv;
-    target_ulong start;
-    int prot;
-};
-
-static int walk_memory_regions_end(struct walk_memory_regions_data *data,
-                                   target_ulong end, int new_prot)
-{
-    if (data->start != -1u) {
-        int rc = data->fn(data->priv, data->start, end, data->prot);
-        if (rc != 0) {
-            return rc;
-        }
-    }
-
-    data->start = (new_prot ? end : -1u);
-    data->prot = new_prot;
-
-    return 0;
-}
-
-static int walk_memory_regions_1(struct walk_memory_regions_data *data,
-                                 target_ulong base, int level, void **lp)
+int walk_memory_regions(void *priv, walk_memory_regions_fn fn)
 {
-    target_ulong pa;
-    int i, rc;
-
-    if (*lp == NULL) {
-        return walk_memory_regions_end(data, base, 0);
-    }
-
-    if (level == 0) {
-        PageDesc *pd = *lp;
+    PageFlagsNode *p;
+    target_ulong start = 0, end = 0;
+    int prot = 0;
+    int rc = 0;
 
-        for (i = 0; i < V_L2_SIZE; ++i) {
-            int prot = pd[i].flags;
-
-            pa = base | (i << TARGET_PAGE_BITS);
-            if (prot != data->prot) {
-                rc = walk_memory_regions_end(data, pa, prot);
-                if (rc != 0) {
-                    return rc;
-                }
-            }
+    mmap_lock();
+    for (p = pageflags_find(0, -1); p; p = pageflags_next(p, 0, -1)) {
+        if (prot && p->itree.start == end && p->flags == prot) {
+            end = p->itree.last + 1;
+            continue;
         }
-    } else {
-        void **pp = *lp;
-
-        for (i = 0; i < V_L2_SIZE; ++i) {
-            pa = base | ((target_ulong)i <<
-                (TARGET_PAGE_BITS + V_L2_BITS * level));
-            rc = walk_memory_regions_1(data, pa, level - 1, pp + i);
+        if (prot) {
+            rc = fn(priv, start, end, prot);
             if (rc != 0) {
-                return rc;
+                break;
             }
         }
+        start = p->itree.start;
+        end = p->itree.last + 1;
+        prot = p->flags;
     }
-
-    return 0;
-}
-
-int walk_memory_regions(void *priv, walk_memory_regions_fn fn)
-{
-    struct walk_memory_regions_data data;
-    uintptr_t i;
-
-    data.fn = fn;
-    data.priv = priv;
-    data.start = -1u;
-    data.prot = 0;
-
-    for (i = 0; i < V_L1_SIZE; i++) {
-        int rc = walk_memory_regions_1(&data, (target_ulong)i << (V_L1_SHIFT + TARGET_PAGE_BITS),
-                                       V_L1_SHIFT / V_L2_BITS - 1, l1_map + i);
-        if (rc != 0) {
-            return rc;
-        }
+    if (prot && rc == 0) {
+        rc = fn(priv, start, end, prot);
     }
+    mmap_unlock();
 
-    return walk_memory_regions_end(&data, 0, 0);
+    return rc;
 }
 
 static int dump_region(void *priv, target_ulong start,
@@ -1767,13 +2994,40 @@ void page_dump(FILE *f)
 
 int page_get_flags(target_ulong address)
 {
-    PageDesc *p;
+    PageFlagsNode *p;
+    int flags;
 
-    p = page_find(address >> TARGET_PAGE_BITS);
-    if (!p) {
-        return 0;
+    mmap_lock();
+    p = pageflags_find(address, address);
+    flags = p ? p->flags : 0;
+    mmap_unlock();
+    return flags;
+}
+
+/* Invalidate the code on the pages of [start, last] that are not
+   writable yet, before they become so.  */
+static void page_invalidate_before_write(target_ulong start,
+                                         target_ulong last)
+{
+    tb_page_addr_t index = start >> TARGET_PAGE_BITS;
+    tb_page_addr_t last_index = last >> TARGET_PAGE_BITS;
+
+    for (; index <= last_index; index++) {
+        PageDesc *p = page_find(index);
+
+        if (!p) {
+            /* none of the pages of this PageDesc table ever held code */
+            index |= V_L2_SIZE - 1;
+            continue;
+        }
+        if (p->first_tb) {
+            target_ulong addr = (target_ulong)index << TARGET_PAGE_BITS;
+
+            if (!(page_get_flags(addr) & PAGE_WRITE)) {
+                tb_invalidate_phys_page(addr, 0, NULL, false);
+            }
+        }
     }
-    return p->flags;
 }
 
 /* Modify the flags of a page and invalidate the code if necessary.
@@ -1781,8 +3035,6 @@ int page_get_flags(target_ulong address)
    on PAGE_WRITE.  The mmap_lock should already be held.  */
 void page_set_flags(target_ulong start, target_ulong end, int flags)
 {
-    target_ulong addr, len;
-
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
        a missing call to h2g_valid.  */
@@ -1796,29 +3048,18 @@ void page_set_flags(target_ulong start, target_ulong end, int flags)
 
     if (flags & PAGE_WRITE) {
         flags |= PAGE_WRITE_ORG;
-    }
-
-    for (addr = start, len = end - start;
-         len != 0;
-         len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        PageDesc *p = page_find_alloc(addr >> TARGET_PAGE_BITS, 1);
-
         /* If the write protection bit is set, then we invalidate
            the code inside.  */
-        if (!(p->flags & PAGE_WRITE) &&
-            (flags & PAGE_WRITE) &&
-            p->first_tb) {
-            tb_invalidate_phys_page(addr, 0, NULL, false);
-        }
-        p->flags = flags;
+        page_invalidate_before_write(start, end - 1);
     }
+    pageflags_set(start, end - 1, flags);
 }
 
 int page_check_range(target_ulong start, target_ulong len, int flags)
 {
-    PageDesc *p;
-    target_ulong end;
-    target_ulong addr;
+    PageFlagsNode *p;
+    target_ulong addr, last, p_last;
+    int ret = 0;
 
     /* This function should never be called with addresses outside the
        guest address space.  If this assert fires, it probably indicates
@@ -1830,59 +3071,138 @@ int page_check_range(target_ulong start, target_ulong len, int flags)
     if (len == 0) {
         return 0;
     }
-    if (start + len - 1 < start) {
+    last = start + len - 1;
+    if (last < start) {
         /* We've wrapped around.  */
         return -1;
     }
 
-    /* must do before we loose bits in the next step */
-    end = TARGET_PAGE_ALIGN(start + len);
-    start = start & TARGET_PAGE_MASK;
-
-    for (addr = start, len = end - start;
-         len != 0;
-         len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
-        p = page_find(addr >> TARGET_PAGE_BITS);
-        if (!p) {
-            return -1;
+    mmap_lock();
+    /* walk the mappings that cover the range, which must be contiguous */
+    for (addr = start; ; addr = p_last + 1) {
+        p = pageflags_last_checked;
+        if (!p || addr < p->itree.start || addr > p->itree.last) {
+            p = pageflags_find(addr, addr);
+            pageflags_last_checked = p;
         }
-        if (!(p->flags & PAGE_VALID)) {
-            return -1;
+        if (!p || !(p->flags & PAGE_VALID)) {
+            ret = -1;
+            break;
         }
+        p_last = MIN(p->itree.last, last);
 
         if ((flags & PAGE_READ) && !(p->flags & PAGE_READ)) {
-            return -1;
+            ret = -1;
+            break;
         }
         if (flags & PAGE_WRITE) {
             if (!(p->flags & PAGE_WRITE_ORG)) {
-                return -1;
+                ret = -1;
+                break;
             }
-            /* unprotect the page if it was put read-only because it
-               contains translated code */
+            /* unprotect the pages that were put read-only because they
+               contain translated code */
             if (!(p->flags & PAGE_WRITE)) {
-                if (!page_unprotect(addr, 0, NULL)) {
-                    return -1;
+                target_ulong page;
+
+                for (page = addr & TARGET_PAGE_MASK; ;
+                     page += TARGET_PAGE_SIZE) {
+                    if (!page_unprotect(page, 0, NULL)) {
+                        ret = -1;
+                        goto out;
+                    }
+                    if (page == (p_last & TARGET_PAGE_MASK)) {
+                        break;
+                    }
                 }
             }
         }
+        if (p_last == last) {
+            break;
+        }
+    }
+ out:
+    mmap_unlock();
+    return ret;
+}
+
+/* Return the lowest address in [min, max] of a free range of LEN bytes
+   that is aligned to ALIGN, or -1 if there is none.  The mmap_lock
+   should already be held.  */
+target_ulong page_find_range_empty(target_ulong min, target_ulong max,
+                                   target_ulong len, target_ulong align)
+{
+    target_ulong start = (min + align - 1) & -align;
+    target_ulong next;
+    PageFlagsNode *p;
+
+    assert(len != 0);
+    for (;;) {
+        if (start < min || start > max || max - start < len - 1) {
+            return -1;
+        }
+        p = pageflags_find(start, start + len - 1);
+        if (!p) {
+            return start;
+        }
+        /* start again past the lowest mapping in the way */
+        if (p->itree.last >= max) {
+            return -1;
+        }
+        next = ((target_ulong)p->itree.last + align) & -align;
+        if (next <= start) {
+            /* wrapped around */
+            return -1;
+        }
+        start = next;
+    }
+}
+
+/* Likewise, but return the highest such address.  */
+target_ulong page_find_range_empty_top(target_ulong min, target_ulong max,
+                                       target_ulong len, target_ulong align)
+{
+    target_ulong start;
+    PageFlagsNode *p, *next;
+
+    assert(len != 0);
+    if (max < min || max - min < len - 1) {
+        return -1;
+    }
+    for (;;) {
+        start = (max - (len - 1)) & -align;
+        if (start < min) {
+            return -1;
+        }
+        p = pageflags_find(start, start + len - 1);
+        if (!p) {
+            return start;
+        }
+        /* start again below the highest mapping in the way */
+        while ((next = pageflags_next(p, start, start + len - 1)) != NULL) {
+            p = next;
+        }
+        if (p->itree.start <= min || p->itree.start - min < len) {
+            return -1;
+        }
+        max = p->itree.start - 1;
     }
-    return 0;
 }
 
 /* called from signal handler: invalidate the code and unprotect the
    page. Return TRUE if the fault was successfully handled. */
 int page_unprotect(target_ulong address, uintptr_t pc, void *puc)
 {
-    unsigned int prot;
-    PageDesc *p;
-    target_ulong host_start, host_end, addr;
+    PageFlagsNode *p;
+    target_ulong host_start, host_last, addr;
+    int prot;
 
     /* Technically this isn't safe inside a signal handler.  However we
        know this only ever happens in a synchronous SEGV handler, so in
        practice it seems to be ok.  */
     mmap_lock();
 
-    p = page_find(address >> TARGET_PAGE_BITS);
+    p = pageflags_find(address, address);
     if (!p) {
         mmap_unlock();
         return 0;
@@ -1892,27 +3212,34 @@ int page_unprotect(target_ulong address, uintptr_t pc, void *puc)
        protection back to writable */
     if ((p->flags & PAGE_WRITE_ORG) && !(p->flags & PAGE_WRITE)) {
         host_start = address & qemu_host_page_mask;
-        host_end = host_start + qemu_host_page_size;
+        host_last = host_start + qemu_host_page_size - 1;
 
-        prot = 0;
-        for (addr = host_start ; addr < host_end ; addr += TARGET_PAGE_SIZE) {
-            p = page_find(addr >> TARGET_PAGE_BITS);
-            p->flags |= PAGE_WRITE;
-            prot |= p->flags;
+        pageflags_set_clear(host_start, host_last, PAGE_WRITE, 0);
+        prot = pageflags_union(host_start, host_last);
+        /* before the invalidation, which may not return if the code
+           being run modifies itself */
+        mprotect((void *)g2h(host_start), qemu_host_page_size,
+                 prot & PAGE_BITS);
 
-            /* and since the content will be modified, we must invalidate
-               the corresponding translated code. */
+        /* and since the content will be modified, we must invalidate
+           the corresponding translated code. */
+        for (addr = host_start; addr < host_start + qemu_host_page_size;
+             addr += TARGET_PAGE_SIZE) {
             tb_invalidate_phys_page(addr, pc, puc, true);
 #ifdef DEBUG_TB_CHECK
             tb_invalidate_check(addr);
 #endif
         }
-        mprotect((void *)g2h(host_start), qemu_host_page_size,
-                 prot & PAGE_BITS);
 
         mmap_unlock();
         return 1;
     }
+    /* another thread unprotected the page while this one was faulting
+       on it: retry the access */
+    if (p->flags & PAGE_WRITE_ORG) {
+        mmap_unlock();
+        return 1;
+    }
     mmap_unlock();
     return 0;
 }
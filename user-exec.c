@@ -22,6 +22,7 @@
 #include "tcg.h"
 #include "qemu/bitops.h"
 #include "exec/cpu_ldst.h"
+#include "exec/helper-proto.h"
 
 #undef EAX
 #undef ECX
@@ -39,6 +40,8 @@
 
 //#define DEBUG_SIGNAL
 
+DEFINE_TLS(uintptr_t, helper_retaddr);
+
 static void exception_action(CPUState *cpu)
 {
 #if defined(TARGET_I386)
@@ -75,6 +78,7 @@ void cpu_resume_from_signal(CPUState *cpu, void *puc)
 #endif
     }
     cpu->exception_index = -1;
+    tls_var(helper_retaddr) = 0;
     siglongjmp(cpu->jmp_env, 1);
 }
 
@@ -94,6 +98,12 @@ static inline int handle_cpu_signal(uintptr_t pc, unsigned long address,
     qemu_printf("qemu: SIGSEGV pc=0x%08lx address=%08lx w=%d oldset=0x%08lx\n",
                 pc, address, is_write, *(unsigned long *)old_set);
 #endif
+    /* A helper accessing guest memory directly faulted: the guest state
+       is that of the guest instruction calling it.  */
+    if (tls_var(helper_retaddr)) {
+        pc = tls_var(helper_retaddr);
+    }
+
     /* XXX: locking issue */
     if (is_write && h2g_valid(address)
         && page_unprotect(h2g(address), pc, puc)) {
@@ -117,6 +127,7 @@ static inline int handle_cpu_signal(uintptr_t pc, unsigned long address,
     }
     /* now we have a real cpu fault */
     cpu_restore_state(cpu, pc);
+    tls_var(helper_retaddr) = 0;
 
     /* we restore the process signal mask as the sigreturn should
        do it (XXX: use sigsetjmp) */
@@ -661,3 +672,36 @@ int cpu_signal_handler(int host_signum, void *pinfo,
 #error host CPU specific signal handler needed
 
 #endif
+
+/* Atomic read-modify-write helpers, on the host page backing the guest
+   address.  */
+static inline void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
+                                      uintptr_t retaddr)
+{
+    tls_var(helper_retaddr) = retaddr;
+    return g2h(addr);
+}
+
+#define SHIFT 0
+#include "atomic_template.h"
+
+#define SHIFT 1
+#include "atomic_template.h"
+
+#define SHIFT 1
+#define ATOMIC_BE
+#include "atomic_template.h"
+
+#define SHIFT 2
+#include "atomic_template.h"
+
+#define SHIFT 2
+#define ATOMIC_BE
+#include "atomic_template.h"
+
+#define SHIFT 3
+#include "atomic_template.h"
+
+#define SHIFT 3
+#define ATOMIC_BE
+#include "atomic_template.h"
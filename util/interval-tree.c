@@ -0,0 +1,334 @@
+/*
+ * Interval tree: a red-black tree of [start, last] intervals
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#include "qemu/interval-tree.h"
+
+/* The nodes are sorted by start, and each one also records the highest
+ * 'last' of its subtree, which lets a search skip the subtrees that end
+ * before the interval it is looking for.  Rebalancing is the usual
+ * red-black tree one, with NULL as the black leaves; the rotations keep
+ * subtree_last up to date.
+ */
+
+static void it_update(IntervalTreeNode *n)
+{
+    uint64_t max = n->last;
+
+    if (n->left && n->left->subtree_last > max) {
+        max = n->left->subtree_last;
+    }
+    if (n->right && n->right->subtree_last > max) {
+        max = n->right->subtree_last;
+    }
+    n->subtree_last = max;
+}
+
+/* Recompute subtree_last from N up to the root.  */
+static void it_propagate(IntervalTreeNode *n)
+{
+    for (; n; n = n->parent) {
+        it_update(n);
+    }
+}
+
+static void it_replace_child(IntervalTreeRoot *root, IntervalTreeNode *parent,
+                             IntervalTreeNode *old, IntervalTreeNode *new)
+{
+    if (!parent) {
+        root->root = new;
+    } else if (parent->left == old) {
+        parent->left = new;
+    } else {
+        parent->right = new;
+    }
+}
+
+static void it_rotate_left(IntervalTreeRoot *root, IntervalTreeNode *x)
+{
+    IntervalTreeNode *y = x->right;
+
+    x->right = y->left;
+    if (y->left) {
+        y->left->parent = x;
+    }
+    y->parent = x->parent;
+    it_replace_child(root, x->parent, x, y);
+    y->left = x;
+    x->parent = y;
+
+    /* y now covers the nodes x covered */
+    y->subtree_last = x->subtree_last;
+    it_update(x);
+}
+
+static void it_rotate_right(IntervalTreeRoot *root, IntervalTreeNode *x)
+{
+    IntervalTreeNode *y = x->left;
+
+    x->left = y->right;
+    if (y->right) {
+        y->right->parent = x;
+    }
+    y->parent = x->parent;
+    it_replace_child(root, x->parent, x, y);
+    y->right = x;
+    x->parent = y;
+
+    y->subtree_last = x->subtree_last;
+    it_update(x);
+}
+
+static bool it_is_red(IntervalTreeNode *n)
+{
+    return n && n->red;
+}
+
+void interval_tree_insert(IntervalTreeNode *node, IntervalTreeRoot *root)
+{
+    IntervalTreeNode **link = &root->root;
+    IntervalTreeNode *parent = NULL;
+    IntervalTreeNode *n, *p, *g, *u;
+
+    while (*link) {
+        parent = *link;
+        if (parent->subtree_last < node->last) {
+            parent->subtree_last = node->last;
+        }
+        link = node->start < parent->start ? &parent->left : &parent->right;
+    }
+    node->parent = parent;
+    node->left = node->right = NULL;
+    node->red = true;
+    node->subtree_last = node->last;
+    *link = node;
+
+    n = node;
+    while ((p = n->parent) && p->red) {
+        /* p is red, so it is not the root */
+        g = p->parent;
+        if (p == g->left) {
+            u = g->right;
+            if (it_is_red(u)) {
+                p->red = false;
+                u->red = false;
+                g->red = true;
+                n = g;
+                continue;
+            }
+            if (n == p->right) {
+                it_rotate_left(root, p);
+                n = p;
+                p = n->parent;
+            }
+            p->red = false;
+            g->red = true;
+            it_rotate_right(root, g);
+        } else {
+            u = g->left;
+            if (it_is_red(u)) {
+                p->red = false;
+                u->red = false;
+                g->red = true;
+                n = g;
+                continue;
+            }
+            if (n == p->left) {
+                it_rotate_right(root, p);
+                n = p;
+                p = n->parent;
+            }
+            p->red = false;
+            g->red = true;
+            it_rotate_left(root, g);
+        }
+    }
+    root->root->red = false;
+}
+
+static void it_transplant(IntervalTreeRoot *root, IntervalTreeNode *u,
+                          IntervalTreeNode *v)
+{
+    it_replace_child(root, u->parent, u, v);
+    if (v) {
+        v->parent = u->parent;
+    }
+}
+
+/* X took the place of a black node and is one black short; XP is its
+ * parent, as X may be NULL.
+ */
+static void it_remove_fixup(IntervalTreeRoot *root, IntervalTreeNode *x,
+                            IntervalTreeNode *xp)
+{
+    IntervalTreeNode *w;
+
+    while (x != root->root && !it_is_red(x)) {
+        /* the sibling of a node that is one black short is never NULL */
+        if (x == xp->left) {
+            w = xp->right;
+            if (w->red) {
+                w->red = false;
+                xp->red = true;
+                it_rotate_left(root, xp);
+                w = xp->right;
+            }
+            if (!it_is_red(w->left) && !it_is_red(w->right)) {
+                w->red = true;
+                x = xp;
+                xp = x->parent;
+                continue;
+            }
+            if (!it_is_red(w->right)) {
+                w->left->red = false;
+                w->red = true;
+                it_rotate_right(root, w);
+                w = xp->right;
+            }
+            w->red = xp->red;
+            xp->red = false;
+            w->right->red = false;
+            it_rotate_left(root, xp);
+        } else {
+            w = xp->left;
+            if (w->red) {
+                w->red = false;
+                xp->red = true;
+                it_rotate_right(root, xp);
+                w = xp->left;
+            }
+            if (!it_is_red(w->left) && !it_is_red(w->right)) {
+                w->red = true;
+                x = xp;
+                xp = x->parent;
+                continue;
+            }
+            if (!it_is_red(w->left)) {
+                w->right->red = false;
+                w->red = true;
+                it_rotate_left(root, w);
+                w = xp->left;
+            }
+            w->red = xp->red;
+            xp->red = false;
+            w->left->red = false;
+            it_rotate_right(root, xp);
+        }
+        x = root->root;
+    }
+    if (x) {
+        x->red = false;
+    }
+}
+
+void interval_tree_remove(IntervalTreeNode *node, IntervalTreeRoot *root)
+{
+    IntervalTreeNode *y, *x, *xp;
+    bool removed_red;
+
+    if (!node->left || !node->right) {
+        x = node->left ? node->left : node->right;
+        xp = node->parent;
+        removed_red = node->red;
+        it_transplant(root, node, x);
+    } else {
+        /* replace node with its successor, which has no left child */
+        y = node->right;
+        while (y->left) {
+            y = y->left;
+        }
+        removed_red = y->red;
+        x = y->right;
+        if (y->parent == node) {
+            xp = y;
+        } else {
+            xp = y->parent;
+            it_transplant(root, y, x);
+            y->right = node->right;
+            y->right->parent = y;
+        }
+        it_transplant(root, node, y);
+        y->left = node->left;
+        y->left->parent = y;
+        y->red = node->red;
+    }
+
+    /* every node whose subtree changed is on the path from xp up */
+    it_propagate(xp);
+    if (!removed_red) {
+        it_remove_fixup(root, x, xp);
+    }
+}
+
+/* Return the leftmost node of the subtree rooted at N that overlaps
+ * [start, last], given that N->subtree_last >= start.
+ */
+static IntervalTreeNode *it_subtree_search(IntervalTreeNode *n,
+                                           uint64_t start, uint64_t last)
+{
+    for (;;) {
+        if (n->left && n->left->subtree_last >= start) {
+            /* The leftmost node that ends at or after start is in the
+             * left subtree.  Either it overlaps, or it starts after
+             * last and so does everything to its right.
+             */
+            n = n->left;
+            continue;
+        }
+        if (n->start > last) {
+            return NULL;
+        }
+        if (n->last >= start) {
+            return n;
+        }
+        if (n->right && n->right->subtree_last >= start) {
+            n = n->right;
+            continue;
+        }
+        return NULL;
+    }
+}
+
+IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
+                                           uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *n = root->root;
+
+    if (!n || n->subtree_last < start) {
+        return NULL;
+    }
+    return it_subtree_search(n, start, last);
+}
+
+IntervalTreeNode *interval_tree_iter_next(IntervalTreeNode *node,
+                                          uint64_t start, uint64_t last)
+{
+    IntervalTreeNode *right = node->right;
+    IntervalTreeNode *prev;
+
+    for (;;) {
+        if (right && right->subtree_last >= start) {
+            return it_subtree_search(right, start, last);
+        }
+
+        /* climb until we arrive from a left child: that parent is next */
+        do {
+            prev = node;
+            node = node->parent;
+            if (!node) {
+                return NULL;
+            }
+        } while (prev == node->right);
+
+        if (node->start > last) {
+            return NULL;
+        }
+        if (node->last >= start) {
+            return node;
+        }
+        right = node->right;
+    }
+}
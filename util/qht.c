@@ -0,0 +1,390 @@
+/*
+ * QHT: hash table with lock-free lookups
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#include <string.h>
+#include <assert.h>
+#include "qemu-common.h"
+#include "qemu/atomic.h"
+#include "qemu/qht.h"
+
+/* The table is an array of buckets, each the size of a cache line, and
+ * each holding a few (hash, pointer) pairs.  A bucket that fills up is
+ * chained to an overflow bucket.  Entries are kept packed at the start
+ * of a chain, so that the first empty slot ends a search.
+ *
+ * Writers are serialized by ht->lock.  Lookups take no lock: the head
+ * bucket of every chain has a sequence count, odd while a writer modifies
+ * the chain, and readers retry if it changed under their feet (as in
+ * qemu/seqlock.h).  When the table grows, a new map is built and then
+ * published with a single pointer store; the old map is left untouched
+ * for readers still walking it and only freed by qht_reset.
+ */
+
+#define QHT_BUCKET_ALIGN 64
+
+#if HOST_LONG_BITS == 32
+#define QHT_BUCKET_ENTRIES 6
+#else
+#define QHT_BUCKET_ENTRIES 4
+#endif
+
+/* grow when the average chain holds this fraction of a bucket */
+#define QHT_GROW_NUM 3
+#define QHT_GROW_DEN 4
+
+typedef struct QHTBucket QHTBucket;
+
+struct QHTBucket {
+    /* only used in the head bucket of a chain */
+    unsigned sequence;
+    uint32_t hashes[QHT_BUCKET_ENTRIES];
+    void *pointers[QHT_BUCKET_ENTRIES];
+    QHTBucket *next;
+} QEMU_ALIGNED(QHT_BUCKET_ALIGN);
+
+QEMU_BUILD_BUG_ON(sizeof(QHTBucket) > QHT_BUCKET_ALIGN);
+
+struct QHTMap {
+    QHTBucket *buckets;
+    size_t n_buckets;
+    size_t n_items;
+    size_t n_overflow;
+    QHTMap *retired_next;
+};
+
+static inline void qht_bucket_write_begin(QHTBucket *head)
+{
+    atomic_set(&head->sequence, head->sequence + 1);
+    smp_wmb();
+}
+
+static inline void qht_bucket_write_end(QHTBucket *head)
+{
+    smp_wmb();
+    atomic_set(&head->sequence, head->sequence + 1);
+}
+
+static inline unsigned qht_bucket_read_begin(QHTBucket *head)
+{
+    /* Always fail if a write is in progress.  */
+    unsigned ret = atomic_read(&head->sequence) & ~1;
+
+    smp_rmb();
+    return ret;
+}
+
+static inline bool qht_bucket_read_retry(QHTBucket *head, unsigned start)
+{
+    smp_rmb();
+    return unlikely(atomic_read(&head->sequence) != start);
+}
+
+static QHTMap *qht_map_create(size_t n_buckets)
+{
+    QHTMap *map = g_new0(QHTMap, 1);
+
+    map->n_buckets = n_buckets;
+    map->buckets = qemu_memalign(QHT_BUCKET_ALIGN,
+                                 n_buckets * sizeof(QHTBucket));
+    memset(map->buckets, 0, n_buckets * sizeof(QHTBucket));
+    return map;
+}
+
+static void qht_map_free_overflow(QHTMap *map)
+{
+    size_t i;
+
+    for (i = 0; i < map->n_buckets; i++) {
+        QHTBucket *b = map->buckets[i].next;
+
+        while (b) {
+            QHTBucket *next = b->next;
+
+            qemu_vfree(b);
+            b = next;
+        }
+    }
+    map->n_overflow = 0;
+}
+
+static void qht_map_destroy(QHTMap *map)
+{
+    qht_map_free_overflow(map);
+    qemu_vfree(map->buckets);
+    g_free(map);
+}
+
+static inline QHTBucket *qht_map_head(QHTMap *map, uint32_t hash)
+{
+    return &map->buckets[hash & (map->n_buckets - 1)];
+}
+
+/* Must be called with ht->lock held, or on a map not yet published.  */
+static bool qht_map_insert(QHTMap *map, void *p, uint32_t hash)
+{
+    QHTBucket *head = qht_map_head(map, hash);
+    QHTBucket *b, *prev = NULL;
+    int i;
+
+    for (b = head; b; prev = b, b = b->next) {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            if (b->pointers[i] == NULL) {
+                goto found;
+            }
+            if (b->pointers[i] == p) {
+                return false;
+            }
+        }
+    }
+
+    /* chain full: the new bucket must be fully set up before it is
+       linked, since readers do not check the sequence to follow ->next */
+    b = qemu_memalign(QHT_BUCKET_ALIGN, sizeof(*b));
+    memset(b, 0, sizeof(*b));
+    b->hashes[0] = hash;
+    b->pointers[0] = p;
+    qht_bucket_write_begin(head);
+    atomic_set(&prev->next, b);
+    qht_bucket_write_end(head);
+    map->n_overflow++;
+    map->n_items++;
+    return true;
+
+ found:
+    qht_bucket_write_begin(head);
+    atomic_set(&b->hashes[i], hash);
+    atomic_set(&b->pointers[i], p);
+    qht_bucket_write_end(head);
+    map->n_items++;
+    return true;
+}
+
+static void qht_grow(QHT *ht)
+{
+    QHTMap *old = ht->map;
+    QHTMap *new = qht_map_create(old->n_buckets * 2);
+    size_t i;
+    int j;
+
+    for (i = 0; i < old->n_buckets; i++) {
+        QHTBucket *b;
+
+        for (b = &old->buckets[i]; b; b = b->next) {
+            for (j = 0; j < QHT_BUCKET_ENTRIES && b->pointers[j]; j++) {
+                qht_map_insert(new, b->pointers[j], b->hashes[j]);
+            }
+        }
+    }
+
+    /* publish the new map; it is complete before the pointer store */
+    atomic_mb_set(&ht->map, new);
+    old->retired_next = ht->retired;
+    ht->retired = old;
+    ht->resizes++;
+}
+
+void qht_init(QHT *ht, size_t n_elems)
+{
+    size_t n_buckets = 1;
+
+    while (n_buckets * QHT_BUCKET_ENTRIES < n_elems) {
+        n_buckets <<= 1;
+    }
+
+    qemu_mutex_init(&ht->lock);
+    ht->map = qht_map_create(n_buckets);
+    ht->retired = NULL;
+    ht->min_buckets = n_buckets;
+    ht->resizes = 0;
+}
+
+static void qht_free_retired(QHT *ht)
+{
+    while (ht->retired) {
+        QHTMap *map = ht->retired;
+
+        ht->retired = map->retired_next;
+        qht_map_destroy(map);
+    }
+}
+
+void qht_destroy(QHT *ht)
+{
+    qht_free_retired(ht);
+    qht_map_destroy(ht->map);
+    qemu_mutex_destroy(&ht->lock);
+    memset(ht, 0, sizeof(*ht));
+}
+
+bool qht_insert(QHT *ht, void *p, uint32_t hash)
+{
+    QHTMap *map;
+    bool ret;
+
+    assert(p);
+    qemu_mutex_lock(&ht->lock);
+    map = ht->map;
+    if ((map->n_items + 1) * QHT_GROW_DEN >
+        map->n_buckets * QHT_BUCKET_ENTRIES * QHT_GROW_NUM) {
+        qht_grow(ht);
+        map = ht->map;
+    }
+    ret = qht_map_insert(map, p, hash);
+    qemu_mutex_unlock(&ht->lock);
+    return ret;
+}
+
+bool qht_remove(QHT *ht, const void *p, uint32_t hash)
+{
+    QHTMap *map;
+    QHTBucket *head, *b, *found_b = NULL, *last_b = NULL;
+    int i, found_i = 0, last_i = 0;
+
+    qemu_mutex_lock(&ht->lock);
+    map = ht->map;
+    head = qht_map_head(map, hash);
+    for (b = head; b; b = b->next) {
+        for (i = 0; i < QHT_BUCKET_ENTRIES && b->pointers[i]; i++) {
+            if (b->pointers[i] == p) {
+                found_b = b;
+                found_i = i;
+            }
+            last_b = b;
+            last_i = i;
+        }
+    }
+    if (!found_b) {
+        qemu_mutex_unlock(&ht->lock);
+        return false;
+    }
+
+    /* keep the chain packed: move the last entry into the hole */
+    qht_bucket_write_begin(head);
+    atomic_set(&found_b->hashes[found_i], last_b->hashes[last_i]);
+    atomic_set(&found_b->pointers[found_i], last_b->pointers[last_i]);
+    atomic_set(&last_b->pointers[last_i], NULL);
+    atomic_set(&last_b->hashes[last_i], 0);
+    qht_bucket_write_end(head);
+    map->n_items--;
+    qemu_mutex_unlock(&ht->lock);
+    return true;
+}
+
+static void *qht_bucket_lookup(QHTBucket *head, qht_lookup_func_t func,
+                               const void *userp, uint32_t hash)
+{
+    QHTBucket *b = head;
+    int i;
+
+    do {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            void *p = atomic_read(&b->pointers[i]);
+
+            if (p == NULL) {
+                return NULL;
+            }
+            if (atomic_read(&b->hashes[i]) == hash && func(p, userp)) {
+                return p;
+            }
+        }
+        b = atomic_read(&b->next);
+        smp_read_barrier_depends();
+    } while (b);
+
+    return NULL;
+}
+
+void *qht_lookup(QHT *ht, qht_lookup_func_t func, const void *userp,
+                 uint32_t hash)
+{
+    QHTMap *map;
+    QHTBucket *head;
+    unsigned seq;
+    void *ret;
+
+    do {
+        map = atomic_read(&ht->map);
+        smp_read_barrier_depends();
+        head = qht_map_head(map, hash);
+        do {
+            seq = qht_bucket_read_begin(head);
+            ret = qht_bucket_lookup(head, func, userp, hash);
+        } while (qht_bucket_read_retry(head, seq));
+        /* a miss may be due to the entry being added to a newer map */
+    } while (!ret && map != atomic_read(&ht->map));
+
+    return ret;
+}
+
+void qht_reset(QHT *ht)
+{
+    QHTMap *map;
+
+    qemu_mutex_lock(&ht->lock);
+    qht_free_retired(ht);
+    map = ht->map;
+    if (map->n_buckets > ht->min_buckets * 4) {
+        /* most of the entries are usually added back soon, but do not
+           keep a table sized for a workload that went away */
+        qht_map_destroy(map);
+        map = qht_map_create(ht->min_buckets * 4);
+        atomic_mb_set(&ht->map, map);
+    } else {
+        qht_map_free_overflow(map);
+        memset(map->buckets, 0, map->n_buckets * sizeof(QHTBucket));
+        map->n_items = 0;
+        smp_wmb();
+    }
+    qemu_mutex_unlock(&ht->lock);
+}
+
+void qht_iter(QHT *ht, qht_iter_func_t func, void *userp)
+{
+    QHTMap *map;
+    size_t i;
+    int j;
+
+    qemu_mutex_lock(&ht->lock);
+    map = ht->map;
+    for (i = 0; i < map->n_buckets; i++) {
+        QHTBucket *b;
+
+        for (b = &map->buckets[i]; b; b = b->next) {
+            for (j = 0; j < QHT_BUCKET_ENTRIES && b->pointers[j]; j++) {
+                func(b->pointers[j], b->hashes[j], userp);
+            }
+        }
+    }
+    qemu_mutex_unlock(&ht->lock);
+}
+
+void qht_statistics(QHT *ht, QHTStats *stats)
+{
+    QHTMap *map;
+    size_t i;
+
+    memset(stats, 0, sizeof(*stats));
+    qemu_mutex_lock(&ht->lock);
+    map = ht->map;
+    stats->head_buckets = map->n_buckets;
+    stats->overflow_buckets = map->n_overflow;
+    stats->entries = map->n_items;
+    stats->resizes = ht->resizes;
+    for (i = 0; i < map->n_buckets; i++) {
+        QHTBucket *b = &map->buckets[i];
+        size_t chain = 0;
+
+        if (b->pointers[0]) {
+            stats->used_head_buckets++;
+        }
+        for (; b; b = b->next) {
+            chain++;
+        }
+        stats->max_chain = MAX(stats->max_chain, chain);
+    }
+    qemu_mutex_unlock(&ht->lock);
+}
@@ -542,6 +542,26 @@ static QemuOptsList qemu_mem_opts = {
     },
 };
 
+static QemuOptsList qemu_tcg_opts = {
+    .name = "tcg",
+    .implied_opt_name = "thread",
+    .merge_lists = true,
+    .head = QTAILQ_HEAD_INITIALIZER(qemu_tcg_opts.head),
+    .desc = {
+        {
+            .name = "thread",
+            .type = QEMU_OPT_STRING,
+        }, {
+            .name = "hot-trace",
+            .type = QEMU_OPT_NUMBER,
+        }, {
+            .name = "perf",
+            .type = QEMU_OPT_STRING,
+        },
+        { /* end of list */ }
+    },
+};
+
 static QemuOptsList qemu_icount_opts = {
     .name = "icount",
     .implied_opt_name = "shift",
@@ -2862,6 +2882,7 @@ int main(int argc, char **argv, char **envp)
     DisplayState *ds;
     int cyls, heads, secs, translation;
     QemuOpts *hda_opts = NULL, *opts, *machine_opts, *icount_opts = NULL;
+    QemuOpts *tcg_opts = NULL;
     QemuOptsList *olist;
     int optind;
     const char *optarg;
@@ -2928,6 +2949,7 @@ int main(int argc, char **argv, char **envp)
     qemu_add_opts(&qemu_name_opts);
     qemu_add_opts(&qemu_numa_opts);
     qemu_add_opts(&qemu_icount_opts);
+    qemu_add_opts(&qemu_tcg_opts);
 
     runstate_init();
 
@@ -3785,6 +3807,13 @@ int main(int argc, char **argv, char **envp)
                     exit(1);
                 }
                 break;
+            case QEMU_OPTION_tcg:
+                tcg_opts = qemu_opts_parse(qemu_find_opts("tcg"),
+                                           optarg, 1);
+                if (!tcg_opts) {
+                    exit(1);
+                }
+                break;
             case QEMU_OPTION_incoming:
                 incoming = optarg;
                 runstate_set(RUN_STATE_INMIGRATE);
@@ -4268,6 +4297,20 @@ int main(int argc, char **argv, char **envp)
         configure_icount(icount_opts, &error_abort);
         qemu_opts_del(icount_opts);
     }
+    if (tcg_opts) {
+        Error *err = NULL;
+
+        if (!tcg_enabled()) {
+            fprintf(stderr, "-tcg is only allowed with the TCG accelerator\n");
+            exit(1);
+        }
+        configure_tcg(tcg_opts, &err);
+        if (err) {
+            error_report("%s", error_get_pretty(err));
+            exit(1);
+        }
+        qemu_opts_del(tcg_opts);
+    }
 
     /* clean up network at qemu process termination */
     atexit(&net_cleanup);